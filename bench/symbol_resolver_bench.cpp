@@ -0,0 +1,159 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+// Times SymbolResolver::resolve on a synthetic CodeGeneratorRequest, once on
+// a single thread and once with one thread per core.
+//
+//   symbol_resolver_bench [files] [structs per file] [runs]
+
+#include "../src/symbol_resolver.h"
+#include <capnp/message.h>
+#include <capnp/schema.capnp.h>
+#include <capnp/serialize.h>
+#include <chrono>
+#include <cstdlib>
+#include <kj/debug.h>
+#include <kj/filesystem.h>
+#include <stdio.h>
+
+namespace capnp_ls {
+namespace {
+
+using FileSourceInfo = capnp::schema::CodeGeneratorRequest::RequestedFile::
+    FileSourceInfo;
+
+constexpr uint32_t LINES_PER_STRUCT = 8;
+constexpr uint32_t IDENTIFIERS_PER_STRUCT = 4;
+
+struct Workspace {
+  kj::String path;
+  kj::Array<capnp::word> message;
+};
+
+// Writes `fileCount` schema files into a fresh temp directory and builds a
+// request in the shape `capnp compile -o-` produces for all of them.
+Workspace makeWorkspace(uint32_t fileCount, uint32_t structsPerFile) {
+  auto dirTemplate = kj::heapString("/tmp/capnp-ls-bench.XXXXXX");
+  KJ_ASSERT(mkdtemp(dirTemplate.begin()) != nullptr);
+  auto fs = kj::newDiskFilesystem();
+  auto dir = fs->getRoot().openSubdir(
+      kj::Path::parse(dirTemplate.slice(1)), kj::WriteMode::MODIFY);
+
+  capnp::MallocMessageBuilder builder;
+  auto request = builder.initRoot<capnp::schema::CodeGeneratorRequest>();
+  uint32_t nodesPerFile = structsPerFile + 1;
+  auto nodes = request.initNodes(fileCount * nodesPerFile);
+  auto sourceInfos = request.initSourceInfo(fileCount * structsPerFile);
+  auto requestedFiles = request.initRequestedFiles(fileCount);
+  uint64_t nextId = 0x8000000000000000ull;
+
+  for (uint32_t f = 0; f < fileCount; f++) {
+    auto fileName = kj::str("file", f, ".capnp");
+    uint64_t fileId = nextId++;
+    auto fileNode = nodes[f * nodesPerFile];
+    fileNode.setId(fileId);
+    fileNode.setDisplayName(fileName);
+    fileNode.setFile();
+    auto requested = requestedFiles[f];
+    requested.setId(fileId);
+    requested.setFilename(fileName);
+    auto identifiers = requested.initFileSourceInfo().initIdentifiers(
+        structsPerFile * IDENTIFIERS_PER_STRUCT);
+
+    kj::Vector<char> text;
+    for (uint32_t s = 0; s < structsPerFile; s++) {
+      uint64_t id = nextId++;
+      uint32_t start = text.size();
+      auto name = kj::str("S", s);
+      text.addAll(kj::str("struct ", name, " {\n"));
+      for (uint32_t l = 0; l < LINES_PER_STRUCT - 2; l++) {
+        uint32_t fieldStart = text.size() + 2;
+        text.addAll(kj::str("  f", l, " @", l, " :S", s, ";\n"));
+        if (l < IDENTIFIERS_PER_STRUCT) {
+          auto identifier = identifiers[s * IDENTIFIERS_PER_STRUCT + l];
+          identifier.setStartByte(fieldStart);
+          identifier.setEndByte(fieldStart + 2);
+          identifier.setTypeId(id);
+        }
+      }
+      text.addAll(kj::StringPtr("}\n"));
+
+      auto node = nodes[f * nodesPerFile + 1 + s];
+      node.setId(id);
+      node.setScopeId(fileId);
+      node.setDisplayName(kj::str(fileName, ":", name));
+      node.setDisplayNamePrefixLength(fileName.size() + 1);
+      node.initStruct();
+      auto sourceInfo = sourceInfos[f * structsPerFile + s];
+      sourceInfo.setId(id);
+      sourceInfo.setStartByte(start);
+      sourceInfo.setEndByte(text.size());
+    }
+    dir->openFile(kj::Path(fileName), kj::WriteMode::CREATE)
+        ->writeAll(text.asPtr().asBytes());
+  }
+
+  return Workspace{kj::mv(dirTemplate), capnp::messageToFlatArray(builder)};
+}
+
+double timeResolve(const Workspace &workspace, uint32_t runs) {
+  kj::Vector<kj::String> importPaths;
+  kj::StringPtr workspacePath = workspace.path;
+  double total = 0;
+  for (uint32_t r = 0; r < runs; r++) {
+    auto base = SymbolSnapshot::empty();
+    SymbolSnapshot::Builder snapshot(*base);
+    SymbolTable symbolTable;
+    ReferenceIndex referenceIndex;
+    SchemaStore schemaStore;
+    auto start = std::chrono::steady_clock::now();
+    int status = SymbolResolver::resolve(
+        kj::heap<capnp::FlatArrayMessageReader>(workspace.message),
+        snapshot,
+        symbolTable,
+        referenceIndex,
+        schemaStore,
+        importPaths,
+        workspacePath,
+        [](kj::StringPtr) { return false; },
+        [](kj::StringPtr) -> kj::Maybe<kj::StringPtr> { return nullptr; });
+    total += std::chrono::duration<double, std::milli>(
+                 std::chrono::steady_clock::now() - start)
+                 .count();
+    KJ_ASSERT(status == 0);
+  }
+  return total / runs;
+}
+
+uint32_t argOr(int argc, char *argv[], int index, uint32_t fallback) {
+  return argc > index ? static_cast<uint32_t>(atoi(argv[index])) : fallback;
+}
+
+} // namespace
+} // namespace capnp_ls
+
+int main(int argc, char *argv[]) {
+  using namespace capnp_ls;
+  uint32_t fileCount = argOr(argc, argv, 1, 200);
+  uint32_t structsPerFile = argOr(argc, argv, 2, 200);
+  uint32_t runs = argOr(argc, argv, 3, 5);
+
+  auto workspace = makeWorkspace(fileCount, structsPerFile);
+  SymbolResolver::setWorkerLimit(1);
+  double serial = timeResolve(workspace, runs);
+  SymbolResolver::setWorkerLimit(0);
+  double parallel = timeResolve(workspace, runs);
+  kj::newDiskFilesystem()->getRoot().remove(
+      kj::Path::parse(workspace.path.slice(1)));
+
+  printf(
+      "%u files, %u nodes: 1 thread %.1f ms, all cores %.1f ms (%.2fx)\n",
+      fileCount,
+      fileCount * (structsPerFile + 1),
+      serial,
+      parallel,
+      serial / parallel);
+  return 0;
+}
@@ -6,6 +6,29 @@
 import * as vscode from 'vscode';
 import * as assert from 'assert';
 import * as path from 'path';
+import * as fs from 'fs';
+import * as os from 'os';
+import { spawnSync } from 'child_process';
+import { LanguageClient } from 'vscode-languageclient/node';
+
+const EXTENSION_ID = 'tomitty.capnp-ls-client';
+
+// Runs `capnp-ls check` on `dir` with the compiler and import paths of the
+// test workspace, and parses its SARIF report.
+function runCheck(dir: string): { status: number | null; sarif: any } {
+    const workspaceFolder = vscode.workspace.workspaceFolders![0].uri.fsPath;
+    const extension = vscode.extensions.getExtension(EXTENSION_ID)!;
+    const config = vscode.workspace.getConfiguration('capnp-ls-client');
+    const serverPath = path.resolve(extension.extensionPath, config.get<string>('languageServer.path')!);
+    const args = ['check', dir, '--compiler', config.get<string>('compiler.path')!, '--format', 'sarif'];
+    for (const importPath of config.get<string[]>('compiler.importPaths')!) {
+        args.push('-I', path.resolve(workspaceFolder, importPath));
+    }
+    console.log('Running:', serverPath, args);
+    const run = spawnSync(serverPath, args, { encoding: 'utf8' });
+    console.log('Check exited with', run.status, run.stderr);
+    return { status: run.status, sarif: JSON.parse(run.stdout) };
+}
 
 suite('Cap\'n Proto Language Server Test Suite', () => {
     let document: vscode.TextDocument;
@@ -78,4 +101,337 @@ suite('Cap\'n Proto Language Server Test Suite', () => {
         assert.strictEqual(definitions[0].range.start.line, 17, 'Definition should be at line 18 (0-indexed)');
         assert.strictEqual(definitions[0].range.start.character, 2, 'Definition should start at character 3');
     });
-}); 
\ No newline at end of file
+
+    test('Completion Provider', async () => {
+        console.log('Starting Completion Provider test');
+
+        const workspaceFolder = vscode.workspace.workspaceFolders![0];
+        const uri = vscode.Uri.file(path.join(workspaceFolder.uri.fsPath, 'schemas/company.capnp'));
+        document = await vscode.workspace.openTextDocument(uri);
+        await vscode.window.showTextDocument(document);
+
+        await new Promise(resolve => setTimeout(resolve, 2000));
+
+        // line 38, right after "Foo." (0-indexed)
+        const position = new vscode.Position(37, 16);
+        const completions = await vscode.commands.executeCommand<vscode.CompletionList>(
+            'vscode.executeCompletionItemProvider',
+            document.uri,
+            position
+        );
+
+        const labels = completions.items.map(item => typeof item.label === 'string' ? item.label : item.label.label);
+        console.log('Completions found:', labels);
+        assert.ok(labels.includes('Bar'), 'Nested struct Bar should be suggested after "Foo."');
+    });
+
+    test('References Provider', async () => {
+        console.log('Starting References Provider test');
+
+        const workspaceFolder = vscode.workspace.workspaceFolders![0];
+        const uri = vscode.Uri.file(path.join(workspaceFolder.uri.fsPath, 'schemas/company.capnp'));
+        document = await vscode.workspace.openTextDocument(uri);
+        await vscode.window.showTextDocument(document);
+
+        await new Promise(resolve => setTimeout(resolve, 2000));
+
+        // "Employee" in addEmployee's parameter list (0-indexed)
+        const position = new vscode.Position(14, 28);
+        const references = await vscode.commands.executeCommand<vscode.Location[]>(
+            'vscode.executeReferenceProvider',
+            document.uri,
+            position
+        );
+
+        console.log('References found:', references?.length);
+        assert.ok(references?.length >= 4, 'Employee is referenced by every EmployeeManagement method');
+        assert.ok(references.some(ref => ref.range.start.line === 15), 'updateEmployee should reference Employee');
+    });
+
+    test('Workspace Symbol Provider', async () => {
+        console.log('Starting Workspace Symbol Provider test');
+
+        // Typo on purpose: the trigram index should still find "Employee".
+        const symbols = await vscode.commands.executeCommand<vscode.SymbolInformation[]>(
+            'vscode.executeWorkspaceSymbolProvider',
+            'Emplyee'
+        );
+
+        console.log('Symbols found:', symbols?.map(symbol => symbol.name));
+        assert.ok(symbols?.some(symbol => symbol.name === 'Employee'), 'Employee should match a fuzzy query');
+    });
+
+    test('Document Symbol Provider', async () => {
+        console.log('Starting Document Symbol Provider test');
+
+        const workspaceFolder = vscode.workspace.workspaceFolders![0];
+        const uri = vscode.Uri.file(path.join(workspaceFolder.uri.fsPath, 'schemas/company.capnp'));
+        document = await vscode.workspace.openTextDocument(uri);
+        await vscode.window.showTextDocument(document);
+
+        await new Promise(resolve => setTimeout(resolve, 2000));
+
+        const symbols = await vscode.commands.executeCommand<vscode.DocumentSymbol[]>(
+            'vscode.executeDocumentSymbolProvider',
+            document.uri
+        );
+
+        console.log('Document symbols found:', symbols?.map(symbol => symbol.name));
+        const employeeManagement = symbols?.find(symbol => symbol.name === 'EmployeeManagement');
+        assert.ok(employeeManagement, 'EmployeeManagement should be a top-level symbol');
+        assert.ok(employeeManagement!.children.some(child => child.name === 'addEmployee'), 'Methods should be nested under their interface');
+    });
+
+    test('Hover Provider', async () => {
+        console.log('Starting Hover Provider test');
+
+        const workspaceFolder = vscode.workspace.workspaceFolders![0];
+        const uri = vscode.Uri.file(path.join(workspaceFolder.uri.fsPath, 'schemas/company.capnp'));
+        document = await vscode.workspace.openTextDocument(uri);
+        await vscode.window.showTextDocument(document);
+
+        await new Promise(resolve => setTimeout(resolve, 2000));
+
+        // "myCompanyId" in its const declaration (0-indexed)
+        const position = new vscode.Position(9, 8);
+        const hovers = await vscode.commands.executeCommand<vscode.Hover[]>(
+            'vscode.executeHoverProvider',
+            document.uri,
+            position
+        );
+
+        const text = hovers?.flatMap(hover => hover.contents.map(content => typeof content === 'string' ? content : content.value)).join('\n');
+        console.log('Hover text:', text);
+        assert.ok(text?.includes('const myCompanyId :UInt32 = 123'), 'Hover should show the evaluated constant');
+    });
+
+    test('Semantic Tokens Provider', async () => {
+        console.log('Starting Semantic Tokens Provider test');
+
+        const workspaceFolder = vscode.workspace.workspaceFolders![0];
+        const uri = vscode.Uri.file(path.join(workspaceFolder.uri.fsPath, 'schemas/company.capnp'));
+        document = await vscode.workspace.openTextDocument(uri);
+        await vscode.window.showTextDocument(document);
+
+        await new Promise(resolve => setTimeout(resolve, 2000));
+
+        const tokens = await vscode.commands.executeCommand<vscode.SemanticTokens>(
+            'vscode.provideDocumentSemanticTokens',
+            document.uri
+        );
+
+        console.log('Semantic token integers:', tokens?.data.length);
+        assert.ok(tokens && tokens.data.length > 0, 'Semantic tokens should be returned');
+        assert.strictEqual(tokens.data.length % 5, 0, 'Each token is encoded as five integers');
+    });
+
+    test('Pull Diagnostics', async () => {
+        console.log('Starting Pull Diagnostics test');
+
+        const workspaceFolder = vscode.workspace.workspaceFolders![0];
+        const uri = vscode.Uri.file(path.join(workspaceFolder.uri.fsPath, 'schemas/company.capnp'));
+        document = await vscode.workspace.openTextDocument(uri);
+        await vscode.window.showTextDocument(document);
+
+        await new Promise(resolve => setTimeout(resolve, 2000));
+
+        const extension = vscode.extensions.getExtension(EXTENSION_ID)!;
+        const client: LanguageClient = await extension.activate();
+        const params = { textDocument: { uri: document.uri.toString() } };
+        const first = await client.sendRequest<any>('textDocument/diagnostic', params);
+        console.log('First report:', first.kind, first.resultId);
+        assert.strictEqual(first.kind, 'full');
+        assert.ok(first.resultId, 'A full report should carry a result id');
+
+        // Nothing changed in between, so the client may keep what it has.
+        const second = await client.sendRequest<any>('textDocument/diagnostic', { ...params, previousResultId: first.resultId });
+        console.log('Second report:', second.kind, second.resultId);
+        assert.strictEqual(second.kind, 'unchanged');
+        assert.strictEqual(second.resultId, first.resultId);
+        assert.strictEqual(second.items, undefined, 'An unchanged report should not repeat the diagnostics');
+    });
+
+    test('Rename Provider', async () => {
+        console.log('Starting Rename Provider test');
+
+        const workspaceFolder = vscode.workspace.workspaceFolders![0];
+        const uri = vscode.Uri.file(path.join(workspaceFolder.uri.fsPath, 'schemas/company.capnp'));
+        document = await vscode.workspace.openTextDocument(uri);
+        await vscode.window.showTextDocument(document);
+
+        await new Promise(resolve => setTimeout(resolve, 2000));
+
+        // "Employee" in addEmployee's parameter list (0-indexed)
+        const position = new vscode.Position(14, 28);
+        const edit = await vscode.commands.executeCommand<vscode.WorkspaceEdit>(
+            'vscode.executeDocumentRenameProvider',
+            document.uri,
+            position,
+            'Staff'
+        );
+
+        const edits = edit?.get(document.uri) ?? [];
+        console.log('Rename edits:', edits.length);
+        assert.ok(edits.length >= 5, 'The declaration and every reference should be renamed');
+        assert.ok(edits.every(textEdit => textEdit.newText === 'Staff'), 'Every edit should use the new name');
+    });
+
+    test('Formatting Provider', async () => {
+        console.log('Starting Formatting Provider test');
+
+        const workspaceFolder = vscode.workspace.workspaceFolders![0];
+        const uri = vscode.Uri.file(path.join(workspaceFolder.uri.fsPath, 'schemas/company.capnp'));
+        document = await vscode.workspace.openTextDocument(uri);
+        await vscode.window.showTextDocument(document);
+
+        await new Promise(resolve => setTimeout(resolve, 2000));
+
+        const edits = await vscode.commands.executeCommand<vscode.TextEdit[]>(
+            'vscode.executeFormatDocumentProvider',
+            document.uri,
+            { tabSize: 2, insertSpaces: true }
+        );
+
+        console.log('Formatting edits:', edits?.length);
+        assert.ok(Array.isArray(edits), 'Formatting should return a list of edits');
+        assert.ok(edits.every(edit => edit.newText.trim() === ''), 'Formatting should only touch whitespace');
+    });
+
+    test('Syntax Features While Editing', async () => {
+        console.log('Starting Syntax Features While Editing test');
+
+        const workspaceFolder = vscode.workspace.workspaceFolders![0];
+        const uri = vscode.Uri.file(path.join(workspaceFolder.uri.fsPath, 'schemas/company.capnp'));
+        document = await vscode.workspace.openTextDocument(uri);
+        const editor = await vscode.window.showTextDocument(document);
+
+        await new Promise(resolve => setTimeout(resolve, 2000));
+
+        // An unsaved, unterminated struct that refers to itself
+        const end = document.lineAt(document.lineCount - 1).range.end;
+        await editor.edit(builder => builder.insert(end, '\n\nstruct Draft {\n  next @0 :Draft\n'));
+
+        const symbols = await vscode.commands.executeCommand<vscode.DocumentSymbol[]>(
+            'vscode.executeDocumentSymbolProvider',
+            document.uri
+        );
+        assert.ok(symbols?.some(symbol => symbol.name === 'Draft'), 'The half-typed struct should be in the outline');
+
+        // "Draft" in "  next @0 :Draft" (0-indexed)
+        const position = new vscode.Position(document.lineCount - 2, 12);
+        const definitions = await vscode.commands.executeCommand<vscode.Location[]>(
+            'vscode.executeDefinitionProvider',
+            document.uri,
+            position
+        );
+
+        await vscode.commands.executeCommand('workbench.action.files.revert');
+
+        console.log('Definitions found:', definitions?.length);
+        assert.ok(definitions?.length > 0, 'The declaration in the buffer should be found');
+        assert.strictEqual(definitions[0].range.start.line, position.line - 1, 'Definition should be the struct name');
+        assert.strictEqual(definitions[0].range.start.character, 7, 'Definition should start after "struct "');
+    });
+
+    test('Ordinal Completion', async () => {
+        console.log('Starting Ordinal Completion test');
+
+        const workspaceFolder = vscode.workspace.workspaceFolders![0];
+        const uri = vscode.Uri.file(path.join(workspaceFolder.uri.fsPath, 'schemas/company.capnp'));
+        document = await vscode.workspace.openTextDocument(uri);
+        const editor = await vscode.window.showTextDocument(document);
+
+        await new Promise(resolve => setTimeout(resolve, 2000));
+
+        const end = document.lineAt(document.lineCount - 1).range.end;
+        await editor.edit(builder => builder.insert(end, '\n\nstruct Draft {\n  a @0 :Text;\n  b @1 :Text;\n  c @'));
+
+        const position = document.lineAt(document.lineCount - 1).range.end;
+        const completions = await vscode.commands.executeCommand<vscode.CompletionList>(
+            'vscode.executeCompletionItemProvider',
+            document.uri,
+            position,
+            '@'
+        );
+
+        await vscode.commands.executeCommand('workbench.action.files.revert');
+
+        const labels = completions?.items.map(item => typeof item.label === 'string' ? item.label : item.label.label) ?? [];
+        console.log('Ordinal completions:', labels);
+        assert.ok(labels.includes('@2'), 'The next free ordinal should be suggested');
+    });
+
+    test('ID Generation and Code Actions', async () => {
+        console.log('Starting ID Generation and Code Actions test');
+
+        const id = await vscode.commands.executeCommand<string>('capnp.generateId');
+        console.log('Generated ID:', id);
+        assert.ok(/^@0x[89a-f][0-9a-f]{15}$/.test(id ?? ''), 'Generated IDs should have the high bit set');
+
+        const workspaceFolder = vscode.workspace.workspaceFolders![0];
+        const uri = vscode.Uri.file(path.join(workspaceFolder.uri.fsPath, 'schemas/company.capnp'));
+        document = await vscode.workspace.openTextDocument(uri);
+        const editor = await vscode.window.showTextDocument(document);
+
+        await new Promise(resolve => setTimeout(resolve, 2000));
+
+        const end = document.lineAt(document.lineCount - 1).range.end;
+        await editor.edit(builder => builder.insert(end, '\n\nstruct Draft {\n  a @0 :Text;\n}'));
+
+        const header = document.lineAt(document.lineCount - 3).range;
+        const actions = await vscode.commands.executeCommand<vscode.CodeAction[]>(
+            'vscode.executeCodeActionProvider',
+            document.uri,
+            header
+        );
+
+        await vscode.commands.executeCommand('workbench.action.files.revert');
+
+        const titles = actions?.map(action => action.title) ?? [];
+        console.log('Code actions:', titles);
+        assert.ok(titles.includes('Add ID to struct Draft'), 'A struct without an ID should get one');
+    });
+
+    test('Command-Line Check Reports Errors', async () => {
+        console.log('Starting Command-Line Check Reports Errors test');
+
+        const dir = fs.mkdtempSync(path.join(os.tmpdir(), 'capnp-ls-check-'));
+        const workspaceFolder = vscode.workspace.workspaceFolders![0];
+        fs.copyFileSync(
+            path.join(workspaceFolder.uri.fsPath, 'schemas/error_company.capnp'),
+            path.join(dir, 'error_company.capnp'));
+        try {
+            const { status, sarif } = runCheck(dir);
+            assert.strictEqual(status, 1, 'A compile error should fail the check');
+            assert.strictEqual(sarif.version, '2.1.0');
+            const results: any[] = sarif.runs[0].results;
+            console.log('SARIF results:', results.map(result => result.message.text));
+            assert.ok(results.length > 0, 'The error should be reported');
+            assert.ok(results.some(result => result.level === 'error' && result.locations[0].physicalLocation.artifactLocation.uri === 'error_company.capnp'), 'The error should be reported against the file, relative to the checked directory');
+            assert.ok(results.every(result => result.locations[0].physicalLocation.region.startLine >= 1), 'SARIF lines are 1-based');
+        } finally {
+            fs.rmSync(dir, { recursive: true, force: true });
+        }
+    });
+
+    test('Compile in a Path With Spaces', async () => {
+        console.log('Starting Compile in a Path With Spaces test');
+
+        // The compiler gets its arguments as an argv, not through a shell.
+        const dir = fs.mkdtempSync(path.join(os.tmpdir(), 'capnp ls workspace '));
+        const workspaceFolder = vscode.workspace.workspaceFolders![0];
+        fs.mkdirSync(path.join(dir, 'my schemas'));
+        fs.copyFileSync(
+            path.join(workspaceFolder.uri.fsPath, 'schemas/company.capnp'),
+            path.join(dir, 'my schemas', 'company.capnp'));
+        try {
+            const { status, sarif } = runCheck(dir);
+            const results: any[] = sarif.runs[0].results;
+            console.log('SARIF results:', results.map(result => result.message.text));
+            assert.strictEqual(status, 0, 'A valid schema under a path with spaces should compile');
+            assert.ok(results.every(result => result.level !== 'error'), 'No errors should be reported');
+        } finally {
+            fs.rmSync(dir, { recursive: true, force: true });
+        }
+    });
+});
@@ -0,0 +1,67 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <atomic>
+#include <kj/refcount.h>
+#include <thread>
+
+namespace capnp_ls {
+
+// The current version of an immutable, atomically refcounted `T`. One
+// thread publishes new versions; any thread can take a reference to the
+// current one without locking, and keeps that version alive for as long as
+// it holds the reference. A replaced version is freed with its last
+// reference.
+//
+// Taking a reference is a load followed by an increment, so a version must
+// not be released in between. Readers announce themselves in one of two
+// counters, picked by an epoch; publish() moves new readers to the other
+// counter and waits for the first to drain before dropping its own
+// reference to the old version. That wait spans only the few instructions
+// between a reader's load and its increment.
+template <typename T>
+class AtomicSnapshot {
+public:
+  explicit AtomicSnapshot(kj::Own<const T> initial)
+      : owned(kj::mv(initial)), current(owned.get()) {}
+  KJ_DISALLOW_COPY(AtomicSnapshot);
+
+  kj::Own<const T> get() const {
+    uint64_t e;
+    for (;;) {
+      e = epoch.load();
+      acquiring[e & 1].fetch_add(1);
+      if (epoch.load() == e) {
+        break;
+      }
+      acquiring[e & 1].fetch_sub(1);
+    }
+    auto result = kj::atomicAddRef(*current.load());
+    acquiring[e & 1].fetch_sub(1);
+    return result;
+  }
+
+  // Only ever called from the same thread.
+  void publish(kj::Own<const T> next) {
+    current.store(next.get());
+    auto previous = kj::mv(owned);
+    owned = kj::mv(next);
+    uint64_t e = epoch.load();
+    epoch.store(e + 1);
+    while (acquiring[e & 1].load() != 0) {
+      std::this_thread::yield();
+    }
+  }
+
+private:
+  kj::Own<const T> owned;
+  std::atomic<const T *> current;
+  std::atomic<uint64_t> epoch{0};
+  mutable std::atomic<uint32_t> acquiring[2] = {{0}, {0}};
+};
+
+} // namespace capnp_ls
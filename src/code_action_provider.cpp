@@ -0,0 +1,179 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#include "code_action_provider.h"
+
+namespace capnp_ls {
+namespace {
+
+bool isPunctuation(
+    kj::StringPtr text,
+    const Token &token,
+    kj::StringPtr punctuation) {
+  return token.kind == TokenKind::PUNCTUATION &&
+         Lexer::textOf(text, token) == punctuation;
+}
+
+bool isId(kj::StringPtr text, const Token &token) {
+  return token.kind == TokenKind::ORDINAL &&
+         IdIndex::parseId(Lexer::textOf(text, token)) != nullptr;
+}
+
+// Whether an id appears outside of every top-level declaration, which is
+// where the file id goes.
+bool hasFileId(
+    kj::StringPtr text,
+    kj::ArrayPtr<const Token> tokens,
+    kj::ArrayPtr<const SyntaxNode> declarations) {
+  size_t next = 0;
+  for (uint32_t i = 0; i < tokens.size(); i++) {
+    while (next < declarations.size() && declarations[next].lastToken < i) {
+      next++;
+    }
+    if (next < declarations.size() && declarations[next].firstToken <= i) {
+      i = declarations[next].lastToken;
+      continue;
+    }
+    if (isId(text, tokens[i])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// The `{` opening the body of a type declaration, or null when its header
+// already has an id or the body is missing.
+kj::Maybe<uint32_t> findBodyStart(
+    kj::StringPtr text,
+    kj::ArrayPtr<const Token> tokens,
+    const SyntaxNode &node) {
+  uint32_t depth = 0;
+  for (uint32_t i = node.firstToken + 1;
+       i <= node.lastToken && i < tokens.size();
+       i++) {
+    auto &token = tokens[i];
+    if (depth == 0 && isId(text, token)) {
+      return nullptr;
+    }
+    if (isPunctuation(text, token, "(") || isPunctuation(text, token, "[")) {
+      depth++;
+    } else if (
+        depth > 0 &&
+        (isPunctuation(text, token, ")") || isPunctuation(text, token, "]"))) {
+      depth--;
+    } else if (depth == 0 && isPunctuation(text, token, "{")) {
+      return i;
+    } else if (depth == 0 && isPunctuation(text, token, ";")) {
+      return nullptr;
+    }
+  }
+  return nullptr;
+}
+
+Range insertionAt(const Token &token) {
+  Position position{token.line + 1, token.column + 1};
+  return Range{position, position};
+}
+
+// Adds an action for every struct, enum and interface in `nodes` whose
+// header lies on lines [firstLine, lastLine] (0-based) and has no id.
+void addMissingTypeIds(
+    kj::StringPtr text,
+    kj::ArrayPtr<const Token> tokens,
+    kj::ArrayPtr<const SyntaxNode> nodes,
+    uint32_t firstLine,
+    uint32_t lastLine,
+    const IdIndex &idIndex,
+    kj::Vector<CodeAction> &actions) {
+  for (auto &node : nodes) {
+    if (node.kind != SyntaxKind::STRUCT && node.kind != SyntaxKind::ENUM &&
+        node.kind != SyntaxKind::INTERFACE) {
+      continue;
+    }
+    KJ_IF_MAYBE (nameToken, node.nameToken) {
+      KJ_IF_MAYBE (bodyStart, findBodyStart(text, tokens, node)) {
+        if (tokens[node.firstToken].line <= lastLine &&
+            firstLine <= tokens[*bodyStart].line) {
+          kj::Vector<TextEdit> edits;
+          edits.add(TextEdit{
+              insertionAt(tokens[*bodyStart]),
+              kj::str(IdIndex::formatId(idIndex.generateUniqueId()), " ")});
+          actions.add(CodeAction{
+              kj::str(
+                  "Add ID to ",
+                  Lexer::textOf(text, tokens[node.firstToken]),
+                  " ",
+                  Lexer::textOf(text, tokens[*nameToken])),
+              kj::mv(edits),
+              false});
+        }
+      }
+    }
+    addMissingTypeIds(
+        text, tokens, node.children, firstLine, lastLine, idIndex, actions);
+  }
+}
+
+} // namespace
+
+kj::Vector<CodeAction> CodeActionProvider::compute(
+    const Document &document,
+    kj::StringPtr filePath,
+    Range range,
+    const IdIndex &idIndex) {
+  kj::Vector<CodeAction> actions;
+  auto text = document.getText();
+  auto tokens = document.getTokens();
+  auto declarations = document.getSyntaxTree().getDeclarations();
+  uint32_t firstLine = range.start.line - 1;
+  uint32_t lastLine = range.end.line - 1;
+
+  for (auto &declaration : idIndex.getIds(filePath)) {
+    if (idIndex.isDuplicate(declaration.id) &&
+        declaration.range.start.line >= firstLine &&
+        declaration.range.start.line <= lastLine) {
+      auto &start = declaration.range.start;
+      auto &end = declaration.range.end;
+      kj::Vector<TextEdit> edits;
+      edits.add(TextEdit{
+          {{start.line + 1, start.character + 1},
+           {end.line + 1, end.character + 1}},
+          IdIndex::formatId(idIndex.generateUniqueId())});
+      actions.add(CodeAction{
+          kj::str(
+              "Replace duplicate ID ",
+              IdIndex::formatId(declaration.id),
+              " with a new one"),
+          kj::mv(edits),
+          true});
+    }
+  }
+
+  if (!hasFileId(text, tokens, declarations)) {
+    // Above the first declaration, below any leading comments.
+    kj::Maybe<const Token &> firstCode;
+    for (auto &token : tokens) {
+      if (token.kind != TokenKind::COMMENT) {
+        firstCode = token;
+        break;
+      }
+    }
+    auto id = IdIndex::formatId(idIndex.generateUniqueId());
+    kj::Vector<TextEdit> edits;
+    KJ_IF_MAYBE (token, firstCode) {
+      Position position{token->line + 1, 1};
+      edits.add(TextEdit{{position, position}, kj::str(id, ";\n\n")});
+    } else {
+      edits.add(TextEdit{{{1, 1}, {1, 1}}, kj::str(id, ";\n")});
+    }
+    actions.add(CodeAction{kj::heapString("Add file ID"), kj::mv(edits), true});
+  }
+
+  addMissingTypeIds(
+      text, tokens, declarations, firstLine, lastLine, idIndex, actions);
+  return actions;
+}
+
+} // namespace capnp_ls
@@ -0,0 +1,32 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include "document.h"
+#include "id_index.h"
+#include "lsp_types.h"
+#include <kj/string.h>
+#include <kj/vector.h>
+
+namespace capnp_ls {
+
+class CodeActionProvider {
+public:
+  // workspace/executeCommand command returning a fresh "@0x..." id.
+  static constexpr const char *GENERATE_ID_COMMAND = "capnp.generateId";
+
+  // Id fixes for `range` (1-based) of an open document: a file id when the
+  // file has none, an id for the struct, enum or interface whose header is
+  // in the range, and a new value for every duplicated id in the range.
+  // Generated ids are unique across `idIndex`.
+  static kj::Vector<CodeAction> compute(
+      const Document &document,
+      kj::StringPtr filePath,
+      Range range,
+      const IdIndex &idIndex);
+};
+
+} // namespace capnp_ls
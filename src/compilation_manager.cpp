@@ -5,6 +5,7 @@
 
 #include "compilation_manager.h"
 #include "compile_error_parser.h"
+#include "compile_overlay.h"
 #include "utils.h"
 #include <kj/debug.h>
 #include <kj/io.h>
@@ -12,16 +13,57 @@
 #include <regex>
 
 namespace capnp_ls {
+namespace {
+
+// The workspace and the import paths as absolute paths, the workspace first.
+kj::Vector<kj::String> overlayRoots(
+    kj::StringPtr workingDir,
+    kj::ArrayPtr<const kj::String> importPaths) {
+  kj::Vector<kj::String> roots;
+  roots.add(kj::heapString(workingDir));
+  for (auto &importPath : importPaths) {
+    roots.add(
+        importPath.startsWith("/") ? kj::heapString(importPath)
+                                   : kj::str(workingDir, "/", importPath));
+  }
+  return roots;
+}
+
+} // namespace
 
 CompilationManager::CompilationManager(kj::AsyncIoContext &ioContext)
-    : subprocessRunner(ioContext) {}
+    : ioContext(ioContext), subprocessRunner(ioContext) {}
+
+void CompilationManager::useCompileDaemon(CompileDaemonClient::Mode mode) {
+  if (compileDaemon == nullptr) {
+    compileDaemon = kj::heap<CompileDaemonClient>(ioContext, mode);
+  }
+}
+
+void CompilationManager::forgetFile(kj::StringPtr filePath) {
+  compileCache.forget(filePath);
+}
 
-kj::Promise<void> CompilationManager::compile(CompileParams params) {
+kj::Promise<SubprocessRunner::RunResult> CompilationManager::runCompiler(
+    kj::ArrayPtr<const kj::String> argv,
+    kj::StringPtr workingDir,
+    bool overlay) {
+  KJ_IF_MAYBE (daemon, compileDaemon) {
+    return (*daemon)->compile(argv, workingDir, overlay);
+  }
+  return subprocessRunner.run(
+      {.argv = argv,
+       .workingDir = workingDir,
+       .output = SubprocessRunner::Output::CAPNP_MESSAGE});
+}
+
+kj::Promise<kj::Array<kj::String>>
+CompilationManager::compile(CompileParams params) {
   return checkCapnpVersionCompatible(params.compilerPath)
       .then([this, params](bool isCompatible) {
         if (!isCompatible) {
           KJ_LOG(FATAL, "Cap'n Proto version is not compatible");
-          return kj::Promise<void>(kj::READY_NOW);
+          return kj::Promise<kj::Array<kj::String>>(kj::Array<kj::String>());
         } else {
           KJ_LOG(INFO, "Compiling:", params.fileName);
           kj::String strippedUri = kj::heapString(params.fileName);
@@ -29,20 +71,51 @@ kj::Promise<void> CompilationManager::compile(CompileParams params) {
             strippedUri =
                 kj::heapString(strippedUri.slice(params.workingDir.size() + 1));
           }
-          params.diagnosticMap.clear();
-          KJ_IF_MAYBE (command, buildCommand(params)) {
-            return subprocessRunner
-                .run(
-                    {.command = *command,
-                     .workingDir = params.workingDir,
-                     .isCapnpMessageOutput = true})
-                .then([params, fileName = kj::mv(strippedUri)](
+          KJ_IF_MAYBE (argv, buildArgv(params)) {
+            auto key =
+                kj::str(params.workingDir, "\n", kj::strArray(*argv, "\n"));
+            // With unsaved buffers the result depends on more than the files
+            // on disk, so the cache is neither asked nor told.
+            auto overlay = overlayModified(params);
+            if (overlay == nullptr && compileCache.isUpToDate(key)) {
+              // The symbols of the last compile stand, and a successful
+              // compile has no diagnostics.
+              SymbolSnapshot::Builder snapshot(*params.snapshots.get());
+              params.snapshots.publish(snapshot.finish());
+              return kj::Promise<kj::Array<kj::String>>(
+                  compileCache.closureOf(key));
+            }
+            kj::ArrayPtr<const kj::String> compileArgv = *argv;
+            kj::StringPtr compileDir = params.workingDir;
+            KJ_IF_MAYBE (compile, overlay) {
+              compileArgv = (*compile)->argv;
+              compileDir = (*compile)->workingDir;
+            }
+            // Stamped before the compiler starts, so that a file written
+            // while it runs keeps the result out of the cache.
+            kj::Vector<kj::String> expected;
+            expected.add(kj::heapString(params.fileName));
+            for (auto &path : compileCache.closureOf(key)) {
+              expected.add(kj::mv(path));
+            }
+            CompileStart start(expected.asPtr());
+            return runCompiler(compileArgv, compileDir, overlay != nullptr)
+                .then([this,
+                       params,
+                       fileName = kj::mv(strippedUri),
+                       key = kj::mv(key),
+                       overlay = kj::mv(overlay),
+                       start = kj::mv(start)](
                           SubprocessRunner::RunResult result) mutable {
+                  // The next version starts from whatever is current now,
+                  // so that compiles finishing in any order all land.
+                  SymbolSnapshot::Builder snapshot(*params.snapshots.get());
+                  kj::Vector<kj::String> resolved;
                   if (result.exitCode != 0) {
                     KJ_LOG(
                         ERROR, "Failed to compile", fileName, result.errorText);
                     int status = CompileErrorParser::parse(
-                        fileName, result.errorText, params.diagnosticMap);
+                        fileName, result.errorText, snapshot.getDiagnostics());
                     if (status != 0) {
                       KJ_LOG(
                           ERROR,
@@ -50,33 +123,63 @@ kj::Promise<void> CompilationManager::compile(CompileParams params) {
                           fileName,
                           result.errorText);
                     }
-                    return kj::Promise<void>(kj::READY_NOW);
-                  }
-
-                  KJ_IF_MAYBE (reader, result.maybeReader) {
-                    SymbolResolver::resolve(
-                        kj::mv(*reader),
-                        params.fileSourceInfoMap,
-                        params.nodeLocationMap,
-                        params.importPaths,
-                        params.workingDir);
+                  } else {
+                    KJ_IF_MAYBE (reader, result.maybeReader) {
+                      auto closure = importClosureOf(
+                          (*reader)
+                              ->getRoot<capnp::schema::CodeGeneratorRequest>(),
+                          params.importPaths,
+                          params.workingDir);
+                      SymbolResolver::resolve(
+                          kj::mv(*reader),
+                          snapshot,
+                          params.symbolTable,
+                          params.referenceIndex,
+                          params.schemaStore,
+                          params.importPaths,
+                          params.workingDir,
+                          [&](kj::StringPtr filePath) {
+                            return params.documents.find(filePath) != nullptr;
+                          },
+                          [&](kj::StringPtr filePath)
+                              -> kj::Maybe<kj::StringPtr> {
+                            KJ_IF_MAYBE (compile, overlay) {
+                              KJ_IF_MAYBE (
+                                  buffer, (*compile)->buffers.find(filePath)) {
+                                return kj::StringPtr(*buffer);
+                              }
+                            }
+                            return nullptr;
+                          });
+                      KJ_IF_MAYBE (compile, overlay) {
+                        // Compiles that read these files from disk are no
+                        // longer what the symbols hold.
+                        for (auto &buffer : (*compile)->buffers) {
+                          compileCache.forget(buffer.key);
+                        }
+                      } else {
+                        compileCache.record(kj::mv(key), closure, start);
+                      }
+                      resolved = kj::mv(closure);
+                    }
                   }
-                  return kj::Promise<void>(kj::READY_NOW);
+                  params.snapshots.publish(snapshot.finish());
+                  return resolved.releaseAsArray();
                 })
                 .catch_([](kj::Exception &&e) {
                   KJ_LOG(
                       ERROR,
                       "Compilation error, exception:",
                       e.getDescription());
-                  return kj::Promise<void>(kj::READY_NOW);
+                  return kj::Array<kj::String>();
                 });
           }
-          return kj::Promise<void>(kj::READY_NOW);
+          return kj::Promise<kj::Array<kj::String>>(kj::Array<kj::String>());
         }
       })
       .catch_([](kj::Exception &&e) {
         KJ_LOG(ERROR, "Version check error, exception:", e.getDescription());
-        return kj::Promise<void>(kj::READY_NOW);
+        return kj::Array<kj::String>();
       });
 }
 
@@ -90,10 +193,11 @@ CompilationManager::checkCapnpVersionCompatible(kj::StringPtr compilerPath) {
     return kj::Promise<bool>(false);
   }
 
-  auto command = kj::str(compilerPath, " --version");
-  KJ_LOG(INFO, "Checking capnp version with command:", command);
-  SubprocessRunner::RunParams params = {
-      .command = command, .workingDir = ".", .isCapnpMessageOutput = false};
+  kj::Vector<kj::String> argv;
+  argv.add(kj::heapString(compilerPath));
+  argv.add(kj::heapString("--version"));
+  KJ_LOG(INFO, "Checking capnp version with command:", kj::strArray(argv, " "));
+  SubprocessRunner::RunParams params = {.argv = argv, .workingDir = "."};
   return subprocessRunner.run(params)
       .then([this](SubprocessRunner::RunResult result) -> bool {
         if (result.status != SubprocessRunner::Status::SUCCESS) {
@@ -171,20 +275,182 @@ CompilationManager::checkCapnpVersionCompatible(kj::StringPtr compilerPath) {
       });
 }
 
-kj::Maybe<kj::String> CompilationManager::buildCommand(CompileParams params) {
-  kj::Vector<kj::String> args;
-  kj::String compilerPath;
-  if (params.compilerPath != nullptr && params.compilerPath.size() > 0) {
-    compilerPath = kj::heapString(params.compilerPath);
-    KJ_LOG(INFO, "Using user-specified capnp compiler", compilerPath);
+kj::Vector<TextEdit> CompilationManager::format(FormatParams params) {
+  return Formatter::format(params.text, params.options, params.range);
+}
+
+kj::Promise<bool> CompilationManager::verify(VerifyParams params) {
+  auto roots = overlayRoots(params.workingDir, params.importPaths);
+  kj::Vector<kj::String> importPaths;
+
+  kj::Own<CompileOverlay> overlay;
+  kj::Vector<kj::String> fileNames;
+  try {
+    overlay = kj::heap<CompileOverlay>(roots);
+    for (auto &entry : params.files) {
+      overlay->addFile(entry.key, entry.value);
+      fileNames.add(overlay->overlayPathOf(entry.key));
+    }
+  } catch (kj::Exception &e) {
+    KJ_LOG(ERROR, "Failed to prepare compile overlay", e.getDescription());
+    return false;
+  }
+  // Overlay copies shadow the real import paths.
+  auto importRoots = roots.asPtr().slice(1, roots.size());
+  for (auto &root : importRoots) {
+    importPaths.add(overlay->overlayPathOf(root));
+  }
+  for (auto &root : importRoots) {
+    importPaths.add(kj::heapString(root));
+  }
+
+  KJ_IF_MAYBE (argv, buildArgv(params.compilerPath, importPaths, fileNames)) {
+    return runCompiler(*argv, params.workingDir)
+        .then([](SubprocessRunner::RunResult result) {
+          if (result.exitCode != 0) {
+            KJ_LOG(INFO, "Verification compile failed", result.errorText);
+            return false;
+          }
+          return true;
+        })
+        .attach(kj::mv(overlay));
+  }
+  return false;
+}
+
+kj::Maybe<kj::Own<CompilationManager::OverlayCompile>>
+CompilationManager::overlayModified(CompileParams params) {
+  bool modified = false;
+  for (auto &entry : params.documents) {
+    modified = modified || entry.value->isModified();
+  }
+  if (!modified) {
+    return nullptr;
+  }
+
+  auto roots = overlayRoots(params.workingDir, params.importPaths);
+  auto compile = kj::heap<OverlayCompile>();
+  try {
+    compile->overlay = kj::heap<CompileOverlay>(roots);
+  } catch (kj::Exception &e) {
+    KJ_LOG(ERROR, "Failed to prepare compile overlay", e.getDescription());
+    return nullptr;
+  }
+  for (auto &entry : params.documents) {
+    if (!entry.value->isModified()) {
+      continue;
+    }
+    auto text = entry.value->getText();
+    KJ_IF_MAYBE (e, kj::runCatchingExceptions([&]() {
+                   compile->overlay->addFile(entry.key, text);
+                 })) {
+      // Outside of the workspace and import paths: compiled from disk.
+      KJ_LOG(
+          INFO, "Unsaved buffer not overlaid", entry.key, e->getDescription());
+    } else {
+      compile->buffers.insert(kj::heapString(entry.key), kj::heapString(text));
+    }
+  }
+  if (compile->buffers.size() == 0) {
+    return nullptr;
+  }
+
+  // Run in the overlay's copy of the workspace and given a relative name,
+  // the compiler reports the same display names as outside of it, which
+  // resolve to the real files.
+  kj::Vector<kj::String> importPaths;
+  for (auto &root : roots.asPtr().slice(1, roots.size())) {
+    importPaths.add(compile->overlay->overlayPathOf(root));
+  }
+  kj::Vector<kj::String> fileNames;
+  if (params.fileName.startsWith(kj::str(params.workingDir, "/"))) {
+    fileNames.add(
+        kj::heapString(params.fileName.slice(params.workingDir.size() + 1)));
+  } else if (compile->buffers.find(params.fileName) != nullptr) {
+    fileNames.add(compile->overlay->overlayPathOf(params.fileName));
   } else {
+    fileNames.add(kj::heapString(params.fileName));
+  }
+  KJ_IF_MAYBE (argv, buildArgv(params.compilerPath, importPaths, fileNames)) {
+    compile->argv = kj::mv(*argv);
+  } else {
+    return nullptr;
+  }
+  compile->workingDir = compile->overlay->overlayPathOf(params.workingDir);
+  KJ_LOG(INFO, "Compiling with unsaved buffers", compile->buffers.size());
+  return kj::mv(compile);
+}
+
+kj::Promise<kj::HashMap<kj::String, kj::Vector<Diagnostic>>>
+CompilationManager::check(CheckParams params) {
+  auto argv =
+      buildArgv(params.compilerPath, params.importPaths, params.fileNames);
+  KJ_IF_MAYBE (args, argv) {
+    // Only the errors are read, so the generated request is not collected.
+    return subprocessRunner
+        .run(
+            {.argv = *args,
+             .workingDir = params.workingDir,
+             .output = SubprocessRunner::Output::NONE})
+        .then([fileNames = params.fileNames](
+                  SubprocessRunner::RunResult result) {
+          KJ_REQUIRE(
+              result.status == SubprocessRunner::Status::SUCCESS,
+              "Failed to run the compiler",
+              result.errorText);
+          kj::HashMap<kj::String, kj::Vector<Diagnostic>> diagnostics;
+          bool parsed = false;
+          for (auto &fileName : fileNames) {
+            if (CompileErrorParser::parse(
+                    fileName, result.errorText, diagnostics) == 0) {
+              parsed = true;
+            }
+          }
+          if (result.exitCode != 0 && !parsed) {
+            // Nothing attributable to these files, e.g. a missing import
+            // path: report it against the first one rather than lose it.
+            kj::Vector<Diagnostic> unattributed;
+            unattributed.add(Diagnostic{
+                Range{{0, 0}, {0, 0}},
+                DiagnosticSeverity::Error,
+                kj::str(result.errorText),
+                kj::str("capnp-compiler")});
+            diagnostics.upsert(
+                kj::heapString(fileNames[0]), kj::mv(unattributed));
+          }
+          return diagnostics;
+        });
+  }
+  return KJ_EXCEPTION(FAILED, "Invalid compiler path", params.compilerPath);
+}
+
+kj::StringPtr CompilationManager::defaultCompilerPath() {
 #ifdef BUNDLED_CAPNP_EXECUTABLE
-    compilerPath = kj::heapString(BUNDLED_CAPNP_EXECUTABLE);
-    KJ_LOG(INFO, "Using bundled capnp compiler", compilerPath);
+  return BUNDLED_CAPNP_EXECUTABLE;
 #else
-    compilerPath = kj::heapString("capnp");
-    KJ_LOG(INFO, "Using default capnp command", compilerPath);
+  return "capnp";
 #endif
+}
+
+kj::Maybe<kj::Array<kj::String>>
+CompilationManager::buildArgv(CompileParams params) {
+  kj::Vector<kj::String> fileNames;
+  fileNames.add(kj::heapString(params.fileName));
+  return buildArgv(params.compilerPath, params.importPaths, fileNames);
+}
+
+kj::Maybe<kj::Array<kj::String>> CompilationManager::buildArgv(
+    kj::StringPtr requestedCompilerPath,
+    kj::ArrayPtr<const kj::String> importPaths,
+    kj::ArrayPtr<const kj::String> fileNames) {
+  kj::Vector<kj::String> args;
+  kj::String compilerPath;
+  if (requestedCompilerPath != nullptr && requestedCompilerPath.size() > 0) {
+    compilerPath = kj::heapString(requestedCompilerPath);
+    KJ_LOG(INFO, "Using user-specified capnp compiler", compilerPath);
+  } else {
+    compilerPath = kj::heapString(defaultCompilerPath());
+    KJ_LOG(INFO, "Using default capnp compiler", compilerPath);
   }
 
   if (!compilerPath.endsWith("capnp")) {
@@ -194,24 +460,16 @@ kj::Maybe<kj::String> CompilationManager::buildCommand(CompileParams params) {
   args.add(kj::mv(compilerPath));
   args.add(kj::heapString("compile"));
 
-  for (auto &path : params.importPaths) {
+  for (auto &path : importPaths) {
     args.add(kj::str("-I", path));
   }
 
   args.add(kj::str("-o", "-")); // output to stdout
-  args.add(kj::heapString(params.fileName));
-
-  kj::String result;
-  for (auto &arg : args) {
-    if (result.size() > 0)
-      result = kj::str(result, " ");
-    if (arg.findFirst(' ') != nullptr || arg.findFirst('\t') != nullptr) {
-      result = kj::str(result, "\"", arg, "\"");
-    } else {
-      result = kj::str(result, arg);
-    }
+  for (auto &fileName : fileNames) {
+    args.add(kj::heapString(fileName));
   }
 
-  return result;
+  // Passed to the child as is: paths with spaces need no quoting.
+  return args.releaseAsArray();
 }
 } // namespace capnp_ls
\ No newline at end of file
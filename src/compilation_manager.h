@@ -5,9 +5,15 @@
 
 #pragma once
 
+#include "compile_cache.h"
+#include "compile_daemon.h"
+#include "compile_overlay.h"
+#include "document.h"
+#include "formatter.h"
 #include "lsp_types.h"
 #include "subprocess_runner.h"
 #include "symbol_resolver.h"
+#include "symbol_snapshot.h"
 #include <kj/async-io.h>
 #include <kj/map.h>
 #include <kj/string.h>
@@ -25,24 +31,89 @@ public:
     const kj::Vector<kj::String> &importPaths;
     kj::StringPtr fileName;
     kj::StringPtr workingDir;
-    kj::HashMap<kj::String, kj::HashMap<Range, uint64_t>> &fileSourceInfoMap;
-    kj::HashMap<uint64_t, kj::Own<Location>> &nodeLocationMap;
-    kj::HashMap<kj::String, kj::Vector<Diagnostic>> &diagnosticMap;
+    // Receives a new version once the compile is done.
+    SymbolSnapshots &snapshots;
+    SymbolTable &symbolTable;
+    ReferenceIndex &referenceIndex;
+    SchemaStore &schemaStore;
+    // Open files get positions even when they are only imported. Those with
+    // unsaved edits are compiled from their buffers.
+    const DocumentMap &documents;
   };
 
-  struct FormatParams {
+  struct VerifyParams {
     kj::StringPtr compilerPath;
-    kj::StringPtr fileName;
+    const kj::Vector<kj::String> &importPaths;
+    kj::StringPtr workingDir;
+    // Absolute path -> contents to compile in place of what is on disk.
+    const kj::HashMap<kj::String, kj::String> &files;
+  };
+
+  struct CheckParams {
+    kj::StringPtr compilerPath;
+    kj::ArrayPtr<const kj::String> importPaths;
     kj::StringPtr workingDir;
+    // Relative to `workingDir`; compiled by a single compiler run.
+    kj::ArrayPtr<const kj::String> fileNames;
+  };
+
+  struct FormatParams {
+    kj::StringPtr text;
+    FormattingOptions options;
+    // Only the lines of this range are touched, if given.
+    kj::Maybe<Range> range;
   };
 
-  kj::Promise<void> compile(CompileParams params);
+  // Resolves to the files whose symbols the compile left in place: those it
+  // read, or for a compile skipped as up to date those the last one read.
+  // Empty if it failed.
+  kj::Promise<kj::Array<kj::String>> compile(CompileParams params);
   kj::Promise<bool> checkCapnpVersionCompatible(kj::StringPtr compilerPath);
-  kj::Promise<void> format(FormatParams params);
+  // Formats in-process; no compiler run is needed.
+  kj::Vector<TextEdit> format(FormatParams params);
+  // Compiles `params.files` against an overlay of the workspace and import
+  // paths. Resolves to true if capnp accepts them.
+  kj::Promise<bool> verify(VerifyParams params);
+  // Diagnostics of each of `params.fileNames` that has any, keyed by its
+  // name as given. Errors the compiler reports in other files are left to
+  // the check of those files.
+  kj::Promise<kj::HashMap<kj::String, kj::Vector<Diagnostic>>>
+  check(CheckParams params);
+  // The bundled compiler if there is one, else `capnp` from PATH.
+  static kj::StringPtr defaultCompilerPath();
+  // Sends later compiles to a CompileDaemonClient instead of running the
+  // compiler directly.
+  void useCompileDaemon(CompileDaemonClient::Mode mode);
+  // The symbols of `filePath` were dropped; the next compile that reaches
+  // it resolves it again.
+  void forgetFile(kj::StringPtr filePath);
 
 private:
+  kj::AsyncIoContext &ioContext;
   SubprocessRunner subprocessRunner;
-  kj::Maybe<kj::String> buildCommand(CompileParams params);
+  kj::Maybe<kj::Own<CompileDaemonClient>> compileDaemon;
+  CompileCache compileCache;
+  // A compile that reads unsaved buffers: the compiler runs in an overlay of
+  // the workspace and import paths that holds the modified open documents.
+  struct OverlayCompile {
+    kj::Own<CompileOverlay> overlay;
+    kj::Array<kj::String> argv;
+    kj::String workingDir;
+    // Real path -> the buffer the overlay holds in its place.
+    kj::HashMap<kj::String, kj::String> buffers;
+  };
+
+  kj::Promise<SubprocessRunner::RunResult> runCompiler(
+      kj::ArrayPtr<const kj::String> argv,
+      kj::StringPtr workingDir,
+      bool overlay = false);
+  // Null if no open document has unsaved edits.
+  kj::Maybe<kj::Own<OverlayCompile>> overlayModified(CompileParams params);
+  kj::Maybe<kj::Array<kj::String>> buildArgv(CompileParams params);
+  kj::Maybe<kj::Array<kj::String>> buildArgv(
+      kj::StringPtr compilerPath,
+      kj::ArrayPtr<const kj::String> importPaths,
+      kj::ArrayPtr<const kj::String> fileNames);
   bool isCapnpVersionCompatible = false;
 };
 } // namespace capnp_ls
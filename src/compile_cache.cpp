@@ -0,0 +1,177 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#include "compile_cache.h"
+#include "symbol_resolver.h"
+#include "utils.h"
+#include <kj/debug.h>
+#include <kj/filesystem.h>
+#include <sys/stat.h>
+#include <time.h>
+
+namespace capnp_ls {
+
+kj::Maybe<FileStamp> stampOf(kj::StringPtr path) {
+  struct stat info;
+  if (stat(path.cStr(), &info) != 0) {
+    return nullptr;
+  }
+  return FileStamp{
+      kj::heapString(path),
+      static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 +
+          info.st_mtim.tv_nsec,
+      static_cast<int64_t>(info.st_size),
+      info.st_ino};
+}
+
+CompileStart::CompileStart(kj::ArrayPtr<const kj::String> paths) {
+  struct timespec now;
+#ifdef __linux__
+  // The clock file times are taken from, so that a write after this reads
+  // as such even when it lands within the same tick.
+  KJ_SYSCALL(clock_gettime(CLOCK_REALTIME_COARSE, &now));
+#else
+  KJ_SYSCALL(clock_gettime(CLOCK_REALTIME, &now));
+#endif
+  startedNs = static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+  for (auto &path : paths) {
+    KJ_IF_MAYBE (stamp, stampOf(path)) {
+      stamps.upsert(kj::heapString(path), kj::mv(*stamp));
+    }
+  }
+}
+
+bool CompileStart::saw(const FileStamp &stamp) const {
+  KJ_IF_MAYBE (before, stamps.find(stamp.path)) {
+    return *before == stamp;
+  }
+  return stamp.modifiedNs < startedNs;
+}
+
+kj::Vector<kj::String> importClosureOf(
+    capnp::schema::CodeGeneratorRequest::Reader request,
+    const kj::Vector<kj::String> &importPaths,
+    kj::StringPtr workingDir) {
+  kj::Vector<kj::String> closure;
+  for (auto node : request.getNodes()) {
+    if (node.isFile()) {
+      closure.add(SymbolResolver::resolveFilePath(
+          node.getDisplayName(), importPaths, workingDir));
+    }
+  }
+  return closure;
+}
+
+bool CompileCache::isUpToDate(kj::StringPtr key) {
+  bool upToDate = false;
+  KJ_IF_MAYBE (files, compiles.find(key)) {
+    upToDate = true;
+    for (auto &file : *files) {
+      if (!isUnchanged(file)) {
+        upToDate = false;
+        break;
+      }
+    }
+  }
+  if (upToDate) {
+    hits++;
+  } else {
+    misses++;
+  }
+  KJ_LOG(
+      INFO,
+      upToDate ? "Compile skipped, nothing changed" : "Compile needed",
+      key,
+      kj::str("hit ratio ", hits, "/", hits + misses));
+  return upToDate;
+}
+
+bool CompileCache::isUnchanged(FileState &file) {
+  KJ_IF_MAYBE (resolved, resolvedHashes.find(file.stamp.path)) {
+    if (*resolved != file.hash) {
+      return false;
+    }
+  } else {
+    return false;
+  }
+  KJ_IF_MAYBE (current, stampOf(file.stamp.path)) {
+    if (*current == file.stamp) {
+      return true;
+    }
+    // Written since, maybe with the same content.
+    KJ_IF_MAYBE (hash, hashFile(file.stamp.path)) {
+      if (*hash == file.hash) {
+        file.stamp = kj::mv(*current);
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void CompileCache::record(
+    kj::String key,
+    kj::ArrayPtr<const kj::String> closure,
+    const CompileStart &start) {
+  kj::Vector<FileState> files;
+  bool complete = true;
+  for (auto &path : closure) {
+    // Stamped before reading, so that a write in between moves the stamp.
+    auto stamp = stampOf(path);
+    auto hash = hashFile(path);
+    KJ_IF_MAYBE (s, stamp) {
+      // Written while the compiler ran, the hash may not be of what it read.
+      bool seen = start.saw(*s);
+      KJ_IF_MAYBE (h, hash) {
+        if (seen) {
+          resolvedHashes.upsert(kj::heapString(path), *h);
+          files.add(FileState{kj::mv(*s), *h});
+          continue;
+        }
+      }
+      if (!seen) {
+        KJ_LOG(INFO, "Compile not recorded, file written during it", path);
+      }
+    }
+    // Its symbols come from content we cannot name: nothing that read it is
+    // up to date until it is resolved again.
+    resolvedHashes.erase(path);
+    complete = false;
+  }
+  if (!complete) {
+    compiles.erase(key);
+    return;
+  }
+  if (compiles.size() >= MAX_COMPILES) {
+    compiles.clear();
+  }
+  compiles.upsert(kj::mv(key), kj::mv(files));
+}
+
+kj::Array<kj::String> CompileCache::closureOf(kj::StringPtr key) const {
+  kj::Vector<kj::String> closure;
+  KJ_IF_MAYBE (files, compiles.find(key)) {
+    for (auto &file : *files) {
+      closure.add(kj::heapString(file.stamp.path));
+    }
+  }
+  return closure.releaseAsArray();
+}
+
+void CompileCache::forget(kj::StringPtr path) {
+  resolvedHashes.erase(path);
+}
+
+kj::Maybe<uint64_t> CompileCache::hashFile(kj::StringPtr path) {
+  try {
+    auto fs = kj::newDiskFilesystem();
+    auto file = fs->getRoot().openFile(kj::Path::parse(path.slice(1)));
+    return hashBytes(file->readAllBytes());
+  } catch (kj::Exception &e) {
+    return nullptr;
+  }
+}
+
+} // namespace capnp_ls
@@ -0,0 +1,112 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <capnp/schema.capnp.h>
+#include <kj/map.h>
+#include <kj/string.h>
+#include <kj/vector.h>
+#include <sys/types.h>
+
+namespace capnp_ls {
+
+// What a stat says about a file: enough to tell, without reading it, that
+// it has not been written since.
+struct FileStamp {
+  kj::String path;
+  int64_t modifiedNs;
+  int64_t size;
+  ino_t inode;
+
+  bool operator==(const FileStamp &other) const {
+    return path == other.path && modifiedNs == other.modifiedNs &&
+           size == other.size && inode == other.inode;
+  }
+};
+
+kj::Maybe<FileStamp> stampOf(kj::StringPtr path);
+
+// Stamps taken just before a compiler is spawned, to tell afterwards
+// whether a file it read was written while it ran. Only a compile whose
+// files all pass `saw` may be cached: otherwise its output can be older
+// than the stamps stored with it.
+class CompileStart {
+public:
+  // Stamps `paths`, the files the compile is expected to read.
+  explicit CompileStart(kj::ArrayPtr<const kj::String> paths);
+
+  // Whether `stamp`, taken after the compile, is of the content the
+  // compiler read: the same as at the start if the file was stamped then,
+  // else last written before the start.
+  bool saw(const FileStamp &stamp) const;
+
+private:
+  int64_t startedNs;
+  kj::HashMap<kj::String, FileStamp> stamps;
+};
+
+// Absolute paths of the files in a compile's output: the requested ones and
+// everything they import.
+kj::Vector<kj::String> importClosureOf(
+    capnp::schema::CodeGeneratorRequest::Reader request,
+    const kj::Vector<kj::String> &importPaths,
+    kj::StringPtr workingDir);
+
+// Remembers which files each successful compile read, with their stamps and
+// content hashes, so that a compile that could only repeat the last one is
+// skipped. A stamp that moved without the content changing, as on a save
+// with no edits, costs a read and a hash but still counts as unchanged.
+class CompileCache {
+public:
+  static constexpr size_t MAX_COMPILES = 256;
+
+  CompileCache() = default;
+  KJ_DISALLOW_COPY(CompileCache);
+
+  // Whether compiling `key` again would give what the symbols and
+  // diagnostics already hold: every file it read last time has the same
+  // content, and no other compile has resolved any of them since from
+  // different content. Counts a hit or a miss.
+  bool isUpToDate(kj::StringPtr key);
+
+  // Records a successful compile of `key` that read `closure`, whose
+  // symbols have just been resolved. Not recorded if a file in it was
+  // written after `start`.
+  void record(
+      kj::String key,
+      kj::ArrayPtr<const kj::String> closure,
+      const CompileStart &start);
+  // Files the last recorded compile of `key` read.
+  kj::Array<kj::String> closureOf(kj::StringPtr key) const;
+  // The symbols of `path` were dropped: no compile that read it is up to
+  // date until it is resolved again.
+  void forget(kj::StringPtr path);
+
+  uint64_t getHits() const {
+    return hits;
+  }
+  uint64_t getMisses() const {
+    return misses;
+  }
+
+private:
+  struct FileState {
+    FileStamp stamp;
+    uint64_t hash;
+  };
+
+  kj::HashMap<kj::String, kj::Vector<FileState>> compiles;
+  // Content hash of each file as last resolved into the symbols, by any
+  // compile.
+  kj::HashMap<kj::String, uint64_t> resolvedHashes;
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+
+  static kj::Maybe<uint64_t> hashFile(kj::StringPtr path);
+  bool isUnchanged(FileState &file);
+};
+
+} // namespace capnp_ls
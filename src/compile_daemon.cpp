@@ -0,0 +1,690 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#include "compile_daemon.h"
+#include "compile_cache.h"
+#include "compile_daemon.capnp.h"
+#include <capnp/rpc-twoparty.h>
+#include <capnp/schema.capnp.h>
+#include <capnp/serialize.h>
+#include <cstring>
+#include <kj/async-unix.h>
+#include <kj/debug.h>
+#include <kj/map.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+namespace capnp_ls {
+namespace {
+
+constexpr size_t MAX_CACHED_COMPILES = 64;
+// A shared daemon with no session for this long exits.
+constexpr kj::Duration SHARED_IDLE_TIMEOUT = 10 * kj::MINUTES;
+
+capnp::ReaderOptions readerOptions() {
+  capnp::ReaderOptions options;
+  options.traversalLimitInWords = 1 << 30;
+  return options;
+}
+
+// A successful compile, valid while every file it read is unchanged.
+struct CachedCompile {
+  kj::Vector<FileStamp> closure;
+  kj::Array<kj::byte> output;
+  kj::String errorText; // warnings
+};
+
+class CompileDaemonImpl final : public CompileDaemon::Server {
+public:
+  explicit CompileDaemonImpl(kj::AsyncIoContext &ioContext)
+      : runner(ioContext),
+        maxRunning(kj::max(std::thread::hardware_concurrency(), 1u)) {}
+
+protected:
+  kj::Promise<void> compile(CompileContext context) override {
+    auto request = context.getParams().getRequest();
+    kj::Vector<kj::String> argv;
+    for (auto arg : request.getArgv()) {
+      argv.add(kj::heapString(arg));
+    }
+    auto workingDir = kj::heapString(request.getWorkingDir());
+    auto key = kj::str(workingDir, "\n", kj::strArray(argv, "\n"));
+    bool overlay = request.getOverlay();
+
+    // Files the compile is expected to read, stamped once it is spawned.
+    kj::Vector<kj::String> expected;
+    KJ_IF_MAYBE (cached, overlay ? nullptr : cache.find(key)) {
+      if (isFresh(*cached)) {
+        auto result = context.getResults().initResult();
+        result.setExitCode(0);
+        result.setErrorText(cached->errorText);
+        result.setOutput(
+            capnp::Data::Reader(cached->output.begin(), cached->output.size()));
+        result.setCached(true);
+        return kj::READY_NOW;
+      }
+      for (auto &stamp : cached->closure) {
+        expected.add(kj::mv(stamp.path));
+      }
+      cache.erase(key);
+    }
+
+    // Compilers run one per core at most, however many sessions ask.
+    return acquireSlot().then([this,
+                               context,
+                               argv = kj::mv(argv),
+                               workingDir = kj::mv(workingDir),
+                               key = kj::mv(key),
+                               expected = kj::mv(expected),
+                               overlay]() mutable {
+      CompileStart start(expected.asPtr());
+      auto run = runner
+                     .run(
+                         {.argv = argv,
+                          .workingDir = workingDir,
+                          .output = SubprocessRunner::Output::BYTES})
+                     .attach(kj::defer([this]() { releaseSlot(); }));
+      return run.then([this,
+                       context,
+                       argv = kj::mv(argv),
+                       workingDir = kj::mv(workingDir),
+                       key = kj::mv(key),
+                       start = kj::mv(start),
+                       overlay](SubprocessRunner::RunResult run) mutable {
+        auto result = context.getResults().initResult();
+        result.setExitCode(run.exitCode);
+        result.setErrorText(run.errorText);
+        if (run.exitCode != 0 ||
+            run.status != SubprocessRunner::Status::SUCCESS) {
+          return;
+        }
+        result.setOutput(
+            capnp::Data::Reader(run.rawOutput.begin(), run.rawOutput.size()));
+        if (overlay) {
+          return;
+        }
+        KJ_IF_MAYBE (
+            closure, stampClosure(run.rawOutput, argv, workingDir, start)) {
+          if (cache.size() >= MAX_CACHED_COMPILES) {
+            cache.clear();
+          }
+          cache.upsert(
+              kj::mv(key),
+              CachedCompile{
+                  kj::mv(*closure),
+                  kj::mv(run.rawOutput),
+                  kj::mv(run.errorText)});
+        }
+      });
+    });
+  }
+
+private:
+  SubprocessRunner runner;
+  kj::HashMap<kj::String, CachedCompile> cache;
+  size_t maxRunning;
+  size_t running = 0;
+  // Compiles waiting for a slot, first come first served from `nextWaiter`.
+  kj::Vector<kj::Own<kj::PromiseFulfiller<void>>> waiting;
+  size_t nextWaiter = 0;
+
+  kj::Promise<void> acquireSlot() {
+    if (running < maxRunning) {
+      running++;
+      return kj::READY_NOW;
+    }
+    auto paf = kj::newPromiseAndFulfiller<void>();
+    waiting.add(kj::mv(paf.fulfiller));
+    return kj::mv(paf.promise);
+  }
+
+  // Hands the slot to the next compile still waiting, if any.
+  void releaseSlot() {
+    while (nextWaiter < waiting.size()) {
+      auto next = kj::mv(waiting[nextWaiter++]);
+      if (next->isWaiting()) {
+        next->fulfill();
+        return;
+      }
+    }
+    waiting.clear();
+    nextWaiter = 0;
+    running--;
+  }
+
+  static bool isFresh(const CachedCompile &cached) {
+    for (auto &stamp : cached.closure) {
+      KJ_IF_MAYBE (current, stampOf(stamp.path)) {
+        if (!(*current == stamp)) {
+          return false;
+        }
+      } else {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Stamps of every file in the compiler's output, or null if one of them
+  // cannot be found or was written while the compiler ran (the result is
+  // then not cached).
+  static kj::Maybe<kj::Vector<FileStamp>> stampClosure(
+      kj::ArrayPtr<const kj::byte> output,
+      kj::ArrayPtr<const kj::String> argv,
+      kj::StringPtr workingDir,
+      const CompileStart &start) {
+    kj::Vector<kj::String> importPaths;
+    for (auto &arg : argv) {
+      if (arg.startsWith("-I")) {
+        importPaths.add(kj::heapString(arg.slice(2)));
+      }
+    }
+    try {
+      // Heap arrays are aligned well enough to be read in place.
+      capnp::FlatArrayMessageReader reader(
+          kj::arrayPtr(
+              reinterpret_cast<const capnp::word *>(output.begin()),
+              output.size() / sizeof(capnp::word)),
+          readerOptions());
+      auto request = reader.getRoot<capnp::schema::CodeGeneratorRequest>();
+      kj::Vector<FileStamp> closure;
+      for (auto &path : importClosureOf(request, importPaths, workingDir)) {
+        KJ_IF_MAYBE (stamp, stampOf(path)) {
+          if (!start.saw(*stamp)) {
+            return nullptr;
+          }
+          closure.add(kj::mv(*stamp));
+        } else {
+          return nullptr;
+        }
+      }
+      return kj::mv(closure);
+    } catch (kj::Exception &e) {
+      KJ_LOG(INFO, "Compile not cached", e.getDescription());
+      return nullptr;
+    }
+  }
+};
+
+sockaddr_un socketAddress(kj::StringPtr path) {
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  KJ_REQUIRE(
+      path.size() < sizeof(address.sun_path), "socket path too long", path);
+  memcpy(address.sun_path, path.begin(), path.size());
+  return address;
+}
+
+// A connected socket, or null if nothing is listening at `path`.
+kj::Maybe<kj::AutoCloseFd> tryConnect(kj::StringPtr path) {
+  int fd;
+  KJ_SYSCALL(fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+  kj::AutoCloseFd socket(fd);
+  auto address = socketAddress(path);
+  int result;
+  KJ_SYSCALL_HANDLE_ERRORS(
+      result = connect(
+          fd, reinterpret_cast<sockaddr *>(&address), sizeof(address))) {
+  case ENOENT:
+  case ECONNREFUSED:
+    return nullptr;
+  default:
+    KJ_FAIL_SYSCALL("connect", error, path);
+  }
+  return kj::mv(socket);
+}
+
+// Held while a shared daemon binds its socket, or removes it on exit, so
+// that no daemon takes another's socket for one left behind, between that
+// one's bind and listen, or removes a socket that has replaced its own.
+kj::AutoCloseFd lockSocketPath(kj::StringPtr socketPath) {
+  auto lockPath = kj::str(socketPath, ".lock");
+  int fd;
+  KJ_SYSCALL(
+      fd = open(lockPath.cStr(), O_RDWR | O_CREAT | O_CLOEXEC, 0600),
+      lockPath);
+  kj::AutoCloseFd lock(fd);
+  KJ_SYSCALL(flock(fd, LOCK_EX), lockPath);
+  return lock;
+}
+
+// Serves one CompileDaemonImpl, and so one cache and one compile queue, to
+// every session that connects to the shared socket.
+class SharedDaemon final : public kj::TaskSet::ErrorHandler {
+public:
+  SharedDaemon(
+      kj::AsyncIoContext &ioContext,
+      kj::Own<kj::ConnectionReceiver> listener)
+      : ioContext(ioContext), listener(kj::mv(listener)),
+        bootstrap(kj::heap<CompileDaemonImpl>(ioContext)), sessions(*this) {}
+
+  // Resolves once no session has been connected for SHARED_IDLE_TIMEOUT.
+  kj::Promise<void> run() {
+    auto paf = kj::newPromiseAndFulfiller<void>();
+    idle = kj::mv(paf.fulfiller);
+    startIdleTimer();
+    return acceptLoop().exclusiveJoin(kj::mv(paf.promise));
+  }
+
+  void taskFailed(kj::Exception &&exception) override {
+    KJ_LOG(ERROR, "Compile daemon session failed", exception.getDescription());
+  }
+
+private:
+  struct Session {
+    Session(kj::Own<kj::AsyncIoStream> streamParam, CompileDaemon::Client cap)
+        : stream(kj::mv(streamParam)),
+          network(*stream, capnp::rpc::twoparty::Side::SERVER),
+          rpcSystem(capnp::makeRpcServer(network, kj::mv(cap))) {}
+
+    kj::Own<kj::AsyncIoStream> stream;
+    capnp::TwoPartyVatNetwork network;
+    capnp::RpcSystem<capnp::rpc::twoparty::VatId> rpcSystem;
+  };
+
+  kj::AsyncIoContext &ioContext;
+  kj::Own<kj::ConnectionReceiver> listener;
+  CompileDaemon::Client bootstrap;
+  kj::TaskSet sessions;
+  size_t sessionCount = 0;
+  kj::Maybe<kj::Promise<void>> idleTimer;
+  kj::Own<kj::PromiseFulfiller<void>> idle;
+
+  kj::Promise<void> acceptLoop() {
+    return listener->accept().then([this](kj::Own<kj::AsyncIoStream> stream) {
+      sessionCount++;
+      idleTimer = nullptr;
+      auto session = kj::heap<Session>(kj::mv(stream), bootstrap);
+      auto &network = session->network;
+      sessions.add(network.onDisconnect().attach(kj::mv(session)).then(
+          [this]() {
+            if (--sessionCount == 0) {
+              startIdleTimer();
+            }
+          }));
+      return acceptLoop();
+    });
+  }
+
+  void startIdleTimer() {
+    idleTimer = ioContext.provider->getTimer()
+                    .afterDelay(SHARED_IDLE_TIMEOUT)
+                    .then([this]() { idle->fulfill(); })
+                    .eagerlyEvaluate(nullptr);
+  }
+};
+
+} // namespace
+
+int runCompileDaemon() {
+  kj::_::Debug::setLogLevel(kj::LogSeverity::WARNING);
+  signal(SIGPIPE, SIG_IGN);
+  auto ioContext = kj::setupAsyncIo();
+  auto stream = ioContext.lowLevelProvider->wrapSocketFd(
+      CompileDaemonClient::SOCKET_FD,
+      kj::LowLevelAsyncIoProvider::TAKE_OWNERSHIP);
+  capnp::TwoPartyVatNetwork network(
+      *stream, capnp::rpc::twoparty::Side::SERVER);
+  auto rpcSystem =
+      capnp::makeRpcServer(network, kj::heap<CompileDaemonImpl>(ioContext));
+  network.onDisconnect().wait(ioContext.waitScope);
+  return 0;
+}
+
+int runSharedCompileDaemon() {
+  kj::_::Debug::setLogLevel(kj::LogSeverity::WARNING);
+  signal(SIGPIPE, SIG_IGN);
+  auto path = CompileDaemonClient::sharedSocketPath();
+  int fd;
+  KJ_SYSCALL(fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+  kj::AutoCloseFd listenSocket(fd);
+  auto address = socketAddress(path);
+  auto bindSocket = [&]() {
+    return bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address));
+  };
+  struct stat bound;
+  {
+    auto lock = lockSocketPath(path);
+    if (bindSocket() != 0) {
+      KJ_REQUIRE(errno == EADDRINUSE, "cannot bind", path, strerror(errno));
+      if (tryConnect(path) != nullptr) {
+        // Another server started one first.
+        return 0;
+      }
+      // Left behind by a daemon that did not exit cleanly.
+      unlink(path.cStr());
+      KJ_SYSCALL(bindSocket(), path);
+    }
+    KJ_SYSCALL(listen(fd, SOMAXCONN));
+    // Tells our socket file from one that replaces it later.
+    KJ_SYSCALL(stat(path.cStr(), &bound), path);
+  }
+
+  // The socket accepts connections from here on. Detach from the server
+  // that started us, which waits for this process to exit, so that the
+  // daemon outlives it and is reparented rather than left a zombie.
+  pid_t pid;
+  KJ_SYSCALL(pid = fork());
+  if (pid != 0) {
+    return 0;
+  }
+  setsid();
+
+  auto ioContext = kj::setupAsyncIo();
+  SharedDaemon daemon(
+      ioContext,
+      ioContext.lowLevelProvider->wrapListenSocketFd(kj::mv(listenSocket)));
+  daemon.run().wait(ioContext.waitScope);
+  auto lock = lockSocketPath(path);
+  struct stat current;
+  if (stat(path.cStr(), &current) == 0 && current.st_dev == bound.st_dev &&
+      current.st_ino == bound.st_ino) {
+    unlink(path.cStr());
+  }
+  return 0;
+}
+
+kj::String CompileDaemonClient::sharedSocketPath() {
+  const char *runtimeDir = getenv("XDG_RUNTIME_DIR");
+  auto dir = runtimeDir != nullptr && *runtimeDir != '\0'
+      ? kj::str(runtimeDir, "/capnp-ls")
+      : kj::str("/tmp/capnp-ls-", getuid());
+  if (mkdir(dir.cStr(), 0700) != 0 && errno != EEXIST) {
+    KJ_FAIL_SYSCALL("mkdir", errno, dir);
+  }
+  // Anyone who can write here can answer our compiles.
+  struct stat info;
+  KJ_SYSCALL(lstat(dir.cStr(), &info), dir);
+  KJ_REQUIRE(
+      S_ISDIR(info.st_mode) && info.st_uid == getuid() &&
+          (info.st_mode & 077) == 0,
+      "compile daemon directory is not private to this user",
+      dir);
+  return kj::str(dir, "/compile-daemon.sock");
+}
+
+// A daemon that is a child of this server. Reaped by the event port like
+// the compilers, which nulls `pid`, so that a pid reused since is never
+// killed.
+struct CompileDaemonClient::DaemonProcess : public kj::Refcounted {
+  kj::Maybe<pid_t> pid;
+};
+
+struct CompileDaemonClient::Connection {
+  // `stream` resolves once the daemon is listening; a shared one this server
+  // starts is not until its launcher exits.
+  Connection(
+      kj::Maybe<kj::Own<DaemonProcess>> processParam,
+      kj::Promise<kj::Own<kj::AsyncIoStream>> stream)
+      : process(kj::mv(processParam)),
+        starting(stream
+                     .then(
+                         [this](kj::Own<kj::AsyncIoStream> &&connected) {
+                           rpc = kj::heap<Rpc>(kj::mv(connected));
+                           for (auto &waiter : waiting) {
+                             waiter->fulfill();
+                           }
+                           waiting.clear();
+                         },
+                         [this](kj::Exception &&e) {
+                           for (auto &waiter : waiting) {
+                             waiter->reject(kj::cp(e));
+                           }
+                           waiting.clear();
+                           failure = kj::mv(e);
+                         })
+                     .eagerlyEvaluate(nullptr)) {}
+  ~Connection() {
+    // A shared daemon is not ours to stop.
+    KJ_IF_MAYBE (owned, process) {
+      KJ_IF_MAYBE (pid, (*owned)->pid) {
+        kill(*pid, SIGKILL);
+      }
+    }
+  }
+  KJ_DISALLOW_COPY(Connection);
+
+  // Resolves once `rpc` is set.
+  kj::Promise<void> whenReady() {
+    if (rpc != nullptr) {
+      return kj::READY_NOW;
+    }
+    KJ_IF_MAYBE (e, failure) {
+      return kj::cp(*e);
+    }
+    auto paf = kj::newPromiseAndFulfiller<void>();
+    waiting.add(kj::mv(paf.fulfiller));
+    return kj::mv(paf.promise);
+  }
+
+  struct Rpc {
+    explicit Rpc(kj::Own<kj::AsyncIoStream> streamParam)
+        : stream(kj::mv(streamParam)), client(*stream),
+          daemon(client.bootstrap().castAs<CompileDaemon>()) {}
+
+    kj::Own<kj::AsyncIoStream> stream;
+    capnp::TwoPartyClient client;
+    CompileDaemon::Client daemon;
+  };
+
+  kj::Maybe<kj::Own<DaemonProcess>> process;
+  kj::Maybe<kj::Own<Rpc>> rpc;
+  kj::Maybe<kj::Exception> failure;
+  kj::Vector<kj::Own<kj::PromiseFulfiller<void>>> waiting;
+  kj::Promise<void> starting;
+};
+
+CompileDaemonClient::CompileDaemonClient(
+    kj::AsyncIoContext &ioContext,
+    Mode mode)
+    : ioContext(ioContext), mode(mode), tasks(*this) {}
+
+CompileDaemonClient::~CompileDaemonClient() {}
+
+void CompileDaemonClient::taskFailed(kj::Exception &&exception) {
+  KJ_LOG(ERROR, "Compile daemon task failed", exception.getDescription());
+}
+
+CompileDaemonClient::Connection &CompileDaemonClient::connect() {
+  KJ_IF_MAYBE (existing, connection) {
+    return **existing;
+  }
+
+  kj::Vector<kj::String> argv;
+  argv.add(kj::mv(KJ_REQUIRE_NONNULL(
+      SubprocessRunner::serverExecutable(),
+      "cannot locate the server executable")));
+  argv.add(kj::heapString(DAEMON_FLAG));
+
+  kj::Own<Connection> started;
+  if (mode == Mode::SHARED) {
+    auto path = sharedSocketPath();
+    KJ_IF_MAYBE (socket, tryConnect(path)) {
+      started = kj::heap<Connection>(
+          nullptr, ioContext.lowLevelProvider->wrapSocketFd(kj::mv(*socket)));
+    } else {
+      // The daemon is listening by the time its first process exits.
+      argv.add(kj::heapString(SHARED_FLAG));
+      pid_t pid;
+      int error = SubprocessRunner::spawn(argv, "/", nullptr, pid);
+      if (error != 0) {
+        KJ_FAIL_SYSCALL("posix_spawn", error, argv[0]);
+      }
+      auto launcher = kj::heap<kj::Maybe<pid_t>>(pid);
+      auto exited = ioContext.unixEventPort.onChildExit(*launcher);
+      started = kj::heap<Connection>(
+          nullptr,
+          exited.attach(kj::mv(launcher))
+              .then([this, path = kj::mv(path)](int) {
+                KJ_LOG(INFO, "Started shared compile daemon", path);
+                return ioContext.lowLevelProvider->wrapSocketFd(
+                    kj::mv(KJ_REQUIRE_NONNULL(
+                        tryConnect(path),
+                        "shared compile daemon is not listening",
+                        path)));
+              }));
+    }
+  } else {
+    int fds[2];
+    KJ_SYSCALL(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds));
+    kj::AutoCloseFd serverEnd(fds[0]);
+    kj::AutoCloseFd daemonEnd(fds[1]);
+    SubprocessRunner::FdMapping mapping[] = {{daemonEnd.get(), SOCKET_FD}};
+    pid_t pid;
+    int error = SubprocessRunner::spawn(argv, "/", mapping, pid);
+    if (error != 0) {
+      KJ_FAIL_SYSCALL("posix_spawn", error, argv[0]);
+    }
+    daemonEnd = nullptr;
+    KJ_LOG(INFO, "Started compile daemon", pid);
+    auto process = kj::refcounted<DaemonProcess>();
+    process->pid = pid;
+    // Outlives the connection, which only kills the daemon.
+    tasks.add(ioContext.unixEventPort.onChildExit(process->pid)
+                  .then([](int status) {
+                    KJ_LOG(WARNING, "Compile daemon exited", status);
+                  })
+                  .attach(kj::addRef(*process)));
+    started = kj::heap<Connection>(
+        kj::mv(process),
+        ioContext.lowLevelProvider->wrapSocketFd(kj::mv(serverEnd)));
+  }
+  auto &result = *started;
+  connection = kj::mv(started);
+  return result;
+}
+
+kj::Promise<SubprocessRunner::RunResult> CompileDaemonClient::compile(
+    kj::ArrayPtr<const kj::String> argv,
+    kj::StringPtr workingDir,
+    bool overlay) {
+  auto args = kj::heapArrayBuilder<kj::String>(argv.size());
+  for (auto &arg : argv) {
+    args.add(kj::heapString(arg));
+  }
+  return send(args.finish(), kj::heapString(workingDir), overlay, true);
+}
+
+kj::Promise<SubprocessRunner::RunResult> CompileDaemonClient::send(
+    kj::Array<kj::String> argv,
+    kj::String workingDir,
+    bool overlay,
+    bool mayRetry) {
+  using RunResult = SubprocessRunner::RunResult;
+
+  Connection *used = nullptr;
+  kj::Promise<void> ready = kj::READY_NOW;
+  try {
+    used = &connect();
+    ready = used->whenReady();
+  } catch (kj::Exception &e) {
+    KJ_LOG(ERROR, "Failed to start compile daemon", e.getDescription());
+    return RunResult{
+        .status = SubprocessRunner::Status::EXECUTION_ERROR,
+        .exitCode = -1,
+        .errorText = kj::str(e.getDescription())};
+  }
+
+  // Both point into buffers the error handler below keeps alive.
+  kj::ArrayPtr<const kj::String> args = argv;
+  kj::StringPtr dir = workingDir;
+  return ready
+      .then([this, used, args, dir, overlay]()
+                -> kj::Promise<capnp::Response<CompileDaemon::CompileResults>> {
+        // Another request may have dropped the connection meanwhile.
+        KJ_IF_MAYBE (current, connection) {
+          if (current->get() == used) {
+            auto request =
+                KJ_ASSERT_NONNULL(used->rpc)->daemon.compileRequest();
+            auto params = request.initRequest();
+            auto argList = params.initArgv(args.size());
+            for (size_t i = 0; i < args.size(); i++) {
+              argList.set(i, args[i]);
+            }
+            params.setWorkingDir(dir);
+            params.setOverlay(overlay);
+            return request.send();
+          }
+        }
+        return KJ_EXCEPTION(DISCONNECTED, "compile daemon connection dropped");
+      })
+      .then(
+          [](capnp::Response<CompileDaemon::CompileResults> &&response)
+              -> kj::Promise<RunResult> {
+            auto result = response.getResult();
+            RunResult run{
+                .status = SubprocessRunner::Status::SUCCESS,
+                .exitCode = result.getExitCode(),
+                .errorText = kj::heapString(result.getErrorText())};
+            auto output = result.getOutput();
+            if (output.size() > 0) {
+              // Copied into words: Data in an RPC message carries no
+              // alignment guarantee.
+              auto words = kj::heapArray<capnp::word>(
+                  output.size() / sizeof(capnp::word));
+              memcpy(words.begin(), output.begin(), words.asBytes().size());
+              run.maybeReader =
+                  kj::heap<capnp::FlatArrayMessageReader>(
+                      words, readerOptions())
+                      .attach(kj::mv(words));
+            }
+            if (result.getCached()) {
+              KJ_LOG(INFO, "Compile answered from the daemon cache");
+            }
+            return kj::mv(run);
+          },
+          [this,
+           used,
+           argv = kj::mv(argv),
+           workingDir = kj::mv(workingDir),
+           overlay,
+           mayRetry](kj::Exception &&e) mutable -> kj::Promise<RunResult> {
+            bool disconnected =
+                e.getType() == kj::Exception::Type::DISCONNECTED;
+            // A daemon that is gone or never came up is dropped, so that
+            // the next request starts another. Dropped outside of this
+            // callback, which the connection's RPC system may be running.
+            KJ_IF_MAYBE (current, connection) {
+              if (current->get() == used &&
+                  (disconnected || (*current)->rpc == nullptr)) {
+                if (disconnected) {
+                  KJ_LOG(WARNING, "Compile daemon died, restarting it");
+                }
+                tasks.add(kj::evalLater(
+                    [dead = kj::mv(*current)]() mutable { dead = nullptr; }));
+                connection = nullptr;
+              }
+            }
+            if (!disconnected || !mayRetry) {
+              if (!disconnected) {
+                KJ_LOG(
+                    ERROR,
+                    "Compile daemon request failed",
+                    e.getDescription());
+              }
+              return RunResult{
+                  .status = SubprocessRunner::Status::EXECUTION_ERROR,
+                  .exitCode = -1,
+                  .errorText = disconnected
+                      ? kj::str("Compile daemon disconnected")
+                      : kj::str(e.getDescription())};
+            }
+            return kj::evalLater([this,
+                                  argv = kj::mv(argv),
+                                  workingDir = kj::mv(workingDir),
+                                  overlay]() mutable {
+              return send(kj::mv(argv), kj::mv(workingDir), overlay, false);
+            });
+          });
+}
+
+} // namespace capnp_ls
@@ -0,0 +1,85 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include "subprocess_runner.h"
+#include <kj/async-io.h>
+#include <kj/memory.h>
+#include <kj/string.h>
+#include <sys/types.h>
+
+namespace capnp_ls {
+
+// Entry point of `capnp-ls --compile-daemon`: serves CompileDaemon (see
+// compile_daemon.capnp) on CompileDaemonClient::SOCKET_FD until the server
+// hangs up.
+int runCompileDaemon();
+// Entry point of `capnp-ls --compile-daemon --shared`: listens on
+// CompileDaemonClient::sharedSocketPath() and serves every session of the
+// user from one cache and one compile queue, until none has been connected
+// for a while.
+int runSharedCompileDaemon();
+
+// Runs compiles in a long-lived child process instead of the server. The
+// daemon keeps the output of earlier compiles and answers a repeated compile
+// from memory while none of the files it read has changed on disk. A
+// compiler crash or runaway memory use stays in the daemon, which is started
+// again on the next request if it dies.
+class CompileDaemonClient : public kj::TaskSet::ErrorHandler {
+public:
+  static constexpr const char *DAEMON_FLAG = "--compile-daemon";
+  static constexpr const char *SHARED_FLAG = "--shared";
+  // Descriptor the daemon finds its end of the socketpair on.
+  static constexpr int SOCKET_FD = 3;
+
+  enum class Mode {
+    // A child of this server, over a socketpair.
+    PRIVATE,
+    // One daemon per user, shared by every server that asks for it, so
+    // that editor windows on the same workspace compile each file once.
+    // Started by the first server that finds none listening.
+    SHARED
+  };
+
+  explicit CompileDaemonClient(
+      kj::AsyncIoContext &ioContext,
+      Mode mode = Mode::PRIVATE);
+  ~CompileDaemonClient();
+  KJ_DISALLOW_COPY(CompileDaemonClient);
+
+  // Same result as SubprocessRunner::run with Output::CAPNP_MESSAGE. A
+  // request the daemon dropped by dying is sent once more to a new daemon.
+  // `overlay`: see CompileRequest.overlay in compile_daemon.capnp.
+  kj::Promise<SubprocessRunner::RunResult> compile(
+      kj::ArrayPtr<const kj::String> argv,
+      kj::StringPtr workingDir,
+      bool overlay);
+
+  // Socket of the shared daemon, in a directory only the user can enter.
+  static kj::String sharedSocketPath();
+
+private:
+  struct DaemonProcess;
+  struct Connection;
+
+  kj::AsyncIoContext &ioContext;
+  Mode mode;
+  // Reaps the daemons this server started and drops dead connections.
+  kj::TaskSet tasks;
+  kj::Maybe<kj::Own<Connection>> connection;
+
+  void taskFailed(kj::Exception &&exception) override;
+
+  Connection &connect();
+  kj::Promise<SubprocessRunner::RunResult>
+  send(
+      kj::Array<kj::String> argv,
+      kj::String workingDir,
+      bool overlay,
+      bool mayRetry);
+};
+
+} // namespace capnp_ls
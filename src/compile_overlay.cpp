@@ -0,0 +1,111 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#include "compile_overlay.h"
+#include <algorithm>
+#include <errno.h>
+#include <kj/debug.h>
+#include <stdlib.h>
+
+namespace capnp_ls {
+namespace {
+
+kj::Path parseAbsolute(kj::StringPtr path) {
+  KJ_REQUIRE(path.startsWith("/"), "expected an absolute path", path);
+  return kj::Path::parse(path.slice(1));
+}
+
+kj::Path makeTempDirectory() {
+  char pattern[] = "/tmp/capnp-ls-overlay-XXXXXX";
+  if (mkdtemp(pattern) == nullptr) {
+    KJ_FAIL_SYSCALL("mkdtemp", errno, pattern);
+  }
+  return parseAbsolute(pattern);
+}
+
+} // namespace
+
+CompileOverlay::CompileOverlay(kj::ArrayPtr<const kj::String> rootPaths)
+    : filesystem(kj::newDiskFilesystem()), basePath(makeTempDirectory()),
+      base(filesystem->getRoot().openSubdir(basePath, kj::WriteMode::MODIFY)) {
+  // Parents first, so that a root nested in another one is mirrored as part
+  // of it rather than twice.
+  kj::Vector<kj::Path> candidates;
+  for (auto &rootPath : rootPaths) {
+    candidates.add(parseAbsolute(rootPath));
+  }
+  std::sort(
+      candidates.begin(),
+      candidates.end(),
+      [](const kj::Path &a, const kj::Path &b) { return a.size() < b.size(); });
+
+  for (auto &root : candidates) {
+    if (findRoot(root) != nullptr || !filesystem->getRoot().exists(root)) {
+      continue;
+    }
+    mirrorDirectory(root);
+    roots.add(kj::mv(root));
+  }
+}
+
+CompileOverlay::~CompileOverlay() {
+  KJ_IF_MAYBE (exception, kj::runCatchingExceptions([&]() {
+                 filesystem->getRoot().remove(basePath);
+               })) {
+    KJ_LOG(
+        WARNING,
+        "Failed to remove compile overlay",
+        basePath.toString(true),
+        exception->getDescription());
+  }
+}
+
+void CompileOverlay::addFile(kj::StringPtr filePath, kj::StringPtr contents) {
+  auto path = parseAbsolute(filePath);
+  KJ_IF_MAYBE (root, findRoot(path)) {
+    // Turn every symlinked directory between the root and the file into a
+    // real directory so that the file itself can be replaced.
+    for (size_t depth = root->size() + 1; depth < path.size(); depth++) {
+      auto dir = path.slice(0, depth);
+      auto metadata = base->lstat(dir);
+      if (metadata.type == kj::FsNode::Type::SYMLINK) {
+        base->remove(dir);
+        mirrorDirectory(dir);
+      }
+    }
+    base->tryRemove(path);
+    base->openFile(path, kj::WriteMode::CREATE)->writeAll(contents);
+  } else {
+    KJ_FAIL_REQUIRE("file is outside of the overlay roots", filePath);
+  }
+}
+
+kj::String CompileOverlay::overlayPathOf(kj::StringPtr realPath) const {
+  return basePath.append(parseAbsolute(realPath)).toString(true);
+}
+
+void CompileOverlay::mirrorDirectory(kj::PathPtr realDir) {
+  auto &rootDir = filesystem->getRoot();
+  auto source = rootDir.openSubdir(realDir);
+  auto mirror = base->openSubdir(
+      realDir, kj::WriteMode::CREATE | kj::WriteMode::CREATE_PARENT);
+  for (auto &name : source->listNames()) {
+    mirror->symlink(
+        kj::Path(name),
+        realDir.append(kj::Path(name)).toString(true),
+        kj::WriteMode::CREATE);
+  }
+}
+
+kj::Maybe<kj::PathPtr> CompileOverlay::findRoot(kj::PathPtr path) const {
+  for (auto &root : roots) {
+    if (path.startsWith(root)) {
+      return root;
+    }
+  }
+  return nullptr;
+}
+
+} // namespace capnp_ls
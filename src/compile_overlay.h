@@ -0,0 +1,43 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <kj/filesystem.h>
+#include <kj/map.h>
+#include <kj/string.h>
+#include <kj/vector.h>
+
+namespace capnp_ls {
+
+// A temporary directory tree that mirrors the source roots (workspace and
+// import paths) through symlinks, with selected files replaced by in-memory
+// contents. Compiling the overlay paths of those files sees the replacements
+// for both relative and import-path lookups, without touching the real tree.
+// The directory is deleted when the overlay is destroyed.
+class CompileOverlay {
+public:
+  // `roots` are absolute directory paths.
+  explicit CompileOverlay(kj::ArrayPtr<const kj::String> roots);
+  ~CompileOverlay();
+  KJ_DISALLOW_COPY(CompileOverlay);
+
+  // `filePath` is absolute and must lie under one of the roots.
+  void addFile(kj::StringPtr filePath, kj::StringPtr contents);
+
+  // Where `realPath` appears inside the overlay.
+  kj::String overlayPathOf(kj::StringPtr realPath) const;
+
+private:
+  void mirrorDirectory(kj::PathPtr realDir);
+  kj::Maybe<kj::PathPtr> findRoot(kj::PathPtr path) const;
+
+  kj::Own<kj::Filesystem> filesystem;
+  kj::Path basePath;
+  kj::Own<const kj::Directory> base;
+  kj::Vector<kj::Path> roots;
+};
+
+} // namespace capnp_ls
@@ -0,0 +1,545 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#include "completion_provider.h"
+#include <algorithm>
+#include <kj/debug.h>
+#include <kj/map.h>
+
+namespace capnp_ls {
+namespace {
+
+enum class CompletionContext { ANY, TYPE, ANNOTATION, VALUE };
+
+struct UsingAlias {
+  kj::String name;
+  kj::Maybe<kj::String> importPath;
+  kj::Vector<kj::String> target; // dotted path when not an import
+};
+
+struct Candidate {
+  kj::String label;
+  CompletionItemKind kind;
+  kj::String detail;
+  uint32_t rank;
+};
+
+constexpr uint32_t ALIAS_RANK = 8;
+constexpr uint32_t WORKSPACE_RANK = 9;
+constexpr int MAX_ALIAS_DEPTH = 4;
+
+const char *const BUILTIN_TYPES[] = {
+    "Void",       "Bool",      "Int8",       "Int16",   "Int32",
+    "Int64",      "UInt8",     "UInt16",     "UInt32",  "UInt64",
+    "Float32",    "Float64",   "Text",       "Data",    "List",
+    "AnyPointer", "AnyStruct", "AnyList",    "Capability"};
+
+bool isIdentifierChar(char c) {
+  return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') ||
+         ('0' <= c && c <= '9') || c == '_';
+}
+
+bool startsWithIgnoreCase(kj::StringPtr text, kj::StringPtr prefix) {
+  if (text.size() < prefix.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < prefix.size(); i++) {
+    char a = text[i];
+    char b = prefix[i];
+    if ('A' <= a && a <= 'Z') {
+      a = a - 'A' + 'a';
+    }
+    if ('A' <= b && b <= 'Z') {
+      b = b - 'A' + 'a';
+    }
+    if (a != b) {
+      return false;
+    }
+  }
+  return true;
+}
+
+kj::Vector<kj::String> splitPath(kj::ArrayPtr<const char> path) {
+  kj::Vector<kj::String> parts;
+  size_t start = 0;
+  for (size_t i = 0; i <= path.size(); i++) {
+    if (i == path.size() || path[i] == '.') {
+      parts.add(kj::heapString(path.slice(start, i)));
+      start = i + 1;
+    }
+  }
+  return parts;
+}
+
+// Finds `using Name = import "path";` and `using Name = Some.Type;` without
+// running a full parse, so it is cheap enough to repeat on every keystroke.
+kj::Vector<UsingAlias> findUsingAliases(kj::StringPtr text) {
+  kj::Vector<UsingAlias> aliases;
+  size_t n = text.size();
+  size_t i = 0;
+  auto skipSpaces = [&]() {
+    while (i < n && (text[i] == ' ' || text[i] == '\t' || text[i] == '\n' ||
+                     text[i] == '\r')) {
+      i++;
+    }
+  };
+  auto readWord = [&]() {
+    size_t start = i;
+    while (i < n && isIdentifierChar(text[i])) {
+      i++;
+    }
+    return text.slice(start, i);
+  };
+
+  while (i < n) {
+    char c = text[i];
+    if (c == '#') {
+      while (i < n && text[i] != '\n') {
+        i++;
+      }
+      continue;
+    }
+    if (c == '"') {
+      i++;
+      while (i < n && text[i] != '"' && text[i] != '\n') {
+        i++;
+      }
+      i++;
+      continue;
+    }
+    if (!isIdentifierChar(c)) {
+      i++;
+      continue;
+    }
+
+    auto word = readWord();
+    if (word != kj::StringPtr("using").asArray()) {
+      continue;
+    }
+    skipSpaces();
+    auto name = readWord();
+    skipSpaces();
+    if (name.size() == 0 || i >= n || text[i] != '=' ||
+        name == kj::StringPtr("import").asArray()) {
+      continue;
+    }
+    i++;
+    skipSpaces();
+
+    UsingAlias alias{kj::heapString(name), nullptr, {}};
+    size_t targetStart = i;
+    auto first = readWord();
+    if (first == kj::StringPtr("import").asArray()) {
+      skipSpaces();
+      if (i < n && text[i] == '"') {
+        size_t pathStart = ++i;
+        while (i < n && text[i] != '"' && text[i] != '\n') {
+          i++;
+        }
+        alias.importPath = kj::heapString(text.slice(pathStart, i));
+        aliases.add(kj::mv(alias));
+      }
+      continue;
+    }
+    i = targetStart;
+    while (i < n && (isIdentifierChar(text[i]) || text[i] == '.')) {
+      i++;
+    }
+    if (i > targetStart) {
+      alias.target = splitPath(text.slice(targetStart, i));
+      aliases.add(kj::mv(alias));
+    }
+  }
+  return aliases;
+}
+
+class ScopeResolver {
+public:
+  ScopeResolver(
+      const SymbolTable &table,
+      kj::StringPtr filePath,
+      const kj::Vector<UsingAlias> &aliases,
+      const kj::Vector<const SymbolTable::Symbol *> &scopeChain)
+      : table(table), filePath(filePath), aliases(aliases),
+        scopeChain(scopeChain) {}
+
+  kj::Maybe<const SymbolTable::Symbol &>
+  resolvePath(kj::ArrayPtr<const kj::String> path, int depth = 0) const {
+    if (path.size() == 0) {
+      return nullptr;
+    }
+    kj::Maybe<const SymbolTable::Symbol &> current =
+        resolveName(path[0], depth);
+    for (auto &component : path.slice(1, path.size())) {
+      KJ_IF_MAYBE (symbol, current) {
+        current = table.findChild(symbol->id, component);
+      } else {
+        return nullptr;
+      }
+    }
+    return current;
+  }
+
+private:
+  kj::Maybe<const SymbolTable::Symbol &>
+  resolveName(kj::StringPtr name, int depth) const {
+    for (auto scope : scopeChain) {
+      KJ_IF_MAYBE (child, table.findChild(scope->id, name)) {
+        return *child;
+      }
+    }
+    for (auto &alias : aliases) {
+      if (alias.name != name) {
+        continue;
+      }
+      KJ_IF_MAYBE (importPath, alias.importPath) {
+        return table.findImport(*importPath, filePath);
+      }
+      if (depth < MAX_ALIAS_DEPTH) {
+        return resolvePath(alias.target.asPtr(), depth + 1);
+      }
+    }
+    return nullptr;
+  }
+
+  const SymbolTable &table;
+  kj::StringPtr filePath;
+  const kj::Vector<UsingAlias> &aliases;
+  const kj::Vector<const SymbolTable::Symbol *> &scopeChain;
+};
+
+CompletionItemKind toCompletionItemKind(SymbolKind kind) {
+  switch (kind) {
+  case SymbolKind::FILE:
+    return CompletionItemKind::Module;
+  case SymbolKind::STRUCT:
+    return CompletionItemKind::Struct;
+  case SymbolKind::ENUM:
+    return CompletionItemKind::Enum;
+  case SymbolKind::INTERFACE:
+    return CompletionItemKind::Interface;
+  case SymbolKind::CONST:
+    return CompletionItemKind::Constant;
+  case SymbolKind::ANNOTATION:
+    return CompletionItemKind::Property;
+  case SymbolKind::FIELD:
+    return CompletionItemKind::Field;
+  case SymbolKind::ENUMERANT:
+    return CompletionItemKind::EnumMember;
+  case SymbolKind::METHOD:
+    return CompletionItemKind::Method;
+  }
+  KJ_UNREACHABLE;
+}
+
+bool acceptsSymbol(CompletionContext context, const SymbolTable::Symbol &s) {
+  if (s.isGroup || s.kind == SymbolKind::FILE) {
+    return false;
+  }
+  switch (context) {
+  case CompletionContext::ANY:
+    return true;
+  case CompletionContext::TYPE:
+    return s.kind == SymbolKind::STRUCT || s.kind == SymbolKind::ENUM ||
+           s.kind == SymbolKind::INTERFACE;
+  case CompletionContext::ANNOTATION:
+    // Structs and interfaces can scope annotations, e.g. `$Foo.bar`.
+    return s.kind == SymbolKind::ANNOTATION || s.kind == SymbolKind::STRUCT ||
+           s.kind == SymbolKind::INTERFACE;
+  case CompletionContext::VALUE:
+    return s.kind != SymbolKind::ANNOTATION;
+  }
+  KJ_UNREACHABLE;
+}
+
+bool acceptsMember(
+    CompletionContext context,
+    const SymbolTable::Member &member) {
+  return member.kind == SymbolKind::ENUMERANT &&
+         (context == CompletionContext::ANY ||
+          context == CompletionContext::VALUE);
+}
+
+} // namespace
+
+CompletionList CompletionProvider::complete(
+    const SymbolTable &symbolTable,
+    kj::StringPtr filePath,
+    kj::StringPtr text,
+    Position position) {
+  // Locate the cursor and the dotted word being typed in front of it.
+  size_t lineStart = 0;
+  for (uint32_t line = 1; line < position.line && lineStart < text.size();
+       lineStart++) {
+    if (text[lineStart] == '\n') {
+      line++;
+    }
+  }
+  size_t lineEnd = lineStart;
+  while (lineEnd < text.size() && text[lineEnd] != '\n') {
+    lineEnd++;
+  }
+  size_t cursor = kj::min(lineStart + position.character - 1, lineEnd);
+  size_t wordStart = cursor;
+  while (wordStart > lineStart && (isIdentifierChar(text[wordStart - 1]) ||
+                                   text[wordStart - 1] == '.')) {
+    wordStart--;
+  }
+  size_t contextPos = wordStart;
+  while (contextPos > lineStart &&
+         (text[contextPos - 1] == ' ' || text[contextPos - 1] == '\t')) {
+    contextPos--;
+  }
+
+  CompletionContext context = CompletionContext::ANY;
+  if (contextPos > lineStart) {
+    switch (text[contextPos - 1]) {
+    case '$':
+      context = CompletionContext::ANNOTATION;
+      break;
+    case ':':
+      context = CompletionContext::TYPE;
+      break;
+    case '=':
+      context = CompletionContext::VALUE;
+      break;
+    default:
+      break;
+    }
+  }
+
+  auto path = splitPath(text.slice(wordStart, cursor));
+  kj::StringPtr prefix = path[path.size() - 1];
+  auto qualifier = path.asPtr().slice(0, path.size() - 1);
+
+  kj::Vector<const SymbolTable::Symbol *> scopeChain;
+  KJ_IF_MAYBE (scope, symbolTable.findEnclosingScope(filePath, position)) {
+    const SymbolTable::Symbol *current = scope;
+    while (current != nullptr) {
+      scopeChain.add(current);
+      if (current->kind == SymbolKind::FILE) {
+        break;
+      }
+      KJ_IF_MAYBE (parent, symbolTable.find(current->scopeId)) {
+        current = parent;
+      } else {
+        current = nullptr;
+      }
+    }
+  }
+  auto aliases = findUsingAliases(text);
+  ScopeResolver resolver(symbolTable, filePath, aliases, scopeChain);
+
+  kj::Vector<Candidate> candidates;
+  kj::HashSet<uint64_t> seen;
+  bool isIncomplete = false;
+
+  auto addSymbol = [&](const SymbolTable::Symbol &symbol, uint32_t rank) {
+    if (seen.contains(symbol.id) || !acceptsSymbol(context, symbol) ||
+        !startsWithIgnoreCase(symbol.name, prefix)) {
+      return;
+    }
+    seen.insert(symbol.id);
+    candidates.add(Candidate{
+        kj::heapString(symbol.name),
+        toCompletionItemKind(symbol.kind),
+        kj::heapString(symbol.qualifiedName),
+        rank});
+  };
+  auto addMember = [&](const SymbolTable::Symbol &parent,
+                       const SymbolTable::Member &member,
+                       uint32_t rank) {
+    if (!acceptsMember(context, member) ||
+        !startsWithIgnoreCase(member.name, prefix)) {
+      return;
+    }
+    candidates.add(Candidate{
+        kj::heapString(member.name),
+        toCompletionItemKind(member.kind),
+        kj::str(parent.qualifiedName, ".", member.name),
+        rank});
+  };
+
+  if (qualifier.size() > 0) {
+    // `Outer.Inner.pre`: list what is declared inside the resolved scope.
+    KJ_IF_MAYBE (target, resolver.resolvePath(qualifier)) {
+      for (auto id : target->nestedIds) {
+        KJ_IF_MAYBE (child, symbolTable.find(id)) {
+          addSymbol(*child, 0);
+        }
+      }
+      for (auto &member : target->members) {
+        addMember(*target, member, 0);
+      }
+    }
+  } else {
+    // Lexically visible declarations first, innermost scope first.
+    for (uint32_t depth = 0; depth < scopeChain.size(); depth++) {
+      for (auto id : scopeChain[depth]->nestedIds) {
+        KJ_IF_MAYBE (child, symbolTable.find(id)) {
+          addSymbol(*child, kj::min(depth, ALIAS_RANK - 1));
+        }
+      }
+    }
+    if (context != CompletionContext::VALUE) {
+      for (auto &alias : aliases) {
+        if (startsWithIgnoreCase(alias.name, prefix)) {
+          candidates.add(Candidate{
+              kj::heapString(alias.name),
+              CompletionItemKind::Reference,
+              kj::str("using ", alias.name),
+              ALIAS_RANK});
+        }
+      }
+    }
+    if (context == CompletionContext::ANY ||
+        context == CompletionContext::TYPE) {
+      for (auto builtin : BUILTIN_TYPES) {
+        if (startsWithIgnoreCase(builtin, prefix)) {
+          candidates.add(Candidate{
+              kj::heapString(builtin),
+              CompletionItemKind::Keyword,
+              kj::heapString("builtin type"),
+              ALIAS_RANK});
+        }
+      }
+    }
+    // Everything else in the workspace, from the sorted name index. An empty
+    // prefix would just enumerate the index alphabetically, so skip it.
+    if (prefix.size() > 0) {
+      auto matches = symbolTable.findByPrefix(prefix, MAX_INDEX_SCAN);
+      isIncomplete = matches.size() == MAX_INDEX_SCAN;
+      for (auto &match : matches) {
+        if (match.member == nullptr) {
+          addSymbol(*match.symbol, WORKSPACE_RANK);
+        } else {
+          addMember(*match.symbol, *match.member, WORKSPACE_RANK);
+        }
+      }
+    }
+  }
+
+  std::sort(
+      candidates.begin(),
+      candidates.end(),
+      [&](const Candidate &a, const Candidate &b) {
+        if (a.rank != b.rank) {
+          return a.rank < b.rank;
+        }
+        bool aExact = a.label.startsWith(prefix);
+        bool bExact = b.label.startsWith(prefix);
+        if (aExact != bExact) {
+          return aExact;
+        }
+        if (a.label.size() != b.label.size()) {
+          return a.label.size() < b.label.size();
+        }
+        return kj::StringPtr(a.label) < kj::StringPtr(b.label);
+      });
+
+  CompletionList result;
+  result.isIncomplete = isIncomplete || candidates.size() > MAX_RESULTS;
+  size_t count = kj::min(candidates.size(), MAX_RESULTS);
+  for (size_t i = 0; i < count; i++) {
+    auto &candidate = candidates[i];
+    result.items.add(CompletionItem{
+        kj::mv(candidate.label),
+        candidate.kind,
+        kj::mv(candidate.detail),
+        // Fixed-width so the client keeps our ranking.
+        kj::str(10000 + i)});
+  }
+  return result;
+}
+
+kj::Maybe<CompletionList> CompletionProvider::completeOrdinal(
+    const Document &document,
+    Position position) {
+  auto text = document.getText();
+  auto tokens = document.getTokens();
+  auto isCode = [](const Token &token) {
+    return token.kind != TokenKind::COMMENT;
+  };
+
+  // The `@` or `@N` token the cursor is in or right after.
+  auto it = std::lower_bound(
+      tokens.begin(),
+      tokens.end(),
+      position.line,
+      [](const Token &token, uint32_t line) { return token.line + 1 < line; });
+  uint32_t index = tokens.size();
+  for (; it != tokens.end() && it->line + 1 == position.line; ++it) {
+    uint32_t length = it->endByte - it->startByte;
+    if (it->column + 1 < position.character &&
+        position.character <= it->column + 1 + length) {
+      index = it - tokens.begin();
+      break;
+    }
+  }
+  if (index == tokens.size()) {
+    return nullptr;
+  }
+  auto &ordinal = tokens[index];
+  auto ordinalText = Lexer::textOf(text, ordinal);
+  if (ordinalText.size() == 0 || ordinalText[0] != '@' ||
+      (ordinal.kind != TokenKind::ORDINAL &&
+       ordinal.kind != TokenKind::PUNCTUATION)) {
+    return nullptr;
+  }
+  for (size_t i = 1; i < ordinalText.size(); i++) {
+    if (ordinalText[i] < '0' || ordinalText[i] > '9') {
+      return nullptr; // an id, "@0x..."
+    }
+  }
+
+  // Only a member name may precede it; `struct Foo @` is an id.
+  kj::Vector<const Token *> previous;
+  for (uint32_t i = index; i > 0 && previous.size() < 2; i--) {
+    if (isCode(tokens[i - 1])) {
+      previous.add(&tokens[i - 1]);
+    }
+  }
+  if (previous.size() == 0 || previous[0]->kind != TokenKind::IDENTIFIER ||
+      (previous.size() > 1 && previous[1]->kind == TokenKind::KEYWORD)) {
+    return nullptr;
+  }
+
+  auto &ordinals = document.getOrdinalIndex();
+  KJ_IF_MAYBE (
+      at,
+      ordinals.findScope(tokens, document.getSyntaxTree(), position)) {
+    auto &scope = at->scope;
+    uint32_t next = OrdinalIndex::nextOrdinal(
+        scope,
+        at->baseToken,
+        ordinal.kind == TokenKind::ORDINAL ? kj::Maybe<uint32_t>(index)
+                                           : nullptr);
+    kj::String scopeName = kj::heapString("scope");
+    KJ_IF_MAYBE (nameToken, scope.nameToken) {
+      auto &name = tokens[at->baseToken + *nameToken];
+      scopeName = kj::heapString(Lexer::textOf(text, name));
+    }
+    kj::String detail;
+    KJ_IF_MAYBE (max, scope.maxOrdinal) {
+      detail = kj::str("next ordinal of ", scopeName, " (highest @", *max, ")");
+    } else {
+      detail = kj::str("first ordinal of ", scopeName);
+    }
+
+    auto label = kj::str("@", next);
+    Range replaced{{ordinal.line + 1, ordinal.column + 1}, position};
+    CompletionList result;
+    result.items.add(CompletionItem{
+        kj::heapString(label),
+        CompletionItemKind::Value,
+        kj::mv(detail),
+        kj::heapString("0"),
+        TextEdit{replaced, kj::mv(label)}});
+    return kj::mv(result);
+  }
+  return nullptr;
+}
+
+} // namespace capnp_ls
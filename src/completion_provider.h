@@ -0,0 +1,41 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include "document.h"
+#include "lsp_types.h"
+#include "symbol_table.h"
+#include <kj/string.h>
+#include <kj/vector.h>
+
+namespace capnp_ls {
+
+struct CompletionList {
+  bool isIncomplete = false;
+  kj::Vector<CompletionItem> items;
+};
+
+class CompletionProvider {
+public:
+  static constexpr size_t MAX_RESULTS = 100;
+  // Upper bound on sorted-index entries visited for an unqualified prefix.
+  static constexpr size_t MAX_INDEX_SCAN = 1000;
+
+  // `position` is 1-based, like the positions stored by SymbolResolver.
+  static CompletionList complete(
+      const SymbolTable &symbolTable,
+      kj::StringPtr filePath,
+      kj::StringPtr documentText,
+      Position position);
+
+  // After `name @` (or inside `@N`): the lowest free ordinal of the
+  // enclosing struct, interface or enum, from the buffer's ordinal index.
+  // Null when the cursor is not on a member's ordinal.
+  static kj::Maybe<CompletionList>
+  completeOrdinal(const Document &document, Position position);
+};
+
+} // namespace capnp_ls
@@ -0,0 +1,148 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#include "document.h"
+#include <algorithm>
+
+namespace capnp_ls {
+namespace {
+
+int64_t countLines(kj::ArrayPtr<const char> text) {
+  return std::count(text.begin(), text.end(), '\n');
+}
+
+// Bytes of the UTF-8 sequence starting with `lead`.
+size_t sequenceLength(char lead) {
+  auto byte = static_cast<unsigned char>(lead);
+  return byte < 0x80 ? 1 : byte < 0xE0 ? 2 : byte < 0xF0 ? 3 : 4;
+}
+
+} // namespace
+
+Document::Document(kj::String text) : text(kj::mv(text)) {
+  indexLines();
+  tokens = Lexer::tokenize(this->text);
+  syntaxTree.parse(this->text, tokens);
+  ordinalIndex.rebuild(this->text, tokens, syntaxTree);
+}
+
+void Document::applyChange(kj::Maybe<Range> range, kj::StringPtr newText) {
+  version++;
+  modified = true;
+
+  KJ_IF_MAYBE (changed, range) {
+    size_t start = offsetOf(changed->start);
+    size_t end = kj::max(start, offsetOf(changed->end));
+
+    // No token spans a line break, so the lines the edit touches are all
+    // that has to be lexed again.
+    uint32_t firstLine =
+        std::upper_bound(lineStarts.begin(), lineStarts.end(), start) -
+        lineStarts.begin() - 1;
+    size_t relexStart = lineStarts[firstLine];
+    size_t oldRelexEnd = end;
+    while (oldRelexEnd < text.size() && text[oldRelexEnd] != '\n') {
+      oldRelexEnd++;
+    }
+    int64_t byteDelta = static_cast<int64_t>(newText.size()) -
+                        static_cast<int64_t>(end - start);
+    int64_t lineDelta =
+        countLines(newText) - countLines(text.slice(start, end));
+
+    auto startsBefore = [](const Token &token, size_t offset) {
+      return token.startByte < offset;
+    };
+    size_t changeStart =
+        std::lower_bound(
+            tokens.begin(), tokens.end(), relexStart, startsBefore) -
+        tokens.begin();
+    size_t changeEnd =
+        std::lower_bound(
+            tokens.begin(), tokens.end(), oldRelexEnd, startsBefore) -
+        tokens.begin();
+
+    text = kj::str(text.slice(0, start), newText, text.slice(end));
+    auto relexed = Lexer::tokenize(
+        text, relexStart, oldRelexEnd + byteDelta, firstLine);
+
+    kj::Vector<Token> updated(
+        tokens.size() - (changeEnd - changeStart) + relexed.size());
+    updated.addAll(tokens.begin(), tokens.begin() + changeStart);
+    updated.addAll(relexed);
+    for (size_t i = changeEnd; i < tokens.size(); i++) {
+      Token token = tokens[i];
+      token.startByte = static_cast<uint32_t>(token.startByte + byteDelta);
+      token.endByte = static_cast<uint32_t>(token.endByte + byteDelta);
+      token.line = static_cast<uint32_t>(token.line + lineDelta);
+      updated.add(token);
+    }
+    tokens = kj::mv(updated);
+    indexLines();
+    auto change = syntaxTree.reparse(
+        text,
+        tokens,
+        changeStart,
+        changeEnd - changeStart,
+        relexed.size());
+    ordinalIndex.update(text, tokens, syntaxTree, change);
+  } else {
+    text = kj::heapString(newText);
+    indexLines();
+    tokens = Lexer::tokenize(text);
+    syntaxTree.parse(text, tokens);
+    ordinalIndex.rebuild(text, tokens, syntaxTree);
+  }
+}
+
+void Document::indexLines() {
+  lineStarts.clear();
+  lineStarts.add(0);
+  for (size_t i = 0; i < text.size(); i++) {
+    if (text[i] == '\n') {
+      lineStarts.add(i + 1);
+    }
+  }
+}
+
+size_t Document::offsetOf(Position position) const {
+  if (position.line == 0) {
+    return 0;
+  }
+  if (position.line > lineStarts.size()) {
+    return text.size();
+  }
+  size_t offset = lineStarts[position.line - 1];
+  uint32_t units = 0;
+  while (units + 1 < position.character && offset < text.size() &&
+         text[offset] != '\n') {
+    size_t length = sequenceLength(text[offset]);
+    // Characters outside the BMP are a surrogate pair in UTF-16.
+    units += length == 4 ? 2 : 1;
+    offset = kj::min(offset + length, text.size());
+  }
+  return offset;
+}
+
+uint32_t utf16Length(kj::ArrayPtr<const char> text) {
+  uint32_t units = 0;
+  for (size_t i = 0; i < text.size(); i += sequenceLength(text[i])) {
+    units += sequenceLength(text[i]) == 4 ? 2 : 1;
+  }
+  return units;
+}
+
+uint32_t Utf16Columns::columnOf(size_t byteOffset, uint32_t byteColumn) {
+  size_t start = byteOffset - byteColumn;
+  if (start != lineStart || byteOffset < offset) {
+    lineStart = start;
+    offset = start;
+    units = 0;
+  }
+  units += utf16Length(text.slice(offset, byteOffset));
+  offset = byteOffset;
+  return units;
+}
+
+} // namespace capnp_ls
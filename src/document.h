@@ -0,0 +1,94 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include "lexer.h"
+#include "lsp_types.h"
+#include "ordinal_index.h"
+#include "syntax_tree.h"
+#include <kj/map.h>
+#include <kj/memory.h>
+#include <kj/string.h>
+#include <kj/vector.h>
+
+namespace capnp_ls {
+
+// Buffer of an open document with its tokens and syntax tree, kept current
+// on every edit without the compiler. An edit re-lexes only the lines it
+// touches and re-parses only the top-level declarations around them, and
+// only those declarations are re-indexed for ordinals.
+class Document {
+public:
+  explicit Document(kj::String text);
+
+  kj::StringPtr getText() const {
+    return text;
+  }
+  kj::ArrayPtr<const Token> getTokens() const {
+    return tokens;
+  }
+  const SyntaxTree &getSyntaxTree() const {
+    return syntaxTree;
+  }
+  const OrdinalIndex &getOrdinalIndex() const {
+    return ordinalIndex;
+  }
+  // Bumped by every change.
+  uint64_t getVersion() const {
+    return version;
+  }
+  // Whether the buffer was edited since it was opened or last saved, i.e.
+  // whether compile results (which come from the file on disk) may be stale.
+  bool isModified() const {
+    return modified;
+  }
+  void markSaved() {
+    modified = false;
+  }
+
+  // Applies one `contentChanges` entry of textDocument/didChange. `range` is
+  // 1-based with characters counted in UTF-16 code units, as sent by the
+  // client; a null range replaces the whole buffer.
+  void applyChange(kj::Maybe<Range> range, kj::StringPtr newText);
+
+private:
+  kj::String text;
+  kj::Vector<uint32_t> lineStarts; // byte offset of each line
+  kj::Vector<Token> tokens;
+  SyntaxTree syntaxTree;
+  OrdinalIndex ordinalIndex;
+  uint64_t version = 1;
+  bool modified = false;
+
+  void indexLines();
+  size_t offsetOf(Position position) const;
+};
+
+using DocumentMap = kj::HashMap<kj::String, kj::Own<Document>>;
+
+// Length of UTF-8 `text` in UTF-16 code units, the unit LSP counts
+// characters in.
+uint32_t utf16Length(kj::ArrayPtr<const char> text);
+
+// LSP columns of byte offsets in `text`, for Token::column, which counts
+// bytes. Offsets visited in increasing order on a line cost one pass over
+// it.
+class Utf16Columns {
+public:
+  explicit Utf16Columns(kj::StringPtr text) : text(text) {}
+
+  // 0-based column of `byteOffset`, which is `byteColumn` bytes into its
+  // line.
+  uint32_t columnOf(size_t byteOffset, uint32_t byteColumn);
+
+private:
+  kj::StringPtr text;
+  size_t lineStart = 0;
+  size_t offset = 0;
+  uint32_t units = 0;
+};
+
+} // namespace capnp_ls
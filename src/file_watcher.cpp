@@ -0,0 +1,229 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#include "file_watcher.h"
+#include <cerrno>
+#include <cstring>
+#include <kj/debug.h>
+#include <kj/filesystem.h>
+#include <kj/vector.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+namespace capnp_ls {
+
+namespace {
+
+bool isSkippedDirectory(kj::StringPtr name) {
+  return name.startsWith(".") || name == "node_modules";
+}
+
+} // namespace
+
+FileWatcher::FileWatcher(
+    kj::AsyncIoContext &ioContext,
+    Callback onChange,
+    size_t maxWatches)
+    : ioContext(ioContext), onChange(kj::mv(onChange)),
+      maxWatches(maxWatches), tasks(*this) {}
+
+bool FileWatcher::watch(kj::StringPtr root) {
+#ifdef __linux__
+  if (observer == nullptr) {
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+      KJ_LOG(ERROR, "Failed to start watching files", strerror(errno));
+      return false;
+    }
+    inotifyFd = kj::AutoCloseFd(fd);
+    observer = kj::heap<kj::UnixEventPort::FdObserver>(
+        ioContext.unixEventPort,
+        fd,
+        kj::UnixEventPort::FdObserver::OBSERVE_READ);
+    tasks.add(readEvents());
+  }
+  size_t before = directories.size();
+  addTree(root);
+  KJ_LOG(INFO, "Watching directories", root, directories.size() - before);
+  return directories.size() > before;
+#else
+  KJ_LOG(WARNING, "Watching files is only supported on Linux", root);
+  return false;
+#endif
+}
+
+#ifdef __linux__
+
+void FileWatcher::addTree(kj::StringPtr root) {
+  // Breadth first, so that the cap leaves out the deepest directories.
+  auto fs = kj::newDiskFilesystem();
+  kj::Vector<kj::String> queue;
+  queue.add(kj::heapString(root));
+  for (size_t i = 0; i < queue.size(); i++) {
+    if (!addWatch(queue[i])) {
+      continue;
+    }
+    try {
+      auto dir =
+          fs->getRoot().openSubdir(kj::Path::parse(queue[i].slice(1)));
+      for (auto &entry : dir->listEntries()) {
+        if (entry.type == kj::FsNode::Type::DIRECTORY &&
+            !isSkippedDirectory(entry.name) &&
+            directories.size() + queue.size() - i < maxWatches) {
+          queue.add(kj::str(queue[i], "/", entry.name));
+        }
+      }
+    } catch (kj::Exception &e) {
+      KJ_LOG(
+          WARNING,
+          "Skipping unreadable directory",
+          queue[i],
+          e.getDescription());
+    }
+  }
+}
+
+bool FileWatcher::addWatch(kj::StringPtr directory) {
+  if (isFull) {
+    return false;
+  }
+  if (directories.size() >= maxWatches) {
+    KJ_LOG(
+        WARNING,
+        "File watch limit reached, deeper directories are not watched",
+        maxWatches);
+    isFull = true;
+    return false;
+  }
+  int wd = inotify_add_watch(
+      inotifyFd.get(),
+      directory.cStr(),
+      IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+          IN_ONLYDIR | IN_EXCL_UNLINK);
+  if (wd < 0) {
+    if (errno == ENOSPC) {
+      KJ_LOG(WARNING, "Out of inotify watches", directory);
+      isFull = true;
+    } else {
+      KJ_LOG(WARNING, "Failed to watch", directory, strerror(errno));
+    }
+    return false;
+  }
+  // Already watched, e.g. reached again through a symlink.
+  if (directories.find(wd) != nullptr) {
+    return false;
+  }
+  directories.insert(wd, kj::heapString(directory));
+  return true;
+}
+
+kj::Promise<void> FileWatcher::readEvents() {
+  KJ_IF_MAYBE (fdObserver, observer) {
+    return (*fdObserver)->whenBecomesReadable().then([this]() {
+      alignas(struct inotify_event) char buffer[16 * 1024];
+      for (;;) {
+        ssize_t n;
+        KJ_NONBLOCKING_SYSCALL(
+            n = read(inotifyFd.get(), buffer, sizeof(buffer)));
+        if (n <= 0) {
+          break;
+        }
+        for (char *p = buffer; p < buffer + n;) {
+          auto *event = reinterpret_cast<struct inotify_event *>(p);
+          handleEvent(
+              event->wd,
+              event->mask,
+              event->len > 0 ? kj::StringPtr(event->name) : kj::StringPtr());
+          p += sizeof(struct inotify_event) + event->len;
+        }
+      }
+      return readEvents();
+    });
+  }
+  return kj::READY_NOW;
+}
+
+void FileWatcher::handleEvent(int wd, uint32_t mask, kj::StringPtr name) {
+  if (mask & IN_Q_OVERFLOW) {
+    KJ_LOG(WARNING, "Too many file changes at once, some were missed");
+    changesUnknown = true;
+    scheduleFlush();
+    return;
+  }
+  if (mask & IN_IGNORED) {
+    // The directory was deleted or moved out of reach.
+    directories.erase(wd);
+    return;
+  }
+  kj::String path;
+  KJ_IF_MAYBE (directory, directories.find(wd)) {
+    path = kj::str(*directory, "/", name);
+  } else {
+    return;
+  }
+  if (mask & IN_ISDIR) {
+    if (isSkippedDirectory(name)) {
+      return;
+    }
+    if (mask & (IN_CREATE | IN_MOVED_TO)) {
+      addTree(path);
+    }
+    // Whatever schemas the directory holds changed too.
+    changesUnknown = true;
+    scheduleFlush();
+    return;
+  }
+  if (path.endsWith(".capnp")) {
+    if (!pending.contains(path)) {
+      pending.insert(kj::mv(path));
+    }
+    scheduleFlush();
+  }
+}
+
+#endif
+
+void FileWatcher::scheduleFlush() {
+  auto now = ioContext.provider->getTimer().now();
+  lastEvent = now;
+  if (!flushScheduled) {
+    flushScheduled = true;
+    burstStart = now;
+    tasks.add(waitForQuiet().then([this]() { flush(); }));
+  }
+}
+
+kj::Promise<void> FileWatcher::waitForQuiet() {
+  auto &timer = ioContext.provider->getTimer();
+  auto deadline = kj::min(lastEvent + SETTLE_DELAY, burstStart + MAX_DELAY);
+  return timer.atTime(deadline).then([this, &timer]() -> kj::Promise<void> {
+    auto now = timer.now();
+    if (now < lastEvent + SETTLE_DELAY && now < burstStart + MAX_DELAY) {
+      return waitForQuiet();
+    }
+    return kj::READY_NOW;
+  });
+}
+
+void FileWatcher::flush() {
+  flushScheduled = false;
+  kj::Vector<kj::String> changedFiles;
+  if (!changesUnknown) {
+    for (auto &path : pending) {
+      changedFiles.add(kj::heapString(path));
+    }
+  }
+  pending.clear();
+  changesUnknown = false;
+  tasks.add(onChange(changedFiles.releaseAsArray()));
+}
+
+void FileWatcher::taskFailed(kj::Exception &&exception) {
+  KJ_LOG(ERROR, "File watcher task failed", exception.getDescription());
+}
+
+} // namespace capnp_ls
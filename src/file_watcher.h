@@ -0,0 +1,79 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <kj/async-io.h>
+#include <kj/async-unix.h>
+#include <kj/function.h>
+#include <kj/io.h>
+#include <kj/map.h>
+#include <kj/string.h>
+#include <kj/time.h>
+
+namespace capnp_ls {
+
+// Watches directory trees for changed schemas with inotify, on the event
+// loop, and reports a burst of changes once, after it has gone quiet. Watches
+// are per directory rather than per file and capped in number, so that a
+// large tree neither exhausts the user's inotify watches nor takes long to
+// set up; directories past the cap go unwatched.
+class FileWatcher : public kj::TaskSet::ErrorHandler {
+public:
+  static constexpr size_t DEFAULT_MAX_WATCHES = 8192;
+  // How long a burst must be quiet before it is reported, and how long it
+  // may go on before it is reported anyway.
+  static constexpr kj::Duration SETTLE_DELAY = 200 * kj::MILLISECONDS;
+  static constexpr kj::Duration MAX_DELAY = 2 * kj::SECONDS;
+
+  // Called with the schemas written, created, moved or deleted in a burst.
+  // Empty if the changes are not known one by one: inotify dropped events,
+  // or a directory was added or removed.
+  using Callback =
+      kj::Function<kj::Promise<void>(kj::Array<kj::String> changedFiles)>;
+
+  FileWatcher(
+      kj::AsyncIoContext &ioContext,
+      Callback onChange,
+      size_t maxWatches = DEFAULT_MAX_WATCHES);
+  KJ_DISALLOW_COPY(FileWatcher);
+
+  // Watches `root` and the directories below it, skipping hidden ones and
+  // node_modules, nearest first. False if nothing could be watched.
+  bool watch(kj::StringPtr root);
+
+  size_t getWatchCount() const {
+    return directories.size();
+  }
+
+private:
+  kj::AsyncIoContext &ioContext;
+  Callback onChange;
+  size_t maxWatches;
+  kj::AutoCloseFd inotifyFd;
+  kj::Maybe<kj::Own<kj::UnixEventPort::FdObserver>> observer;
+  // Watched directories by watch descriptor.
+  kj::HashMap<int, kj::String> directories;
+  bool isFull = false;
+
+  kj::HashSet<kj::String> pending;
+  // Set when events were dropped or a whole directory came or went.
+  bool changesUnknown = false;
+  bool flushScheduled = false;
+  kj::TimePoint burstStart = kj::origin<kj::TimePoint>();
+  kj::TimePoint lastEvent = kj::origin<kj::TimePoint>();
+  kj::TaskSet tasks;
+
+  void addTree(kj::StringPtr root);
+  bool addWatch(kj::StringPtr directory);
+  kj::Promise<void> readEvents();
+  void handleEvent(int wd, uint32_t mask, kj::StringPtr name);
+  void scheduleFlush();
+  kj::Promise<void> waitForQuiet();
+  void flush();
+  void taskFailed(kj::Exception &&exception) override;
+};
+
+} // namespace capnp_ls
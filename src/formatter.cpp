@@ -0,0 +1,173 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#include "formatter.h"
+#include "document.h"
+#include "lexer.h"
+
+namespace capnp_ls {
+namespace {
+
+constexpr uint32_t MAX_CONSECUTIVE_NEWLINES = 2;
+
+bool is(kj::StringPtr text, const Token *token, kj::StringPtr value) {
+  if (token == nullptr) {
+    return false;
+  }
+  auto tokenText = Lexer::textOf(text, *token);
+  return kj::StringPtr(tokenText.begin(), tokenText.size()) == value;
+}
+
+// Spacing between two tokens on the same line; null to keep the original.
+kj::Maybe<kj::StringPtr> spaceBetween(
+    kj::StringPtr text,
+    const Token &prev,
+    const Token &next,
+    kj::ArrayPtr<const char> original) {
+  if (next.kind == TokenKind::COMMENT) {
+    // Keep hand-aligned trailing comments, but never glue them on.
+    if (original.size() > 0) {
+      return nullptr;
+    }
+    return kj::StringPtr(" ");
+  }
+  if (is(text, &next, ";") || is(text, &next, ",") || is(text, &next, ")") ||
+      is(text, &next, "]") || is(text, &next, ".")) {
+    return kj::StringPtr("");
+  }
+  if (is(text, &prev, "(") || is(text, &prev, "[") || is(text, &prev, ".") ||
+      is(text, &prev, "$") || is(text, &prev, ":") || is(text, &prev, "-")) {
+    return kj::StringPtr("");
+  }
+  if (is(text, &next, "(")) {
+    // `List(Text)`, `extends(Base)`, `Map(K, V)`, but `foo @0 (a :T)`.
+    bool spaced = prev.kind == TokenKind::ORDINAL || is(text, &prev, "->") ||
+                  is(text, &prev, "=");
+    return kj::StringPtr(spaced ? " " : "");
+  }
+  return kj::StringPtr(" ");
+}
+
+} // namespace
+
+kj::Vector<TextEdit> Formatter::format(
+    kj::StringPtr text,
+    const FormattingOptions &options,
+    kj::Maybe<Range> range) {
+  auto tokens = Lexer::tokenize(text);
+  kj::String indentUnit =
+      options.insertSpaces ? kj::str(kj::repeat(' ', options.tabSize))
+                           : kj::str("\t");
+  kj::StringPtr newline = text.findFirst('\r') != nullptr ? "\r\n" : "\n";
+
+  kj::Vector<TextEdit> edits;
+  // Token columns count bytes, edits UTF-16 code units.
+  Utf16Columns columns(text);
+  uint32_t braceDepth = 0;
+  uint32_t parenDepth = 0;
+
+  // Whitespace runs are the gaps before each token, plus the one after the
+  // last token.
+  for (size_t i = 0; i <= tokens.size(); i++) {
+    const Token *prev = i > 0 ? &tokens[i - 1] : nullptr;
+    const Token *next = i < tokens.size() ? &tokens[i] : nullptr;
+
+    if (prev != nullptr) {
+      if (is(text, prev, "{")) {
+        braceDepth++;
+      } else if (is(text, prev, "}") && braceDepth > 0) {
+        braceDepth--;
+      } else if (is(text, prev, "(") || is(text, prev, "[")) {
+        parenDepth++;
+      } else if (is(text, prev, ")") || is(text, prev, "]")) {
+        parenDepth = parenDepth > 0 ? parenDepth - 1 : 0;
+      }
+    }
+
+    size_t gapStart = prev == nullptr ? 0 : prev->endByte;
+    size_t gapEnd = next == nullptr ? text.size() : next->startByte;
+    auto original = text.slice(gapStart, gapEnd);
+    uint32_t newlines = 0;
+    for (char c : original) {
+      if (c == '\n') {
+        newlines++;
+      }
+    }
+
+    // Leave anything next to bytes the lexer did not understand alone.
+    if ((prev != nullptr && prev->kind == TokenKind::UNKNOWN) ||
+        (next != nullptr && next->kind == TokenKind::UNKNOWN)) {
+      continue;
+    }
+
+    kj::String desired;
+    if (next == nullptr) {
+      desired = prev == nullptr ? kj::str("") : kj::str(newline);
+    } else if (prev == nullptr || newlines > 0) {
+      uint32_t depth = braceDepth + parenDepth;
+      if ((is(text, next, "}") || is(text, next, ")") || is(text, next, "]")) &&
+          depth > 0) {
+        depth--;
+      }
+      kj::Vector<char> gap;
+      if (prev != nullptr) {
+        for (uint32_t n = 0; n < kj::min(newlines, MAX_CONSECUTIVE_NEWLINES);
+             n++) {
+          gap.addAll(newline);
+        }
+      }
+      for (uint32_t d = 0; d < depth; d++) {
+        gap.addAll(indentUnit);
+      }
+      desired = kj::heapString(gap.begin(), gap.size());
+    } else {
+      KJ_IF_MAYBE (space, spaceBetween(text, *prev, *next, original)) {
+        desired = kj::str(*space);
+      } else {
+        desired = kj::heapString(original);
+      }
+    }
+
+    if (kj::StringPtr(desired) ==
+        kj::StringPtr(original.begin(), original.size())) {
+      continue;
+    }
+
+    Position start{1, 1};
+    if (prev != nullptr) {
+      uint32_t byteColumn = prev->column + (prev->endByte - prev->startByte);
+      start = Position{
+          prev->line + 1, columns.columnOf(prev->endByte, byteColumn) + 1};
+    }
+    Position end{1, 1};
+    if (next != nullptr) {
+      end = Position{
+          next->line + 1, columns.columnOf(next->startByte, next->column) + 1};
+    } else {
+      end = start;
+      for (char c : original) {
+        if (c == '\n') {
+          end.line++;
+          end.character = 1;
+        } else {
+          end.character++;
+        }
+      }
+    }
+
+    // A run belongs to the line of the token it precedes, so that a range
+    // covers the indentation of its first line but not the line break after
+    // its last one.
+    KJ_IF_MAYBE (limit, range) {
+      if (end.line < limit->start.line || end.line > limit->end.line) {
+        continue;
+      }
+    }
+    edits.add(TextEdit{Range{start, end}, kj::mv(desired)});
+  }
+  return edits;
+}
+
+} // namespace capnp_ls
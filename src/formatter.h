@@ -0,0 +1,34 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include "lsp_types.h"
+#include <kj/string.h>
+#include <kj/vector.h>
+
+namespace capnp_ls {
+
+struct FormattingOptions {
+  uint32_t tabSize = 2;
+  bool insertSpaces = true;
+};
+
+// Formats a schema by rewriting only the whitespace between tokens:
+// indentation follows brace depth, spacing follows the usual capnp style
+// (`name @0 :Type;`, `foo @1 (a :Int32) -> ();`), at most one blank line is
+// kept and trailing whitespace is dropped. Line breaks are otherwise left
+// where the author put them.
+class Formatter {
+public:
+  // One edit per whitespace run that changes, limited to runs that precede
+  // a token on the lines of `range` (1-based) when one is given.
+  static kj::Vector<TextEdit> format(
+      kj::StringPtr text,
+      const FormattingOptions &options,
+      kj::Maybe<Range> range = nullptr);
+};
+
+} // namespace capnp_ls
@@ -0,0 +1,335 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#include "hover_provider.h"
+#include <capnp/dynamic.h>
+#include <capnp/message.h>
+#include <kj/debug.h>
+#include <kj/vector.h>
+
+namespace capnp_ls {
+namespace {
+
+kj::StringPtr qualifiedName(capnp::schema::Node::Reader node) {
+  kj::StringPtr displayName = node.getDisplayName();
+  KJ_IF_MAYBE (colonPos, displayName.findFirst(':')) {
+    return displayName.slice(*colonPos + 1);
+  }
+  return displayName;
+}
+
+kj::StringPtr shortName(capnp::schema::Node::Reader node) {
+  return node.getDisplayName().slice(node.getDisplayNamePrefixLength());
+}
+
+kj::String typeName(SchemaStore &store, capnp::Type type) {
+  switch (type.which()) {
+  case capnp::schema::Type::VOID:
+    return kj::str("Void");
+  case capnp::schema::Type::BOOL:
+    return kj::str("Bool");
+  case capnp::schema::Type::INT8:
+    return kj::str("Int8");
+  case capnp::schema::Type::INT16:
+    return kj::str("Int16");
+  case capnp::schema::Type::INT32:
+    return kj::str("Int32");
+  case capnp::schema::Type::INT64:
+    return kj::str("Int64");
+  case capnp::schema::Type::UINT8:
+    return kj::str("UInt8");
+  case capnp::schema::Type::UINT16:
+    return kj::str("UInt16");
+  case capnp::schema::Type::UINT32:
+    return kj::str("UInt32");
+  case capnp::schema::Type::UINT64:
+    return kj::str("UInt64");
+  case capnp::schema::Type::FLOAT32:
+    return kj::str("Float32");
+  case capnp::schema::Type::FLOAT64:
+    return kj::str("Float64");
+  case capnp::schema::Type::TEXT:
+    return kj::str("Text");
+  case capnp::schema::Type::DATA:
+    return kj::str("Data");
+  case capnp::schema::Type::LIST:
+    return kj::str(
+        "List(", typeName(store, type.asList().getElementType()), ")");
+  case capnp::schema::Type::ENUM:
+    return kj::str(qualifiedName(type.asEnum().getProto()));
+  case capnp::schema::Type::STRUCT:
+    return kj::str(qualifiedName(type.asStruct().getProto()));
+  case capnp::schema::Type::INTERFACE:
+    return kj::str(qualifiedName(type.asInterface().getProto()));
+  case capnp::schema::Type::ANY_POINTER:
+    KJ_IF_MAYBE (parameter, type.getBrandParameter()) {
+      KJ_IF_MAYBE (scope, store.findNode(parameter->scopeId)) {
+        auto parameters = scope->getParameters();
+        if (parameter->index < parameters.size()) {
+          return kj::str(parameters[parameter->index].getName());
+        }
+      }
+    }
+    return kj::str("AnyPointer");
+  }
+  return kj::str("?");
+}
+
+kj::String formatValue(capnp::DynamicValue::Reader value) {
+  auto text = kj::str(value);
+  if (text.size() > HoverProvider::MAX_VALUE_LENGTH) {
+    return kj::str(text.slice(0, HoverProvider::MAX_VALUE_LENGTH), "...");
+  }
+  return text;
+}
+
+kj::String parameterList(capnp::schema::Node::Reader node) {
+  auto parameters = node.getParameters();
+  if (parameters.size() == 0) {
+    return kj::str("");
+  }
+  kj::Vector<kj::StringPtr> names;
+  for (auto parameter : parameters) {
+    names.add(parameter.getName());
+  }
+  return kj::str("(", kj::strArray(names, ", "), ")");
+}
+
+// "(a :T, b :U)" for implicit param/result structs, "Name" otherwise.
+kj::String
+structArguments(SchemaStore &store, capnp::StructSchema structSchema) {
+  if (structSchema.getProto().getScopeId() != 0) {
+    return kj::str(qualifiedName(structSchema.getProto()));
+  }
+  kj::Vector<kj::String> arguments;
+  for (auto field : structSchema.getFields()) {
+    arguments.add(kj::str(
+        field.getProto().getName(), " :", typeName(store, field.getType())));
+  }
+  return kj::str("(", kj::strArray(arguments, ", "), ")");
+}
+
+kj::Maybe<kj::String> fieldDefault(
+    capnp::StructSchema structSchema,
+    capnp::StructSchema::Field field) {
+  auto proto = field.getProto();
+  if (proto.which() != capnp::schema::Field::SLOT ||
+      !proto.getSlot().getHadExplicitDefault() ||
+      proto.getDiscriminantValue() != capnp::schema::Field::NO_DISCRIMINANT ||
+      field.getType().isAnyPointer()) {
+    return nullptr;
+  }
+  // An empty instance reads back every field's default value.
+  try {
+    capnp::MallocMessageBuilder message;
+    auto instance = message.initRoot<capnp::DynamicStruct>(structSchema);
+    return formatValue(instance.asReader().get(field));
+  } catch (kj::Exception &e) {
+    KJ_LOG(WARNING, "Failed to evaluate default value", e.getDescription());
+    return nullptr;
+  }
+}
+
+kj::String fieldSignature(
+    SchemaStore &store,
+    capnp::StructSchema structSchema,
+    capnp::StructSchema::Field field) {
+  auto proto = field.getProto();
+  kj::String ordinal;
+  if (proto.getOrdinal().isExplicit()) {
+    ordinal = kj::str(" @", proto.getOrdinal().getExplicit());
+  }
+  if (proto.which() == capnp::schema::Field::GROUP) {
+    auto group = field.getType().asStruct();
+    bool isUnion = group.getProto().getStruct().getDiscriminantCount() > 0 &&
+                   group.getFields().size() ==
+                       group.getProto().getStruct().getDiscriminantCount();
+    return kj::str(
+        proto.getName(), ordinal, " :", isUnion ? "union" : "group");
+  }
+  kj::String signature = kj::str(
+      proto.getName(), ordinal, " :", typeName(store, field.getType()));
+  KJ_IF_MAYBE (value, fieldDefault(structSchema, field)) {
+    signature = kj::str(signature, " = ", *value);
+  }
+  return signature;
+}
+
+kj::String annotationTargets(capnp::schema::Node::Annotation::Reader proto) {
+  const struct {
+    bool targets;
+    const char *name;
+  } candidates[] = {
+      {proto.getTargetsFile(), "file"},
+      {proto.getTargetsConst(), "const"},
+      {proto.getTargetsEnum(), "enum"},
+      {proto.getTargetsEnumerant(), "enumerant"},
+      {proto.getTargetsStruct(), "struct"},
+      {proto.getTargetsField(), "field"},
+      {proto.getTargetsUnion(), "union"},
+      {proto.getTargetsGroup(), "group"},
+      {proto.getTargetsInterface(), "interface"},
+      {proto.getTargetsMethod(), "method"},
+      {proto.getTargetsParam(), "param"},
+      {proto.getTargetsAnnotation(), "annotation"}};
+
+  kj::Vector<kj::StringPtr> targets;
+  for (auto &candidate : candidates) {
+    if (candidate.targets) {
+      targets.add(candidate.name);
+    }
+  }
+  if (targets.size() == kj::size(candidates)) {
+    return kj::str("*");
+  }
+  return kj::strArray(targets, ", ");
+}
+
+kj::String nodeSignature(
+    SchemaStore &store,
+    capnp::Schema schema,
+    capnp::schema::Node::Reader node) {
+  auto id = kj::str(" @0x", kj::hex(node.getId()));
+  switch (node.which()) {
+  case capnp::schema::Node::FILE:
+    return kj::str("# ", qualifiedName(node), id);
+  case capnp::schema::Node::STRUCT:
+    if (node.getStruct().getIsGroup()) {
+      return kj::str("group ", qualifiedName(node));
+    }
+    return kj::str("struct ", qualifiedName(node), parameterList(node), id);
+  case capnp::schema::Node::ENUM:
+    return kj::str("enum ", qualifiedName(node), id);
+  case capnp::schema::Node::INTERFACE: {
+    kj::Vector<kj::String> superclasses;
+    for (auto superclass : schema.asInterface().getSuperclasses()) {
+      superclasses.add(kj::str(qualifiedName(superclass.getProto())));
+    }
+    return kj::str(
+        "interface ",
+        qualifiedName(node),
+        parameterList(node),
+        id,
+        superclasses.size() == 0
+            ? kj::str("")
+            : kj::str(" extends(", kj::strArray(superclasses, ", "), ")"));
+  }
+  case capnp::schema::Node::CONST: {
+    auto constSchema = schema.asConst();
+    return kj::str(
+        "const ",
+        shortName(node),
+        " :",
+        typeName(store, constSchema.getType()),
+        " = ",
+        formatValue(constSchema.as<capnp::DynamicValue>()));
+  }
+  case capnp::schema::Node::ANNOTATION: {
+    auto annotation = node.getAnnotation();
+    capnp::Schema scope = schema;
+    KJ_IF_MAYBE (parent, store.getSchema(node.getScopeId())) {
+      scope = *parent;
+    }
+    return kj::str(
+        "annotation ",
+        shortName(node),
+        "(",
+        annotationTargets(annotation),
+        ") :",
+        typeName(store, store.getType(annotation.getType(), scope)),
+        id);
+  }
+  }
+  return kj::str(qualifiedName(node));
+}
+
+kj::String
+render(kj::StringPtr signature, kj::Maybe<kj::StringPtr> docComment) {
+  kj::String text = kj::str("```capnp\n", signature, "\n```");
+  KJ_IF_MAYBE (comment, docComment) {
+    if (comment->size() > 0) {
+      text = kj::str(text, "\n\n", *comment);
+    }
+  }
+  return text;
+}
+
+} // namespace
+
+kj::Maybe<kj::String>
+HoverProvider::describeNode(SchemaStore &store, uint64_t id) {
+  KJ_IF_MAYBE (node, store.findNode(id)) {
+    KJ_IF_MAYBE (schema, store.getSchema(id)) {
+      kj::Maybe<kj::StringPtr> docComment;
+      KJ_IF_MAYBE (sourceInfo, store.findSourceInfo(id)) {
+        docComment = sourceInfo->getDocComment();
+      }
+      return render(nodeSignature(store, *schema, *node), docComment);
+    }
+  }
+  return nullptr;
+}
+
+kj::Maybe<kj::String> HoverProvider::describeMember(
+    SchemaStore &store,
+    uint64_t scopeId,
+    uint32_t memberIndex) {
+  KJ_IF_MAYBE (schema, store.getSchema(scopeId)) {
+    kj::Maybe<kj::StringPtr> docComment;
+    KJ_IF_MAYBE (sourceInfo, store.findSourceInfo(scopeId)) {
+      auto members = sourceInfo->getMembers();
+      if (memberIndex < members.size()) {
+        docComment = members[memberIndex].getDocComment();
+      }
+    }
+
+    auto proto = schema->getProto();
+    switch (proto.which()) {
+    case capnp::schema::Node::STRUCT: {
+      auto structSchema = schema->asStruct();
+      auto fields = structSchema.getFields();
+      if (memberIndex < fields.size()) {
+        return render(
+            fieldSignature(store, structSchema, fields[memberIndex]),
+            docComment);
+      }
+      break;
+    }
+    case capnp::schema::Node::ENUM: {
+      auto enumerants = schema->asEnum().getEnumerants();
+      if (memberIndex < enumerants.size()) {
+        auto enumerant = enumerants[memberIndex];
+        return render(
+            kj::str(
+                enumerant.getProto().getName(), " @", enumerant.getOrdinal()),
+            docComment);
+      }
+      break;
+    }
+    case capnp::schema::Node::INTERFACE: {
+      auto methods = schema->asInterface().getMethods();
+      if (memberIndex < methods.size()) {
+        auto method = methods[memberIndex];
+        return render(
+            kj::str(
+                method.getProto().getName(),
+                " @",
+                method.getOrdinal(),
+                " ",
+                structArguments(store, method.getParamType()),
+                " -> ",
+                structArguments(store, method.getResultType())),
+            docComment);
+      }
+      break;
+    }
+    default:
+      break;
+    }
+  }
+  return nullptr;
+}
+
+} // namespace capnp_ls
@@ -0,0 +1,28 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include "schema_store.h"
+#include <kj/string.h>
+
+namespace capnp_ls {
+
+// Renders hover text (Markdown) from the stored schemas: a capnp-style
+// signature, the doc comment, and for consts and fields with an explicit
+// default the evaluated value.
+class HoverProvider {
+public:
+  // Longest evaluated value shown before it is elided.
+  static constexpr size_t MAX_VALUE_LENGTH = 512;
+
+  static kj::Maybe<kj::String> describeNode(SchemaStore &store, uint64_t id);
+  // `memberIndex` indexes the struct's fields, the enum's enumerants or the
+  // interface's methods, like SourceInfo.members does.
+  static kj::Maybe<kj::String>
+  describeMember(SchemaStore &store, uint64_t scopeId, uint32_t memberIndex);
+};
+
+} // namespace capnp_ls
@@ -0,0 +1,210 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#include "id_index.h"
+#include <fcntl.h>
+#include <kj/debug.h>
+#include <kj/io.h>
+
+namespace capnp_ls {
+namespace {
+
+bool hasId(kj::ArrayPtr<const IdDeclaration> ids, uint64_t id) {
+  for (auto &declaration : ids) {
+    if (declaration.id == id) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+uint64_t IdIndex::generateId() {
+  int fd;
+  KJ_SYSCALL(fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC));
+  kj::FdInputStream input{kj::AutoCloseFd(fd)};
+  uint64_t id = 0;
+  size_t n = input.tryRead(&id, sizeof(id), sizeof(id));
+  KJ_REQUIRE(n == sizeof(id), "short read from /dev/urandom");
+  return id | (1ull << 63);
+}
+
+kj::Maybe<uint64_t> IdIndex::parseId(kj::ArrayPtr<const char> text) {
+  if (text.size() < 4 || text[0] != '@' || text[1] != '0' ||
+      (text[2] != 'x' && text[2] != 'X') || text.size() > 3 + 16) {
+    return nullptr;
+  }
+  uint64_t value = 0;
+  for (char c : text.slice(3, text.size())) {
+    uint64_t digit;
+    if (c >= '0' && c <= '9') {
+      digit = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      digit = c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      digit = c - 'A' + 10;
+    } else {
+      return nullptr;
+    }
+    value = value << 4 | digit;
+  }
+  return value;
+}
+
+kj::String IdIndex::formatId(uint64_t id) {
+  static constexpr char DIGITS[] = "0123456789abcdef";
+  char hex[16];
+  for (int i = 15; i >= 0; i--) {
+    hex[i] = DIGITS[id & 0xf];
+    id >>= 4;
+  }
+  return kj::str("@0x", kj::ArrayPtr<const char>(hex, sizeof(hex)));
+}
+
+kj::Vector<IdDeclaration>
+IdIndex::scan(kj::StringPtr text, kj::ArrayPtr<const Token> tokens) {
+  kj::Vector<IdDeclaration> ids;
+  for (auto &token : tokens) {
+    if (token.kind != TokenKind::ORDINAL) {
+      continue;
+    }
+    KJ_IF_MAYBE (id, parseId(Lexer::textOf(text, token))) {
+      uint32_t length = token.endByte - token.startByte;
+      ids.add(IdDeclaration{
+          *id,
+          {{token.line, token.column}, {token.line, token.column + length}}});
+    }
+  }
+  return ids;
+}
+
+kj::Vector<kj::String>
+IdIndex::update(kj::StringPtr filePath, kj::Vector<IdDeclaration> ids) {
+  kj::ArrayPtr<const IdDeclaration> previous;
+  KJ_IF_MAYBE (recorded, files.find(filePath)) {
+    previous = *recorded;
+  }
+
+  // Ids added to or removed from the file; only their other declarations
+  // see a change in collisions.
+  kj::Vector<uint64_t> changedIds;
+  bool hadDuplicates = false;
+  for (auto &declaration : previous) {
+    KJ_IF_MAYBE (entries, occurrences.find(declaration.id)) {
+      hadDuplicates = hadDuplicates || entries->size() > 1;
+      kj::Vector<Occurrence> kept(entries->size());
+      for (auto &entry : *entries) {
+        if (entry.filePath != filePath) {
+          kept.add(kj::mv(entry));
+        }
+      }
+      if (kept.size() == 0) {
+        occurrences.erase(declaration.id);
+      } else {
+        *entries = kj::mv(kept);
+      }
+    }
+    if (!hasId(ids, declaration.id)) {
+      changedIds.add(declaration.id);
+    }
+  }
+
+  bool hasDuplicates = false;
+  for (auto &declaration : ids) {
+    kj::Vector<Occurrence> *entries;
+    KJ_IF_MAYBE (existing, occurrences.find(declaration.id)) {
+      entries = existing;
+    } else {
+      entries = &occurrences.insert(declaration.id, {}).value;
+    }
+    entries->add(Occurrence{kj::heapString(filePath), declaration.range});
+    hasDuplicates = hasDuplicates || entries->size() > 1;
+    if (!hasId(previous, declaration.id)) {
+      changedIds.add(declaration.id);
+    }
+  }
+
+  kj::Vector<kj::String> affected;
+  kj::HashSet<kj::StringPtr> seen;
+  for (auto id : changedIds) {
+    KJ_IF_MAYBE (entries, occurrences.find(id)) {
+      for (auto &entry : *entries) {
+        if (entry.filePath != filePath && !seen.contains(entry.filePath)) {
+          seen.insert(entry.filePath);
+          affected.add(kj::heapString(entry.filePath));
+        }
+      }
+    }
+  }
+  if (hadDuplicates || hasDuplicates) {
+    affected.add(kj::heapString(filePath));
+  }
+
+  if (ids.size() == 0) {
+    files.erase(filePath);
+  } else {
+    files.upsert(kj::heapString(filePath), kj::mv(ids));
+  }
+  return affected;
+}
+
+kj::ArrayPtr<const IdDeclaration>
+IdIndex::getIds(kj::StringPtr filePath) const {
+  KJ_IF_MAYBE (ids, files.find(filePath)) {
+    return *ids;
+  }
+  return nullptr;
+}
+
+bool IdIndex::isDuplicate(uint64_t id) const {
+  KJ_IF_MAYBE (entries, occurrences.find(id)) {
+    return entries->size() > 1;
+  }
+  return false;
+}
+
+uint64_t IdIndex::generateUniqueId() const {
+  for (;;) {
+    uint64_t id = generateId();
+    if (occurrences.find(id) == nullptr) {
+      return id;
+    }
+  }
+}
+
+kj::Vector<Diagnostic> IdIndex::diagnose(kj::StringPtr filePath) const {
+  kj::Vector<Diagnostic> diagnostics;
+  for (auto &declaration : getIds(filePath)) {
+    KJ_IF_MAYBE (entries, occurrences.find(declaration.id)) {
+      if (entries->size() < 2) {
+        continue;
+      }
+      for (auto &other : *entries) {
+        if (other.filePath == filePath && other.range == declaration.range) {
+          continue;
+        }
+        auto where =
+            other.filePath == filePath
+                ? kj::str("line ", other.range.start.line + 1)
+                : kj::str(other.filePath, ":", other.range.start.line + 1);
+        diagnostics.add(Diagnostic{
+            declaration.range,
+            DiagnosticSeverity::Error,
+            kj::str(
+                "Duplicate ID ",
+                formatId(declaration.id),
+                "; also declared at ",
+                where,
+                "."),
+            kj::heapString("capnp-ls")});
+        break;
+      }
+    }
+  }
+  return diagnostics;
+}
+
+} // namespace capnp_ls
@@ -0,0 +1,64 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include "lexer.h"
+#include "lsp_types.h"
+#include <kj/map.h>
+#include <kj/string.h>
+#include <kj/vector.h>
+
+namespace capnp_ls {
+
+// A unique id ("@0x...") written in a schema.
+struct IdDeclaration {
+  uint64_t id;
+  Range range; // 0-based, like diagnostics
+};
+
+// Every id written in the workspace, keyed by value. Indexing a file costs
+// one hash lookup per id it declares, which is also all it takes to find the
+// files it collides with; the compiler only reports duplicates between files
+// compiled together.
+class IdIndex {
+public:
+  // A random id with the high bit set, the same way `capnp id` makes them.
+  static uint64_t generateId();
+  // "@0x" followed by 16 hex digits.
+  static kj::String formatId(uint64_t id);
+  // The value of an id token, or null for ordinals and malformed ids.
+  static kj::Maybe<uint64_t> parseId(kj::ArrayPtr<const char> text);
+
+  // Ids declared in a token stream: the file id and those of type, const
+  // and annotation declarations.
+  static kj::Vector<IdDeclaration>
+  scan(kj::StringPtr text, kj::ArrayPtr<const Token> tokens);
+
+  // Replaces the ids recorded for `filePath` (an empty list forgets the
+  // file). Returns the files whose collisions changed, `filePath` included
+  // whenever it had or has any, so their diagnostics can be published again.
+  kj::Vector<kj::String>
+  update(kj::StringPtr filePath, kj::Vector<IdDeclaration> ids);
+
+  kj::ArrayPtr<const IdDeclaration> getIds(kj::StringPtr filePath) const;
+  bool isDuplicate(uint64_t id) const;
+
+  // A fresh id that nothing in the index uses yet.
+  uint64_t generateUniqueId() const;
+
+  // One error per id of `filePath` that is declared more than once.
+  kj::Vector<Diagnostic> diagnose(kj::StringPtr filePath) const;
+
+private:
+  struct Occurrence {
+    kj::String filePath;
+    Range range;
+  };
+  kj::HashMap<uint64_t, kj::Vector<Occurrence>> occurrences;
+  kj::HashMap<kj::String, kj::Vector<IdDeclaration>> files;
+};
+
+} // namespace capnp_ls
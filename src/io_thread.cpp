@@ -0,0 +1,53 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#include "io_thread.h"
+#include <kj/debug.h>
+#include <kj/mutex.h>
+
+namespace capnp_ls {
+
+IoThread::IoThread(
+    kj::Function<kj::Promise<void>(kj::AsyncIoContext &)> bodyParam)
+    : body(kj::mv(bodyParam)) {
+  kj::MutexGuarded<kj::Maybe<kj::Own<const kj::Executor>>> started;
+  thread = kj::heap<kj::Thread>([this, &started]() {
+    auto ioContext = kj::setupAsyncIo();
+    auto paf = kj::newPromiseAndFulfiller<void>();
+    stop = kj::mv(paf.fulfiller);
+    *started.lockExclusive() = kj::getCurrentThreadExecutor().addRef();
+    KJ_IF_MAYBE (exception, kj::runCatchingExceptions([&]() {
+                   body(ioContext)
+                       .exclusiveJoin(kj::mv(paf.promise))
+                       .wait(ioContext.waitScope);
+                 })) {
+      KJ_LOG(ERROR, "I/O thread failed", exception->getDescription());
+    }
+    stop = nullptr;
+  });
+  executor = started.when(
+      [](const kj::Maybe<kj::Own<const kj::Executor>> &executor) {
+        return executor != nullptr;
+      },
+      [](kj::Maybe<kj::Own<const kj::Executor>> &executor) {
+        return kj::mv(KJ_ASSERT_NONNULL(executor));
+      });
+}
+
+IoThread::~IoThread() noexcept(false) {
+  KJ_IF_MAYBE (exception, kj::runCatchingExceptions([this]() {
+                 executor->executeSync([this]() {
+                   KJ_IF_MAYBE (fulfiller, stop) {
+                     (*fulfiller)->fulfill();
+                   }
+                 });
+               })) {
+    // The loop already ended by itself.
+    KJ_LOG(INFO, "I/O thread already stopped", exception->getDescription());
+  }
+  thread = nullptr;
+}
+
+} // namespace capnp_ls
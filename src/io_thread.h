@@ -0,0 +1,36 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <kj/async-io.h>
+#include <kj/function.h>
+#include <kj/thread.h>
+
+namespace capnp_ls {
+
+// A thread with an event loop of its own. Runs `body` on it until the
+// returned promise resolves or the IoThread is destroyed, which cancels
+// the promise on that thread and joins it.
+class IoThread {
+public:
+  explicit IoThread(kj::Function<kj::Promise<void>(kj::AsyncIoContext &)> body);
+  ~IoThread() noexcept(false);
+  KJ_DISALLOW_COPY(IoThread);
+
+  // Runs work on the thread's loop; usable from any thread.
+  const kj::Executor &getExecutor() const {
+    return *executor;
+  }
+
+private:
+  kj::Function<kj::Promise<void>(kj::AsyncIoContext &)> body;
+  kj::Own<const kj::Executor> executor;
+  // Only touched on the thread.
+  kj::Maybe<kj::Own<kj::PromiseFulfiller<void>>> stop;
+  kj::Own<kj::Thread> thread;
+};
+
+} // namespace capnp_ls
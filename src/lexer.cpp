@@ -0,0 +1,192 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#include "lexer.h"
+#include <kj/debug.h>
+
+namespace capnp_ls {
+namespace {
+
+constexpr const char *KEYWORDS[] = {
+    "using",
+    "import",
+    "embed",
+    "const",
+    "annotation",
+    "struct",
+    "union",
+    "group",
+    "enum",
+    "interface",
+    "extends",
+    "true",
+    "false",
+    "inf",
+    "nan",
+    "void"};
+
+constexpr const char *BUILTIN_TYPES[] = {
+    "Void",
+    "Bool",
+    "Int8",
+    "Int16",
+    "Int32",
+    "Int64",
+    "UInt8",
+    "UInt16",
+    "UInt32",
+    "UInt64",
+    "Float32",
+    "Float64",
+    "Text",
+    "Data",
+    "List",
+    "AnyPointer",
+    "AnyStruct",
+    "AnyList",
+    "Capability"};
+
+bool isIdentifierStart(char c) {
+  return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || c == '_';
+}
+
+bool isDigit(char c) {
+  return '0' <= c && c <= '9';
+}
+
+bool isDataLiteralStart(kj::StringPtr text, size_t pos, size_t size) {
+  return pos + 2 < size && text[pos] == '0' && text[pos + 1] == 'x' &&
+         text[pos + 2] == '"';
+}
+
+bool isIdentifierPart(char c) {
+  return isIdentifierStart(c) || isDigit(c);
+}
+
+template <size_t N>
+bool contains(const char *const (&words)[N], kj::ArrayPtr<const char> word) {
+  for (auto candidate : words) {
+    if (kj::StringPtr(candidate) == kj::StringPtr(word.begin(), word.size())) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+bool Lexer::isBuiltinType(kj::ArrayPtr<const char> name) {
+  return contains(BUILTIN_TYPES, name);
+}
+
+kj::Vector<Token> Lexer::tokenize(kj::StringPtr text) {
+  return tokenize(text, 0, text.size(), 0);
+}
+
+kj::Vector<Token> Lexer::tokenize(
+    kj::StringPtr text, size_t begin, size_t end, uint32_t firstLine) {
+  KJ_REQUIRE(begin <= end && end <= text.size());
+  kj::Vector<Token> tokens;
+  size_t size = end;
+  size_t pos = begin;
+  uint32_t line = firstLine;
+  size_t lineStart = begin;
+
+  auto add = [&](TokenKind kind, size_t start, size_t end) {
+    tokens.add(Token{
+        kind,
+        static_cast<uint32_t>(start),
+        static_cast<uint32_t>(end),
+        line,
+        static_cast<uint32_t>(start - lineStart)});
+  };
+
+  while (pos < size) {
+    char c = text[pos];
+    size_t start = pos;
+
+    if (c == '\n') {
+      pos++;
+      line++;
+      lineStart = pos;
+    } else if (c == ' ' || c == '\t' || c == '\r') {
+      pos++;
+    } else if (c == '#') {
+      while (pos < size && text[pos] != '\n') {
+        pos++;
+      }
+      add(TokenKind::COMMENT, start, pos);
+    } else if (c == '"' || isDataLiteralStart(text, pos, size)) {
+      // Text literal, or a 0x"..." data literal.
+      pos += c == '"' ? 1 : 3;
+      while (pos < size && text[pos] != '"' && text[pos] != '\n') {
+        if (text[pos] == '\\' && pos + 1 < size && text[pos + 1] != '\n') {
+          pos++;
+        }
+        pos++;
+      }
+      if (pos < size && text[pos] == '"') {
+        pos++;
+      }
+      add(TokenKind::STRING, start, pos);
+    } else if (c == '@') {
+      pos++;
+      while (pos < size && isIdentifierPart(text[pos])) {
+        pos++;
+      }
+      add(
+          pos - start > 1 ? TokenKind::ORDINAL : TokenKind::PUNCTUATION,
+          start,
+          pos);
+    } else if (isDigit(c)) {
+      if (c == '0' && pos + 1 < size &&
+          (text[pos + 1] == 'x' || text[pos + 1] == 'X')) {
+        pos += 2;
+        while (pos < size && isIdentifierPart(text[pos])) {
+          pos++;
+        }
+      } else {
+        while (pos < size && (isDigit(text[pos]) || text[pos] == '.')) {
+          pos++;
+        }
+        if (pos < size && (text[pos] == 'e' || text[pos] == 'E')) {
+          pos++;
+          if (pos < size && (text[pos] == '+' || text[pos] == '-')) {
+            pos++;
+          }
+          while (pos < size && isDigit(text[pos])) {
+            pos++;
+          }
+        }
+      }
+      add(TokenKind::NUMBER, start, pos);
+    } else if (isIdentifierStart(c)) {
+      while (pos < size && isIdentifierPart(text[pos])) {
+        pos++;
+      }
+      add(
+          contains(KEYWORDS, text.slice(start, pos)) ? TokenKind::KEYWORD
+                                                     : TokenKind::IDENTIFIER,
+          start,
+          pos);
+    } else if (c == '-' && pos + 1 < size && text[pos + 1] == '>') {
+      pos += 2;
+      add(TokenKind::PUNCTUATION, start, pos);
+    } else if (kj::StringPtr("{}()[];:,.=$-*").findFirst(c) != nullptr) {
+      pos++;
+      add(TokenKind::PUNCTUATION, start, pos);
+    } else {
+      // Multi-byte UTF-8 sequences stay in one token.
+      pos++;
+      while (pos < size && (text[pos] & 0xC0) == 0x80) {
+        pos++;
+      }
+      add(TokenKind::UNKNOWN, start, pos);
+    }
+  }
+  return tokens;
+}
+
+} // namespace capnp_ls
@@ -0,0 +1,52 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <kj/string.h>
+#include <kj/vector.h>
+
+namespace capnp_ls {
+
+enum class TokenKind {
+  IDENTIFIER,
+  KEYWORD,
+  NUMBER,
+  STRING,
+  ORDINAL, // "@3", or "@0x..." for ids
+  COMMENT,
+  PUNCTUATION,
+  UNKNOWN
+};
+
+struct Token {
+  TokenKind kind;
+  uint32_t startByte;
+  uint32_t endByte;
+  uint32_t line;   // 0-based
+  uint32_t column; // 0-based, in bytes
+};
+
+// Splits a schema into tokens without ever failing: unterminated strings end
+// at the line break and stray bytes become UNKNOWN tokens, so half-typed
+// buffers still produce a usable stream.
+class Lexer {
+public:
+  static kj::Vector<Token> tokenize(kj::StringPtr text);
+
+  // Tokens of `text[begin, end)` only. `begin` must be the start of line
+  // `firstLine`; since no token spans a line break, re-lexing whole lines
+  // gives the same tokens as lexing the entire buffer.
+  static kj::Vector<Token> tokenize(
+      kj::StringPtr text, size_t begin, size_t end, uint32_t firstLine);
+
+  static kj::ArrayPtr<const char>
+  textOf(kj::StringPtr text, const Token &token) {
+    return text.slice(token.startByte, token.endByte);
+  }
+  static bool isBuiltinType(kj::ArrayPtr<const char> name);
+};
+
+} // namespace capnp_ls
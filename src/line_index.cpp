@@ -0,0 +1,45 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#include "line_index.h"
+#include <algorithm>
+#include <kj/debug.h>
+#include <kj/filesystem.h>
+
+namespace capnp_ls {
+
+LineIndex::LineIndex(kj::ArrayPtr<const char> text)
+    : size(static_cast<uint32_t>(text.size())) {
+  lineStarts.add(0);
+  for (uint32_t i = 0; i < text.size(); i++) {
+    if (text[i] == '\n') {
+      lineStarts.add(i + 1);
+    }
+  }
+}
+
+LineIndex LineIndex::forFile(kj::StringPtr filePath) {
+  try {
+    auto content = kj::newDiskFilesystem()
+                       ->getRoot()
+                       .openFile(kj::Path::parse(filePath.slice(1)))
+                       ->readAllBytes();
+    return LineIndex(content.asChars());
+  } catch (kj::Exception &e) {
+    KJ_LOG(ERROR, "Failed to index lines", filePath, e.getDescription());
+    return LineIndex(nullptr);
+  }
+}
+
+Position LineIndex::positionAt(uint32_t byteOffset) const {
+  byteOffset = kj::min(byteOffset, size);
+  // The last line starting at or before the offset.
+  auto next =
+      std::upper_bound(lineStarts.begin(), lineStarts.end(), byteOffset);
+  uint32_t line = static_cast<uint32_t>(next - lineStarts.begin()) - 1;
+  return Position{line + 1, byteOffset - lineStarts[line] + 1};
+}
+
+} // namespace capnp_ls
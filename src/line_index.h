@@ -0,0 +1,41 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include "lsp_types.h"
+#include <kj/string.h>
+#include <kj/vector.h>
+
+namespace capnp_ls {
+
+// Compiler byte offsets of a declaration, kept as they are until a result
+// actually needs the position.
+struct ByteRange {
+  uint32_t startByte;
+  uint32_t endByte;
+};
+
+// Byte offset of every line start in a text, for turning compiler byte
+// offsets into positions in O(log lines).
+class LineIndex {
+public:
+  explicit LineIndex(kj::ArrayPtr<const char> text);
+  // Indexes the file as it is on disk now; empty if it cannot be read.
+  static LineIndex forFile(kj::StringPtr filePath);
+
+  // 1-based line and byte column of `byteOffset`. Offsets past the end of
+  // the text map to its end.
+  Position positionAt(uint32_t byteOffset) const;
+  Range rangeOf(ByteRange range) const {
+    return Range{positionAt(range.startByte), positionAt(range.endByte)};
+  }
+
+private:
+  kj::Vector<uint32_t> lineStarts;
+  uint32_t size;
+};
+
+} // namespace capnp_ls
@@ -72,8 +72,7 @@ public:
   }
 
 private:
-  kj::Promise<void>
-  sendLspLogMessage(kj::LogSeverity severity, kj::String text) {
+  void sendLspLogMessage(kj::LogSeverity severity, kj::String text) {
     // Convert KJ severity to LSP MessageType
     // 1 = Error, 2 = Warning, 3 = Info, 4 = Log
     int messageType;
@@ -126,7 +125,7 @@ private:
     kj::String message =
         kj::str("Content-Length: ", jsonStr.size(), "\r\n\r\n", jsonStr);
 
-    return writer.write(message);
+    writer.write(message);
   }
 
   StdoutWriter &writer;
@@ -9,12 +9,268 @@
 #include <capnp/message.h>
 #include <iostream>
 #include <kj/debug.h>
+#include <kj/filesystem.h>
 #include <kj/io.h>
 #include <kj/string.h>
 #include <unistd.h>
 
 namespace capnp_ls {
 
+namespace {
+
+struct TextDocumentPosition {
+  kj::String uri;
+  Position position; // 1-based
+};
+
+TextDocumentPosition
+parseTextDocumentPosition(const capnp::JsonValue::Reader &params) {
+  TextDocumentPosition result{kj::String(), Position{1, 1}};
+  for (auto field : params.getObject()) {
+    if (field.getName() == "textDocument") {
+      for (auto docField : field.getValue().getObject()) {
+        if (docField.getName() == "uri") {
+          result.uri = kj::heapString(docField.getValue().getString());
+        }
+      }
+    } else if (field.getName() == "position") {
+      for (auto posField : field.getValue().getObject()) {
+        if (posField.getName() == "line") {
+          result.position.line = posField.getValue().getNumber() + 1;
+        } else if (posField.getName() == "character") {
+          result.position.character = posField.getValue().getNumber() + 1;
+        }
+      }
+    }
+  }
+  return result;
+}
+
+// Reads an LSP (0-based) range object as a 1-based Range.
+Range parseRange(const capnp::JsonValue::Reader &value) {
+  Range range{{1, 1}, {1, 1}};
+  for (auto field : value.getObject()) {
+    Position *position = field.getName() == "start" ? &range.start
+                         : field.getName() == "end" ? &range.end
+                                                    : nullptr;
+    if (position == nullptr) {
+      continue;
+    }
+    for (auto posField : field.getValue().getObject()) {
+      if (posField.getName() == "line") {
+        position->line = posField.getValue().getNumber() + 1;
+      } else if (posField.getName() == "character") {
+        position->character = posField.getValue().getNumber() + 1;
+      }
+    }
+  }
+  return range;
+}
+
+// Writes a 1-based Range as an LSP (0-based) range object.
+void setRange(capnp::JsonValue::Builder value, const Range &range) {
+  auto rangeObj = value.initObject(2);
+  rangeObj[0].setName("start");
+  auto start = rangeObj[0].getValue().initObject(2);
+  start[0].setName("line");
+  start[0].getValue().setNumber(range.start.line - 1);
+  start[1].setName("character");
+  start[1].getValue().setNumber(range.start.character - 1);
+  rangeObj[1].setName("end");
+  auto end = rangeObj[1].getValue().initObject(2);
+  end[0].setName("line");
+  end[0].getValue().setNumber(range.end.line - 1);
+  end[1].setName("character");
+  end[1].getValue().setNumber(range.end.character - 1);
+}
+
+void setDocumentSymbols(
+    capnp::JsonValue::Builder value,
+    const kj::Vector<OutlineNode> &nodes) {
+  auto symbols = value.initArray(nodes.size());
+  for (size_t i = 0; i < nodes.size(); i++) {
+    auto &node = nodes[i];
+    auto symbolObj = symbols[i].initObject(6);
+    symbolObj[0].setName("name");
+    symbolObj[0].getValue().setString(node.name);
+    symbolObj[1].setName("detail");
+    symbolObj[1].getValue().setString(node.detail);
+    symbolObj[2].setName("kind");
+    symbolObj[2].getValue().setNumber(static_cast<int>(node.kind));
+    symbolObj[3].setName("range");
+    setRange(symbolObj[3].getValue(), node.range);
+    symbolObj[4].setName("selectionRange");
+    setRange(symbolObj[4].getValue(), node.range);
+    symbolObj[5].setName("children");
+    setDocumentSymbols(symbolObj[5].getValue(), node.children);
+  }
+}
+
+void setFoldingRanges(
+    capnp::JsonValue::Builder value,
+    const kj::Vector<Range> &ranges) {
+  auto foldingRanges = value.initArray(ranges.size());
+  for (size_t i = 0; i < ranges.size(); i++) {
+    auto rangeObj = foldingRanges[i].initObject(3);
+    rangeObj[0].setName("startLine");
+    rangeObj[0].getValue().setNumber(ranges[i].start.line - 1);
+    rangeObj[1].setName("endLine");
+    rangeObj[1].getValue().setNumber(ranges[i].end.line - 1);
+    rangeObj[2].setName("kind");
+    rangeObj[2].getValue().setString("region");
+  }
+}
+
+void setIntegers(
+    capnp::JsonValue::Builder value,
+    kj::ArrayPtr<const uint32_t> integers) {
+  auto array = value.initArray(integers.size());
+  for (size_t i = 0; i < integers.size(); i++) {
+    array[i].setNumber(integers[i]);
+  }
+}
+
+void setLocation(
+    capnp::JsonValue::Builder value,
+    kj::StringPtr filePath,
+    const Range &range) {
+  auto locationObj = value.initObject(2);
+  locationObj[0].setName("uri");
+  locationObj[0].getValue().setString(kj::str("file://", filePath));
+  locationObj[1].setName("range");
+  setRange(locationObj[1].getValue(), range);
+}
+
+// Writes diagnostics (already 0-based) as an LSP Diagnostic array.
+void setDiagnostics(
+    capnp::JsonValue::Builder value,
+    kj::ArrayPtr<const Diagnostic> compiled,
+    kj::ArrayPtr<const Diagnostic> local) {
+  auto diagnosticsArray = value.initArray(compiled.size() + local.size());
+  for (size_t i = 0; i < diagnosticsArray.size(); i++) {
+    const auto &diagnostic =
+        i < compiled.size() ? compiled[i] : local[i - compiled.size()];
+    auto diagnosticObj = diagnosticsArray[i].initObject(4);
+
+    diagnosticObj[0].setName("severity");
+    diagnosticObj[0].getValue().setNumber(
+        static_cast<int>(diagnostic.severity));
+
+    diagnosticObj[1].setName("message");
+    diagnosticObj[1].getValue().setString(diagnostic.message);
+
+    diagnosticObj[2].setName("range");
+    auto rangeObj = diagnosticObj[2].getValue().initObject(2);
+    rangeObj[0].setName("start");
+    auto start = rangeObj[0].getValue().initObject(2);
+    start[0].setName("line");
+    start[0].getValue().setNumber(diagnostic.range.start.line);
+    start[1].setName("character");
+    start[1].getValue().setNumber(diagnostic.range.start.character);
+    rangeObj[1].setName("end");
+    auto end = rangeObj[1].getValue().initObject(2);
+    end[0].setName("line");
+    end[0].getValue().setNumber(diagnostic.range.end.line);
+    end[1].setName("character");
+    end[1].getValue().setNumber(diagnostic.range.end.character);
+
+    diagnosticObj[3].setName("source");
+    diagnosticObj[3].getValue().setString(diagnostic.source);
+  }
+}
+
+// Hash of everything a client shows of the diagnostics, so that a file whose
+// diagnostics came out the same gets the same result id again, even after a
+// recompile or a restart.
+kj::String diagnosticsResultId(
+    kj::ArrayPtr<const Diagnostic> compiled,
+    kj::ArrayPtr<const Diagnostic> local) {
+  uint64_t hash = HASH_SEED;
+  for (auto diagnostics : {compiled, local}) {
+    for (const auto &diagnostic : diagnostics) {
+      uint32_t fields[] = {
+          diagnostic.range.start.line,
+          diagnostic.range.start.character,
+          diagnostic.range.end.line,
+          diagnostic.range.end.character,
+          static_cast<uint32_t>(diagnostic.severity)};
+      hash = hashBytes(kj::arrayPtr(fields, kj::size(fields)).asBytes(), hash);
+      // Terminators included, so that text cannot shift between fields.
+      kj::StringPtr texts[] = {diagnostic.message, diagnostic.source};
+      for (auto text : texts) {
+        hash = hashBytes(
+            kj::arrayPtr(text.begin(), text.size() + 1).asBytes(), hash);
+      }
+    }
+  }
+  return kj::str(kj::hex(hash));
+}
+
+// Whether the client pulls diagnostics and can be asked to pull again when a
+// compile changes them. Others are sent publishDiagnostics as before.
+bool supportsPullDiagnostics(const capnp::JsonValue::Reader &capabilities) {
+  bool pull = false;
+  bool refresh = false;
+  for (auto field : capabilities.getObject()) {
+    if (field.getName() == "textDocument") {
+      for (auto docField : field.getValue().getObject()) {
+        if (docField.getName() == "diagnostic") {
+          pull = true;
+        }
+      }
+    } else if (field.getName() == "workspace") {
+      for (auto workspaceField : field.getValue().getObject()) {
+        if (workspaceField.getName() != "diagnostics") {
+          continue;
+        }
+        for (auto diagnosticsField : workspaceField.getValue().getObject()) {
+          auto value = diagnosticsField.getValue();
+          if (diagnosticsField.getName() == "refreshSupport" &&
+              value.isBoolean() && value.getBoolean()) {
+            refresh = true;
+          }
+        }
+      }
+    }
+  }
+  return pull && refresh;
+}
+
+// Calls `callback(path, text)` for every schema below `dir`, skipping hidden
+// directories, until `budget` files have been read.
+template <typename Callback>
+void forEachSchemaFile(
+    const kj::ReadableDirectory &dir,
+    kj::StringPtr dirPath,
+    size_t &budget,
+    Callback &callback) {
+  for (auto &entry : dir.listEntries()) {
+    if (budget == 0) {
+      return;
+    }
+    if (entry.name.startsWith(".") || entry.name == "node_modules") {
+      continue;
+    }
+    auto path = kj::str(dirPath, "/", entry.name);
+    try {
+      if (entry.type == kj::FsNode::Type::DIRECTORY) {
+        auto subdir = dir.openSubdir(kj::Path(kj::heapString(entry.name)));
+        forEachSchemaFile(*subdir, path, budget, callback);
+      } else if (
+          entry.type == kj::FsNode::Type::FILE &&
+          entry.name.endsWith(".capnp")) {
+        budget--;
+        auto file = dir.openFile(kj::Path(kj::heapString(entry.name)));
+        callback(path, file->readAllText());
+      }
+    } catch (kj::Exception &e) {
+      KJ_LOG(WARNING, "Skipping unreadable path", path, e.getDescription());
+    }
+  }
+}
+
+} // namespace
+
 LspMessageHandler::LspMessageHandler(
     ServerContext &serverContext,
     StdoutWriter &stdoutWriter)
@@ -22,28 +278,25 @@ LspMessageHandler::LspMessageHandler(
   compilationManager = kj::heap<CompilationManager>(context.getIoContext());
 }
 
+kj::Own<capnp::MallocMessageBuilder>
+LspMessageHandler::decode(kj::StringPtr message) {
+  const char *headerEnd = strstr(message.begin(), LSP_HEADER_DELIMITER);
+  KJ_REQUIRE(headerEnd != nullptr, "no header delimiter found");
+  const char *jsonStart = headerEnd + LSP_HEADER_DELIMITER_SIZE;
+  kj::ArrayPtr<const char> jsonContent(jsonStart, message.end() - jsonStart);
+
+  auto messageBuilder = kj::heap<capnp::MallocMessageBuilder>();
+  capnp::JsonCodec codec;
+  codec.decodeRaw(jsonContent, messageBuilder->initRoot<capnp::JsonValue>());
+  return messageBuilder;
+}
+
 kj::Promise<void>
-LspMessageHandler::handleMessage(kj::Maybe<kj::String> maybeMessage) {
+LspMessageHandler::handleMessage(
+    kj::Maybe<kj::Own<capnp::MallocMessageBuilder>> maybeMessage) {
   try {
     KJ_IF_MAYBE (message, maybeMessage) {
-      const char *headerEnd = strstr(message->begin(), LSP_HEADER_DELIMITER);
-      if (!headerEnd) {
-        KJ_LOG(ERROR, "Invalid message format: no header delimiter found");
-        handleShutdown();
-        return kj::READY_NOW;
-      }
-
-      const char *jsonStart = headerEnd + LSP_HEADER_DELIMITER_SIZE;
-      size_t jsonLength = message->end() - jsonStart;
-
-      capnp::JsonCodec codec;
-      kj::ArrayPtr<const char> jsonContent(jsonStart, jsonLength);
-
-      capnp::MallocMessageBuilder messageBuilder;
-      auto root = messageBuilder.initRoot<capnp::JsonValue>();
-
-      codec.decodeRaw(jsonContent, root);
-
+      auto root = (*message)->getRoot<capnp::JsonValue>();
       auto obj = root.getObject();
       kj::StringPtr method;
       kj::Maybe<double> maybeRequestId;
@@ -65,6 +318,12 @@ LspMessageHandler::handleMessage(kj::Maybe<kj::String> maybeMessage) {
         }
       }
 
+      if (method.size() == 0) {
+        // The client answering one of our requests (a diagnostic refresh),
+        // which nothing waits for.
+        return kj::READY_NOW;
+      }
+
       auto responseMessageBuilder = kj::heap<capnp::MallocMessageBuilder>();
       kj::Promise<void> promise = kj::READY_NOW;
 
@@ -85,14 +344,70 @@ LspMessageHandler::handleMessage(kj::Maybe<kj::String> maybeMessage) {
         case LspMethod::DID_SAVE:
           promise = handleDidSave(params);
           break;
+        case LspMethod::DID_CHANGE:
+          promise = handleDidChange(params);
+          break;
+        case LspMethod::DID_CLOSE:
+          promise = handleDidClose(params);
+          break;
+        case LspMethod::COMPLETION:
+          promise = handleCompletion(params, *responseMessageBuilder);
+          break;
+        case LspMethod::REFERENCES:
+          promise = handleReferences(params, *responseMessageBuilder);
+          break;
+        case LspMethod::WORKSPACE_SYMBOL:
+          promise = handleWorkspaceSymbol(params, *responseMessageBuilder);
+          break;
+        case LspMethod::DOCUMENT_SYMBOL:
+          promise = handleDocumentSymbol(params, *responseMessageBuilder);
+          break;
+        case LspMethod::FOLDING_RANGE:
+          promise = handleFoldingRange(params, *responseMessageBuilder);
+          break;
+        case LspMethod::HOVER:
+          promise = handleHover(params, *responseMessageBuilder);
+          break;
+        case LspMethod::SEMANTIC_TOKENS_FULL:
+          promise = handleSemanticTokensFull(params, *responseMessageBuilder);
+          break;
+        case LspMethod::SEMANTIC_TOKENS_FULL_DELTA:
+          promise =
+              handleSemanticTokensFullDelta(params, *responseMessageBuilder);
+          break;
+        case LspMethod::PREPARE_RENAME:
+          promise = handlePrepareRename(params, *responseMessageBuilder);
+          break;
+        case LspMethod::RENAME:
+          promise = handleRename(params, *responseMessageBuilder);
+          break;
         case LspMethod::FORMATTING:
           promise = handleFormatting(params, *responseMessageBuilder);
           break;
+        case LspMethod::RANGE_FORMATTING:
+          promise = handleRangeFormatting(params, *responseMessageBuilder);
+          break;
+        case LspMethod::ON_TYPE_FORMATTING:
+          promise = handleOnTypeFormatting(params, *responseMessageBuilder);
+          break;
+        case LspMethod::CODE_ACTION:
+          promise = handleCodeAction(params, *responseMessageBuilder);
+          break;
+        case LspMethod::EXECUTE_COMMAND:
+          promise = handleExecuteCommand(params, *responseMessageBuilder);
+          break;
+        case LspMethod::DOCUMENT_DIAGNOSTIC:
+          promise = handleDocumentDiagnostic(params, *responseMessageBuilder);
+          break;
+        case LspMethod::WORKSPACE_DIAGNOSTIC:
+          promise = handleWorkspaceDiagnostic(params, *responseMessageBuilder);
+          break;
         case LspMethod::INITIALIZED:
+          promise = handleInitialized();
+          break;
         case LspMethod::SET_TRACE:
         case LspMethod::CANCEL_REQUEST:
         case LspMethod::DID_CHANGE_WATCHED_FILES:
-        case LspMethod::DID_CHANGE:
           // KJ_LOG(INFO, "Ignoring method", method.cStr());
           break;
         }
@@ -140,9 +455,8 @@ kj::Maybe<kj::String> LspMessageHandler::buildResponseString(
     obj[1].getValue().setNumber(id);
 
     obj[2].setName(LSP_RESULT);
-    if (result.isObject() && result.getObject().size() > 0 &&
-        result.getObject()[0].getValue().isObject()) {
-      obj[2].getValue().setObject(result.getObject()[0].getValue().getObject());
+    if (result.isObject() && result.getObject().size() > 0) {
+      obj[2].setValue(result.getObject()[0].getValue());
     } else {
       obj[2].getValue().setNull();
     }
@@ -172,130 +486,480 @@ kj::Promise<void> LspMessageHandler::compileCapnpFile(kj::StringPtr uri) {
             .importPaths = importPaths,
             .fileName = strippedUri,
             .workingDir = workspacePath,
-            .fileSourceInfoMap = fileSourceInfoMap,
-            .nodeLocationMap = nodeLocationMap,
-            .diagnosticMap = diagnosticMap})
-        .then([this, strippedUri = kj::mv(strippedUri)]() {
+            .snapshots = snapshots,
+            .symbolTable = symbolTable,
+            .referenceIndex = referenceIndex,
+            .schemaStore = schemaStore,
+            .documents = documents})
+        .then([this, strippedUri = kj::mv(strippedUri)](
+                  kj::Array<kj::String> resolvedFiles) {
+          accountSymbols(strippedUri, kj::mv(resolvedFiles));
           return publishDiagnostics(strippedUri);
         });
   }
   return kj::READY_NOW;
 }
 
-kj::Promise<void>
-LspMessageHandler::publishDiagnostics(kj::StringPtr fileName) {
-  KJ_LOG(INFO, "Publishing diagnostics");
-
+kj::String LspMessageHandler::getDocumentText(kj::StringPtr filePath) {
+  KJ_IF_MAYBE (document, documents.find(filePath)) {
+    return kj::heapString((*document)->getText());
+  }
   try {
-    capnp::MallocMessageBuilder messageBuilder;
-    auto root = messageBuilder.initRoot<capnp::JsonValue>();
-    auto notificationObj = root.initObject(3);
+    auto fs = kj::newDiskFilesystem();
+    return fs->getRoot()
+        .openFile(kj::Path::parse(filePath.slice(1)))
+        ->readAllText();
+  } catch (kj::Exception &e) {
+    KJ_LOG(ERROR, "Failed to read document", filePath, e.getDescription());
+    return kj::String();
+  }
+}
 
-    // Set jsonrpc version
-    notificationObj[0].setName(LSP_JSONRPC);
-    notificationObj[0].getValue().setString(LSP_JSON_RPC_VERSION);
+void LspMessageHandler::reindexIds(kj::StringPtr filePath) {
+  kj::Vector<IdDeclaration> ids;
+  KJ_IF_MAYBE (document, documents.find(filePath)) {
+    ids = IdIndex::scan((*document)->getText(), (*document)->getTokens());
+  } else {
+    try {
+      auto fs = kj::newDiskFilesystem();
+      auto text = fs->getRoot()
+                      .openFile(kj::Path::parse(filePath.slice(1)))
+                      ->readAllText();
+      ids = IdIndex::scan(text, Lexer::tokenize(text));
+    } catch (kj::Exception &e) {
+      // Deleted or unreadable: forget its ids.
+    }
+  }
+  for (auto &affected : idIndex.update(filePath, kj::mv(ids))) {
+    if (affected != filePath) {
+      publishLocalDiagnostics(affected);
+    }
+  }
+}
+
+bool LspMessageHandler::hasCompiledState(kj::StringPtr filePath) {
+  KJ_IF_MAYBE (document, documents.find(filePath)) {
+    if ((*document)->isModified()) {
+      return false;
+    }
+  }
+  auto snapshot = snapshots.get();
+  KJ_IF_MAYBE (diagnostics, snapshot->findDiagnostics(filePath)) {
+    for (auto &diagnostic : *diagnostics) {
+      if (diagnostic.severity == DiagnosticSeverity::Error) {
+        return false;
+      }
+    }
+  }
+  return snapshot->findReferences(filePath) != nullptr;
+}
+
+void LspMessageHandler::accountSymbols(
+    kj::StringPtr compiledFile,
+    kj::Array<kj::String> resolvedFiles) {
+  for (auto &filePath : resolvedFiles) {
+    memoryBudget.touch(filePath);
+  }
+  memoryBudget.touch(compiledFile);
+  // A failed compile leaves the symbols of the last good one in place.
+  if (resolvedFiles.size() > 0 && documents.find(compiledFile) != nullptr) {
+    importClosures.upsert(kj::heapString(compiledFile), kj::mv(resolvedFiles));
+  }
+
+  auto snapshot = snapshots.get();
+  snapshot->forEachFootprint([this](kj::StringPtr filePath, size_t bytes) {
+    bytes += symbolTable.footprintOf(filePath) +
+             referenceIndex.footprintOf(filePath);
+    KJ_IF_MAYBE (file, symbolTable.findFile(filePath)) {
+      bytes += schemaStore.footprintOf(file->id);
+    }
+    memoryBudget.setSize(filePath, bytes);
+  });
+
+  // Open documents need what they import for definitions and hovers.
+  kj::HashSet<kj::StringPtr> imported;
+  for (auto &entry : importClosures) {
+    for (auto &filePath : entry.value) {
+      if (!imported.contains(filePath)) {
+        imported.insert(filePath);
+      }
+    }
+  }
+  auto evicted =
+      memoryBudget.collectEvictions([&](kj::StringPtr filePath) {
+        return filePath == compiledFile ||
+               documents.find(filePath) != nullptr ||
+               imported.contains(filePath);
+      });
+  if (evicted.size() > 0) {
+    evictSymbols(evicted);
+    KJ_LOG(
+        INFO,
+        "Evicted symbol data of closed files",
+        evicted.size(),
+        memoryBudget.getEvictionCount(),
+        memoryBudget.getTotal());
+  }
+}
+
+void LspMessageHandler::evictSymbols(kj::ArrayPtr<const kj::String> filePaths) {
+  auto snapshot = snapshots.get();
+  SymbolSnapshot::Builder next(*snapshot);
+  next.keepDiagnostics(*snapshot);
+  for (auto &filePath : filePaths) {
+    next.removeFile(filePath);
+    referenceIndex.removeFile(filePath);
+    KJ_IF_MAYBE (file, symbolTable.findFile(filePath)) {
+      schemaStore.removeFile(file->id);
+    }
+    symbolTable.removeFile(filePath);
+    // Else a compile skipped as up to date would never bring it back.
+    compilationManager->forgetFile(filePath);
+  }
+  snapshots.publish(next.finish());
+}
+
+kj::Maybe<Range> LspMessageHandler::findLocalDefinition(
+    kj::StringPtr filePath,
+    Position position) {
+  KJ_IF_MAYBE (document, documents.find(filePath)) {
+    auto text = (*document)->getText();
+    auto tokens = (*document)->getTokens();
+    for (auto &token : tokens) {
+      if (token.line + 1 != position.line ||
+          token.kind != TokenKind::IDENTIFIER) {
+        continue;
+      }
+      uint32_t length = token.endByte - token.startByte;
+      if (token.column + 1 <= position.character &&
+          position.character <= token.column + 1 + length) {
+        KJ_IF_MAYBE (
+            declaration,
+            (*document)->getSyntaxTree().findDeclaration(
+                text, tokens, Lexer::textOf(text, token), position)) {
+          KJ_IF_MAYBE (nameToken, declaration->nameToken) {
+            return SyntaxTree::rangeOf(tokens, *nameToken, *nameToken);
+          }
+        }
+        return nullptr;
+      }
+    }
+  }
+  return nullptr;
+}
 
-    // Set method
-    notificationObj[1].setName(LSP_METHOD);
-    notificationObj[1].getValue().setString("textDocument/publishDiagnostics");
+kj::Maybe<uint64_t>
+LspMessageHandler::findNodeIdAt(kj::StringPtr filePath, Position position) {
+  auto snapshot = snapshots.get();
+  KJ_IF_MAYBE (rangeMap, snapshot->findReferences(filePath)) {
+    for (const auto &[range, id] : *rangeMap) {
+      if (range.start.line <= position.line &&
+          position.line <= range.end.line &&
+          range.start.character <= position.character &&
+          position.character <= range.end.character) {
+        return id;
+      }
+    }
+  }
+  // Not a use site; fall back to the declaration whose header is under the
+  // cursor.
+  KJ_IF_MAYBE (symbol, symbolTable.findEnclosingScope(filePath, position)) {
+    if (symbol->kind != SymbolKind::FILE &&
+        symbol->range.start.line == position.line) {
+      return symbol->id;
+    }
+  }
+  return nullptr;
+}
 
-    // Set params
-    notificationObj[2].setName(LSP_PARAMS);
-    auto params = notificationObj[2].getValue().initObject(2);
+kj::Promise<void>
+LspMessageHandler::publishDiagnostics(kj::StringPtr fileName) {
+  KJ_LOG(INFO, "Publishing diagnostics");
+  if (pullDiagnostics) {
+    requestDiagnosticRefresh();
+    return kj::READY_NOW;
+  }
 
+  try {
+    auto snapshot = snapshots.get();
+    auto &diagnosticMap = snapshot->getDiagnostics();
     if (diagnosticMap.size() == 0) {
       // If there are no diagnostics, send an empty diagnostics array for the
       // current file
-      params[0].setName("uri");
-      // Ensure fileName is relative to workspacePath
-      kj::StringPtr relativeFileName = fileName;
-      if (fileName.startsWith(workspacePath)) {
-        relativeFileName = fileName.slice(
-            workspacePath.size() + 1); // +1 for the trailing slash
-      }
-      kj::String fullUri =
-          kj::str("file://", workspacePath, "/", relativeFileName);
-      params[0].getValue().setString(fullUri);
-
-      params[1].setName("diagnostics");
-      params[1].getValue().initArray(0);
-
-      capnp::JsonCodec codec;
-      kj::String notificationStr = codec.encodeRaw(root);
-      kj::String message = kj::str(
-          LSP_CONTENT_LENGTH_HEADER,
-          notificationStr.size(),
-          LSP_HEADER_DELIMITER,
-          notificationStr);
-      stdoutWriter.write(message);
+      sendDiagnostics(fileName, nullptr);
     } else {
       for (const auto &[uri, diagnostics] : diagnosticMap) {
-        // Set URI
-        params[0].setName("uri");
-        // Ensure uri is relative to workspacePath
-        kj::StringPtr relativeUri = uri;
-        if (uri.startsWith(workspacePath)) {
-          relativeUri =
-              uri.slice(workspacePath.size() + 1); // +1 for the trailing slash
-        }
-        kj::String fullUri =
-            kj::str("file://", workspacePath, "/", relativeUri);
-        params[0].getValue().setString(fullUri);
-
-        // Set diagnostics array
-        params[1].setName("diagnostics");
-        auto diagnosticsArray =
-            params[1].getValue().initArray(diagnostics.size());
-
-        for (size_t i = 0; i < diagnostics.size(); i++) {
-          const auto &diagnostic = diagnostics[i];
-          auto diagnosticObj = diagnosticsArray[i].initObject(3);
-
-          // Set severity
-          diagnosticObj[0].setName("severity");
-          diagnosticObj[0].getValue().setNumber(1); // Error = 1
-
-          // Set message
-          diagnosticObj[1].setName("message");
-          diagnosticObj[1].getValue().setString(diagnostic.message);
-
-          // Set range
-          diagnosticObj[2].setName("range");
-          auto rangeObj = diagnosticObj[2].getValue().initObject(2);
-
-          // Start position
-          auto startObj = rangeObj[0];
-          startObj.setName("start");
-          auto start = startObj.getValue().initObject(2);
-          start[0].setName("line");
-          start[0].getValue().setNumber(diagnostic.range.start.line);
-          start[1].setName("character");
-          start[1].getValue().setNumber(diagnostic.range.start.character);
-
-          // End position
-          auto endObj = rangeObj[1];
-          endObj.setName("end");
-          auto end = endObj.getValue().initObject(2);
-          end[0].setName("line");
-          end[0].getValue().setNumber(diagnostic.range.end.line);
-          end[1].setName("character");
-          end[1].getValue().setNumber(diagnostic.range.end.character);
+        sendDiagnostics(uri, diagnostics);
+      }
+    }
+  } catch (kj::Exception &e) {
+    KJ_LOG(ERROR, "Error publishing diagnostics", e.getDescription());
+  }
+
+  return kj::READY_NOW;
+}
+
+void LspMessageHandler::publishLocalDiagnostics(kj::StringPtr filePath) {
+  size_t count = collectLocalDiagnostics(filePath).size();
+  size_t published = 0;
+  KJ_IF_MAYBE (previous, localDiagnosticCounts.find(filePath)) {
+    published = *previous;
+  }
+  // Nothing to add and nothing to clear: spare the client a notification
+  // on every keystroke.
+  if (count == 0 && published == 0) {
+    return;
+  }
+  if (pullDiagnostics) {
+    localDiagnosticCounts.upsert(kj::heapString(filePath), count);
+    requestDiagnosticRefresh();
+    return;
+  }
+  auto snapshot = snapshots.get();
+  kj::ArrayPtr<const Diagnostic> compiled;
+  KJ_IF_MAYBE (diagnostics, snapshot->findDiagnostics(filePath)) {
+    compiled = *diagnostics;
+  }
+  sendDiagnostics(filePath, compiled);
+}
+
+kj::Vector<Diagnostic>
+LspMessageHandler::collectLocalDiagnostics(kj::StringPtr filePath) {
+  kj::Vector<Diagnostic> diagnostics;
+  // Ordinal problems in unsaved edits, which the last compile has not seen.
+  KJ_IF_MAYBE (document, documents.find(filePath)) {
+    if ((*document)->isModified()) {
+      diagnostics = (*document)->getOrdinalIndex().diagnose(
+          (*document)->getTokens(), (*document)->getSyntaxTree());
+    }
+  }
+  // Ids shared with other files, which the compiler only notices when both
+  // are part of the same compile.
+  for (auto &diagnostic : idIndex.diagnose(filePath)) {
+    diagnostics.add(kj::mv(diagnostic));
+  }
+  return diagnostics;
+}
+
+void LspMessageHandler::sendDiagnostics(
+    kj::StringPtr filePath,
+    kj::ArrayPtr<const Diagnostic> compiled) {
+  auto local = collectLocalDiagnostics(filePath);
+  localDiagnosticCounts.upsert(kj::heapString(filePath), local.size());
+
+  capnp::MallocMessageBuilder messageBuilder;
+  auto root = messageBuilder.initRoot<capnp::JsonValue>();
+  auto notificationObj = root.initObject(3);
+
+  // Set jsonrpc version
+  notificationObj[0].setName(LSP_JSONRPC);
+  notificationObj[0].getValue().setString(LSP_JSON_RPC_VERSION);
+
+  // Set method
+  notificationObj[1].setName(LSP_METHOD);
+  notificationObj[1].getValue().setString("textDocument/publishDiagnostics");
+
+  // Set params
+  notificationObj[2].setName(LSP_PARAMS);
+  auto params = notificationObj[2].getValue().initObject(2);
+
+  params[0].setName("uri");
+  params[0].getValue().setString(toWorkspaceUri(filePath));
+
+  params[1].setName("diagnostics");
+  setDiagnostics(params[1].getValue(), compiled, local);
+
+  // Encode and send the notification
+  capnp::JsonCodec codec;
+  kj::String notificationStr = codec.encodeRaw(root);
+  kj::String message = kj::str(
+      LSP_CONTENT_LENGTH_HEADER,
+      notificationStr.size(),
+      LSP_HEADER_DELIMITER,
+      notificationStr);
+
+  stdoutWriter.write(message);
+}
+
+kj::String LspMessageHandler::toWorkspaceUri(kj::StringPtr filePath) {
+  // Ensure filePath is relative to workspacePath
+  kj::StringPtr relativePath = filePath;
+  if (filePath.startsWith(workspacePath)) {
+    relativePath =
+        filePath.slice(workspacePath.size() + 1); // +1 for the trailing slash
+  }
+  return kj::str("file://", workspacePath, "/", relativePath);
+}
+
+void LspMessageHandler::setDiagnosticReport(
+    capnp::JsonValue::Builder value,
+    const SymbolSnapshot &snapshot,
+    kj::StringPtr filePath,
+    kj::StringPtr previousResultId,
+    bool isWorkspaceItem) {
+  kj::ArrayPtr<const Diagnostic> compiled;
+  KJ_IF_MAYBE (diagnostics, snapshot.findDiagnostics(filePath)) {
+    compiled = *diagnostics;
+  }
+  // Compile errors are keyed by the name the compiler was given, relative
+  // to the workspace.
+  if (compiled.size() == 0 && filePath.startsWith(workspacePath) &&
+      filePath.size() > workspacePath.size()) {
+    auto relativePath = filePath.slice(workspacePath.size() + 1);
+    KJ_IF_MAYBE (diagnostics, snapshot.findDiagnostics(relativePath)) {
+      compiled = *diagnostics;
+    }
+  }
+  auto local = collectLocalDiagnostics(filePath);
+  localDiagnosticCounts.upsert(kj::heapString(filePath), local.size());
+
+  auto resultId = diagnosticsResultId(compiled, local);
+  bool unchanged = resultId == previousResultId;
+  auto report =
+      value.initObject((isWorkspaceItem ? 2 : 0) + (unchanged ? 2 : 3));
+  size_t field = 0;
+  if (isWorkspaceItem) {
+    report[field].setName("uri");
+    report[field++].getValue().setString(toWorkspaceUri(filePath));
+    // Reports cover the compiled file as well as the buffer, not a version.
+    report[field].setName("version");
+    report[field++].getValue().setNull();
+  }
+  report[field].setName("kind");
+  report[field++].getValue().setString(unchanged ? "unchanged" : "full");
+  report[field].setName("resultId");
+  report[field++].getValue().setString(resultId);
+  if (!unchanged) {
+    report[field].setName("items");
+    setDiagnostics(report[field].getValue(), compiled, local);
+  }
+}
+
+void LspMessageHandler::requestDiagnosticRefresh() {
+  capnp::MallocMessageBuilder messageBuilder;
+  auto root = messageBuilder.initRoot<capnp::JsonValue>();
+  auto requestObj = root.initObject(3);
+  requestObj[0].setName(LSP_JSONRPC);
+  requestObj[0].getValue().setString(LSP_JSON_RPC_VERSION);
+  requestObj[1].setName(LSP_ID);
+  requestObj[1].getValue().setNumber(nextServerRequestId++);
+  requestObj[2].setName(LSP_METHOD);
+  requestObj[2].getValue().setString("workspace/diagnostic/refresh");
+
+  capnp::JsonCodec codec;
+  kj::String requestStr = codec.encodeRaw(root);
+  stdoutWriter.write(kj::str(
+      LSP_CONTENT_LENGTH_HEADER,
+      requestStr.size(),
+      LSP_HEADER_DELIMITER,
+      requestStr));
+}
+
+kj::Promise<void> LspMessageHandler::handleDocumentDiagnostic(
+    const capnp::JsonValue::Reader &params,
+    capnp::MallocMessageBuilder &diagnosticResponseBuilder) {
+  auto root = diagnosticResponseBuilder.initRoot<capnp::JsonValue>();
+  auto resultObj = root.initObject(1);
+  auto resultField = resultObj[0];
+  resultField.setName(LSP_RESULT);
+
+  try {
+    auto request = parseTextDocumentPosition(params);
+    kj::StringPtr previousResultId;
+    for (auto field : params.getObject()) {
+      if (field.getName() == "previousResultId" &&
+          field.getValue().isString()) {
+        previousResultId = field.getValue().getString();
+      }
+    }
+    auto snapshot = snapshots.get();
+    setDiagnosticReport(
+        resultField.getValue(),
+        *snapshot,
+        uriToPath(request.uri),
+        previousResultId,
+        false);
+  } catch (kj::Exception &e) {
+    KJ_LOG(ERROR, "Error processing diagnostic request", e.getDescription());
+    resultField.getValue().setNull();
+  }
+
+  return kj::READY_NOW;
+}
+
+kj::Promise<void> LspMessageHandler::handleWorkspaceDiagnostic(
+    const capnp::JsonValue::Reader &params,
+    capnp::MallocMessageBuilder &diagnosticResponseBuilder) {
+  auto root = diagnosticResponseBuilder.initRoot<capnp::JsonValue>();
+  auto resultObj = root.initObject(1);
+  auto resultField = resultObj[0];
+  resultField.setName(LSP_RESULT);
+
+  try {
+    kj::HashMap<kj::String, kj::String> previousResultIds;
+    for (auto field : params.getObject()) {
+      if (field.getName() != "previousResultIds") {
+        continue;
+      }
+      for (auto previous : field.getValue().getArray()) {
+        kj::String filePath;
+        kj::String resultId;
+        for (auto previousField : previous.getObject()) {
+          if (previousField.getName() == "uri") {
+            filePath = uriToPath(previousField.getValue().getString());
+          } else if (previousField.getName() == "value") {
+            resultId = kj::heapString(previousField.getValue().getString());
+          }
         }
+        previousResultIds.upsert(kj::mv(filePath), kj::mv(resultId));
+      }
+    }
 
-        // Encode and send the notification
-        capnp::JsonCodec codec;
-        kj::String notificationStr = codec.encodeRaw(root);
-        kj::String message = kj::str(
-            LSP_CONTENT_LENGTH_HEADER,
-            notificationStr.size(),
-            LSP_HEADER_DELIMITER,
-            notificationStr);
+    // Files with something to report, plus those the client still shows
+    // diagnostics of, which may have to be cleared.
+    auto snapshot = snapshots.get();
+    kj::HashSet<kj::String> files;
+    auto addFile = [&](kj::StringPtr filePath) {
+      auto path = filePath.startsWith("/")
+                      ? kj::heapString(filePath)
+                      : kj::str(workspacePath, "/", filePath);
+      if (!files.contains(path)) {
+        files.insert(kj::mv(path));
+      }
+    };
+    for (auto &entry : snapshot->getDiagnostics()) {
+      addFile(entry.key);
+    }
+    for (auto &entry : documents) {
+      addFile(entry.key);
+    }
+    for (auto &entry : localDiagnosticCounts) {
+      if (entry.value > 0) {
+        addFile(entry.key);
+      }
+    }
+    for (auto &entry : previousResultIds) {
+      addFile(entry.key);
+    }
 
-        stdoutWriter.write(message);
+    auto reportObj = resultField.getValue().initObject(1);
+    reportObj[0].setName("items");
+    auto items = reportObj[0].getValue().initArray(files.size());
+    size_t i = 0;
+    for (auto &filePath : files) {
+      kj::StringPtr previousResultId;
+      KJ_IF_MAYBE (previous, previousResultIds.find(filePath)) {
+        previousResultId = *previous;
       }
+      setDiagnosticReport(
+          items[i++], *snapshot, filePath, previousResultId, true);
     }
   } catch (kj::Exception &e) {
-    KJ_LOG(ERROR, "Error publishing diagnostics", e.getDescription());
+    KJ_LOG(
+        ERROR,
+        "Error processing workspace diagnostic request",
+        e.getDescription());
+    resultField.getValue().setNull();
   }
 
   return kj::READY_NOW;
@@ -358,15 +1022,21 @@ kj::Promise<void> LspMessageHandler::handleDefinition(
         line,
         character);
 
-    KJ_IF_MAYBE (rangeMap, fileSourceInfoMap.find(strippedUri)) {
-      for (const auto &[range, id] : *rangeMap) {
+    bool compiled = hasCompiledState(strippedUri);
+    auto snapshot = snapshots.get();
+    kj::Maybe<const kj::HashMap<Range, uint64_t> &> rangeMap;
+    if (compiled) {
+      rangeMap = snapshot->findReferences(strippedUri);
+    }
+    KJ_IF_MAYBE (ranges, rangeMap) {
+      for (const auto &[range, id] : *ranges) {
         if (range.start.line <= line && line <= range.end.line &&
             range.start.character <= character &&
             character <= range.end.character) {
 
           KJ_LOG(INFO, "Found range for ", id);
 
-          KJ_IF_MAYBE (location, nodeLocationMap.find(id)) {
+          KJ_IF_MAYBE (location, snapshot->findLocation(id)) {
             KJ_LOG(INFO, "Found location");
 
             auto locationObj = resultField.getValue().initObject(2);
@@ -374,7 +1044,7 @@ kj::Promise<void> LspMessageHandler::handleDefinition(
             // Uri
             auto uriField = locationObj[0];
             uriField.setName("uri");
-            kj::String fullUri = kj::str("file://", (*location)->uri);
+            kj::String fullUri = kj::str("file://", location->uri);
             uriField.getValue().setString(fullUri);
 
             // Range
@@ -387,19 +1057,18 @@ kj::Promise<void> LspMessageHandler::handleDefinition(
             startField.setName("start");
             auto startObj = startField.getValue().initObject(2);
             startObj[0].setName("line");
-            startObj[0].getValue().setNumber((*location)->range.start.line - 1);
+            startObj[0].getValue().setNumber(location->range.start.line - 1);
             startObj[1].setName("character");
             startObj[1].getValue().setNumber(
-                (*location)->range.start.character - 1);
+                location->range.start.character - 1);
 
             auto endField = rangeObj[1];
             endField.setName("end");
             auto endObj = endField.getValue().initObject(2);
             endObj[0].setName("line");
-            endObj[0].getValue().setNumber((*location)->range.end.line - 1);
+            endObj[0].getValue().setNumber(location->range.end.line - 1);
             endObj[1].setName("character");
-            endObj[1].getValue().setNumber(
-                (*location)->range.end.character - 1);
+            endObj[1].getValue().setNumber(location->range.end.character - 1);
 
             KJ_LOG(INFO, "Response structure complete");
             return kj::READY_NOW;
@@ -407,8 +1076,15 @@ kj::Promise<void> LspMessageHandler::handleDefinition(
         }
       }
     } else {
-      KJ_LOG(FATAL, "Capnp compilation error occurred. Please check the logs on Cap\'n Proto LSP output channel.");
-      KJ_LOG(ERROR, kj::str("SourceInfo not found due to compilation error for ", strippedUri));
+      KJ_LOG(INFO, "No current compile results, using the syntax tree");
+    }
+
+    // Declarations in the buffer itself can still be found while the file
+    // is being edited or does not compile.
+    KJ_IF_MAYBE (
+        range, findLocalDefinition(strippedUri, Position{line, character})) {
+      setLocation(resultField.getValue(), strippedUri, *range);
+      return kj::READY_NOW;
     }
 
     resultField.getValue().setNull();
@@ -467,6 +1143,9 @@ LspMessageHandler::handleDidSave(const capnp::JsonValue::Reader &params) {
           if (docField.getName() == "uri") {
             auto uri = kj::heapString(docField.getValue().getString());
             KJ_LOG(INFO, "URI", uri.cStr());
+            KJ_IF_MAYBE (document, documents.find(uriToPath(uri))) {
+              (*document)->markSaved();
+            }
             return compileCapnpFile(uri);
           }
         }
@@ -499,6 +1178,8 @@ kj::Promise<void> LspMessageHandler::handleInitialize(
             }
           }
         }
+      } else if (field.getName() == "capabilities") {
+        pullDiagnostics = supportsPullDiagnostics(field.getValue());
       } else if (field.getName() == "initializationOptions") {
         auto initOptions = field.getValue().getObject();
         for (auto optField : initOptions) {
@@ -515,6 +1196,29 @@ kj::Promise<void> LspMessageHandler::handleInitialize(
                   importPaths.add(kj::heapString(path.getString()));
                 }
                 KJ_LOG(INFO, "Import paths configured");
+              } else if (
+                  configField.getName() == "memoryBudgetMB" &&
+                  configField.getValue().isNumber() &&
+                  configField.getValue().getNumber() > 0) {
+                memoryBudget.setLimit(
+                    static_cast<size_t>(configField.getValue().getNumber())
+                    << 20);
+                KJ_LOG(INFO, "Symbol memory budget set");
+              } else if (
+                  configField.getName() == "watchFiles" &&
+                  configField.getValue().isBoolean()) {
+                watchFiles = configField.getValue().getBoolean();
+              } else if (configField.getName() == "compileDaemon") {
+                auto value = configField.getValue();
+                if (value.isBoolean() && value.getBoolean()) {
+                  compilationManager->useCompileDaemon(
+                      CompileDaemonClient::Mode::PRIVATE);
+                  KJ_LOG(INFO, "Compiling through the compile daemon");
+                } else if (value.isString() && value.getString() == "shared") {
+                  compilationManager->useCompileDaemon(
+                      CompileDaemonClient::Mode::SHARED);
+                  KJ_LOG(INFO, "Compiling through the shared compile daemon");
+                }
               }
             }
           }
@@ -534,7 +1238,8 @@ kj::Promise<void> LspMessageHandler::handleInitialize(
   auto capsField = resultValue[0];
   capsField.setName("capabilities");
 
-  auto capabilities = capsField.getValue().initObject(4);
+  auto capabilities =
+      capsField.getValue().initObject(pullDiagnostics ? 17 : 16);
 
   // Set text document sync capability
   auto syncField = capabilities[0];
@@ -547,7 +1252,7 @@ kj::Promise<void> LspMessageHandler::handleInitialize(
 
   auto changeField = syncObj[1];
   changeField.setName("change");
-  changeField.getValue().setNumber(1);
+  changeField.getValue().setNumber(2); // Incremental
 
   auto saveField = syncObj[2];
   saveField.setName("save");
@@ -561,50 +1266,246 @@ kj::Promise<void> LspMessageHandler::handleInitialize(
   // Set completion provider capability
   auto compField = capabilities[2];
   compField.setName("completionProvider");
-  compField.getValue().setBoolean(true);
+  auto compObj = compField.getValue().initObject(1);
+  compObj[0].setName("triggerCharacters");
+  auto triggerCharacters = compObj[0].getValue().initArray(4);
+  triggerCharacters[0].setString(".");
+  triggerCharacters[1].setString("$");
+  triggerCharacters[2].setString(":");
+  triggerCharacters[3].setString("@");
 
   // Set workspace/didChangeWatchedFiles capability
   auto watchedFilesField = capabilities[3];
   watchedFilesField.setName("workspace/didChangeWatchedFiles");
   watchedFilesField.getValue().setBoolean(true);
 
+  // Set references provider capability
+  auto referencesField = capabilities[4];
+  referencesField.setName("referencesProvider");
+  referencesField.getValue().setBoolean(true);
+
+  // Set workspace symbol provider capability
+  auto workspaceSymbolField = capabilities[5];
+  workspaceSymbolField.setName("workspaceSymbolProvider");
+  workspaceSymbolField.getValue().setBoolean(true);
+
+  // Set document symbol provider capability
+  auto documentSymbolField = capabilities[6];
+  documentSymbolField.setName("documentSymbolProvider");
+  documentSymbolField.getValue().setBoolean(true);
+
+  // Set folding range provider capability
+  auto foldingRangeField = capabilities[7];
+  foldingRangeField.setName("foldingRangeProvider");
+  foldingRangeField.getValue().setBoolean(true);
+
+  // Set hover provider capability
+  auto hoverField = capabilities[8];
+  hoverField.setName("hoverProvider");
+  hoverField.getValue().setBoolean(true);
+
+  // Set semantic tokens provider capability
+  auto semanticTokensField = capabilities[9];
+  semanticTokensField.setName("semanticTokensProvider");
+  auto semanticTokensObj = semanticTokensField.getValue().initObject(2);
+  semanticTokensObj[0].setName("legend");
+  auto legendObj = semanticTokensObj[0].getValue().initObject(2);
+  legendObj[0].setName("tokenTypes");
+  auto tokenTypes = legendObj[0].getValue().initArray(
+      kj::size(SemanticTokensProvider::TOKEN_TYPES));
+  for (size_t i = 0; i < tokenTypes.size(); i++) {
+    tokenTypes[i].setString(SemanticTokensProvider::TOKEN_TYPES[i]);
+  }
+  legendObj[1].setName("tokenModifiers");
+  auto tokenModifiers = legendObj[1].getValue().initArray(
+      kj::size(SemanticTokensProvider::TOKEN_MODIFIERS));
+  for (size_t i = 0; i < tokenModifiers.size(); i++) {
+    tokenModifiers[i].setString(SemanticTokensProvider::TOKEN_MODIFIERS[i]);
+  }
+  semanticTokensObj[1].setName("full");
+  auto fullObj = semanticTokensObj[1].getValue().initObject(1);
+  fullObj[0].setName("delta");
+  fullObj[0].getValue().setBoolean(true);
+
+  // Set rename provider capability
+  auto renameField = capabilities[10];
+  renameField.setName("renameProvider");
+  auto renameObj = renameField.getValue().initObject(1);
+  renameObj[0].setName("prepareProvider");
+  renameObj[0].getValue().setBoolean(true);
+
+  // Set formatting provider capabilities
+  auto formattingField = capabilities[11];
+  formattingField.setName("documentFormattingProvider");
+  formattingField.getValue().setBoolean(true);
+
+  auto rangeFormattingField = capabilities[12];
+  rangeFormattingField.setName("documentRangeFormattingProvider");
+  rangeFormattingField.getValue().setBoolean(true);
+
+  auto onTypeFormattingField = capabilities[13];
+  onTypeFormattingField.setName("documentOnTypeFormattingProvider");
+  auto onTypeObj = onTypeFormattingField.getValue().initObject(2);
+  onTypeObj[0].setName("firstTriggerCharacter");
+  onTypeObj[0].getValue().setString("}");
+  onTypeObj[1].setName("moreTriggerCharacter");
+  auto moreTriggers = onTypeObj[1].getValue().initArray(2);
+  moreTriggers[0].setString(";");
+  moreTriggers[1].setString("\n");
+
+  // Set code action and command capabilities
+  auto codeActionField = capabilities[14];
+  codeActionField.setName("codeActionProvider");
+  auto codeActionObj = codeActionField.getValue().initObject(1);
+  codeActionObj[0].setName("codeActionKinds");
+  codeActionObj[0].getValue().initArray(1)[0].setString("quickfix");
+
+  auto executeCommandField = capabilities[15];
+  executeCommandField.setName("executeCommandProvider");
+  auto executeCommandObj = executeCommandField.getValue().initObject(1);
+  executeCommandObj[0].setName("commands");
+  executeCommandObj[0].getValue().initArray(1)[0].setString(
+      CodeActionProvider::GENERATE_ID_COMMAND);
+
+  if (pullDiagnostics) {
+    auto diagnosticField = capabilities[16];
+    diagnosticField.setName("diagnosticProvider");
+    auto diagnosticObj = diagnosticField.getValue().initObject(2);
+    // Ids and imports make one file's diagnostics depend on others.
+    diagnosticObj[0].setName("interFileDependencies");
+    diagnosticObj[0].getValue().setBoolean(true);
+    diagnosticObj[1].setName("workspaceDiagnostics");
+    diagnosticObj[1].getValue().setBoolean(true);
+  }
+
   return kj::READY_NOW;
 }
 
-kj::Promise<void> LspMessageHandler::handleDidOpenTextDocument(
-    const capnp::JsonValue::Reader &params) {
-  KJ_LOG(INFO, "Handling didOpenTextDocument notification");
-
+kj::Promise<void> LspMessageHandler::handleInitialized() {
+  if (workspacePath.size() == 0) {
+    return kj::READY_NOW;
+  }
+  if (watchFiles) {
+    startFileWatcher();
+  }
+  // Index the ids of the whole workspace up front, so that a collision with
+  // a file that was never opened is reported as soon as either side is.
   try {
-    auto paramsObj = params.getObject();
-    kj::String uri;
-
-    for (auto field : paramsObj) {
-      if (field.getName() == "textDocument") {
-        auto textDocument = field.getValue().getObject();
-        for (auto docField : textDocument) {
-          if (docField.getName() == "uri") {
-            uri = kj::heapString(docField.getValue().getString());
-          }
+    auto fs = kj::newDiskFilesystem();
+    auto workspace =
+        fs->getRoot().openSubdir(kj::Path::parse(workspacePath.slice(1)));
+    kj::HashSet<kj::String> affected;
+    size_t budget = MAX_ID_INDEXED_FILES;
+    auto indexFile = [&](kj::StringPtr filePath, kj::StringPtr text) {
+      if (documents.find(filePath) != nullptr) {
+        return;
+      }
+      auto ids = IdIndex::scan(text, Lexer::tokenize(text));
+      for (auto &file : idIndex.update(filePath, kj::mv(ids))) {
+        if (!affected.contains(file)) {
+          affected.insert(kj::mv(file));
         }
       }
+    };
+    forEachSchemaFile(*workspace, workspacePath, budget, indexFile);
+    for (auto &file : affected) {
+      publishLocalDiagnostics(file);
     }
-    return compileCapnpFile(uri);
-  } catch (kj::Exception &e) {
     KJ_LOG(
-        ERROR,
-        "Error processing didOpenTextDocument notification",
-        e.getDescription());
+        INFO,
+        "Indexed ids of schema files",
+        MAX_ID_INDEXED_FILES - budget,
+        affected.size());
+  } catch (kj::Exception &e) {
+    KJ_LOG(ERROR, "Error indexing workspace ids", e.getDescription());
   }
   return kj::READY_NOW;
 }
 
-kj::Promise<void> LspMessageHandler::handleFormatting(
-    const capnp::JsonValue::Reader &params,
-    capnp::MallocMessageBuilder &formattingResponseBuilder) {
+void LspMessageHandler::startFileWatcher() {
+  auto watcher = kj::heap<FileWatcher>(
+      context.getIoContext(), [this](kj::Array<kj::String> changedFiles) {
+        return handleWatchedChanges(kj::mv(changedFiles));
+      });
+  watcher->watch(workspacePath);
+  for (auto &importPath : importPaths) {
+    watcher->watch(
+        importPath.startsWith("/")
+            ? kj::heapString(importPath)
+            : kj::str(workspacePath, "/", importPath));
+  }
+  KJ_LOG(INFO, "Watching files", watcher->getWatchCount());
+  fileWatcher = kj::mv(watcher);
+}
+
+kj::Promise<void>
+LspMessageHandler::handleWatchedChanges(kj::Array<kj::String> changedFiles) {
+  // Saves of open documents are reported by the client and compiled then.
+  // An empty batch means the watcher lost track of what changed.
+  bool unknown = changedFiles.size() == 0;
+  kj::HashSet<kj::StringPtr> changedOnDisk;
+  for (auto &filePath : changedFiles) {
+    if (documents.find(filePath) == nullptr) {
+      reindexIds(filePath);
+      if (!changedOnDisk.contains(filePath)) {
+        changedOnDisk.insert(filePath);
+      }
+    }
+  }
+  if (!unknown && changedOnDisk.size() == 0) {
+    return kj::READY_NOW;
+  }
+  // Only the open schemas that import what changed, as of their last good
+  // compile, need compiling again. One whose closure is unknown or whose
+  // last compile failed may import it now. Compile them one at a time
+  // rather than all at once.
+  auto snapshot = snapshots.get();
+  kj::Vector<kj::String> uris;
+  for (auto &entry : documents) {
+    bool affected = unknown;
+    KJ_IF_MAYBE (closure, importClosures.find(entry.key)) {
+      for (auto &filePath : *closure) {
+        if (changedOnDisk.contains(filePath)) {
+          affected = true;
+          break;
+        }
+      }
+    } else {
+      affected = true;
+    }
+    KJ_IF_MAYBE (diagnostics, snapshot->findDiagnostics(entry.key)) {
+      for (auto &diagnostic : *diagnostics) {
+        if (diagnostic.severity == DiagnosticSeverity::Error) {
+          affected = true;
+        }
+      }
+    }
+    if (affected) {
+      uris.add(kj::str("file://", entry.key));
+    }
+  }
+  KJ_LOG(
+      INFO,
+      "Recompiling open documents",
+      changedFiles.size(),
+      uris.size(),
+      documents.size());
+  kj::Promise<void> compiles = kj::READY_NOW;
+  for (auto &uri : uris) {
+    compiles = compiles.then(
+        [this, uri = kj::mv(uri)]() { return compileCapnpFile(uri); });
+  }
+  return compiles;
+}
+
+kj::Promise<void> LspMessageHandler::handleDidOpenTextDocument(
+    const capnp::JsonValue::Reader &params) {
+  KJ_LOG(INFO, "Handling didOpenTextDocument notification");
+
   try {
     auto paramsObj = params.getObject();
     kj::String uri;
+    kj::String text;
 
     for (auto field : paramsObj) {
       if (field.getName() == "textDocument") {
@@ -612,12 +1513,17 @@ kj::Promise<void> LspMessageHandler::handleFormatting(
         for (auto docField : textDocument) {
           if (docField.getName() == "uri") {
             uri = kj::heapString(docField.getValue().getString());
+          } else if (docField.getName() == "text") {
+            text = kj::heapString(docField.getValue().getString());
           }
         }
       }
     }
-    KJ_LOG(ERROR, "Formatting capability is not implemented yet");
-    // TODO: Call CompilationManager::format
+    auto filePath = uriToPath(uri);
+    documents.upsert(
+        kj::heapString(filePath), kj::heap<Document>(kj::mv(text)));
+    reindexIds(filePath);
+    return compileCapnpFile(uri);
   } catch (kj::Exception &e) {
     KJ_LOG(
         ERROR,
@@ -627,4 +1533,790 @@ kj::Promise<void> LspMessageHandler::handleFormatting(
   return kj::READY_NOW;
 }
 
+kj::Promise<void>
+LspMessageHandler::handleDidChange(const capnp::JsonValue::Reader &params) {
+  try {
+    kj::Maybe<Document &> document;
+    kj::Maybe<kj::String> changedFile;
+    for (auto field : params.getObject()) {
+      if (field.getName() == "textDocument") {
+        for (auto docField : field.getValue().getObject()) {
+          if (docField.getName() == "uri") {
+            auto filePath = uriToPath(docField.getValue().getString());
+            KJ_IF_MAYBE (open, documents.find(filePath)) {
+              document = **open;
+              changedFile = kj::mv(filePath);
+            } else {
+              KJ_LOG(ERROR, "didChange for a closed document", filePath);
+            }
+          }
+        }
+      }
+    }
+    for (auto field : params.getObject()) {
+      if (field.getName() == "contentChanges") {
+        KJ_IF_MAYBE (target, document) {
+          // Changes apply in order, each to the result of the previous one.
+          for (auto change : field.getValue().getArray()) {
+            kj::Maybe<Range> range;
+            kj::StringPtr text;
+            for (auto changeField : change.getObject()) {
+              if (changeField.getName() == "range") {
+                range = parseRange(changeField.getValue());
+              } else if (changeField.getName() == "text") {
+                text = changeField.getValue().getString();
+              }
+            }
+            target->applyChange(range, text);
+          }
+        }
+      }
+    }
+    KJ_IF_MAYBE (changedPath, changedFile) {
+      reindexIds(*changedPath);
+      publishLocalDiagnostics(*changedPath);
+    }
+  } catch (kj::Exception &e) {
+    KJ_LOG(
+        ERROR, "Error processing didChange notification", e.getDescription());
+  }
+  return kj::READY_NOW;
+}
+
+kj::Promise<void>
+LspMessageHandler::handleDidClose(const capnp::JsonValue::Reader &params) {
+  try {
+    for (auto field : params.getObject()) {
+      if (field.getName() == "textDocument") {
+        for (auto docField : field.getValue().getObject()) {
+          if (docField.getName() == "uri") {
+            auto filePath = uriToPath(docField.getValue().getString());
+            documents.erase(filePath);
+            importClosures.erase(filePath);
+            outlineCache.erase(filePath);
+            semanticTokensCache.erase(filePath);
+            // Unsaved edits are gone: go back to the ids on disk and drop
+            // the ordinal diagnostics of the buffer.
+            reindexIds(filePath);
+            publishLocalDiagnostics(filePath);
+          }
+        }
+      }
+    }
+  } catch (kj::Exception &e) {
+    KJ_LOG(ERROR, "Error processing didClose notification", e.getDescription());
+  }
+  return kj::READY_NOW;
+}
+
+kj::Promise<void> LspMessageHandler::handleCompletion(
+    const capnp::JsonValue::Reader &params,
+    capnp::MallocMessageBuilder &completionResponseBuilder) {
+  KJ_LOG(INFO, "Handling completion request");
+
+  auto root = completionResponseBuilder.initRoot<capnp::JsonValue>();
+  auto resultObj = root.initObject(1);
+  auto resultField = resultObj[0];
+  resultField.setName(LSP_RESULT);
+
+  try {
+    auto request = parseTextDocumentPosition(params);
+    kj::String filePath = uriToPath(request.uri);
+    kj::String text = getDocumentText(filePath);
+
+    kj::Maybe<CompletionList> ordinals;
+    KJ_IF_MAYBE (document, documents.find(filePath)) {
+      ordinals =
+          CompletionProvider::completeOrdinal(**document, request.position);
+    }
+    CompletionList completion;
+    KJ_IF_MAYBE (list, ordinals) {
+      completion = kj::mv(*list);
+    } else {
+      completion = CompletionProvider::complete(
+          symbolTable, filePath, text, request.position);
+    }
+
+    auto listObj = resultField.getValue().initObject(2);
+    listObj[0].setName("isIncomplete");
+    listObj[0].getValue().setBoolean(completion.isIncomplete);
+    listObj[1].setName("items");
+    auto items = listObj[1].getValue().initArray(completion.items.size());
+    for (size_t i = 0; i < completion.items.size(); i++) {
+      auto &item = completion.items[i];
+      auto itemObj = items[i].initObject(item.textEdit == nullptr ? 4 : 5);
+      itemObj[0].setName("label");
+      itemObj[0].getValue().setString(item.label);
+      itemObj[1].setName("kind");
+      itemObj[1].getValue().setNumber(static_cast<int>(item.kind));
+      itemObj[2].setName("detail");
+      itemObj[2].getValue().setString(item.detail);
+      itemObj[3].setName("sortText");
+      itemObj[3].getValue().setString(item.sortText);
+      KJ_IF_MAYBE (edit, item.textEdit) {
+        itemObj[4].setName("textEdit");
+        auto editObj = itemObj[4].getValue().initObject(2);
+        editObj[0].setName("range");
+        setRange(editObj[0].getValue(), edit->range);
+        editObj[1].setName("newText");
+        editObj[1].getValue().setString(edit->newText);
+      }
+    }
+  } catch (kj::Exception &e) {
+    KJ_LOG(ERROR, "Error processing completion request", e.getDescription());
+    resultField.getValue().setNull();
+  }
+
+  return kj::READY_NOW;
+}
+
+kj::Promise<void> LspMessageHandler::handleReferences(
+    const capnp::JsonValue::Reader &params,
+    capnp::MallocMessageBuilder &referencesResponseBuilder) {
+  KJ_LOG(INFO, "Handling references request");
+
+  auto root = referencesResponseBuilder.initRoot<capnp::JsonValue>();
+  auto resultObj = root.initObject(1);
+  auto resultField = resultObj[0];
+  resultField.setName(LSP_RESULT);
+
+  try {
+    auto request = parseTextDocumentPosition(params);
+    bool includeDeclaration = false;
+    for (auto field : params.getObject()) {
+      if (field.getName() == "context") {
+        for (auto contextField : field.getValue().getObject()) {
+          if (contextField.getName() == "includeDeclaration") {
+            includeDeclaration = contextField.getValue().getBoolean();
+          }
+        }
+      }
+    }
+
+    kj::String filePath = uriToPath(request.uri);
+    KJ_IF_MAYBE (nodeId, findNodeIdAt(filePath, request.position)) {
+      kj::Maybe<Location> declaration;
+      if (includeDeclaration) {
+        declaration = snapshots.get()->findLocation(*nodeId);
+      }
+
+      size_t count = referenceIndex.countReferences(*nodeId);
+      auto locations = resultField.getValue().initArray(
+          count + (declaration == nullptr ? 0 : 1));
+      size_t i = 0;
+      KJ_IF_MAYBE (location, declaration) {
+        setLocation(locations[i++], location->uri, location->range);
+      }
+      referenceIndex.forEachReference(
+          *nodeId, [&](kj::StringPtr referencePath, const Range &range) {
+            setLocation(locations[i++], referencePath, range);
+          });
+      KJ_LOG(INFO, "Found references", *nodeId, count);
+      return kj::READY_NOW;
+    }
+
+    resultField.getValue().setNull();
+  } catch (kj::Exception &e) {
+    KJ_LOG(ERROR, "Error processing references request", e.getDescription());
+    resultField.getValue().setNull();
+  }
+
+  return kj::READY_NOW;
+}
+
+kj::Promise<void> LspMessageHandler::handleWorkspaceSymbol(
+    const capnp::JsonValue::Reader &params,
+    capnp::MallocMessageBuilder &workspaceSymbolResponseBuilder) {
+  KJ_LOG(INFO, "Handling workspace symbol request");
+
+  auto root = workspaceSymbolResponseBuilder.initRoot<capnp::JsonValue>();
+  auto resultObj = root.initObject(1);
+  auto resultField = resultObj[0];
+  resultField.setName(LSP_RESULT);
+
+  try {
+    kj::StringPtr query;
+    for (auto field : params.getObject()) {
+      if (field.getName() == "query") {
+        query = field.getValue().getString();
+      }
+    }
+
+    auto matches = symbolTable.search(query, MAX_WORKSPACE_SYMBOLS);
+    auto symbols = resultField.getValue().initArray(matches.size());
+    for (size_t i = 0; i < matches.size(); i++) {
+      auto &symbol = *matches[i].symbol;
+      auto symbolObj = symbols[i].initObject(4);
+      symbolObj[0].setName("name");
+      symbolObj[0].getValue().setString(symbol.name);
+      symbolObj[1].setName("kind");
+      symbolObj[1].getValue().setNumber(
+          static_cast<int>(toLspSymbolKind(symbol.kind)));
+      symbolObj[2].setName("location");
+      setLocation(
+          symbolObj[2].getValue(),
+          symbol.filePath,
+          symbolTable.rangeOf(symbol));
+      symbolObj[3].setName("containerName");
+      KJ_IF_MAYBE (parent, symbolTable.find(symbol.scopeId)) {
+        symbolObj[3].getValue().setString(parent->qualifiedName);
+      } else {
+        symbolObj[3].getValue().setString("");
+      }
+    }
+  } catch (kj::Exception &e) {
+    KJ_LOG(
+        ERROR, "Error processing workspace symbol request", e.getDescription());
+    resultField.getValue().setNull();
+  }
+
+  return kj::READY_NOW;
+}
+
+LspMessageHandler::CachedOutline &
+LspMessageHandler::getOutline(kj::StringPtr filePath) {
+  kj::Maybe<Document &> parsed;
+  KJ_IF_MAYBE (document, documents.find(filePath)) {
+    if (!hasCompiledState(filePath)) {
+      parsed = **document;
+    }
+  }
+  uint64_t revision = symbolTable.getRevision(filePath);
+  KJ_IF_MAYBE (document, parsed) {
+    revision = document->getVersion();
+  }
+  KJ_IF_MAYBE (cached, outlineCache.find(filePath)) {
+    if (cached->isParsed == (parsed != nullptr) &&
+        cached->revision == revision) {
+      return *cached;
+    }
+  }
+
+  kj::Vector<OutlineNode> outline;
+  KJ_IF_MAYBE (document, parsed) {
+    outline = OutlineProvider::buildOutline(*document);
+  } else {
+    outline = OutlineProvider::buildOutline(symbolTable, filePath);
+  }
+  auto documentSymbols = kj::heap<capnp::MallocMessageBuilder>();
+  setDocumentSymbols(documentSymbols->initRoot<capnp::JsonValue>(), outline);
+  auto foldingRanges = kj::heap<capnp::MallocMessageBuilder>();
+  setFoldingRanges(
+      foldingRanges->initRoot<capnp::JsonValue>(),
+      OutlineProvider::buildFoldingRanges(outline));
+
+  return outlineCache.upsert(
+      kj::heapString(filePath),
+      CachedOutline{
+          parsed != nullptr,
+          revision,
+          kj::mv(documentSymbols),
+          kj::mv(foldingRanges)},
+      [](CachedOutline &existing, CachedOutline &&replacement) {
+        existing = kj::mv(replacement);
+      })
+      .value;
+}
+
+kj::Promise<void> LspMessageHandler::handleDocumentSymbol(
+    const capnp::JsonValue::Reader &params,
+    capnp::MallocMessageBuilder &documentSymbolResponseBuilder) {
+  KJ_LOG(INFO, "Handling document symbol request");
+
+  auto root = documentSymbolResponseBuilder.initRoot<capnp::JsonValue>();
+  auto resultObj = root.initObject(1);
+  auto resultField = resultObj[0];
+  resultField.setName(LSP_RESULT);
+
+  try {
+    auto request = parseTextDocumentPosition(params);
+    auto &outline = getOutline(uriToPath(request.uri));
+    resultField.setValue(
+        outline.documentSymbols->getRoot<capnp::JsonValue>().asReader());
+  } catch (kj::Exception &e) {
+    KJ_LOG(
+        ERROR, "Error processing document symbol request", e.getDescription());
+    resultField.getValue().setNull();
+  }
+
+  return kj::READY_NOW;
+}
+
+kj::Promise<void> LspMessageHandler::handleFoldingRange(
+    const capnp::JsonValue::Reader &params,
+    capnp::MallocMessageBuilder &foldingRangeResponseBuilder) {
+  KJ_LOG(INFO, "Handling folding range request");
+
+  auto root = foldingRangeResponseBuilder.initRoot<capnp::JsonValue>();
+  auto resultObj = root.initObject(1);
+  auto resultField = resultObj[0];
+  resultField.setName(LSP_RESULT);
+
+  try {
+    auto request = parseTextDocumentPosition(params);
+    auto &outline = getOutline(uriToPath(request.uri));
+    resultField.setValue(
+        outline.foldingRanges->getRoot<capnp::JsonValue>().asReader());
+  } catch (kj::Exception &e) {
+    KJ_LOG(
+        ERROR, "Error processing folding range request", e.getDescription());
+    resultField.getValue().setNull();
+  }
+
+  return kj::READY_NOW;
+}
+
+kj::Promise<void> LspMessageHandler::handleHover(
+    const capnp::JsonValue::Reader &params,
+    capnp::MallocMessageBuilder &hoverResponseBuilder) {
+  KJ_LOG(INFO, "Handling hover request");
+
+  auto root = hoverResponseBuilder.initRoot<capnp::JsonValue>();
+  auto resultObj = root.initObject(1);
+  auto resultField = resultObj[0];
+  resultField.setName(LSP_RESULT);
+
+  try {
+    auto request = parseTextDocumentPosition(params);
+    kj::String filePath = uriToPath(request.uri);
+
+    kj::Maybe<kj::String> contents;
+    KJ_IF_MAYBE (nodeId, findNodeIdAt(filePath, request.position)) {
+      contents = HoverProvider::describeNode(schemaStore, *nodeId);
+    } else {
+      KJ_IF_MAYBE (
+          match, symbolTable.findMemberAt(filePath, request.position)) {
+        auto memberIndex = static_cast<uint32_t>(
+            match->member - match->symbol->members.begin());
+        contents = HoverProvider::describeMember(
+            schemaStore, match->symbol->id, memberIndex);
+      }
+    }
+
+    KJ_IF_MAYBE (text, contents) {
+      auto hoverObj = resultField.getValue().initObject(1);
+      hoverObj[0].setName("contents");
+      auto markupObj = hoverObj[0].getValue().initObject(2);
+      markupObj[0].setName("kind");
+      markupObj[0].getValue().setString("markdown");
+      markupObj[1].setName("value");
+      markupObj[1].getValue().setString(*text);
+      return kj::READY_NOW;
+    }
+    resultField.getValue().setNull();
+  } catch (kj::Exception &e) {
+    KJ_LOG(ERROR, "Error processing hover request", e.getDescription());
+    resultField.getValue().setNull();
+  }
+
+  return kj::READY_NOW;
+}
+
+LspMessageHandler::CachedSemanticTokens &
+LspMessageHandler::updateSemanticTokens(kj::StringPtr filePath) {
+  // Compiled identifier ranges only match the buffer until it is edited.
+  bool compiled = hasCompiledState(filePath);
+  auto snapshot = snapshots.get();
+  kj::Maybe<const kj::HashMap<Range, uint64_t> &> references;
+  if (compiled) {
+    references = snapshot->findReferences(filePath);
+  }
+  kj::Vector<uint32_t> data;
+  KJ_IF_MAYBE (document, documents.find(filePath)) {
+    data = SemanticTokensProvider::encode(
+        symbolTable,
+        references,
+        (*document)->getText(),
+        (*document)->getTokens());
+  } else {
+    auto text = getDocumentText(filePath);
+    auto tokens = Lexer::tokenize(text);
+    data = SemanticTokensProvider::encode(
+        symbolTable, references, text, tokens.asPtr());
+  }
+  return semanticTokensCache
+      .upsert(
+          kj::heapString(filePath),
+          CachedSemanticTokens{
+              kj::str(nextSemanticTokensResultId++), kj::mv(data)},
+          [](CachedSemanticTokens &existing,
+             CachedSemanticTokens &&replacement) {
+            existing = kj::mv(replacement);
+          })
+      .value;
+}
+
+kj::Promise<void> LspMessageHandler::handleSemanticTokensFull(
+    const capnp::JsonValue::Reader &params,
+    capnp::MallocMessageBuilder &semanticTokensResponseBuilder) {
+  auto root = semanticTokensResponseBuilder.initRoot<capnp::JsonValue>();
+  auto resultObj = root.initObject(1);
+  auto resultField = resultObj[0];
+  resultField.setName(LSP_RESULT);
+
+  try {
+    auto request = parseTextDocumentPosition(params);
+    auto &tokens = updateSemanticTokens(uriToPath(request.uri));
+    auto tokensObj = resultField.getValue().initObject(2);
+    tokensObj[0].setName("resultId");
+    tokensObj[0].getValue().setString(tokens.resultId);
+    tokensObj[1].setName("data");
+    setIntegers(tokensObj[1].getValue(), tokens.data.asPtr());
+  } catch (kj::Exception &e) {
+    KJ_LOG(
+        ERROR, "Error processing semantic tokens request", e.getDescription());
+    resultField.getValue().setNull();
+  }
+
+  return kj::READY_NOW;
+}
+
+kj::Promise<void> LspMessageHandler::handleSemanticTokensFullDelta(
+    const capnp::JsonValue::Reader &params,
+    capnp::MallocMessageBuilder &semanticTokensResponseBuilder) {
+  auto root = semanticTokensResponseBuilder.initRoot<capnp::JsonValue>();
+  auto resultObj = root.initObject(1);
+  auto resultField = resultObj[0];
+  resultField.setName(LSP_RESULT);
+
+  try {
+    auto request = parseTextDocumentPosition(params);
+    kj::String previousResultId;
+    for (auto field : params.getObject()) {
+      if (field.getName() == "previousResultId") {
+        previousResultId = kj::heapString(field.getValue().getString());
+      }
+    }
+
+    kj::String filePath = uriToPath(request.uri);
+    kj::Maybe<kj::Vector<uint32_t>> previous;
+    KJ_IF_MAYBE (cached, semanticTokensCache.find(filePath)) {
+      if (cached->resultId == previousResultId) {
+        previous = kj::mv(cached->data);
+      }
+    }
+
+    auto &tokens = updateSemanticTokens(filePath);
+    KJ_IF_MAYBE (previousData, previous) {
+      auto edit = SemanticTokensProvider::diff(
+          previousData->asPtr(), tokens.data.asPtr());
+      auto deltaObj = resultField.getValue().initObject(2);
+      deltaObj[0].setName("resultId");
+      deltaObj[0].getValue().setString(tokens.resultId);
+      deltaObj[1].setName("edits");
+      if (edit.deleteCount == 0 && edit.data.size() == 0) {
+        deltaObj[1].getValue().initArray(0);
+      } else {
+        auto edits = deltaObj[1].getValue().initArray(1);
+        auto editObj = edits[0].initObject(3);
+        editObj[0].setName("start");
+        editObj[0].getValue().setNumber(edit.start);
+        editObj[1].setName("deleteCount");
+        editObj[1].getValue().setNumber(edit.deleteCount);
+        editObj[2].setName("data");
+        setIntegers(editObj[2].getValue(), edit.data);
+      }
+    } else {
+      // Unknown or stale previousResultId: fall back to a full response.
+      auto tokensObj = resultField.getValue().initObject(2);
+      tokensObj[0].setName("resultId");
+      tokensObj[0].getValue().setString(tokens.resultId);
+      tokensObj[1].setName("data");
+      setIntegers(tokensObj[1].getValue(), tokens.data.asPtr());
+    }
+  } catch (kj::Exception &e) {
+    KJ_LOG(
+        ERROR,
+        "Error processing semantic tokens delta request",
+        e.getDescription());
+    resultField.getValue().setNull();
+  }
+
+  return kj::READY_NOW;
+}
+
+kj::Maybe<RenameTarget>
+LspMessageHandler::findRenameTarget(kj::StringPtr filePath, Position position) {
+  return RenameProvider::prepare(
+      symbolTable,
+      findNodeIdAt(filePath, position),
+      filePath,
+      getDocumentText(filePath),
+      position);
+}
+
+kj::Promise<void> LspMessageHandler::handlePrepareRename(
+    const capnp::JsonValue::Reader &params,
+    capnp::MallocMessageBuilder &prepareRenameResponseBuilder) {
+  auto root = prepareRenameResponseBuilder.initRoot<capnp::JsonValue>();
+  auto resultObj = root.initObject(1);
+  auto resultField = resultObj[0];
+  resultField.setName(LSP_RESULT);
+
+  try {
+    auto request = parseTextDocumentPosition(params);
+    KJ_IF_MAYBE (
+        target, findRenameTarget(uriToPath(request.uri), request.position)) {
+      auto prepareObj = resultField.getValue().initObject(2);
+      prepareObj[0].setName("range");
+      setRange(prepareObj[0].getValue(), target->range);
+      prepareObj[1].setName("placeholder");
+      prepareObj[1].getValue().setString(target->name);
+      return kj::READY_NOW;
+    }
+    resultField.getValue().setNull();
+  } catch (kj::Exception &e) {
+    KJ_LOG(
+        ERROR, "Error processing prepareRename request", e.getDescription());
+    resultField.getValue().setNull();
+  }
+
+  return kj::READY_NOW;
+}
+
+kj::Promise<void> LspMessageHandler::handleRename(
+    const capnp::JsonValue::Reader &params,
+    capnp::MallocMessageBuilder &renameResponseBuilder) {
+  KJ_LOG(INFO, "Handling rename request");
+
+  auto root = renameResponseBuilder.initRoot<capnp::JsonValue>();
+  auto resultObj = root.initObject(1);
+  auto resultField = resultObj[0];
+  resultField.setName(LSP_RESULT);
+  resultField.getValue().setNull();
+
+  try {
+    auto request = parseTextDocumentPosition(params);
+    kj::String newName;
+    for (auto field : params.getObject()) {
+      if (field.getName() == "newName") {
+        newName = kj::heapString(field.getValue().getString());
+      }
+    }
+    if (!RenameProvider::isValidName(newName)) {
+      KJ_LOG(ERROR, "Invalid name for rename", newName);
+      return kj::READY_NOW;
+    }
+
+    KJ_IF_MAYBE (
+        target, findRenameTarget(uriToPath(request.uri), request.position)) {
+      auto renames = RenameProvider::computeEdits(
+          symbolTable, referenceIndex, documents, *target, newName);
+      if (renames.size() == 0) {
+        return kj::READY_NOW;
+      }
+
+      kj::HashMap<kj::String, kj::String> editedFiles;
+      for (auto &rename : renames) {
+        editedFiles.insert(
+            kj::heapString(rename.filePath), kj::mv(rename.newText));
+      }
+      auto verification =
+          compilationManager->verify(CompilationManager::VerifyParams{
+              .compilerPath = compilerPath,
+              .importPaths = importPaths,
+              .workingDir = workspacePath,
+              .files = editedFiles});
+
+      return verification
+          .then([resultField, renames = kj::mv(renames)](
+                    bool isValid) mutable {
+            if (!isValid) {
+              KJ_LOG(ERROR, "Rename rejected, edited schemas do not compile");
+              return;
+            }
+            auto workspaceEditObj = resultField.getValue().initObject(1);
+            workspaceEditObj[0].setName("changes");
+            auto changes = workspaceEditObj[0].getValue().initObject(
+                renames.size());
+            for (size_t i = 0; i < renames.size(); i++) {
+              changes[i].setName(kj::str("file://", renames[i].filePath));
+              auto edits =
+                  changes[i].getValue().initArray(renames[i].edits.size());
+              for (size_t j = 0; j < renames[i].edits.size(); j++) {
+                auto &edit = renames[i].edits[j];
+                auto editObj = edits[j].initObject(2);
+                editObj[0].setName("range");
+                setRange(editObj[0].getValue(), edit.range);
+                editObj[1].setName("newText");
+                editObj[1].getValue().setString(edit.newText);
+              }
+            }
+            KJ_LOG(INFO, "Rename touches files", renames.size());
+          })
+          .attach(kj::mv(editedFiles));
+    }
+  } catch (kj::Exception &e) {
+    KJ_LOG(ERROR, "Error processing rename request", e.getDescription());
+  }
+
+  return kj::READY_NOW;
+}
+
+kj::Promise<void> LspMessageHandler::handleFormatting(
+    const capnp::JsonValue::Reader &params,
+    capnp::MallocMessageBuilder &formattingResponseBuilder) {
+  return formatDocument(params, nullptr, formattingResponseBuilder);
+}
+
+kj::Promise<void> LspMessageHandler::handleRangeFormatting(
+    const capnp::JsonValue::Reader &params,
+    capnp::MallocMessageBuilder &formattingResponseBuilder) {
+  kj::Maybe<Range> range;
+  for (auto field : params.getObject()) {
+    if (field.getName() == "range") {
+      range = parseRange(field.getValue());
+    }
+  }
+  return formatDocument(params, range, formattingResponseBuilder);
+}
+
+kj::Promise<void> LspMessageHandler::handleOnTypeFormatting(
+    const capnp::JsonValue::Reader &params,
+    capnp::MallocMessageBuilder &formattingResponseBuilder) {
+  auto request = parseTextDocumentPosition(params);
+  kj::StringPtr ch;
+  for (auto field : params.getObject()) {
+    if (field.getName() == "ch") {
+      ch = field.getValue().getString();
+    }
+  }
+  // After a line break the line that was just finished is formatted,
+  // otherwise the line the character was typed on.
+  uint32_t line = request.position.line;
+  if (ch == "\n" && line > 1) {
+    line--;
+  }
+  return formatDocument(
+      params,
+      Range{{line, 1}, {line, UINT32_MAX}},
+      formattingResponseBuilder);
+}
+
+kj::Promise<void> LspMessageHandler::handleCodeAction(
+    const capnp::JsonValue::Reader &params,
+    capnp::MallocMessageBuilder &codeActionResponseBuilder) {
+  KJ_LOG(INFO, "Handling codeAction request");
+
+  auto root = codeActionResponseBuilder.initRoot<capnp::JsonValue>();
+  auto resultObj = root.initObject(1);
+  auto resultField = resultObj[0];
+  resultField.setName(LSP_RESULT);
+  resultField.getValue().setNull();
+
+  try {
+    auto request = parseTextDocumentPosition(params);
+    Range range{{1, 1}, {1, 1}};
+    for (auto field : params.getObject()) {
+      if (field.getName() == "range") {
+        range = parseRange(field.getValue());
+      }
+    }
+    auto filePath = uriToPath(request.uri);
+    KJ_IF_MAYBE (document, documents.find(filePath)) {
+      auto actions =
+          CodeActionProvider::compute(**document, filePath, range, idIndex);
+      auto actionArray = resultField.getValue().initArray(actions.size());
+      for (size_t i = 0; i < actions.size(); i++) {
+        auto &action = actions[i];
+        auto actionObj = actionArray[i].initObject(4);
+        actionObj[0].setName("title");
+        actionObj[0].getValue().setString(action.title);
+        actionObj[1].setName("kind");
+        actionObj[1].getValue().setString("quickfix");
+        actionObj[2].setName("isPreferred");
+        actionObj[2].getValue().setBoolean(action.isPreferred);
+        actionObj[3].setName("edit");
+        auto changes = actionObj[3].getValue().initObject(1);
+        changes[0].setName("changes");
+        auto fileChanges = changes[0].getValue().initObject(1);
+        fileChanges[0].setName(request.uri);
+        auto edits = fileChanges[0].getValue().initArray(action.edits.size());
+        for (size_t j = 0; j < action.edits.size(); j++) {
+          auto editObj = edits[j].initObject(2);
+          editObj[0].setName("range");
+          setRange(editObj[0].getValue(), action.edits[j].range);
+          editObj[1].setName("newText");
+          editObj[1].getValue().setString(action.edits[j].newText);
+        }
+      }
+    }
+  } catch (kj::Exception &e) {
+    KJ_LOG(ERROR, "Error processing codeAction request", e.getDescription());
+  }
+  return kj::READY_NOW;
+}
+
+kj::Promise<void> LspMessageHandler::handleExecuteCommand(
+    const capnp::JsonValue::Reader &params,
+    capnp::MallocMessageBuilder &executeCommandResponseBuilder) {
+  auto root = executeCommandResponseBuilder.initRoot<capnp::JsonValue>();
+  auto resultObj = root.initObject(1);
+  auto resultField = resultObj[0];
+  resultField.setName(LSP_RESULT);
+  resultField.getValue().setNull();
+
+  try {
+    for (auto field : params.getObject()) {
+      if (field.getName() != "command") {
+        continue;
+      }
+      auto command = field.getValue().getString();
+      if (command == CodeActionProvider::GENERATE_ID_COMMAND) {
+        resultField.getValue().setString(
+            IdIndex::formatId(idIndex.generateUniqueId()));
+      } else {
+        KJ_LOG(ERROR, "Unknown command", command);
+      }
+    }
+  } catch (kj::Exception &e) {
+    KJ_LOG(
+        ERROR, "Error processing executeCommand request", e.getDescription());
+  }
+  return kj::READY_NOW;
+}
+
+kj::Promise<void> LspMessageHandler::formatDocument(
+    const capnp::JsonValue::Reader &params,
+    kj::Maybe<Range> range,
+    capnp::MallocMessageBuilder &formattingResponseBuilder) {
+  auto root = formattingResponseBuilder.initRoot<capnp::JsonValue>();
+  auto resultObj = root.initObject(1);
+  auto resultField = resultObj[0];
+  resultField.setName(LSP_RESULT);
+
+  try {
+    auto request = parseTextDocumentPosition(params);
+    FormattingOptions options;
+    for (auto field : params.getObject()) {
+      if (field.getName() == "options") {
+        for (auto option : field.getValue().getObject()) {
+          if (option.getName() == "tabSize") {
+            options.tabSize = option.getValue().getNumber();
+          } else if (option.getName() == "insertSpaces") {
+            options.insertSpaces = option.getValue().getBoolean();
+          }
+        }
+      }
+    }
+
+    auto text = getDocumentText(uriToPath(request.uri));
+    auto edits = compilationManager->format(
+        CompilationManager::FormatParams{text, options, range});
+    auto editArray = resultField.getValue().initArray(edits.size());
+    for (size_t i = 0; i < edits.size(); i++) {
+      auto editObj = editArray[i].initObject(2);
+      editObj[0].setName("range");
+      setRange(editObj[0].getValue(), edits[i].range);
+      editObj[1].setName("newText");
+      editObj[1].getValue().setString(edits[i].newText);
+    }
+    KJ_LOG(INFO, "Formatting edits", edits.size());
+  } catch (kj::Exception &e) {
+    KJ_LOG(ERROR, "Error processing formatting request", e.getDescription());
+    resultField.getValue().setNull();
+  }
+  return kj::READY_NOW;
+}
+
 } // namespace capnp_ls
\ No newline at end of file
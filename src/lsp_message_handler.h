@@ -5,10 +5,24 @@
 
 #pragma once
 
+#include "code_action_provider.h"
 #include "compilation_manager.h"
+#include "completion_provider.h"
+#include "document.h"
+#include "file_watcher.h"
+#include "hover_provider.h"
+#include "id_index.h"
 #include "lsp_types.h"
+#include "memory_budget.h"
+#include "outline_provider.h"
+#include "reference_index.h"
+#include "rename_provider.h"
+#include "schema_store.h"
+#include "semantic_tokens_provider.h"
 #include "server_context.h"
 #include "stdout_writer.h"
+#include "symbol_snapshot.h"
+#include "symbol_table.h"
 #include "utils.h"
 #include <capnp/compat/json.h>
 #include <kj/async.h>
@@ -21,8 +35,17 @@ namespace capnp_ls {
 
 class LspMessageHandler {
 public:
+  static constexpr size_t MAX_WORKSPACE_SYMBOLS = 128;
+  // Schema files read for the id index when the workspace is opened.
+  static constexpr size_t MAX_ID_INDEXED_FILES = 10000;
+
   LspMessageHandler(ServerContext &serverContext, StdoutWriter &stdoutWriter);
-  kj::Promise<void> handleMessage(kj::Maybe<kj::String> message);
+  // Parses one framed message (headers included) into a JsonValue. Uses no
+  // handler state, so it runs on the stdin reader thread.
+  static kj::Own<capnp::MallocMessageBuilder> decode(kj::StringPtr message);
+  // Null at the end of input.
+  kj::Promise<void>
+  handleMessage(kj::Maybe<kj::Own<capnp::MallocMessageBuilder>> message);
 
 private:
   kj::Maybe<kj::String>
@@ -37,22 +60,156 @@ private:
   kj::Promise<void> handleInitialize(
       const capnp::JsonValue::Reader &params,
       capnp::MallocMessageBuilder &initializeResponseBuilder);
+  kj::Promise<void> handleInitialized();
   kj::Promise<void>
   handleDidOpenTextDocument(const capnp::JsonValue::Reader &params);
+  kj::Promise<void> handleDidChange(const capnp::JsonValue::Reader &params);
+  kj::Promise<void> handleDidClose(const capnp::JsonValue::Reader &params);
+  kj::Promise<void> handleCompletion(
+      const capnp::JsonValue::Reader &params,
+      capnp::MallocMessageBuilder &completionResponseBuilder);
+  kj::Promise<void> handleReferences(
+      const capnp::JsonValue::Reader &params,
+      capnp::MallocMessageBuilder &referencesResponseBuilder);
+  kj::Promise<void> handleWorkspaceSymbol(
+      const capnp::JsonValue::Reader &params,
+      capnp::MallocMessageBuilder &workspaceSymbolResponseBuilder);
+  kj::Promise<void> handleDocumentSymbol(
+      const capnp::JsonValue::Reader &params,
+      capnp::MallocMessageBuilder &documentSymbolResponseBuilder);
+  kj::Promise<void> handleFoldingRange(
+      const capnp::JsonValue::Reader &params,
+      capnp::MallocMessageBuilder &foldingRangeResponseBuilder);
+  kj::Promise<void> handleHover(
+      const capnp::JsonValue::Reader &params,
+      capnp::MallocMessageBuilder &hoverResponseBuilder);
+  kj::Promise<void> handleSemanticTokensFull(
+      const capnp::JsonValue::Reader &params,
+      capnp::MallocMessageBuilder &semanticTokensResponseBuilder);
+  kj::Promise<void> handleSemanticTokensFullDelta(
+      const capnp::JsonValue::Reader &params,
+      capnp::MallocMessageBuilder &semanticTokensResponseBuilder);
+  kj::Promise<void> handlePrepareRename(
+      const capnp::JsonValue::Reader &params,
+      capnp::MallocMessageBuilder &prepareRenameResponseBuilder);
+  kj::Promise<void> handleRename(
+      const capnp::JsonValue::Reader &params,
+      capnp::MallocMessageBuilder &renameResponseBuilder);
   kj::Promise<void> handleFormatting(
       const capnp::JsonValue::Reader &params,
       capnp::MallocMessageBuilder &formattingResponseBuilder);
+  kj::Promise<void> handleRangeFormatting(
+      const capnp::JsonValue::Reader &params,
+      capnp::MallocMessageBuilder &formattingResponseBuilder);
+  kj::Promise<void> handleOnTypeFormatting(
+      const capnp::JsonValue::Reader &params,
+      capnp::MallocMessageBuilder &formattingResponseBuilder);
+  kj::Promise<void> handleCodeAction(
+      const capnp::JsonValue::Reader &params,
+      capnp::MallocMessageBuilder &codeActionResponseBuilder);
+  kj::Promise<void> handleExecuteCommand(
+      const capnp::JsonValue::Reader &params,
+      capnp::MallocMessageBuilder &executeCommandResponseBuilder);
+  kj::Promise<void> handleDocumentDiagnostic(
+      const capnp::JsonValue::Reader &params,
+      capnp::MallocMessageBuilder &diagnosticResponseBuilder);
+  kj::Promise<void> handleWorkspaceDiagnostic(
+      const capnp::JsonValue::Reader &params,
+      capnp::MallocMessageBuilder &diagnosticResponseBuilder);
+  kj::Promise<void> formatDocument(
+      const capnp::JsonValue::Reader &params,
+      kj::Maybe<Range> range,
+      capnp::MallocMessageBuilder &formattingResponseBuilder);
   kj::Promise<void> publishDiagnostics(kj::StringPtr fileName);
+  void publishLocalDiagnostics(kj::StringPtr filePath);
+  kj::Vector<Diagnostic> collectLocalDiagnostics(kj::StringPtr filePath);
+  void sendDiagnostics(
+      kj::StringPtr filePath,
+      kj::ArrayPtr<const Diagnostic> compiled);
+  // Writes a full or, if `previousResultId` still matches, an unchanged
+  // diagnostic report of a file.
+  void setDiagnosticReport(
+      capnp::JsonValue::Builder value,
+      const SymbolSnapshot &snapshot,
+      kj::StringPtr filePath,
+      kj::StringPtr previousResultId,
+      bool isWorkspaceItem);
+  void requestDiagnosticRefresh();
+  kj::String toWorkspaceUri(kj::StringPtr filePath);
+
+  // Identifier ranges, node locations and diagnostics of the latest
+  // compile. Queries take a reference to one version and keep it for the
+  // rest of the request.
+  SymbolSnapshots snapshots{SymbolSnapshot::empty()};
+  // What each file's symbols hold across `snapshots`, `symbolTable`,
+  // `referenceIndex` and `schemaStore`. When over budget, closed files that
+  // no open document imports are forgotten until a compile reaches them
+  // again.
+  MemoryBudget memoryBudget;
+  SymbolTable symbolTable;
+  ReferenceIndex referenceIndex;
+  SchemaStore schemaStore;
+  // Open documents, keyed by file path.
+  DocumentMap documents;
+  // Files the last successful compile of each open document resolved.
+  kj::HashMap<kj::String, kj::Array<kj::String>> importClosures;
+  // Ids declared in the workspace, from open buffers and files on disk.
+  IdIndex idIndex;
+  // Number of diagnostics found without the compiler (ordinals and ids)
+  // last published for each file.
+  kj::HashMap<kj::String, size_t> localDiagnosticCounts;
+  // Whether the client pulls diagnostics (textDocument/diagnostic) and is
+  // asked to pull again instead of being sent publishDiagnostics.
+  bool pullDiagnostics = false;
+  uint64_t nextServerRequestId = 1;
+
+  // Encoded documentSymbol/foldingRange results of a file, valid while the
+  // symbol table still holds the revision they were built from or, for an
+  // outline parsed from the buffer, while the document is at that version.
+  struct CachedOutline {
+    bool isParsed;
+    uint64_t revision;
+    kj::Own<capnp::MallocMessageBuilder> documentSymbols;
+    kj::Own<capnp::MallocMessageBuilder> foldingRanges;
+  };
+  kj::HashMap<kj::String, CachedOutline> outlineCache;
 
-  kj::HashMap<kj::String, kj::HashMap<Range, uint64_t>> fileSourceInfoMap;
-  kj::HashMap<uint64_t, kj::Own<Location>> nodeLocationMap;
-  kj::HashMap<kj::String, kj::Vector<Diagnostic>> diagnosticMap;
+  // Last semantic tokens sent for each document, so that a delta request can
+  // be answered with the changed span only.
+  struct CachedSemanticTokens {
+    kj::String resultId;
+    kj::Vector<uint32_t> data;
+  };
+  kj::HashMap<kj::String, CachedSemanticTokens> semanticTokensCache;
+  uint64_t nextSemanticTokensResultId = 1;
   kj::String workspacePath;
   kj::String compilerPath;
   kj::Vector<kj::String> importPaths;
   ServerContext &context;
   kj::Own<CompilationManager> compilationManager;
   StdoutWriter &stdoutWriter;
+  // Set by the watchFiles option. Watches the workspace and import paths on
+  // disk, for changes the client does not report.
+  bool watchFiles = false;
+  kj::Maybe<kj::Own<FileWatcher>> fileWatcher;
+  void startFileWatcher();
+  kj::Promise<void> handleWatchedChanges(kj::Array<kj::String> changedFiles);
   kj::Promise<void> compileCapnpFile(kj::StringPtr uri);
+  kj::String getDocumentText(kj::StringPtr filePath);
+  void reindexIds(kj::StringPtr filePath);
+  bool hasCompiledState(kj::StringPtr filePath);
+  // Updates `memoryBudget` after a compile of `compiledFile` that resolved
+  // `resolvedFiles`, and evicts over it.
+  void accountSymbols(
+      kj::StringPtr compiledFile,
+      kj::Array<kj::String> resolvedFiles);
+  void evictSymbols(kj::ArrayPtr<const kj::String> filePaths);
+  kj::Maybe<Range>
+  findLocalDefinition(kj::StringPtr filePath, Position position);
+  kj::Maybe<uint64_t> findNodeIdAt(kj::StringPtr filePath, Position position);
+  CachedOutline &getOutline(kj::StringPtr filePath);
+  CachedSemanticTokens &updateSemanticTokens(kj::StringPtr filePath);
+  kj::Maybe<RenameTarget>
+  findRenameTarget(kj::StringPtr filePath, Position position);
 };
 } // namespace capnp_ls
\ No newline at end of file
@@ -8,6 +8,7 @@
 #include <iostream>
 #include <kj/map.h>
 #include <kj/string.h>
+#include <kj/vector.h>
 #include <cstdint>
 
 namespace capnp_ls {
@@ -38,7 +39,24 @@ constexpr const char LSP_RESULT[] = "result";
   MACRO(INITIALIZED, "initialized")                                            \
   MACRO(SET_TRACE, "$/setTrace")                                               \
   MACRO(CANCEL_REQUEST, "$/cancelRequest")                                     \
-  MACRO(FORMATTING, "textDocument/formatting")
+  MACRO(DID_CLOSE, "textDocument/didClose")                                    \
+  MACRO(COMPLETION, "textDocument/completion")                                 \
+  MACRO(REFERENCES, "textDocument/references")                                 \
+  MACRO(WORKSPACE_SYMBOL, "workspace/symbol")                                  \
+  MACRO(DOCUMENT_SYMBOL, "textDocument/documentSymbol")                        \
+  MACRO(FOLDING_RANGE, "textDocument/foldingRange")                            \
+  MACRO(HOVER, "textDocument/hover")                                           \
+  MACRO(SEMANTIC_TOKENS_FULL, "textDocument/semanticTokens/full")              \
+  MACRO(SEMANTIC_TOKENS_FULL_DELTA, "textDocument/semanticTokens/full/delta")  \
+  MACRO(PREPARE_RENAME, "textDocument/prepareRename")                          \
+  MACRO(RENAME, "textDocument/rename")                                         \
+  MACRO(FORMATTING, "textDocument/formatting")                                 \
+  MACRO(RANGE_FORMATTING, "textDocument/rangeFormatting")                      \
+  MACRO(ON_TYPE_FORMATTING, "textDocument/onTypeFormatting")                   \
+  MACRO(CODE_ACTION, "textDocument/codeAction")                                \
+  MACRO(EXECUTE_COMMAND, "workspace/executeCommand")                           \
+  MACRO(DOCUMENT_DIAGNOSTIC, "textDocument/diagnostic")                        \
+  MACRO(WORKSPACE_DIAGNOSTIC, "workspace/diagnostic")
 
 enum class LspMethod {
 #define DECLARE_METHOD(id, name) id,
@@ -78,6 +96,11 @@ struct Location {
   Range range;
 };
 
+struct TextEdit {
+  Range range;
+  kj::String newText;
+};
+
 enum class DiagnosticSeverity {
   Error = 1,
   Warning = 2,
@@ -92,6 +115,49 @@ struct Diagnostic {
   kj::String source; // "capnp-compiler"
 };
 
+enum class CompletionItemKind {
+  Method = 2,
+  Field = 5,
+  Interface = 8,
+  Module = 9,
+  Property = 10,
+  Value = 12,
+  Enum = 13,
+  Keyword = 14,
+  Reference = 18,
+  EnumMember = 20,
+  Constant = 21,
+  Struct = 22
+};
+
+enum class LspSymbolKind {
+  File = 1,
+  Method = 6,
+  Property = 7,
+  Field = 8,
+  Enum = 10,
+  Interface = 11,
+  Constant = 14,
+  EnumMember = 22,
+  Struct = 23
+};
+
+struct CompletionItem {
+  kj::String label;
+  CompletionItemKind kind;
+  kj::String detail;
+  kj::String sortText;
+  // Replaces the given range instead of the word at the cursor.
+  kj::Maybe<TextEdit> textEdit;
+};
+
+// A quick fix whose edits all apply to the document it was requested for.
+struct CodeAction {
+  kj::String title;
+  kj::Vector<TextEdit> edits;
+  bool isPreferred;
+};
+
 struct CompileError {
   kj::String file;
   uint32_t rowStart;
@@ -3,11 +3,14 @@
 // Licensed under the MIT License.
 // See LICENSE file in the project root for full license information.
 
+#include "compile_daemon.h"
 #include "logger.h"
 #include "lsp_message_handler.h"
 #include "server_context.h"
 #include "stdin_reader.h"
 #include "stdout_writer.h"
+#include "subprocess_runner.h"
+#include "workspace_check.h"
 #include <kj/async-io.h>
 #include <kj/async-unix.h>
 #include <kj/debug.h>
@@ -44,14 +47,12 @@ int run() {
                 context.shutdown();
               }));
 
-  auto stdout_stream = ioContext.lowLevelProvider->wrapOutputFd(STDOUT_FILENO);
-  StdoutWriter stdout_writer(kj::mv(stdout_stream));
+  StdoutWriter stdout_writer;
   LspLogger logger(stdout_writer);
 
   auto handler = kj::heap<LspMessageHandler>(context, stdout_writer);
 
-  auto stdin_stream = ioContext.lowLevelProvider->wrapInputFd(STDIN_FILENO);
-  StdinReader stdin_reader(kj::mv(stdin_stream), *handler);
+  StdinReader stdin_reader(*handler);
 
   paf.promise.exclusiveJoin(kj::mv(signalPromise)).wait(ioContext.waitScope);
 
@@ -62,5 +63,24 @@ int run() {
 } // namespace capnp_ls
 
 int main(int argc, char *argv[]) {
+  // Execs the compiler right away; nothing of the server is set up.
+  if (argc >= 2 &&
+      kj::StringPtr(argv[1]) == capnp_ls::SubprocessRunner::LIMIT_FLAG) {
+    return capnp_ls::runLimited(argc, argv);
+  }
+  // Compilers are reaped by the event loop, in every mode; this has to come
+  // before any thread is started.
+  kj::UnixEventPort::captureChildExit();
+  if (argc >= 2 &&
+      kj::StringPtr(argv[1]) == capnp_ls::CompileDaemonClient::DAEMON_FLAG) {
+    if (argc == 3 &&
+        kj::StringPtr(argv[2]) == capnp_ls::CompileDaemonClient::SHARED_FLAG) {
+      return capnp_ls::runSharedCompileDaemon();
+    }
+    return capnp_ls::runCompileDaemon();
+  }
+  if (argc >= 2 && kj::StringPtr(argv[1]) == "check") {
+    return capnp_ls::runWorkspaceCheck(argc - 1, argv + 1);
+  }
   return capnp_ls::run();
 }
\ No newline at end of file
@@ -0,0 +1,62 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#include "memory_budget.h"
+#include <algorithm>
+
+namespace capnp_ls {
+
+MemoryBudget::Entry &MemoryBudget::findOrCreate(kj::StringPtr filePath) {
+  return files.findOrCreate(filePath, [&]() -> FileMap::Entry {
+    return {kj::heapString(filePath), Entry{.lastUsed = ++clock}};
+  });
+}
+
+void MemoryBudget::setSize(kj::StringPtr filePath, size_t bytes) {
+  auto &entry = findOrCreate(filePath);
+  if (entry.evicted) {
+    if (bytes == 0) {
+      return;
+    }
+    entry.evicted = false;
+  }
+  total = total - entry.bytes + bytes;
+  entry.bytes = bytes;
+}
+
+void MemoryBudget::touch(kj::StringPtr filePath) {
+  findOrCreate(filePath).lastUsed = ++clock;
+}
+
+kj::Vector<kj::String> MemoryBudget::collectEvictions(
+    kj::FunctionParam<bool(kj::StringPtr)> isPinned) {
+  kj::Vector<kj::String> evicted;
+  if (total <= limit) {
+    return evicted;
+  }
+  kj::Vector<FileMap::Entry *> candidates;
+  for (auto &entry : files) {
+    if (entry.value.bytes > 0 && !isPinned(entry.key)) {
+      candidates.add(&entry);
+    }
+  }
+  std::sort(
+      candidates.begin(), candidates.end(), [](auto *left, auto *right) {
+        return left->value.lastUsed < right->value.lastUsed;
+      });
+  for (auto *candidate : candidates) {
+    if (total <= limit) {
+      break;
+    }
+    total -= candidate->value.bytes;
+    candidate->value.bytes = 0;
+    candidate->value.evicted = true;
+    evicted.add(kj::heapString(candidate->key));
+  }
+  evictionCount += evicted.size();
+  return evicted;
+}
+
+} // namespace capnp_ls
@@ -0,0 +1,65 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <kj/function.h>
+#include <kj/map.h>
+#include <kj/string.h>
+#include <kj/vector.h>
+
+namespace capnp_ls {
+
+// Accounts the memory held by each file's symbol data and picks what to drop
+// once the total outgrows a limit: the least recently used files first,
+// skipping pinned ones. Dropped files are remembered as evicted until their
+// data comes back.
+class MemoryBudget {
+public:
+  static constexpr size_t DEFAULT_LIMIT_BYTES = 256 << 20;
+
+  explicit MemoryBudget(size_t limitBytes = DEFAULT_LIMIT_BYTES)
+      : limit(limitBytes) {}
+  KJ_DISALLOW_COPY(MemoryBudget);
+
+  void setLimit(size_t bytes) {
+    limit = bytes;
+  }
+  // Records the current size of a file's data. A file seen for the first
+  // time counts as just used; a nonzero size clears its evicted mark.
+  void setSize(kj::StringPtr filePath, size_t bytes);
+  void touch(kj::StringPtr filePath);
+
+  // Files whose data has to go, least recently used first, for the total to
+  // fit the limit. They are marked evicted and no longer counted.
+  kj::Vector<kj::String>
+  collectEvictions(kj::FunctionParam<bool(kj::StringPtr)> isPinned);
+
+  size_t getTotal() const {
+    return total;
+  }
+  uint64_t getEvictionCount() const {
+    return evictionCount;
+  }
+
+private:
+  struct Entry {
+    size_t bytes = 0;
+    uint64_t lastUsed = 0;
+    bool evicted = false;
+  };
+
+  using FileMap = kj::HashMap<kj::String, Entry>;
+
+  FileMap files;
+  size_t limit;
+  size_t total = 0;
+  uint64_t clock = 0;
+  uint64_t evictionCount = 0;
+
+  Entry &findOrCreate(kj::StringPtr filePath);
+};
+
+} // namespace capnp_ls
@@ -0,0 +1,284 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#include "ordinal_index.h"
+#include <algorithm>
+#include <kj/debug.h>
+#include <kj/map.h>
+
+namespace capnp_ls {
+namespace {
+
+bool opensScope(SyntaxKind kind) {
+  return kind == SyntaxKind::STRUCT || kind == SyntaxKind::ENUM ||
+         kind == SyntaxKind::INTERFACE;
+}
+
+bool rangeContains(const Range &range, Position position) {
+  if (position.line < range.start.line || position.line > range.end.line) {
+    return false;
+  }
+  if (position.line == range.start.line &&
+      position.character < range.start.character) {
+    return false;
+  }
+  return position.line != range.end.line ||
+         position.character <= range.end.character;
+}
+
+// "@12" as 12, or null for ids ("@0x...") and out-of-range values.
+kj::Maybe<uint32_t> parseOrdinal(kj::StringPtr text, const Token &token) {
+  auto tokenText = Lexer::textOf(text, token);
+  auto digits = tokenText.slice(1, tokenText.size());
+  if (digits.size() == 0 || digits.size() > 5) {
+    return nullptr;
+  }
+  uint32_t value = 0;
+  for (char c : digits) {
+    if (c < '0' || c > '9') {
+      return nullptr;
+    }
+    value = value * 10 + (c - '0');
+  }
+  if (value > OrdinalIndex::MAX_ORDINAL) {
+    return nullptr;
+  }
+  return value;
+}
+
+uint32_t lowestUnused(kj::Vector<uint32_t> &values) {
+  std::sort(values.begin(), values.end());
+  uint32_t next = 0;
+  for (auto value : values) {
+    if (value == next) {
+      next++;
+    } else if (value > next) {
+      break;
+    }
+  }
+  return next;
+}
+
+void addScope(
+    kj::StringPtr text,
+    kj::ArrayPtr<const Token> tokens,
+    const SyntaxNode &node,
+    uint32_t base,
+    kj::Vector<OrdinalScope> &out);
+
+// Ordinals of `nodes` go to out[scopeIndex]; groups and unions share the
+// numbering of the struct around them.
+void addUses(
+    kj::StringPtr text,
+    kj::ArrayPtr<const Token> tokens,
+    kj::ArrayPtr<const SyntaxNode> nodes,
+    uint32_t base,
+    size_t scopeIndex,
+    kj::Vector<OrdinalScope> &out) {
+  for (auto &node : nodes) {
+    if (opensScope(node.kind)) {
+      addScope(text, tokens, node, base, out);
+      continue;
+    }
+    KJ_IF_MAYBE (ordinalToken, node.ordinalToken) {
+      KJ_IF_MAYBE (value, parseOrdinal(text, tokens[*ordinalToken])) {
+        out[scopeIndex].uses.add(
+            OrdinalScope::Use{*value, *ordinalToken - base});
+      }
+    }
+    if (node.kind == SyntaxKind::GROUP || node.kind == SyntaxKind::UNION) {
+      addUses(text, tokens, node.children, base, scopeIndex, out);
+    }
+  }
+}
+
+void addScope(
+    kj::StringPtr text,
+    kj::ArrayPtr<const Token> tokens,
+    const SyntaxNode &node,
+    uint32_t base,
+    kj::Vector<OrdinalScope> &out) {
+  if (!opensScope(node.kind)) {
+    return;
+  }
+  size_t index = out.size();
+  kj::Maybe<uint32_t> nameToken;
+  KJ_IF_MAYBE (name, node.nameToken) {
+    nameToken = *name - base;
+  }
+  out.add(OrdinalScope{
+      node.kind,
+      node.firstToken - base,
+      node.lastToken - base,
+      nameToken,
+      {},
+      nullptr,
+      0});
+  // `out` may grow while nested scopes are added, so address it by index.
+  addUses(text, tokens, node.children, base, index, out);
+
+  auto &scope = out[index];
+  kj::Vector<uint32_t> values(scope.uses.size());
+  for (auto &use : scope.uses) {
+    values.add(use.value);
+    scope.maxOrdinal = kj::max(use.value, scope.maxOrdinal.orDefault(0));
+  }
+  scope.nextOrdinal = lowestUnused(values);
+}
+
+kj::Vector<OrdinalScope> buildScopes(
+    kj::StringPtr text,
+    kj::ArrayPtr<const Token> tokens,
+    const SyntaxNode &declaration) {
+  kj::Vector<OrdinalScope> result;
+  addScope(text, tokens, declaration, declaration.firstToken, result);
+  return result;
+}
+
+Diagnostic makeDiagnostic(const Token &token, kj::String message) {
+  uint32_t length = token.endByte - token.startByte;
+  return Diagnostic{
+      {{token.line, token.column}, {token.line, token.column + length}},
+      DiagnosticSeverity::Error,
+      kj::mv(message),
+      kj::heapString("capnp-ls")};
+}
+
+} // namespace
+
+void OrdinalIndex::rebuild(
+    kj::StringPtr text,
+    kj::ArrayPtr<const Token> tokens,
+    const SyntaxTree &tree) {
+  scopes.clear();
+  for (auto &declaration : tree.getDeclarations()) {
+    scopes.add(buildScopes(text, tokens, declaration));
+  }
+}
+
+void OrdinalIndex::update(
+    kj::StringPtr text,
+    kj::ArrayPtr<const Token> tokens,
+    const SyntaxTree &tree,
+    const SyntaxTreeChange &change) {
+  auto declarations = tree.getDeclarations();
+  KJ_REQUIRE(change.first + change.removed <= scopes.size());
+  KJ_REQUIRE(change.first + change.added <= declarations.size());
+
+  kj::Vector<kj::Vector<OrdinalScope>> updated(declarations.size());
+  for (size_t i = 0; i < change.first; i++) {
+    updated.add(kj::mv(scopes[i]));
+  }
+  for (size_t i = change.first; i < change.first + change.added; i++) {
+    updated.add(buildScopes(text, tokens, declarations[i]));
+  }
+  for (size_t i = change.first + change.removed; i < scopes.size(); i++) {
+    updated.add(kj::mv(scopes[i]));
+  }
+  scopes = kj::mv(updated);
+}
+
+kj::Maybe<OrdinalIndex::ScopeAt> OrdinalIndex::findScope(
+    kj::ArrayPtr<const Token> tokens,
+    const SyntaxTree &tree,
+    Position position) const {
+  auto declarations = tree.getDeclarations();
+  for (size_t i = 0; i < declarations.size() && i < scopes.size(); i++) {
+    auto &declaration = declarations[i];
+    uint32_t base = declaration.firstToken;
+    auto range = SyntaxTree::rangeOf(tokens, base, declaration.lastToken);
+    if (!rangeContains(range, position)) {
+      continue;
+    }
+    // Scopes are in pre-order, so the last one containing the position is
+    // the innermost.
+    const OrdinalScope *innermost = nullptr;
+    for (auto &scope : scopes[i]) {
+      auto scopeRange = SyntaxTree::rangeOf(
+          tokens, base + scope.firstToken, base + scope.lastToken);
+      if (rangeContains(scopeRange, position)) {
+        innermost = &scope;
+      }
+    }
+    if (innermost != nullptr) {
+      return ScopeAt{*innermost, base};
+    }
+    return nullptr;
+  }
+  return nullptr;
+}
+
+uint32_t OrdinalIndex::nextOrdinal(
+    const OrdinalScope &scope,
+    uint32_t baseToken,
+    kj::Maybe<uint32_t> excludedToken) {
+  KJ_IF_MAYBE (excluded, excludedToken) {
+    kj::Vector<uint32_t> values(scope.uses.size());
+    for (auto &use : scope.uses) {
+      if (baseToken + use.token != *excluded) {
+        values.add(use.value);
+      }
+    }
+    return lowestUnused(values);
+  }
+  return scope.nextOrdinal;
+}
+
+kj::Vector<Diagnostic> OrdinalIndex::diagnose(
+    kj::ArrayPtr<const Token> tokens,
+    const SyntaxTree &tree) const {
+  kj::Vector<Diagnostic> diagnostics;
+  auto declarations = tree.getDeclarations();
+  for (size_t i = 0; i < declarations.size() && i < scopes.size(); i++) {
+    uint32_t base = declarations[i].firstToken;
+    for (auto &scope : scopes[i]) {
+      // n uses numbered @0 to @(n-1) leave nothing to report.
+      if (scope.uses.size() == scope.nextOrdinal) {
+        continue;
+      }
+
+      kj::HashMap<uint32_t, uint32_t> firstUse; // value -> absolute token
+      for (auto &use : scope.uses) {
+        uint32_t token = base + use.token;
+        KJ_IF_MAYBE (previous, firstUse.find(use.value)) {
+          diagnostics.add(makeDiagnostic(
+              tokens[token],
+              kj::str(
+                  "Duplicate ordinal @",
+                  use.value,
+                  "; already used on line ",
+                  tokens[*previous].line + 1,
+                  ".")));
+        } else {
+          firstUse.insert(use.value, token);
+        }
+      }
+
+      kj::Vector<uint32_t> values(firstUse.size());
+      for (auto &entry : firstUse) {
+        values.add(entry.key);
+      }
+      std::sort(values.begin(), values.end());
+      uint32_t expected = 0;
+      for (auto value : values) {
+        if (value > expected) {
+          auto skipped = value - expected == 1
+                             ? kj::str("@", expected)
+                             : kj::str("@", expected, "-@", value - 1);
+          diagnostics.add(makeDiagnostic(
+              tokens[KJ_ASSERT_NONNULL(firstUse.find(value))],
+              kj::str(
+                  "Skipped ordinal ",
+                  skipped,
+                  "; ordinals must be sequential starting at @0.")));
+        }
+        expected = value + 1;
+      }
+    }
+  }
+  return diagnostics;
+}
+
+} // namespace capnp_ls
@@ -0,0 +1,78 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include "lexer.h"
+#include "lsp_types.h"
+#include "syntax_tree.h"
+#include <kj/string.h>
+#include <kj/vector.h>
+
+namespace capnp_ls {
+
+// Ordinals share one numbering per struct (including its unions and groups),
+// per interface (methods) and per enum (enumerants).
+struct OrdinalScope {
+  struct Use {
+    uint32_t value;
+    uint32_t token;
+  };
+
+  SyntaxKind kind; // STRUCT, ENUM or INTERFACE
+  // Token indexes here are relative to the first token of the top-level
+  // declaration the scope belongs to, so they survive edits elsewhere.
+  uint32_t firstToken;
+  uint32_t lastToken;
+  kj::Maybe<uint32_t> nameToken;
+  kj::Vector<Use> uses; // in source order
+  kj::Maybe<uint32_t> maxOrdinal;
+  uint32_t nextOrdinal; // lowest unused ordinal
+};
+
+// Per-scope ordinal cache of a parsed buffer. Entries are kept per top-level
+// declaration and only rebuilt for the declarations an edit re-parsed.
+class OrdinalIndex {
+public:
+  static constexpr uint32_t MAX_ORDINAL = 65535;
+
+  void rebuild(
+      kj::StringPtr text,
+      kj::ArrayPtr<const Token> tokens,
+      const SyntaxTree &tree);
+  void update(
+      kj::StringPtr text,
+      kj::ArrayPtr<const Token> tokens,
+      const SyntaxTree &tree,
+      const SyntaxTreeChange &change);
+
+  // The innermost scope around `position` (1-based).
+  struct ScopeAt {
+    const OrdinalScope &scope;
+    uint32_t baseToken; // first token of the top-level declaration
+  };
+  kj::Maybe<ScopeAt> findScope(
+      kj::ArrayPtr<const Token> tokens,
+      const SyntaxTree &tree,
+      Position position) const;
+
+  // Lowest ordinal of `scope` not used by anything but the token at
+  // `excludedToken` (an absolute index), which is the ordinal being edited.
+  static uint32_t nextOrdinal(
+      const OrdinalScope &scope,
+      uint32_t baseToken,
+      kj::Maybe<uint32_t> excludedToken);
+
+  // Duplicate and skipped ordinals, with 0-based ranges like the compiler's
+  // diagnostics.
+  kj::Vector<Diagnostic> diagnose(
+      kj::ArrayPtr<const Token> tokens,
+      const SyntaxTree &tree) const;
+
+private:
+  kj::Vector<kj::Vector<OrdinalScope>> scopes; // per top-level declaration
+};
+
+} // namespace capnp_ls
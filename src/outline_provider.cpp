@@ -0,0 +1,219 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#include "outline_provider.h"
+#include <algorithm>
+
+namespace capnp_ls {
+namespace {
+
+constexpr int MAX_GROUP_DEPTH = 16;
+
+kj::StringPtr kindDetail(SymbolKind kind) {
+  switch (kind) {
+  case SymbolKind::FILE:
+    return "file";
+  case SymbolKind::STRUCT:
+    return "struct";
+  case SymbolKind::ENUM:
+    return "enum";
+  case SymbolKind::INTERFACE:
+    return "interface";
+  case SymbolKind::CONST:
+    return "const";
+  case SymbolKind::ANNOTATION:
+    return "annotation";
+  case SymbolKind::FIELD:
+    return "field";
+  case SymbolKind::ENUMERANT:
+    return "enumerant";
+  case SymbolKind::METHOD:
+    return "method";
+  }
+  KJ_UNREACHABLE;
+}
+
+void sortByPosition(kj::Vector<OutlineNode> &nodes) {
+  std::sort(
+      nodes.begin(),
+      nodes.end(),
+      [](const OutlineNode &a, const OutlineNode &b) {
+        if (a.range.start.line != b.range.start.line) {
+          return a.range.start.line < b.range.start.line;
+        }
+        return a.range.start.character < b.range.start.character;
+      });
+}
+
+void addMembers(
+    const SymbolTable &symbolTable,
+    const SymbolTable::Symbol &symbol,
+    kj::Vector<OutlineNode> &out,
+    int depth);
+
+OutlineNode
+makeNode(const SymbolTable &symbolTable, const SymbolTable::Symbol &symbol) {
+  OutlineNode node{
+      kj::heapString(symbol.name),
+      kj::heapString(kindDetail(symbol.kind)),
+      toLspSymbolKind(symbol.kind),
+      symbol.range,
+      {}};
+  for (auto id : symbol.nestedIds) {
+    KJ_IF_MAYBE (nested, symbolTable.find(id)) {
+      node.children.add(makeNode(symbolTable, *nested));
+    }
+  }
+  addMembers(symbolTable, symbol, node.children, 0);
+  sortByPosition(node.children);
+  return node;
+}
+
+void addMembers(
+    const SymbolTable &symbolTable,
+    const SymbolTable::Symbol &symbol,
+    kj::Vector<OutlineNode> &out,
+    int depth) {
+  for (auto &member : symbol.members) {
+    OutlineNode node{
+        kj::heapString(member.name),
+        kj::heapString(kindDetail(member.kind)),
+        toLspSymbolKind(member.kind),
+        member.range,
+        {}};
+    if (member.groupId != 0 && depth < MAX_GROUP_DEPTH) {
+      KJ_IF_MAYBE (group, symbolTable.find(member.groupId)) {
+        node.detail = kj::heapString("group");
+        addMembers(symbolTable, *group, node.children, depth + 1);
+        sortByPosition(node.children);
+      }
+    }
+    out.add(kj::mv(node));
+  }
+}
+
+kj::StringPtr syntaxDetail(SyntaxKind kind) {
+  switch (kind) {
+  case SyntaxKind::USING:
+    return "using";
+  case SyntaxKind::CONST:
+    return "const";
+  case SyntaxKind::ANNOTATION:
+    return "annotation";
+  case SyntaxKind::STRUCT:
+    return "struct";
+  case SyntaxKind::ENUM:
+    return "enum";
+  case SyntaxKind::INTERFACE:
+    return "interface";
+  case SyntaxKind::FIELD:
+    return "field";
+  case SyntaxKind::GROUP:
+  case SyntaxKind::UNION:
+    return "group";
+  case SyntaxKind::ENUMERANT:
+    return "enumerant";
+  case SyntaxKind::METHOD:
+    return "method";
+  }
+  KJ_UNREACHABLE;
+}
+
+LspSymbolKind syntaxSymbolKind(SyntaxKind kind) {
+  switch (kind) {
+  case SyntaxKind::USING:
+  case SyntaxKind::STRUCT:
+    return LspSymbolKind::Struct;
+  case SyntaxKind::CONST:
+    return LspSymbolKind::Constant;
+  case SyntaxKind::ANNOTATION:
+    return LspSymbolKind::Property;
+  case SyntaxKind::ENUM:
+    return LspSymbolKind::Enum;
+  case SyntaxKind::INTERFACE:
+    return LspSymbolKind::Interface;
+  case SyntaxKind::FIELD:
+  case SyntaxKind::GROUP:
+  case SyntaxKind::UNION:
+    return LspSymbolKind::Field;
+  case SyntaxKind::ENUMERANT:
+    return LspSymbolKind::EnumMember;
+  case SyntaxKind::METHOD:
+    return LspSymbolKind::Method;
+  }
+  KJ_UNREACHABLE;
+}
+
+void addSyntaxNodes(
+    const Document &document,
+    kj::ArrayPtr<const SyntaxNode> nodes,
+    kj::Vector<OutlineNode> &out) {
+  auto tokens = document.getTokens();
+  for (auto &node : nodes) {
+    KJ_IF_MAYBE (nameToken, node.nameToken) {
+      // Usings are aliases rather than declarations of their own.
+      if (node.kind == SyntaxKind::USING) {
+        continue;
+      }
+      auto name = Lexer::textOf(document.getText(), tokens[*nameToken]);
+      OutlineNode outlineNode{
+          kj::heapString(name),
+          kj::heapString(syntaxDetail(node.kind)),
+          syntaxSymbolKind(node.kind),
+          SyntaxTree::rangeOf(tokens, node.firstToken, node.lastToken),
+          {}};
+      addSyntaxNodes(document, node.children, outlineNode.children);
+      out.add(kj::mv(outlineNode));
+    } else {
+      // An unnamed union's members belong to the enclosing struct.
+      addSyntaxNodes(document, node.children, out);
+    }
+  }
+}
+
+void collectFoldingRanges(
+    const kj::Vector<OutlineNode> &nodes,
+    kj::Vector<Range> &out) {
+  for (auto &node : nodes) {
+    if (node.range.start.line < node.range.end.line) {
+      out.add(node.range);
+    }
+    collectFoldingRanges(node.children, out);
+  }
+}
+
+} // namespace
+
+kj::Vector<OutlineNode> OutlineProvider::buildOutline(
+    const SymbolTable &symbolTable,
+    kj::StringPtr filePath) {
+  kj::Vector<OutlineNode> outline;
+  KJ_IF_MAYBE (file, symbolTable.findFile(filePath)) {
+    for (auto id : file->nestedIds) {
+      KJ_IF_MAYBE (symbol, symbolTable.find(id)) {
+        outline.add(makeNode(symbolTable, *symbol));
+      }
+    }
+  }
+  sortByPosition(outline);
+  return outline;
+}
+
+kj::Vector<OutlineNode>
+OutlineProvider::buildOutline(const Document &document) {
+  kj::Vector<OutlineNode> outline;
+  addSyntaxNodes(
+      document, document.getSyntaxTree().getDeclarations(), outline);
+  return outline;
+}
+
+kj::Vector<Range>
+OutlineProvider::buildFoldingRanges(const kj::Vector<OutlineNode> &outline) {
+  kj::Vector<Range> ranges;
+  collectFoldingRanges(outline, ranges);
+  return ranges;
+}
+
+} // namespace capnp_ls
@@ -0,0 +1,37 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include "document.h"
+#include "lsp_types.h"
+#include "symbol_table.h"
+#include <kj/string.h>
+#include <kj/vector.h>
+
+namespace capnp_ls {
+
+struct OutlineNode {
+  kj::String name;
+  kj::String detail;
+  LspSymbolKind kind;
+  Range range;
+  kj::Vector<OutlineNode> children;
+};
+
+class OutlineProvider {
+public:
+  // Declarations of `filePath` nested the way they are in the source:
+  // nested nodes, then fields/enumerants/methods, with groups and unions
+  // expanded under the field that declares them.
+  static kj::Vector<OutlineNode>
+  buildOutline(const SymbolTable &symbolTable, kj::StringPtr filePath);
+
+  // Every multi-line range of the outline, outermost first.
+  static kj::Vector<Range> buildFoldingRanges(
+      const kj::Vector<OutlineNode> &outline);
+};
+
+} // namespace capnp_ls
@@ -0,0 +1,105 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#include "reference_index.h"
+#include <kj/debug.h>
+
+namespace capnp_ls {
+
+void ReferenceIndex::replaceFile(
+    kj::StringPtr filePath,
+    const kj::HashMap<Range, uint64_t> &references,
+    const kj::HashMap<Range, MemberKey> &memberReferences) {
+  removeFile(filePath);
+  for (const auto &[range, nodeId] : references) {
+    nodePostings.add(nodeId, filePath, range);
+  }
+  for (const auto &[range, member] : memberReferences) {
+    memberPostings.add(member, filePath, range);
+  }
+  // Each key holds its ranges in the file under a copy of the path.
+  size_t keys = nodePostings.keyCount(filePath) +
+                memberPostings.keyCount(filePath);
+  size_t ranges = references.size() + memberReferences.size();
+  fileFootprints.upsert(
+      kj::heapString(filePath),
+      ranges * sizeof(Range) +
+          keys * (filePath.size() + sizeof(MemberKey) +
+                  sizeof(kj::Vector<Range>) + 4 * sizeof(uint64_t)));
+}
+
+void ReferenceIndex::removeFile(kj::StringPtr filePath) {
+  nodePostings.removeFile(filePath);
+  memberPostings.removeFile(filePath);
+  fileFootprints.erase(filePath);
+}
+
+size_t ReferenceIndex::footprintOf(kj::StringPtr filePath) const {
+  KJ_IF_MAYBE (bytes, fileFootprints.find(filePath)) {
+    return *bytes;
+  }
+  return 0;
+}
+
+template <typename Key>
+void ReferenceIndex::Postings<Key>::add(
+    Key key,
+    kj::StringPtr filePath,
+    const Range &range) {
+  auto &files = postings.findOrCreate(
+      key, [&]() -> typename kj::HashMap<Key, FileRanges>::Entry {
+        return {key, FileRanges()};
+      });
+  auto &ranges = files.findOrCreate(
+      filePath, [&]() -> typename FileRanges::Entry {
+        auto &keys = fileKeys.findOrCreate(
+            filePath,
+            [&]() -> typename kj::HashMap<kj::String, kj::Vector<Key>>::Entry {
+              return {kj::heapString(filePath), kj::Vector<Key>()};
+            });
+        keys.add(key);
+        return {kj::heapString(filePath), kj::Vector<Range>()};
+      });
+  ranges.add(range);
+}
+
+template <typename Key>
+void ReferenceIndex::Postings<Key>::removeFile(kj::StringPtr filePath) {
+  KJ_IF_MAYBE (keys, fileKeys.find(filePath)) {
+    for (auto key : *keys) {
+      KJ_IF_MAYBE (files, postings.find(key)) {
+        files->erase(filePath);
+        if (files->size() == 0) {
+          postings.erase(key);
+        }
+      }
+    }
+    fileKeys.erase(filePath);
+  }
+}
+
+template <typename Key>
+size_t ReferenceIndex::Postings<Key>::keyCount(kj::StringPtr filePath) const {
+  KJ_IF_MAYBE (keys, fileKeys.find(filePath)) {
+    return keys->size();
+  }
+  return 0;
+}
+
+template <typename Key>
+size_t ReferenceIndex::Postings<Key>::count(Key key) const {
+  size_t count = 0;
+  KJ_IF_MAYBE (files, postings.find(key)) {
+    for (auto &entry : *files) {
+      count += entry.value.size();
+    }
+  }
+  return count;
+}
+
+template class ReferenceIndex::Postings<uint64_t>;
+template class ReferenceIndex::Postings<MemberKey>;
+
+} // namespace capnp_ls
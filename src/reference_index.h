@@ -0,0 +1,91 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include "lsp_types.h"
+#include <kj/map.h>
+#include <kj/string.h>
+#include <kj/vector.h>
+
+namespace capnp_ls {
+
+// A field, enumerant or method: its parent node and its index in the
+// parent's member list.
+struct MemberKey {
+  uint64_t parentId;
+  uint32_t index;
+
+  bool operator==(const MemberKey &other) const {
+    return parentId == other.parentId && index == other.index;
+  }
+  unsigned int hashCode() const {
+    return kj::hashCode(parentId, index);
+  }
+};
+
+// Inverted form of the per-file (Range -> node id) maps: node id -> every
+// place it is referenced, grouped by file so a recompile only touches the
+// postings of the files it produced. Member references are kept the same way
+// under their MemberKey.
+class ReferenceIndex {
+public:
+  void replaceFile(
+      kj::StringPtr filePath,
+      const kj::HashMap<Range, uint64_t> &references,
+      const kj::HashMap<Range, MemberKey> &memberReferences);
+  void removeFile(kj::StringPtr filePath);
+
+  // Calls `callback(filePath, range)` for each use site of `nodeId`.
+  template <typename Func>
+  void forEachReference(uint64_t nodeId, Func &&callback) const {
+    nodePostings.forEach(nodeId, callback);
+  }
+  template <typename Func>
+  void forEachMemberReference(MemberKey member, Func &&callback) const {
+    memberPostings.forEach(member, callback);
+  }
+
+  size_t countReferences(uint64_t nodeId) const {
+    return nodePostings.count(nodeId);
+  }
+
+  // Approximate bytes held for the postings of `filePath`.
+  size_t footprintOf(kj::StringPtr filePath) const;
+
+private:
+  template <typename Key> class Postings {
+  public:
+    void add(Key key, kj::StringPtr filePath, const Range &range);
+    void removeFile(kj::StringPtr filePath);
+
+    template <typename Func> void forEach(Key key, Func &callback) const {
+      KJ_IF_MAYBE (files, postings.find(key)) {
+        for (auto &entry : *files) {
+          for (auto &range : entry.value) {
+            callback(kj::StringPtr(entry.key), range);
+          }
+        }
+      }
+    }
+
+    // Keys with at least one posting in `filePath`.
+    size_t keyCount(kj::StringPtr filePath) const;
+
+    size_t count(Key key) const;
+
+  private:
+    using FileRanges = kj::HashMap<kj::String, kj::Vector<Range>>;
+
+    kj::HashMap<Key, FileRanges> postings;
+    kj::HashMap<kj::String, kj::Vector<Key>> fileKeys;
+  };
+
+  Postings<uint64_t> nodePostings;
+  Postings<MemberKey> memberPostings;
+  kj::HashMap<kj::String, size_t> fileFootprints;
+};
+
+} // namespace capnp_ls
@@ -0,0 +1,292 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#include "rename_provider.h"
+#include "lexer.h"
+#include <algorithm>
+#include <kj/debug.h>
+#include <kj/filesystem.h>
+#include <kj/mutex.h>
+#include <kj/thread.h>
+#include <thread>
+
+namespace capnp_ls {
+namespace {
+
+struct Hint {
+  Range range;
+  bool isDeclaration; // the name is the first match in range, not the last
+};
+
+struct FileJob {
+  kj::String filePath;
+  kj::Vector<Hint> hints;
+};
+
+bool isBefore(const Position &a, const Position &b) {
+  return a.line < b.line || (a.line == b.line && a.character < b.character);
+}
+
+Position startOf(const Token &token) {
+  return Position{token.line + 1, token.column + 1};
+}
+
+Range rangeOf(const Token &token) {
+  return Range{
+      startOf(token),
+      Position{
+          token.line + 1,
+          token.column + 1 + (token.endByte - token.startByte)}};
+}
+
+bool hasText(kj::StringPtr text, const Token &token, kj::StringPtr name) {
+  auto tokenText = Lexer::textOf(text, token);
+  return kj::StringPtr(tokenText.begin(), tokenText.size()) == name;
+}
+
+kj::String readFile(kj::StringPtr filePath) {
+  auto fs = kj::newDiskFilesystem();
+  return fs->getRoot()
+      .openFile(kj::Path::parse(filePath.slice(1)))
+      ->readAllText();
+}
+
+// The identifier `name` inside `range`. A declaration's name is the first
+// match; for a qualified reference such as `Outer.Inner` the referenced name
+// is the last component.
+kj::Maybe<const Token &> findName(
+    kj::StringPtr text,
+    kj::ArrayPtr<const Token> tokens,
+    const Range &range,
+    kj::StringPtr name,
+    bool first) {
+  auto it = std::lower_bound(
+      tokens.begin(),
+      tokens.end(),
+      range.start,
+      [](const Token &token, const Position &position) {
+        return isBefore(startOf(token), position);
+      });
+  kj::Maybe<const Token &> found;
+  for (; it != tokens.end() && !isBefore(range.end, startOf(*it)); ++it) {
+    if (it->kind == TokenKind::IDENTIFIER && hasText(text, *it, name)) {
+      found = *it;
+      if (first) {
+        break;
+      }
+    }
+  }
+  return found;
+}
+
+void renameInFile(
+    const FileJob &job,
+    const DocumentMap &openDocuments,
+    kj::StringPtr oldName,
+    kj::StringPtr newName,
+    FileRename &result) {
+  kj::String text;
+  kj::Vector<Token> lexed;
+  kj::ArrayPtr<const Token> tokens;
+  KJ_IF_MAYBE (document, openDocuments.find(job.filePath)) {
+    text = kj::heapString((*document)->getText());
+    tokens = (*document)->getTokens();
+  } else {
+    text = readFile(job.filePath);
+    lexed = Lexer::tokenize(text);
+    tokens = lexed.asPtr();
+  }
+
+  kj::Vector<const Token *> renamed;
+  for (auto &hint : job.hints) {
+    KJ_IF_MAYBE (
+        token,
+        findName(text, tokens, hint.range, oldName, hint.isDeclaration)) {
+      renamed.add(token);
+    }
+  }
+  std::sort(
+      renamed.begin(), renamed.end(), [](const Token *a, const Token *b) {
+        return a->startByte < b->startByte;
+      });
+
+  kj::Vector<char> newText(text.size());
+  uint32_t copied = 0;
+  for (size_t i = 0; i < renamed.size(); i++) {
+    auto token = renamed[i];
+    if (i > 0 && renamed[i - 1] == token) {
+      continue;
+    }
+    result.edits.add(TextEdit{rangeOf(*token), kj::heapString(newName)});
+    newText.addAll(text.slice(copied, token->startByte));
+    newText.addAll(newName);
+    copied = token->endByte;
+  }
+  newText.addAll(text.slice(copied, text.size()));
+
+  result.filePath = kj::heapString(job.filePath);
+  result.newText = kj::heapString(newText.begin(), newText.size());
+}
+
+} // namespace
+
+bool RenameProvider::isValidName(kj::StringPtr name) {
+  if (name.size() == 0) {
+    return false;
+  }
+  for (size_t i = 0; i < name.size(); i++) {
+    char c = name[i];
+    bool isLetter = ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z');
+    bool isDigit = '0' <= c && c <= '9';
+    if (!isLetter && !(i > 0 && (isDigit || c == '_'))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+kj::Maybe<RenameTarget> RenameProvider::prepare(
+    const SymbolTable &symbolTable,
+    kj::Maybe<uint64_t> referencedNodeId,
+    kj::StringPtr filePath,
+    kj::StringPtr text,
+    Position position) {
+  auto tokens = Lexer::tokenize(text);
+  const Token *nameToken = nullptr;
+  for (auto &token : tokens) {
+    auto range = rangeOf(token);
+    if (token.kind == TokenKind::IDENTIFIER &&
+        range.start.line == position.line &&
+        !isBefore(position, range.start) && !isBefore(range.end, position)) {
+      nameToken = &token;
+      break;
+    }
+  }
+  if (nameToken == nullptr) {
+    return nullptr;
+  }
+  auto nameText = Lexer::textOf(text, *nameToken);
+  kj::StringPtr name(nameText.begin(), nameText.size());
+
+  KJ_IF_MAYBE (nodeId, referencedNodeId) {
+    KJ_IF_MAYBE (symbol, symbolTable.find(*nodeId)) {
+      bool isRenameable =
+          (symbol->kind == SymbolKind::STRUCT && !symbol->isGroup) ||
+          symbol->kind == SymbolKind::ENUM ||
+          symbol->kind == SymbolKind::INTERFACE;
+      if (isRenameable && symbol->name == name) {
+        return RenameTarget{
+            kj::heapString(name), rangeOf(*nameToken), *nodeId, nullptr};
+      }
+    }
+  }
+
+  KJ_IF_MAYBE (match, symbolTable.findMemberAt(filePath, position)) {
+    auto &member = *match->member;
+    if (member.name == name && member.range.start == startOf(*nameToken)) {
+      auto memberIndex = match->member - match->symbol->members.begin();
+      return RenameTarget{
+          kj::heapString(name),
+          rangeOf(*nameToken),
+          match->symbol->id,
+          static_cast<uint32_t>(memberIndex)};
+    }
+  }
+  return nullptr;
+}
+
+kj::Vector<FileRename> RenameProvider::computeEdits(
+    const SymbolTable &symbolTable,
+    const ReferenceIndex &referenceIndex,
+    const DocumentMap &openDocuments,
+    const RenameTarget &target,
+    kj::StringPtr newName) {
+  kj::Vector<FileJob> jobs;
+  kj::HashMap<kj::String, size_t> jobIndex;
+  auto addHint = [&](kj::StringPtr filePath, const Range &range, bool isDecl) {
+    size_t index = jobIndex.findOrCreate(
+        filePath, [&]() -> kj::HashMap<kj::String, size_t>::Entry {
+          jobs.add(FileJob{kj::heapString(filePath), {}});
+          return {kj::heapString(filePath), jobs.size() - 1};
+        });
+    jobs[index].hints.add(Hint{range, isDecl});
+  };
+
+  KJ_IF_MAYBE (symbol, symbolTable.find(target.nodeId)) {
+    KJ_IF_MAYBE (memberIndex, target.memberIndex) {
+      KJ_REQUIRE(*memberIndex < symbol->members.size());
+      addHint(symbol->filePath, symbol->members[*memberIndex].range, true);
+      referenceIndex.forEachMemberReference(
+          MemberKey{target.nodeId, *memberIndex},
+          [&](kj::StringPtr filePath, const Range &range) {
+            addHint(filePath, range, false);
+          });
+    } else {
+      addHint(symbol->filePath, symbolTable.rangeOf(*symbol), true);
+      referenceIndex.forEachReference(
+          target.nodeId, [&](kj::StringPtr filePath, const Range &range) {
+            addHint(filePath, range, false);
+          });
+    }
+  }
+
+  auto results = kj::heapArray<FileRename>(jobs.size());
+  kj::MutexGuarded<kj::Maybe<kj::Exception>> firstError;
+  auto runJob = [&](size_t i) {
+    KJ_IF_MAYBE (exception, kj::runCatchingExceptions([&]() {
+                   renameInFile(
+                       jobs[i],
+                       openDocuments,
+                       target.name,
+                       newName,
+                       results[i]);
+                 })) {
+      KJ_LOG(
+          ERROR,
+          "Failed to rename in",
+          jobs[i].filePath,
+          exception->getDescription());
+      auto error = firstError.lockExclusive();
+      if (*error == nullptr) {
+        *error = kj::mv(*exception);
+      }
+    }
+  };
+
+  size_t workerCount = kj::min(
+      static_cast<size_t>(std::thread::hardware_concurrency()),
+      jobs.size() / MIN_FILES_PER_WORKER);
+  if (workerCount <= 1) {
+    for (size_t i = 0; i < jobs.size(); i++) {
+      runJob(i);
+    }
+  } else {
+    // Each worker owns the results slots of its shard; the threads are
+    // joined when `workers` goes out of scope.
+    kj::Vector<kj::Own<kj::Thread>> workers;
+    for (size_t w = 0; w < workerCount; w++) {
+      workers.add(kj::heap<kj::Thread>([&, w]() {
+        for (size_t i = w; i < jobs.size(); i += workerCount) {
+          runJob(i);
+        }
+      }));
+    }
+  }
+
+  // A rename that skips a file would leave its references dangling.
+  KJ_IF_MAYBE (exception, *firstError.lockExclusive()) {
+    kj::throwFatalException(kj::mv(*exception));
+  }
+
+  kj::Vector<FileRename> renames;
+  for (auto &result : results) {
+    if (result.edits.size() > 0) {
+      renames.add(kj::mv(result));
+    }
+  }
+  return renames;
+}
+
+} // namespace capnp_ls
@@ -0,0 +1,62 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include "document.h"
+#include "lsp_types.h"
+#include "reference_index.h"
+#include "symbol_table.h"
+#include <kj/map.h>
+#include <kj/string.h>
+#include <kj/vector.h>
+
+namespace capnp_ls {
+
+struct RenameTarget {
+  kj::String name;
+  Range range; // the name under the cursor
+  // The renamed declaration, or for a member the scope that declares it.
+  uint64_t nodeId;
+  kj::Maybe<uint32_t> memberIndex;
+};
+
+struct FileRename {
+  kj::String filePath;
+  kj::Vector<TextEdit> edits; // sorted by position
+  kj::String newText;         // the file with `edits` applied
+};
+
+class RenameProvider {
+public:
+  // Files are only spread over worker threads when each gets at least this
+  // many, since small renames finish faster on the calling thread.
+  static constexpr size_t MIN_FILES_PER_WORKER = 8;
+
+  // Structs, enums, interfaces, fields, enumerants and methods can be
+  // renamed, from a declaration or (for types) from any reference.
+  // `referencedNodeId` is the node whose identifier is at `position`, if any.
+  static kj::Maybe<RenameTarget> prepare(
+      const SymbolTable &symbolTable,
+      kj::Maybe<uint64_t> referencedNodeId,
+      kj::StringPtr filePath,
+      kj::StringPtr text,
+      Position position);
+
+  // Edits for the declaration and every recorded reference, grouped per file.
+  // Files are read from `openDocuments` when open and from disk otherwise;
+  // reading and lexing them is sharded across worker threads. Throws if any
+  // file cannot be renamed, rather than return the edits of the others.
+  static kj::Vector<FileRename> computeEdits(
+      const SymbolTable &symbolTable,
+      const ReferenceIndex &referenceIndex,
+      const DocumentMap &openDocuments,
+      const RenameTarget &target,
+      kj::StringPtr newName);
+
+  static bool isValidName(kj::StringPtr name);
+};
+
+} // namespace capnp_ls
@@ -0,0 +1,124 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#include "schema_store.h"
+#include <kj/debug.h>
+
+namespace capnp_ls {
+
+SchemaStore::SchemaStore() : lazyLoader(*this) {}
+
+void SchemaStore::addRequest(kj::Own<capnp::MessageReader> reader) {
+  auto request = reader->getRoot<capnp::schema::CodeGeneratorRequest>();
+  auto retained = kj::refcounted<RetainedRequest>(kj::mv(reader));
+
+  kj::HashMap<uint64_t, capnp::schema::Node::SourceInfo::Reader> sourceInfos;
+  for (auto sourceInfo : request.getSourceInfo()) {
+    sourceInfos.upsert(sourceInfo.getId(), sourceInfo);
+  }
+  // A node's display name starts with that of its file, then a colon.
+  kj::HashMap<kj::StringPtr, uint64_t> fileIds;
+  for (auto node : request.getNodes()) {
+    if (node.isFile()) {
+      fileIds.upsert(node.getDisplayName(), node.getId());
+    }
+  }
+  kj::HashMap<uint64_t, FileNodes> added;
+
+  for (auto node : request.getNodes()) {
+    kj::Maybe<capnp::schema::Node::SourceInfo::Reader> sourceInfo;
+    size_t words = node.totalSize().wordCount;
+    KJ_IF_MAYBE (info, sourceInfos.find(node.getId())) {
+      sourceInfo = *info;
+      words += info->totalSize().wordCount;
+    }
+    kj::StringPtr displayName = node.getDisplayName();
+    KJ_IF_MAYBE (colon, displayName.findFirst(':')) {
+      displayName = kj::StringPtr(displayName.begin(), *colon);
+    }
+    KJ_IF_MAYBE (fileId, fileIds.find(displayName)) {
+      auto &file = added.findOrCreate(
+          *fileId, [&]() -> kj::HashMap<uint64_t, FileNodes>::Entry {
+            return {*fileId, FileNodes()};
+          });
+      file.ids.add(node.getId());
+      file.bytes += words * sizeof(capnp::word);
+    }
+    entries.upsert(
+        node.getId(),
+        Entry{kj::addRef(*retained), node, sourceInfo},
+        [](Entry &existing, Entry &&replacement) {
+          existing = kj::mv(replacement);
+        });
+  }
+  // A compile outputs every node of each file it reaches.
+  for (auto &entry : added) {
+    fileNodes.upsert(entry.key, kj::mv(entry.value));
+  }
+  loader = nullptr;
+}
+
+void SchemaStore::removeFile(uint64_t fileId) {
+  KJ_IF_MAYBE (file, fileNodes.find(fileId)) {
+    for (auto id : file->ids) {
+      entries.erase(id);
+    }
+    fileNodes.erase(fileId);
+    loader = nullptr;
+  }
+}
+
+size_t SchemaStore::footprintOf(uint64_t fileId) const {
+  KJ_IF_MAYBE (file, fileNodes.find(fileId)) {
+    return file->bytes;
+  }
+  return 0;
+}
+
+kj::Maybe<capnp::schema::Node::Reader>
+SchemaStore::findNode(uint64_t id) const {
+  KJ_IF_MAYBE (entry, entries.find(id)) {
+    return entry->node;
+  }
+  return nullptr;
+}
+
+kj::Maybe<capnp::schema::Node::SourceInfo::Reader>
+SchemaStore::findSourceInfo(uint64_t id) const {
+  KJ_IF_MAYBE (entry, entries.find(id)) {
+    return entry->sourceInfo;
+  }
+  return nullptr;
+}
+
+kj::Maybe<capnp::Schema> SchemaStore::getSchema(uint64_t id) {
+  return getLoader().tryGet(id);
+}
+
+capnp::Type SchemaStore::getType(
+    capnp::schema::Type::Reader type,
+    capnp::Schema scope) {
+  return getLoader().getType(type, scope);
+}
+
+capnp::SchemaLoader &SchemaStore::getLoader() {
+  KJ_IF_MAYBE (existing, loader) {
+    return **existing;
+  }
+  auto created = kj::heap<capnp::SchemaLoader>(lazyLoader);
+  auto &result = *created;
+  loader = kj::mv(created);
+  return result;
+}
+
+void SchemaStore::LazyLoader::load(
+    const capnp::SchemaLoader &loader,
+    uint64_t id) const {
+  KJ_IF_MAYBE (node, store.findNode(id)) {
+    loader.loadOnce(*node);
+  }
+}
+
+} // namespace capnp_ls
@@ -0,0 +1,82 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <capnp/message.h>
+#include <capnp/schema-loader.h>
+#include <capnp/schema.capnp.h>
+#include <kj/map.h>
+#include <kj/refcount.h>
+
+namespace capnp_ls {
+
+// Keeps the CodeGeneratorRequests produced by the compiler alive and hands
+// out schema objects on demand. Nothing is converted when a request is
+// added; a node only goes through SchemaLoader the first time something asks
+// for it (or for a type that refers to it).
+class SchemaStore {
+public:
+  SchemaStore();
+  KJ_DISALLOW_COPY(SchemaStore);
+
+  // Nodes of `reader` replace any stored node with the same id. A request is
+  // released once none of its nodes are current anymore.
+  void addRequest(kj::Own<capnp::MessageReader> reader);
+  // Forgets the nodes declared in the file with node id `fileId`.
+  void removeFile(uint64_t fileId);
+  // Approximate bytes of the nodes declared in `fileId`. They are only freed
+  // with the last node of the request they came from.
+  size_t footprintOf(uint64_t fileId) const;
+
+  kj::Maybe<capnp::schema::Node::Reader> findNode(uint64_t id) const;
+  kj::Maybe<capnp::schema::Node::SourceInfo::Reader>
+  findSourceInfo(uint64_t id) const;
+
+  // Loads `id` and whatever it depends on into the current SchemaLoader.
+  // Returned schemas stay valid until the next addRequest().
+  kj::Maybe<capnp::Schema> getSchema(uint64_t id);
+  // Resolves a type as written in `scope`, e.g. an annotation's value type.
+  capnp::Type getType(capnp::schema::Type::Reader type, capnp::Schema scope);
+
+private:
+  struct RetainedRequest : public kj::Refcounted {
+    explicit RetainedRequest(kj::Own<capnp::MessageReader> reader)
+        : reader(kj::mv(reader)) {}
+    kj::Own<capnp::MessageReader> reader;
+  };
+
+  struct Entry {
+    kj::Own<RetainedRequest> request;
+    capnp::schema::Node::Reader node;
+    kj::Maybe<capnp::schema::Node::SourceInfo::Reader> sourceInfo;
+  };
+
+  struct FileNodes {
+    kj::Vector<uint64_t> ids;
+    size_t bytes = 0;
+  };
+
+  class LazyLoader : public capnp::SchemaLoader::LazyLoadCallback {
+  public:
+    explicit LazyLoader(const SchemaStore &store) : store(store) {}
+    void load(const capnp::SchemaLoader &loader, uint64_t id) const override;
+
+  private:
+    const SchemaStore &store;
+  };
+
+  capnp::SchemaLoader &getLoader();
+
+  kj::HashMap<uint64_t, Entry> entries;
+  // Nodes by the id of the file that declares them.
+  kj::HashMap<uint64_t, FileNodes> fileNodes;
+  LazyLoader lazyLoader;
+  // SchemaLoader cannot unload or replace a node, so it is dropped whenever
+  // new nodes arrive and recreated (empty) on the next lookup.
+  kj::Maybe<kj::Own<capnp::SchemaLoader>> loader;
+};
+
+} // namespace capnp_ls
@@ -0,0 +1,250 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#include "semantic_tokens_provider.h"
+#include "document.h"
+
+namespace capnp_ls {
+namespace {
+
+enum class BlockKind { STRUCT, ENUM, INTERFACE, OTHER };
+
+bool is(kj::StringPtr text, const Token *token, kj::StringPtr value) {
+  if (token == nullptr) {
+    return false;
+  }
+  auto tokenText = Lexer::textOf(text, *token);
+  return kj::StringPtr(tokenText.begin(), tokenText.size()) == value;
+}
+
+struct Classification {
+  SemanticTokenType type;
+  uint32_t modifiers;
+};
+
+Classification classifySymbol(SymbolKind kind) {
+  switch (kind) {
+  case SymbolKind::FILE:
+    return {SemanticTokenType::NAMESPACE, 0};
+  case SymbolKind::STRUCT:
+    return {SemanticTokenType::STRUCT, 0};
+  case SymbolKind::ENUM:
+    return {SemanticTokenType::ENUM, 0};
+  case SymbolKind::INTERFACE:
+    return {SemanticTokenType::INTERFACE, 0};
+  case SymbolKind::CONST:
+    return {SemanticTokenType::VARIABLE, READONLY};
+  case SymbolKind::ANNOTATION:
+    return {SemanticTokenType::DECORATOR, 0};
+  case SymbolKind::FIELD:
+    return {SemanticTokenType::PROPERTY, 0};
+  case SymbolKind::ENUMERANT:
+    return {SemanticTokenType::ENUM_MEMBER, 0};
+  case SymbolKind::METHOD:
+    return {SemanticTokenType::METHOD, 0};
+  }
+  KJ_UNREACHABLE;
+}
+
+} // namespace
+
+kj::Vector<uint32_t> SemanticTokensProvider::encode(
+    const SymbolTable &symbolTable,
+    kj::Maybe<const kj::HashMap<Range, uint64_t> &> references,
+    kj::StringPtr text,
+    kj::ArrayPtr<const Token> tokens) {
+  kj::Vector<const Token *> code;
+  for (auto &token : tokens) {
+    if (token.kind != TokenKind::COMMENT) {
+      code.add(&token);
+    }
+  }
+
+  kj::Vector<uint32_t> data;
+  // Columns and lengths in UTF-16 code units; token columns count bytes.
+  Utf16Columns columns(text);
+  uint32_t previousLine = 0;
+  uint32_t previousColumn = 0;
+  auto emit = [&](const Token &token, Classification classification) {
+    uint32_t column = columns.columnOf(token.startByte, token.column);
+    data.add(token.line - previousLine);
+    data.add(token.line == previousLine ? column - previousColumn : column);
+    data.add(utf16Length(Lexer::textOf(text, token)));
+    data.add(static_cast<uint32_t>(classification.type));
+    data.add(classification.modifiers);
+    previousLine = token.line;
+    previousColumn = column;
+  };
+
+  kj::Vector<BlockKind> blocks;
+  BlockKind pendingBlock = BlockKind::OTHER;
+  uint32_t parenDepth = 0;
+  bool expectGenericParams = false;
+  bool inGenericParams = false;
+  kj::HashSet<kj::String> genericParams;
+
+  size_t j = 0; // index of the current token in `code`
+  for (auto &token : tokens) {
+    if (token.kind == TokenKind::COMMENT) {
+      emit(token, {SemanticTokenType::COMMENT, 0});
+      continue;
+    }
+    const Token *prev = j > 0 ? code[j - 1] : nullptr;
+    const Token *prev2 = j > 1 ? code[j - 2] : nullptr;
+    const Token *next = j + 1 < code.size() ? code[j + 1] : nullptr;
+    const Token *next2 = j + 2 < code.size() ? code[j + 2] : nullptr;
+    j++;
+
+    bool wasExpectingGenericParams = expectGenericParams;
+    expectGenericParams = false;
+
+    switch (token.kind) {
+    case TokenKind::STRING:
+      emit(token, {SemanticTokenType::STRING, 0});
+      break;
+    case TokenKind::NUMBER:
+    case TokenKind::ORDINAL:
+      emit(token, {SemanticTokenType::NUMBER, 0});
+      break;
+    case TokenKind::KEYWORD:
+      emit(token, {SemanticTokenType::KEYWORD, 0});
+      if (is(text, &token, "struct") || is(text, &token, "group") ||
+          is(text, &token, "union")) {
+        pendingBlock = BlockKind::STRUCT;
+      } else if (is(text, &token, "enum")) {
+        pendingBlock = BlockKind::ENUM;
+      } else if (is(text, &token, "interface")) {
+        pendingBlock = BlockKind::INTERFACE;
+      }
+      break;
+    case TokenKind::PUNCTUATION:
+      if (is(text, &token, "{")) {
+        blocks.add(pendingBlock);
+        pendingBlock = BlockKind::OTHER;
+      } else if (is(text, &token, "}")) {
+        if (blocks.size() > 0) {
+          blocks.removeLast();
+        }
+      } else if (is(text, &token, ";")) {
+        pendingBlock = BlockKind::OTHER;
+      } else if (is(text, &token, "(")) {
+        parenDepth++;
+        inGenericParams = wasExpectingGenericParams;
+      } else if (is(text, &token, ")")) {
+        parenDepth = parenDepth > 0 ? parenDepth - 1 : 0;
+        inGenericParams = false;
+      }
+      break;
+    case TokenKind::IDENTIFIER: {
+      auto name = Lexer::textOf(text, token);
+      kj::StringPtr nameStr(name.begin(), name.size());
+
+      if (Lexer::isBuiltinType(name)) {
+        emit(token, {SemanticTokenType::TYPE, DEFAULT_LIBRARY});
+      } else if (prev != nullptr && prev->kind == TokenKind::KEYWORD) {
+        if (is(text, prev, "struct") || is(text, prev, "interface")) {
+          emit(
+              token,
+              {is(text, prev, "struct") ? SemanticTokenType::STRUCT
+                                        : SemanticTokenType::INTERFACE,
+               DECLARATION});
+          expectGenericParams = true;
+        } else if (is(text, prev, "enum")) {
+          emit(token, {SemanticTokenType::ENUM, DECLARATION});
+        } else if (is(text, prev, "const")) {
+          emit(token, {SemanticTokenType::VARIABLE, DECLARATION | READONLY});
+        } else if (is(text, prev, "annotation")) {
+          emit(token, {SemanticTokenType::DECORATOR, DECLARATION});
+        } else if (is(text, prev, "using")) {
+          emit(
+              token,
+              {is(text, next2, "import") ? SemanticTokenType::NAMESPACE
+                                         : SemanticTokenType::TYPE,
+               DECLARATION});
+        }
+      } else if (inGenericParams) {
+        emit(token, {SemanticTokenType::TYPE_PARAMETER, DECLARATION});
+        if (!genericParams.contains(nameStr)) {
+          genericParams.insert(kj::heapString(nameStr));
+        }
+      } else if (is(text, prev, "$")) {
+        emit(token, {SemanticTokenType::DECORATOR, 0});
+      } else {
+        kj::Maybe<Classification> resolved;
+        KJ_IF_MAYBE (referenceMap, references) {
+          uint32_t length = token.endByte - token.startByte;
+          Range range{
+              {token.line + 1, token.column + 1},
+              {token.line + 1, token.column + 1 + length}};
+          KJ_IF_MAYBE (nodeId, referenceMap->find(range)) {
+            KJ_IF_MAYBE (symbol, symbolTable.find(*nodeId)) {
+              resolved = classifySymbol(symbol->kind);
+            }
+          }
+        }
+
+        KJ_IF_MAYBE (classification, resolved) {
+          emit(token, *classification);
+        } else if (genericParams.contains(nameStr)) {
+          emit(token, {SemanticTokenType::TYPE_PARAMETER, 0});
+        } else if (next != nullptr && next->kind == TokenKind::ORDINAL) {
+          BlockKind block =
+              blocks.size() > 0 ? blocks.back() : BlockKind::OTHER;
+          emit(
+              token,
+              {block == BlockKind::ENUM        ? SemanticTokenType::ENUM_MEMBER
+               : block == BlockKind::INTERFACE ? SemanticTokenType::METHOD
+                                               : SemanticTokenType::PROPERTY,
+               DECLARATION});
+        } else if (is(text, next, ":")) {
+          emit(
+              token,
+              {parenDepth > 0 ? SemanticTokenType::PARAMETER
+                              : SemanticTokenType::PROPERTY,
+               DECLARATION});
+        } else if (
+            is(text, prev, ":") || is(text, prev, ".") ||
+            (is(text, prev, "(") &&
+             (is(text, prev2, "List") || is(text, prev2, "extends")))) {
+          emit(token, {SemanticTokenType::TYPE, 0});
+        } else if (is(text, prev, "=")) {
+          emit(
+              token,
+              {'a' <= name[0] && name[0] <= 'z' ? SemanticTokenType::ENUM_MEMBER
+                                                : SemanticTokenType::TYPE,
+               0});
+        }
+      }
+      break;
+    }
+    case TokenKind::COMMENT:
+    case TokenKind::UNKNOWN:
+      break;
+    }
+  }
+  return data;
+}
+
+SemanticTokensEdit SemanticTokensProvider::diff(
+    kj::ArrayPtr<const uint32_t> previous,
+    kj::ArrayPtr<const uint32_t> current) {
+  size_t prefix = 0;
+  size_t limit = kj::min(previous.size(), current.size());
+  while (prefix < limit && previous[prefix] == current[prefix]) {
+    prefix++;
+  }
+  size_t suffix = 0;
+  while (suffix < limit - prefix &&
+         previous[previous.size() - 1 - suffix] ==
+             current[current.size() - 1 - suffix]) {
+    suffix++;
+  }
+  return SemanticTokensEdit{
+      static_cast<uint32_t>(prefix),
+      static_cast<uint32_t>(previous.size() - prefix - suffix),
+      current.slice(prefix, current.size() - suffix)};
+}
+
+} // namespace capnp_ls
@@ -0,0 +1,92 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include "lexer.h"
+#include "lsp_types.h"
+#include "symbol_table.h"
+#include <kj/array.h>
+#include <kj/map.h>
+#include <kj/string.h>
+#include <kj/vector.h>
+
+namespace capnp_ls {
+
+// Indexes into SemanticTokensProvider::TOKEN_TYPES.
+enum class SemanticTokenType : uint32_t {
+  NAMESPACE,
+  TYPE,
+  STRUCT,
+  ENUM,
+  INTERFACE,
+  TYPE_PARAMETER,
+  PARAMETER,
+  PROPERTY,
+  ENUM_MEMBER,
+  METHOD,
+  DECORATOR,
+  VARIABLE,
+  KEYWORD,
+  COMMENT,
+  STRING,
+  NUMBER
+};
+
+// Bits matching SemanticTokensProvider::TOKEN_MODIFIERS.
+enum SemanticTokenModifier : uint32_t {
+  DECLARATION = 1 << 0,
+  READONLY = 1 << 1,
+  DEFAULT_LIBRARY = 1 << 2
+};
+
+struct SemanticTokensEdit {
+  uint32_t start;
+  uint32_t deleteCount;
+  kj::ArrayPtr<const uint32_t> data;
+};
+
+class SemanticTokensProvider {
+public:
+  static constexpr const char *TOKEN_TYPES[] = {
+      "namespace",
+      "type",
+      "struct",
+      "enum",
+      "interface",
+      "typeParameter",
+      "parameter",
+      "property",
+      "enumMember",
+      "method",
+      "decorator",
+      "variable",
+      "keyword",
+      "comment",
+      "string",
+      "number"};
+  static constexpr const char *TOKEN_MODIFIERS[] = {
+      "declaration", "readonly", "defaultLibrary"};
+
+  // LSP-encoded token data (5 relative integers per token) for `tokens` of
+  // `text`. Identifiers found in `references` (the file's identifier ranges
+  // from the last compile, while they still match the buffer) are classified
+  // by the declaration they resolve to; the rest are classified from their
+  // lexical context.
+  static kj::Vector<uint32_t> encode(
+      const SymbolTable &symbolTable,
+      kj::Maybe<const kj::HashMap<Range, uint64_t> &> references,
+      kj::StringPtr text,
+      kj::ArrayPtr<const Token> tokens);
+
+  // Single edit turning `previous` into `current`: everything between their
+  // common prefix and common suffix is replaced. `data` points into
+  // `current`.
+  static SemanticTokensEdit diff(
+      kj::ArrayPtr<const uint32_t> previous,
+      kj::ArrayPtr<const uint32_t> current);
+};
+
+} // namespace capnp_ls
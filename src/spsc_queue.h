@@ -0,0 +1,92 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <atomic>
+#include <kj/array.h>
+#include <kj/common.h>
+#include <kj/mutex.h>
+
+namespace capnp_ls {
+
+// Bounded queue between exactly one producer thread and one consumer
+// thread. tryPush() and tryPop() never block or take a lock: a full queue
+// refuses the value and an empty one returns null. push() sleeps while the
+// queue is full, and only then does the consumer take a lock, to wake it.
+template <typename T>
+class SpscQueue {
+public:
+  explicit SpscQueue(size_t capacity)
+      : slots(kj::heapArray<kj::Maybe<T>>(capacity)) {}
+  KJ_DISALLOW_COPY(SpscQueue);
+
+  // Producer. Returns `value` back if the queue is full.
+  kj::Maybe<T> tryPush(T &&value) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) == slots.size()) {
+      return kj::mv(value);
+    }
+    slots[t % slots.size()] = kj::mv(value);
+    tail.store(t + 1, std::memory_order_release);
+    return nullptr;
+  }
+
+  // Producer. Waits for the consumer to take a value if the queue is full.
+  void push(T &&value) {
+    for (;;) {
+      KJ_IF_MAYBE (refused, tryPush(kj::mv(value))) {
+        value = kj::mv(*refused);
+      } else {
+        return;
+      }
+      producerWaiting.store(true, std::memory_order_relaxed);
+      // Pairs with the fence in tryPop(): either the retry below sees the
+      // slot a pop freed, or that pop sees the flag and wakes us.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      uint64_t seen = *pops.lockShared();
+      KJ_IF_MAYBE (refused, tryPush(kj::mv(value))) {
+        value = kj::mv(*refused);
+        pops.when(
+            [seen](const uint64_t &count) { return count != seen; },
+            [](uint64_t &) {});
+        producerWaiting.store(false, std::memory_order_relaxed);
+      } else {
+        producerWaiting.store(false, std::memory_order_relaxed);
+        return;
+      }
+    }
+  }
+
+  // Consumer.
+  kj::Maybe<T> tryPop() {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    auto &slot = slots[h % slots.size()];
+    kj::Maybe<T> value = kj::mv(slot);
+    slot = nullptr;
+    head.store(h + 1, std::memory_order_release);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (producerWaiting.load(std::memory_order_relaxed)) {
+      ++*pops.lockExclusive();
+    }
+    return value;
+  }
+
+private:
+  kj::Array<kj::Maybe<T>> slots;
+  // Written by the consumer only.
+  alignas(64) std::atomic<size_t> head{0};
+  // Written by the producer only.
+  alignas(64) std::atomic<size_t> tail{0};
+  // Set by push() while it waits for room.
+  std::atomic<bool> producerWaiting{false};
+  // Bumped by pops that free a slot for a waiting push().
+  kj::MutexGuarded<uint64_t> pops{0};
+};
+
+} // namespace capnp_ls
@@ -5,11 +5,15 @@
 
 #include "stdin_reader.h"
 #include <cstdlib>
+#include <cstring>
+#include <unistd.h>
 
 namespace capnp_ls {
 struct ParsedMessage {
   size_t processedSize;
   kj::Maybe<kj::String> content;
+  // Size of the whole message once its header is in but not all its content.
+  size_t pendingSize = 0;
 };
 
 ParsedMessage
@@ -38,7 +42,7 @@ parseNextMessage(const char *buffer, size_t currentPos, size_t processedPos) {
   size_t totalMessageSize = headerSize + contentLength;
 
   if (currentPos - processedPos < totalMessageSize) {
-    return {processedPos, nullptr};
+    return {processedPos, nullptr, totalMessageSize};
   }
 
   return {
@@ -46,39 +50,103 @@ parseNextMessage(const char *buffer, size_t currentPos, size_t processedPos) {
       kj::heapString(buffer + processedPos, totalMessageSize)};
 }
 
-kj::Promise<void> StdinReader::monitorStdin() {
-  return input->tryRead(buffer + currentPos, 0, BUFFER_SIZE - currentPos)
-      .then([this](size_t n) {
+StdinReader::StdinReader(LspMessageHandler &handler)
+    : handler(handler), tasks(*this),
+      mainExecutor(kj::getCurrentThreadExecutor().addRef()),
+      queue(QUEUE_CAPACITY), buffer(kj::heapArray<char>(BUFFER_SIZE + 1)),
+      thread([this](kj::AsyncIoContext &ioContext) {
+        auto input = ioContext.lowLevelProvider->wrapInputFd(STDIN_FILENO);
+        auto &stream = *input;
+        return monitorStdin(stream).attach(kj::mv(input));
+      }) {}
+
+kj::Promise<void> StdinReader::monitorStdin(kj::AsyncInputStream &input) {
+  return input
+      .tryRead(buffer.begin() + currentPos, 1, capacity() - currentPos)
+      .then([this, &input](size_t n) {
         if (n == 0) {
           KJ_LOG(INFO, "EOF detected on stdin");
-          tasks.add(handler.handleMessage(kj::Maybe<kj::String>(nullptr)));
+          hand(Inbound{nullptr});
           return kj::Promise<void>(kj::READY_NOW);
         }
 
         currentPos += n;
+        // The header is searched with strstr.
+        buffer[currentPos] = '\0';
 
         size_t processedPos = 0;
+        size_t pendingSize = 0;
         while (processedPos < currentPos) {
-          auto result = parseNextMessage(buffer, currentPos, processedPos);
+          auto result =
+              parseNextMessage(buffer.begin(), currentPos, processedPos);
           processedPos = result.processedSize;
+          pendingSize = result.pendingSize;
 
           KJ_IF_MAYBE (content, result.content) {
-            tasks.add(handler.handleMessage(kj::mv(*content)));
+            try {
+              hand(Inbound{LspMessageHandler::decode(*content)});
+            } catch (kj::Exception &e) {
+              KJ_LOG(ERROR, "Error decoding message", e.getDescription());
+            }
           } else {
             break;
           }
         }
 
         if (processedPos > 0 && processedPos < currentPos) {
-          memmove(buffer, buffer + processedPos, currentPos - processedPos);
+          memmove(
+              buffer.begin(),
+              buffer.begin() + processedPos,
+              currentPos - processedPos);
           currentPos -= processedPos;
         } else if (processedPos == currentPos) {
           currentPos = 0;
         }
-        return monitorStdin();
+        fitBuffer(pendingSize);
+        return monitorStdin(input);
       });
 }
 
+void StdinReader::fitBuffer(size_t pendingSize) {
+  // Room for all of the message being read, or for more header if the
+  // buffer is full without one. Back to the default once a large message
+  // has been handed over.
+  size_t size = kj::max(kj::max(pendingSize, currentPos), BUFFER_SIZE);
+  if (currentPos == capacity() && pendingSize <= currentPos) {
+    size = capacity() * 2;
+  }
+  if (size != capacity()) {
+    auto resized = kj::heapArray<char>(size + 1);
+    memcpy(resized.begin(), buffer.begin(), currentPos);
+    buffer = kj::mv(resized);
+  }
+}
+
+void StdinReader::hand(Inbound inbound) {
+  // A full queue means the main loop is behind; nothing else runs on this
+  // thread, so sleep until it takes a message.
+  queue.push(kj::mv(inbound));
+  if (!drainPending.exchange(true)) {
+    mainExecutor->executeAsync([this]() { drain(); })
+        .detach([](kj::Exception &&exception) {
+          KJ_LOG(
+              ERROR, "Failed to hand over message", exception.getDescription());
+        });
+  }
+}
+
+void StdinReader::drain() {
+  // Cleared before popping, so a message queued from now on rings again.
+  drainPending.store(false);
+  for (;;) {
+    KJ_IF_MAYBE (inbound, queue.tryPop()) {
+      tasks.add(handler.handleMessage(kj::mv(inbound->message)));
+    } else {
+      break;
+    }
+  }
+}
+
 void StdinReader::taskFailed(kj::Exception &&exception) {
   KJ_LOG(ERROR, "task failed", exception.getDescription());
 }
@@ -5,34 +5,56 @@
 
 #pragma once
 
+#include "io_thread.h"
 #include "lsp_message_handler.h"
+#include "spsc_queue.h"
+#include <atomic>
 #include <kj/async-io.h>
 #include <kj/debug.h>
 #include <kj/io.h>
 
 namespace capnp_ls {
+
+// Reads and decodes LSP messages on a thread of its own and hands them to
+// the handler on the main loop, so that a large payload is framed and parsed
+// while the main loop keeps answering other requests.
 class StdinReader : public kj::TaskSet::ErrorHandler {
 public:
+  // Grows to fit a larger message while it is read.
   static constexpr size_t BUFFER_SIZE = 1 << 20; // 1MB
-  explicit StdinReader(
-      kj::Own<kj::AsyncInputStream> input,
-      LspMessageHandler &handler)
-      : tasks(*this), input(kj::mv(input)), handler(handler), currentPos(0) {
-    buffer = new char[BUFFER_SIZE];
-    tasks.add(monitorStdin());
-  }
-
-  ~StdinReader() {
-    delete[] buffer;
-  }
+  static constexpr size_t QUEUE_CAPACITY = 256;
+
+  // Constructed on the main thread, which then receives every message.
+  explicit StdinReader(LspMessageHandler &handler);
+  KJ_DISALLOW_COPY(StdinReader);
 
 private:
-  kj::Promise<void> monitorStdin();
+  // A decoded message, or the end of input.
+  struct Inbound {
+    kj::Maybe<kj::Own<capnp::MallocMessageBuilder>> message;
+  };
+
   void taskFailed(kj::Exception &&exception) override;
-  kj::TaskSet tasks;
-  kj::Own<kj::AsyncInputStream> input;
+
+  // Main thread.
   LspMessageHandler &handler;
-  char *buffer;
-  size_t currentPos;
+  kj::TaskSet tasks;
+  kj::Own<const kj::Executor> mainExecutor;
+  void drain();
+
+  SpscQueue<Inbound> queue;
+  std::atomic<bool> drainPending{false};
+
+  // Reader thread.
+  // One byte past capacity() for a terminating NUL.
+  kj::Array<char> buffer;
+  size_t currentPos = 0;
+  size_t capacity() const { return buffer.size() - 1; }
+  // Resizes `buffer` for a message of `pendingSize` bytes (0 if unknown).
+  void fitBuffer(size_t pendingSize);
+  kj::Promise<void> monitorStdin(kj::AsyncInputStream &input);
+  void hand(Inbound inbound);
+
+  IoThread thread;
 };
-} // namespace capnp_ls
\ No newline at end of file
+} // namespace capnp_ls
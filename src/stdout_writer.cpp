@@ -4,9 +4,71 @@
 // See LICENSE file in the project root for full license information.
 
 #include "stdout_writer.h"
+#include <kj/debug.h>
+#include <unistd.h>
 
 namespace capnp_ls {
-kj::Promise<void> StdoutWriter::write(kj::StringPtr message) {
-  return output->write(message.cStr(), message.size());
+
+StdoutWriter::StdoutWriter()
+    : queue(QUEUE_CAPACITY),
+      thread([this](kj::AsyncIoContext &ioContext) {
+        output = ioContext.lowLevelProvider->wrapOutputFd(STDOUT_FILENO);
+        return kj::Promise<void>(kj::NEVER_DONE)
+            .attach(kj::defer([this]() { output = nullptr; }));
+      }) {}
+
+StdoutWriter::~StdoutWriter() noexcept(false) {
+  KJ_IF_MAYBE (exception, kj::runCatchingExceptions([this]() {
+                 thread.getExecutor().executeSync(
+                     [this]() -> kj::Promise<void> {
+                       if (!writing) {
+                         return flush();
+                       }
+                       auto paf = kj::newPromiseAndFulfiller<void>();
+                       idle = kj::mv(paf.fulfiller);
+                       return kj::mv(paf.promise);
+                     });
+               })) {
+    KJ_LOG(ERROR, "Failed to flush stdout", exception->getDescription());
+  }
 }
-} // namespace capnp_ls
\ No newline at end of file
+
+void StdoutWriter::write(kj::StringPtr message) {
+  // Sleeps while the client is 1024 messages behind, as a blocking write
+  // would.
+  queue.push(kj::heapString(message));
+  if (!flushPending.exchange(true)) {
+    thread.getExecutor()
+        .executeAsync([this]() { return flush(); })
+        .detach([](kj::Exception &&exception) {
+          KJ_LOG(ERROR, "Failed to write", exception.getDescription());
+        });
+  }
+}
+
+kj::Promise<void> StdoutWriter::flush() {
+  // Cleared before popping, so a message queued from now on rings again.
+  flushPending.store(false);
+  if (writing) {
+    // The running pump() picks up the new messages.
+    return kj::READY_NOW;
+  }
+  writing = true;
+  return pump();
+}
+
+kj::Promise<void> StdoutWriter::pump() {
+  KJ_IF_MAYBE (message, queue.tryPop()) {
+    auto &stream = *KJ_ASSERT_NONNULL(output);
+    auto promise = stream.write(message->begin(), message->size());
+    return promise.attach(kj::mv(*message)).then([this]() { return pump(); });
+  }
+  writing = false;
+  KJ_IF_MAYBE (fulfiller, idle) {
+    (*fulfiller)->fulfill();
+    idle = nullptr;
+  }
+  return kj::READY_NOW;
+}
+
+} // namespace capnp_ls
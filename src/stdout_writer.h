@@ -5,17 +5,40 @@
 
 #pragma once
 
+#include "io_thread.h"
+#include "spsc_queue.h"
+#include <atomic>
 #include <kj/async-io.h>
 
 namespace capnp_ls {
+
+// Writes LSP messages to stdout from a thread of its own, so that a slow
+// client never stalls the main loop and every message is written whole.
 class StdoutWriter {
 public:
-  StdoutWriter(kj::Own<kj::AsyncOutputStream> output)
-      : output(kj::mv(output)) {}
+  static constexpr size_t QUEUE_CAPACITY = 1024;
+
+  StdoutWriter();
+  // Writes out everything still queued first.
+  ~StdoutWriter() noexcept(false);
+  KJ_DISALLOW_COPY(StdoutWriter);
 
-  kj::Promise<void> write(kj::StringPtr message);
+  // Queues a copy of `message`. Main thread only; sleeps until the writer
+  // thread takes a message if the queue is full.
+  void write(kj::StringPtr message);
 
 private:
-  kj::Own<kj::AsyncOutputStream> output;
+  SpscQueue<kj::String> queue;
+  std::atomic<bool> flushPending{false};
+
+  // Writer thread only.
+  kj::Maybe<kj::Own<kj::AsyncOutputStream>> output;
+  bool writing = false;
+  kj::Maybe<kj::Own<kj::PromiseFulfiller<void>>> idle;
+
+  kj::Promise<void> flush();
+  kj::Promise<void> pump();
+
+  IoThread thread;
 };
 } // namespace capnp_ls
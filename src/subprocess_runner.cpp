@@ -6,173 +6,515 @@
 #include "subprocess_runner.h"
 #include "logger.h"
 #include <capnp/message.h>
-#include <capnp/serialize-async.h>
-#include <cstdio>
+#include <capnp/serialize.h>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <kj/async-unix.h>
 #include <kj/common.h>
+#include <kj/debug.h>
+#include <kj/filesystem.h>
+#include <kj/io.h>
 #include <kj/string.h>
-#include <limits.h>
-#include <memory>
-#include <string>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#ifdef __APPLE__
+#include <mach-o/dyld.h>
+#endif
+
+extern char **environ;
 
 namespace capnp_ls {
 
-SubprocessRunner::SubprocessRunner(kj::AsyncIoContext &ioContext)
-    : ioContext(ioContext) {}
+namespace {
 
-bool SubprocessRunner::setWorkingDirectory(const kj::StringPtr &workingDir) {
-  if (workingDir == nullptr) {
-    KJ_LOG(ERROR, "Working directory is not specified");
-    return false;
+class SpawnFileActions {
+public:
+  SpawnFileActions() {
+    int error = posix_spawn_file_actions_init(&actions);
+    if (error != 0) {
+      KJ_FAIL_SYSCALL("posix_spawn_file_actions_init", error);
+    }
+  }
+  ~SpawnFileActions() {
+    posix_spawn_file_actions_destroy(&actions);
   }
+  KJ_DISALLOW_COPY(SpawnFileActions);
 
-  if (chdir(workingDir.cStr()) != 0) {
-    KJ_LOG(ERROR, "Failed to change directory", workingDir);
-    return false;
+  posix_spawn_file_actions_t *get() {
+    return &actions;
   }
 
-  char cwd[PATH_MAX];
-  if (getcwd(cwd, sizeof(cwd)) == nullptr) {
-    KJ_LOG(ERROR, "Failed to get current working directory");
-    return false;
+private:
+  posix_spawn_file_actions_t actions;
+};
+
+// posix_spawn functions return the error number instead of setting errno.
+void checkSpawnCall(int error, const char *call) {
+  if (error != 0) {
+    KJ_FAIL_SYSCALL(call, error);
+  }
+}
+
+// The server's environment with PWD set to the child's working directory,
+// the way a shell would leave it after `cd`.
+kj::Vector<kj::String> buildEnvironment(kj::StringPtr workingDir) {
+  kj::Vector<kj::String> environment;
+  for (char **entry = environ; *entry != nullptr; entry++) {
+    if (!kj::StringPtr(*entry).startsWith("PWD=")) {
+      environment.add(kj::heapString(*entry));
+    }
+  }
+  if (workingDir.startsWith("/")) {
+    environment.add(kj::str("PWD=", workingDir));
+  }
+  return environment;
+}
+
+// An unlinked file for the child's stdout: a memfd where there is one, so
+// the output never touches a disk, else a deleted temp file.
+kj::AutoCloseFd createOutputFile() {
+#ifdef __linux__
+  int memfd = memfd_create("capnp-ls-output", MFD_CLOEXEC);
+  if (memfd >= 0) {
+    return kj::AutoCloseFd(memfd);
   }
+  KJ_LOG(INFO, "memfd_create failed, using a temp file", strerror(errno));
+#endif
+  const char *tmpDir = getenv("TMPDIR");
+  auto path = kj::str(
+      tmpDir != nullptr && *tmpDir != '\0' ? tmpDir : "/tmp",
+      "/capnp-ls-output.XXXXXX");
+  int fd;
+  KJ_SYSCALL(fd = mkstemp(path.begin()), path);
+  kj::AutoCloseFd file(fd);
+  KJ_SYSCALL(unlink(path.cStr()), path);
+  KJ_SYSCALL(fcntl(fd, F_SETFD, FD_CLOEXEC));
+  return file;
+}
 
-  setenv("PWD", cwd, 1);
-  KJ_LOG(INFO, "Working directory for capnp compile", workingDir);
-  return true;
+// Reads the message in place from a mapping of `file`, which the returned
+// reader keeps alive. Null if the file is empty.
+kj::Maybe<kj::Own<capnp::MessageReader>> mapMessage(kj::AutoCloseFd file) {
+  struct stat info;
+  KJ_SYSCALL(fstat(file.get(), &info));
+  if (info.st_size == 0) {
+    return nullptr;
+  }
+  auto mapping = kj::newDiskFile(kj::mv(file))->mmap(0, info.st_size);
+  // mmap() is page-aligned.
+  auto words = kj::arrayPtr(
+      reinterpret_cast<const capnp::word *>(mapping.begin()),
+      mapping.size() / sizeof(capnp::word));
+  capnp::ReaderOptions options{.traversalLimitInWords = 1 << 30};
+  return kj::Own<capnp::MessageReader>(
+      kj::heap<capnp::FlatArrayMessageReader>(words, options)
+          .attach(kj::mv(mapping)));
 }
 
-kj::Vector<kj::String> buildArgs(kj::StringPtr command) {
-  // Build arguments for execv, separated by spaces
-  kj::Vector<kj::String> argv;
+// A started child until it is reaped. Shared by the run, which kills the
+// child when it runs too long or is dropped, and the runner's reaping task,
+// which outlives a dropped run until the child is gone.
+struct ChildProcess : public kj::Refcounted {
+  // Nulled by the event port once the child has been waited for, so that a
+  // pid reused since is never killed.
+  kj::Maybe<pid_t> pid;
+  bool timedOut = false;
 
-  // Split command string by spaces
-  size_t start = 0;
-  while (start < command.size()) {
-    // Skip spaces
-    while (start < command.size() && command[start] == ' ')
-      start++;
-    if (start == command.size())
-      break;
+  void kill() {
+    KJ_IF_MAYBE (running, pid) {
+      ::kill(*running, SIGKILL);
+    }
+  }
+};
+
+// Reads `input` to EOF into `kept`, up to `limit` bytes. The rest is read
+// and counted in `dropped`, so that the child never blocks on a full pipe.
+kj::Promise<void> readCapped(
+    kj::AsyncInputStream &input,
+    kj::Vector<char> &kept,
+    size_t &dropped,
+    size_t limit) {
+  auto buffer = kj::heapArray<char>(4096);
+  auto bytes = buffer.begin();
+  auto size = buffer.size();
+  return input.tryRead(bytes, 1, size)
+      .then([&input, &kept, &dropped, limit, buffer = kj::mv(buffer)](
+                size_t n) mutable -> kj::Promise<void> {
+        if (n == 0) {
+          return kj::READY_NOW;
+        }
+        size_t keep = kj::min(n, limit - kept.size());
+        kept.addAll(buffer.begin(), buffer.begin() + keep);
+        dropped += n - keep;
+        return readCapped(input, kept, dropped, limit);
+      });
+}
 
-    // Find end of token
-    size_t end = start;
-    while (end < command.size() && command[end] != ' ')
-      end++;
+} // namespace
 
-    // Add token
-    argv.add(kj::str(command.slice(start, end)));
-    start = end;
+int runLimited(int argc, char *argv[]) {
+  // Failures are reported on the status descriptor, which a successful exec
+  // closes, so that the server can tell them from the command's own.
+  auto fail = [](const char *what) {
+    auto message = kj::str(what, ": ", strerror(errno));
+    ssize_t n = write(
+        SubprocessRunner::STATUS_FD, message.begin(), message.size());
+    (void)n;
+    return 127;
+  };
+  fcntl(SubprocessRunner::STATUS_FD, F_SETFD, FD_CLOEXEC);
+  if (argc < 5) {
+    errno = EINVAL;
+    return fail("usage");
+  }
+  rlim_t cpuSeconds = strtoull(argv[2], nullptr, 10);
+  // The hard limit leaves a few seconds between SIGXCPU and SIGKILL.
+  struct rlimit cpu = {cpuSeconds, cpuSeconds + 5};
+  if (setrlimit(RLIMIT_CPU, &cpu) != 0) {
+    return fail("setrlimit(RLIMIT_CPU)");
   }
+#ifdef __linux__
+  rlim_t memoryBytes = strtoull(argv[3], nullptr, 10);
+  struct rlimit memory = {memoryBytes, memoryBytes};
+  if (setrlimit(RLIMIT_AS, &memory) != 0) {
+    return fail("setrlimit(RLIMIT_AS)");
+  }
+#endif
+  execvp(argv[4], argv + 4);
+  return fail("exec");
+}
 
-  return argv;
+SubprocessRunner::SubprocessRunner(kj::AsyncIoContext &ioContext)
+    : ioContext(ioContext), executable(serverExecutable()), reaping(*this) {}
+
+kj::Maybe<kj::String> SubprocessRunner::serverExecutable() {
+#ifdef __APPLE__
+  uint32_t size = 0;
+  _NSGetExecutablePath(nullptr, &size);
+  auto path = kj::heapArray<char>(size);
+  if (_NSGetExecutablePath(path.begin(), &size) != 0) {
+    return nullptr;
+  }
+  return kj::heapString(path.begin());
+#else
+  return kj::newDiskFilesystem()->getRoot().tryReadlink(
+      kj::Path({"proc", "self", "exe"}));
+#endif
+}
+
+void SubprocessRunner::taskFailed(kj::Exception &&exception) {
+  KJ_LOG(ERROR, "Failed to reap subprocess", exception.getDescription());
+}
+
+int SubprocessRunner::spawn(
+    kj::ArrayPtr<const kj::String> argv,
+    kj::StringPtr workingDir,
+    kj::ArrayPtr<const FdMapping> fds,
+    pid_t &child) {
+  KJ_REQUIRE(argv.size() > 0);
+  auto isMapped = [&](int target) {
+    for (auto &mapping : fds) {
+      if (mapping.target == target) {
+        return true;
+      }
+    }
+    return false;
+  };
+
+  SpawnFileActions actions;
+  // The server's stdin and stdout carry the LSP stream.
+  for (int target : {STDIN_FILENO, STDOUT_FILENO}) {
+    if (!isMapped(target)) {
+      checkSpawnCall(
+          posix_spawn_file_actions_addopen(
+              actions.get(),
+              target,
+              "/dev/null",
+              target == STDIN_FILENO ? O_RDONLY : O_WRONLY,
+              0),
+          "posix_spawn_file_actions_addopen");
+    }
+  }
+  for (auto &mapping : fds) {
+    checkSpawnCall(
+        posix_spawn_file_actions_adddup2(
+            actions.get(), mapping.fd, mapping.target),
+        "posix_spawn_file_actions_adddup2");
+  }
+  checkSpawnCall(
+      posix_spawn_file_actions_addchdir_np(actions.get(), workingDir.cStr()),
+      "posix_spawn_file_actions_addchdir_np");
+
+  kj::Vector<char *> args(argv.size() + 1);
+  for (auto &arg : argv) {
+    args.add(const_cast<char *>(arg.cStr()));
+  }
+  args.add(nullptr);
+  auto environment = buildEnvironment(workingDir);
+  kj::Vector<char *> envp(environment.size() + 1);
+  for (auto &entry : environment) {
+    envp.add(const_cast<char *>(entry.cStr()));
+  }
+  envp.add(nullptr);
+
+  return posix_spawnp(
+      &child, args[0], actions.get(), nullptr, args.begin(), envp.begin());
 }
 
 kj::Promise<SubprocessRunner::RunResult>
 SubprocessRunner::run(RunParams params) {
-  if (!setWorkingDirectory(params.workingDir)) {
-    KJ_LOG(ERROR, "Failed to set working directory", params.workingDir);
+  if (params.workingDir == nullptr) {
+    KJ_LOG(ERROR, "Working directory is not specified");
     return RunResult{.status = Status::WORKDIR_ERROR};
   }
+  if (params.argv.size() == 0) {
+    KJ_LOG(ERROR, "No command to execute");
+    return RunResult{.status = Status::EXECUTION_ERROR, .exitCode = -1};
+  }
+  if (executable == nullptr) {
+    KJ_LOG(ERROR, "Cannot apply resource limits, server executable not found");
+    return RunResult{
+        .status = Status::EXECUTION_ERROR,
+        .exitCode = -1,
+        .errorText = kj::str("Cannot locate the server executable")};
+  }
+  KJ_LOG(
+      INFO,
+      "Executing command:",
+      kj::strArray(params.argv, " "),
+      params.workingDir);
 
-  int pipeFds[2];
+  // Close-on-exec, so that children started side by side do not inherit
+  // each other's pipes; the ends dup'ed onto stdout and stderr stay open.
+  // A Cap'n Proto message goes to a file instead, which is mapped once the
+  // child exits rather than copied out of a pipe.
+  kj::AutoCloseFd outputFile;
+  kj::AutoCloseFd outputRead;
+  kj::AutoCloseFd outputWrite;
+  if (params.output == Output::CAPNP_MESSAGE) {
+    outputFile = createOutputFile();
+  } else if (params.output != Output::NONE) {
+    int pipeFds[2];
+    KJ_SYSCALL(pipe2(pipeFds, O_CLOEXEC));
+    outputRead = kj::AutoCloseFd(pipeFds[0]);
+    outputWrite = kj::AutoCloseFd(pipeFds[1]);
+  }
   int errPipe[2];
-  KJ_SYSCALL(pipe(pipeFds));
-  KJ_SYSCALL(pipe(errPipe));
+  KJ_SYSCALL(pipe2(errPipe, O_CLOEXEC));
+  kj::AutoCloseFd errorRead(errPipe[0]);
+  kj::AutoCloseFd errorWrite(errPipe[1]);
+
+  // Stays open in the child until its exec succeeds.
+  int statusPipe[2];
+  KJ_SYSCALL(pipe2(statusPipe, O_CLOEXEC));
+  kj::AutoCloseFd statusRead(statusPipe[0]);
+  kj::AutoCloseFd statusWrite(statusPipe[1]);
+
+  // The limits are set by runLimited before it execs the command:
+  // posix_spawn has no attribute for them, and setrlimit here would limit
+  // the server.
+  kj::Vector<kj::String> argv(params.argv.size() + 4);
+  argv.add(kj::heapString(KJ_ASSERT_NONNULL(executable)));
+  argv.add(kj::heapString(LIMIT_FLAG));
+  argv.add(kj::str(params.limits.cpuSeconds));
+  argv.add(kj::str(params.limits.memoryBytes));
+  for (auto &arg : params.argv) {
+    argv.add(kj::heapString(arg));
+  }
 
+  // The status descriptor comes last, so that no descriptor dup'ed before
+  // it can be one it replaces.
+  FdMapping fds[] = {
+      {params.output == Output::CAPNP_MESSAGE ? outputFile.get()
+                                              : outputWrite.get(),
+       STDOUT_FILENO},
+      {errorWrite.get(), STDERR_FILENO},
+      {statusWrite.get(), STATUS_FD}};
+  // Without output, spawn() leaves stdout on /dev/null.
+  auto mapped = params.output == Output::NONE ? kj::arrayPtr(fds).slice(1, 3)
+                                              : kj::arrayPtr(fds);
   pid_t child;
-  KJ_SYSCALL(child = fork());
-
-  if (child == 0) {
-    // Child process
-    // To avoid logging from child process
-    kj::_::Debug::setLogLevel(kj::LogSeverity::FATAL);
-
-    KJ_SYSCALL(close(pipeFds[0]));
-    KJ_SYSCALL(dup2(pipeFds[1], STDOUT_FILENO));
-    KJ_SYSCALL(close(pipeFds[1]));
-
-    KJ_SYSCALL(close(errPipe[0]));
-    KJ_SYSCALL(dup2(errPipe[1], STDERR_FILENO));
-    KJ_SYSCALL(close(errPipe[1]));
-
-    // Execute command
-    auto argv = buildArgs(params.command);
-    // Create a vector of char* for execv
-    kj::Vector<const char *> argPtrs;
-    for (auto &arg : argv) {
-      argPtrs.add(arg.cStr());
-    }
-    // Add null terminator required by execv
-    argPtrs.add(nullptr);
-    KJ_LOG(INFO, "Executing command:", params.command);
-    if (argv[0].startsWith("/")) {
-      execv(argv[0].cStr(), const_cast<char *const *>(argPtrs.begin()));
-    } else {
-      execvp(argv[0].cStr(), const_cast<char *const *>(argPtrs.begin()));
-    }
-    // If exec fails
-    int error = errno;
-    if (error == ENOENT) {
-      KJ_LOG(ERROR, "Command not found:", argv[0]);
-    } else {
-      KJ_FAIL_SYSCALL("exec()", error);
-    }
-    _exit(1);
+  int error = spawn(argv, params.workingDir, mapped, child);
+  if (error != 0) {
+    KJ_LOG(ERROR, "Failed to start command", argv[0], strerror(error));
+    return RunResult{
+        .status = Status::EXECUTION_ERROR,
+        .exitCode = -1,
+        .errorText =
+            kj::str("Failed to start ", argv[0], ": ", strerror(error))};
   }
 
-  // Parent process
-  KJ_SYSCALL(close(pipeFds[1])); // Close write end
-  KJ_SYSCALL(close(errPipe[1])); // Close write end
+  auto process = kj::refcounted<ChildProcess>();
+  process->pid = child;
+  // Registered before going back to the event loop, so that the exit cannot
+  // be missed, and owned by the runner rather than this run, so that a child
+  // whose run is dropped is still reaped once it is gone.
+  auto exited = kj::newPromiseAndFulfiller<int>();
+  reaping.add(
+      ioContext.unixEventPort.onChildExit(process->pid)
+          .then([fulfiller = kj::mv(exited.fulfiller)](int status) mutable {
+            fulfiller->fulfill(kj::mv(status));
+          })
+          .attach(kj::addRef(*process)));
+  // Only kills: the exit is still reported by the event port, whenever a
+  // child stuck in the kernel gets round to dying.
+  auto deadline =
+      ioContext.provider->getTimer()
+          .afterDelay(params.limits.timeout)
+          .then([state = kj::addRef(*process),
+                 command = kj::str(params.argv[0])]() {
+            KJ_IF_MAYBE (pid, state->pid) {
+              KJ_LOG(WARNING, "Killing command that timed out", command, *pid);
+              state->timedOut = true;
+              state->kill();
+            }
+          })
+          .eagerlyEvaluate(nullptr);
+  // Runs without waiting for the reads below, which a child that hangs
+  // with its output open would keep from ever finishing.
+  auto exitStatus =
+      exited.promise.attach(kj::mv(deadline)).eagerlyEvaluate(nullptr);
 
-  auto outputStream = ioContext.lowLevelProvider->wrapInputFd(pipeFds[0]);
-  auto errorStream = ioContext.lowLevelProvider->wrapInputFd(errPipe[0]);
+  // Only the child writes to the pipes; closing our ends lets the reads
+  // below see EOF once it exits.
+  outputWrite = nullptr;
+  errorWrite = nullptr;
+  statusWrite = nullptr;
+
+  auto errorStream = ioContext.lowLevelProvider->wrapInputFd(kj::mv(errorRead));
 
-  capnp::ReaderOptions options{.traversalLimitInWords = 1 << 30};
   kj::Promise<RunResult> outputPromise = kj::Promise<RunResult>(RunResult{
       .status = Status::EXECUTION_ERROR,
       .exitCode = -1,
       .errorText = kj::str("Failed to read output")});
-  if (params.isCapnpMessageOutput) {
-    outputPromise =
-        capnp::tryReadMessage(*outputStream, options)
-            .then(
-                [child](kj::Maybe<kj::Own<capnp::MessageReader>>
-                            &&maybeReader) mutable -> RunResult {
-                  return RunResult{
-                      .exitCode = 0, .maybeReader = kj::mv(maybeReader)};
-                })
-            .attach(kj::mv(outputStream));
-  } else {
+  switch (params.output) {
+  case Output::CAPNP_MESSAGE:
+    // Mapped below, once stderr reaches EOF and the child has exited.
+    outputPromise = RunResult{.exitCode = 0};
+    break;
+  case Output::NONE:
+    outputPromise = RunResult{.exitCode = 0};
+    break;
+  case Output::BYTES: {
+    auto outputStream =
+        ioContext.lowLevelProvider->wrapInputFd(kj::mv(outputRead));
+    outputPromise = outputStream->readAllBytes()
+                        .then([](kj::Array<kj::byte> bytes) {
+                          return RunResult{.rawOutput = kj::mv(bytes)};
+                        })
+                        .attach(kj::mv(outputStream));
+    break;
+  }
+  case Output::TEXT: {
+    auto outputStream =
+        ioContext.lowLevelProvider->wrapInputFd(kj::mv(outputRead));
     outputPromise = outputStream->readAllText()
                         .then([child](kj::StringPtr text) {
                           return RunResult{.textOutput = kj::str(text)};
                         })
                         .attach(kj::mv(outputStream));
+    break;
   }
+  }
+
+  auto errorText = kj::heap<kj::Vector<char>>();
+  auto droppedErrorBytes = kj::heap<size_t>(0);
+  auto errorPromise =
+      readCapped(
+          *errorStream,
+          *errorText,
+          *droppedErrorBytes,
+          params.limits.maxErrorBytes)
+          .then([&errorText = *errorText, &dropped = *droppedErrorBytes]() {
+            auto text = kj::heapString(errorText.begin(), errorText.size());
+            if (dropped > 0) {
+              text = kj::str(text, "\n[", dropped, " more bytes not shown]");
+            }
+            return RunResult{.errorText = kj::mv(text)};
+          })
+          .attach(
+              kj::mv(errorStream),
+              kj::mv(errorText),
+              kj::mv(droppedErrorBytes));
 
-  auto errorPromise = errorStream->readAllText()
-                          .then([child](kj::StringPtr errorText) {
-                            return RunResult{.errorText = kj::str(errorText)};
-                          })
-                          .attach(kj::mv(errorStream));
+  auto statusStream =
+      ioContext.lowLevelProvider->wrapInputFd(kj::mv(statusRead));
+  auto statusPromise = statusStream->readAllText()
+                           .then([](kj::String failure) {
+                             return RunResult{.errorText = kj::mv(failure)};
+                           })
+                           .attach(kj::mv(statusStream));
 
-  auto builder = kj::heapArrayBuilder<kj::Promise<RunResult>>(2);
+  auto builder = kj::heapArrayBuilder<kj::Promise<RunResult>>(3);
   builder.add(kj::mv(outputPromise));
   builder.add(kj::mv(errorPromise));
+  builder.add(kj::mv(statusPromise));
   return kj::joinPromises(builder.finish())
-      .then([child](kj::Array<RunResult> &&outputs) {
-        int status;
-        KJ_SYSCALL(waitpid(child, &status, 0));
-        return RunResult{
-            .status = Status::SUCCESS,
-            .exitCode = WEXITSTATUS(status),
-            .maybeReader = kj::mv(outputs[0].maybeReader),
-            .textOutput = kj::mv(outputs[0].textOutput),
-            .errorText = kj::mv(outputs[1].errorText),
-        };
-      });
+      .then([state = kj::addRef(*process),
+             exitStatus = kj::mv(exitStatus),
+             command = kj::str(params.argv[0]),
+             timeout = params.limits.timeout,
+             outputFile = kj::mv(outputFile)](
+                kj::Array<RunResult> &&outputs) mutable {
+        return exitStatus.then([state = kj::mv(state),
+                                command = kj::mv(command),
+                                timeout,
+                                outputFile = kj::mv(outputFile),
+                                outputs = kj::mv(outputs)](int status) mutable {
+          RunResult result{
+              .status = Status::SUCCESS,
+              .exitCode = WIFEXITED(status) ? WEXITSTATUS(status)
+                                            : 128 + WTERMSIG(status),
+              .textOutput = kj::mv(outputs[0].textOutput),
+              .errorText = kj::mv(outputs[1].errorText),
+              .rawOutput = kj::mv(outputs[0].rawOutput),
+          };
+          auto &startFailure = outputs[2].errorText;
+          if (startFailure.size() > 0) {
+            KJ_LOG(ERROR, "Failed to start command", command, startFailure);
+            result.status = Status::EXECUTION_ERROR;
+            result.exitCode = -1;
+            result.errorText =
+                kj::str("Failed to start ", command, ": ", startFailure);
+          } else if (state->timedOut) {
+            result.status = Status::TIMEOUT;
+            result.errorText = kj::str(
+                result.errorText,
+                "\nKilled after running for ",
+                timeout / kj::SECONDS,
+                " seconds");
+          } else if (WIFSIGNALED(status)) {
+            result.status = Status::EXECUTION_ERROR;
+            result.errorText = kj::str(
+                result.errorText,
+                "\nKilled by signal ",
+                WTERMSIG(status),
+                " (",
+                strsignal(WTERMSIG(status)),
+                ")");
+          }
+          if (outputFile != nullptr && result.status == Status::SUCCESS) {
+            try {
+              result.maybeReader = mapMessage(kj::mv(outputFile));
+            } catch (kj::Exception &e) {
+              KJ_LOG(
+                  ERROR, "Failed to read message output", e.getDescription());
+            }
+          }
+          return result;
+        });
+      })
+      .attach(kj::defer([state = kj::mv(process)]() {
+        // Nothing to do once the child has been reaped. Otherwise the run was
+        // dropped with the child still going; the runner reaps it.
+        state->kill();
+      }));
 }
 
 } // namespace capnp_ls
@@ -8,39 +8,112 @@
 #include <capnp/message.h>
 #include <kj/async-io.h>
 #include <kj/function.h>
+#include <kj/string.h>
+#include <kj/time.h>
+#include <sys/types.h>
 
 namespace capnp_ls {
 
-class SubprocessRunner {
+// Entry point of `capnp-ls --exec-limited <cpu seconds> <memory bytes>
+// <command...>`: sets the limits on itself and execs the command, so that the
+// command never runs without them.
+int runLimited(int argc, char *argv[]);
+
+class SubprocessRunner : public kj::TaskSet::ErrorHandler {
 public:
+  // run() starts every command through the server executable with this flag
+  // (see runLimited).
+  static constexpr const char *LIMIT_FLAG = "--exec-limited";
+  // Where runLimited reports failing to set the limits or to start the
+  // command. Closed by a successful exec.
+  static constexpr int STATUS_FD = 3;
+
   explicit SubprocessRunner(kj::AsyncIoContext &ioContext);
   KJ_DISALLOW_COPY(SubprocessRunner);
 
+  enum class Output {
+    TEXT,
+    CAPNP_MESSAGE,
+    BYTES,
+    // Stdout goes to /dev/null; only the exit code and stderr are kept.
+    NONE
+  };
+
+  // Bounds on one child, so that a hung compiler or a schema that sends it
+  // into a loop costs a compile rather than the server.
+  struct Limits {
+    // Wall-clock time before the child is killed.
+    kj::Duration timeout = 60 * kj::SECONDS;
+    // RLIMIT_CPU: SIGXCPU at this many seconds of CPU time.
+    uint32_t cpuSeconds = 60;
+    // RLIMIT_AS, on Linux: allocations past this fail.
+    uint64_t memoryBytes = uint64_t(4) << 30;
+    // Stderr past this is read and dropped.
+    size_t maxErrorBytes = 1 << 20;
+  };
+
   struct RunParams {
-    kj::StringPtr command;
+    // argv[0] is looked up in PATH unless it contains a slash.
+    kj::ArrayPtr<const kj::String> argv;
+    // Working directory of the child; the server's own never changes.
     kj::StringPtr workingDir;
-    bool isCapnpMessageOutput = false;
+    Output output = Output::TEXT;
+    Limits limits = {};
   };
 
   enum class Status {
     SUCCESS,
     WORKDIR_ERROR,
+    // Not started, or ended by a signal (a crash or a resource limit).
     EXECUTION_ERROR,
-    COMPILATION_ERROR
+    COMPILATION_ERROR,
+    // Killed for running past Limits::timeout.
+    TIMEOUT
   };
 
   struct RunResult {
     Status status;
     int exitCode;
+    // Output::CAPNP_MESSAGE. Reads in place from a mapping of the child's
+    // output, which stays alive as long as the reader does.
     kj::Maybe<kj::Own<capnp::MessageReader>> maybeReader;
     kj::String textOutput;
     kj::String errorText;
+    kj::Array<kj::byte> rawOutput; // Output::BYTES
   };
 
+  // Descriptor `fd` of the server becomes `target` in the child.
+  struct FdMapping {
+    int fd;
+    int target;
+  };
+
+  // Starts the child with posix_spawn, which does not copy the server's page
+  // tables the way fork() does, so launching stays equally cheap however
+  // large the server's heap grows. The child is reaped through
+  // UnixEventPort::onChildExit, which needs captureChildExit() at startup,
+  // and never waited for on the event loop: a child that is killed, or
+  // whose run is dropped, is reaped by the runner whenever it goes.
   kj::Promise<RunResult> run(RunParams params);
 
+  // Starts `argv` in `workingDir` without waiting for it. Stdin and stdout
+  // are /dev/null unless `fds` maps them, stderr is inherited. Returns 0 or
+  // the error number of posix_spawn.
+  static int spawn(
+      kj::ArrayPtr<const kj::String> argv,
+      kj::StringPtr workingDir,
+      kj::ArrayPtr<const FdMapping> fds,
+      pid_t &child);
+
+  // Absolute path of the running executable, if it can be found.
+  static kj::Maybe<kj::String> serverExecutable();
+
 private:
-  bool setWorkingDirectory(const kj::StringPtr &workingDir);
   kj::AsyncIoContext &ioContext;
+  kj::Maybe<kj::String> executable;
+  // Waits for the exit of every child still running.
+  kj::TaskSet reaping;
+
+  void taskFailed(kj::Exception &&exception) override;
 };
 } // namespace capnp_ls
\ No newline at end of file
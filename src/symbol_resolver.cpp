@@ -4,64 +4,158 @@
 // See LICENSE file in the project root for full license information.
 
 #include "symbol_resolver.h"
+#include "line_index.h"
 #include "logger.h"
+#include <atomic>
 #include <capnp/message.h>
-#include <capnp/schema-loader.h>
 #include <capnp/schema-parser.h>
 #include <capnp/schema.capnp.h>
 #include <capnp/serialize.h>
 #include <fstream>
 #include <kj/debug.h>
 #include <kj/filesystem.h>
+#include <kj/function.h>
 #include <kj/io.h>
 #include <kj/map.h>
+#include <kj/mutex.h>
 #include <kj/string-tree.h>
+#include <kj/thread.h>
 #include <kj/vector.h>
 #include <sstream>
+#include <thread>
 
 namespace capnp_ls {
-struct BytePosition {
-  uint32_t startByte;
-  uint32_t endByte;
-};
+namespace {
 
-struct ByteRange {
-  BytePosition startBytePosition;
-  BytePosition endBytePosition;
-};
+// Below this much work per thread, starting threads costs more than it saves.
+constexpr size_t MIN_FILES_PER_WORKER = 4;
+constexpr size_t MIN_NODES_PER_WORKER = 256;
 
-struct TypeInfo {
-  kj::Maybe<uint64_t> typeId;
-  int listDepth;
-  kj::String typeName;
-};
+// Written by setWorkerLimit(), possibly while another thread resolves.
+std::atomic<size_t> workerLimit{0};
 
-Position getPositionInFile(kj::StringPtr filePath, size_t byteOffset) {
-  auto fs = kj::newDiskFilesystem();
+// Threads kept across resolves, so that a compile does not pay for starting
+// and joining them. Started on first use and grown to the largest number a
+// run has asked for.
+class WorkerPool {
+public:
+  WorkerPool() = default;
+  KJ_DISALLOW_COPY(WorkerPool);
+  ~WorkerPool() noexcept(false) {
+    // The threads are idle; they are joined as `threads` is destroyed.
+    state.lockExclusive()->stopping = true;
+  }
 
-  const kj::Directory &rootDir = fs->getRoot();
-  auto file = rootDir.openFile(kj::Path::parse(filePath.slice(1)));
+  // Runs `task(slot)` for every slot in [0, count), one slot per pool
+  // thread, and returns once all are done. `task` must not throw. Runs from
+  // several threads take turns.
+  void run(size_t count, kj::FunctionParam<void(size_t)> task) {
+    auto lock = threads.lockExclusive();
+    while (lock->size() < count) {
+      lock->add(kj::heap<kj::Thread>([this]() { work(); }));
+    }
+    {
+      auto current = state.lockExclusive();
+      current->task = &task;
+      current->slotCount = count;
+      current->nextSlot = 0;
+      current->doneCount = 0;
+    }
+    state.when(
+        [count](const State &current) {
+          return current.doneCount == count;
+        },
+        [](State &current) {
+          current.task = nullptr;
+          current.slotCount = 0;
+        });
+  }
 
-  Position pos = {1, 1};
+private:
+  struct State {
+    kj::FunctionParam<void(size_t)> *task = nullptr;
+    size_t slotCount = 0;
+    size_t nextSlot = 0;
+    size_t doneCount = 0;
+    bool stopping = false;
+  };
+  kj::MutexGuarded<State> state;
+  // Held by run() throughout, which serializes runs.
+  kj::MutexGuarded<kj::Vector<kj::Own<kj::Thread>>> threads;
 
-  if (byteOffset == 0) {
-    return pos;
+  void work() {
+    for (;;) {
+      kj::FunctionParam<void(size_t)> *task = nullptr;
+      size_t slot = 0;
+      bool stopping = state.when(
+          [](const State &current) {
+            return current.stopping || current.nextSlot < current.slotCount;
+          },
+          [&](State &current) {
+            if (!current.stopping) {
+              task = current.task;
+              slot = current.nextSlot++;
+            }
+            return current.stopping;
+          });
+      if (stopping) {
+        return;
+      }
+      (*task)(slot);
+      state.lockExclusive()->doneCount++;
+    }
   }
+};
+
+WorkerPool &workerPool() {
+  static WorkerPool pool;
+  return pool;
+}
 
-  auto content = file->readAllText();
+// Runs `job(i)` for every i in [0, count), on several threads when there is
+// enough work. Jobs must only touch state of their own index. The first
+// exception thrown by a job is rethrown once all of them are done.
+template <typename Job>
+void runParallel(size_t count, size_t minPerWorker, Job &&job) {
+  size_t limit = workerLimit.load(std::memory_order_relaxed);
+  size_t cores = limit > 0
+                     ? limit
+                     : static_cast<size_t>(std::thread::hardware_concurrency());
+  size_t workerCount = kj::min(cores, count / minPerWorker);
+  if (workerCount <= 1) {
+    for (size_t i = 0; i < count; i++) {
+      job(i);
+    }
+    return;
+  }
 
-  for (size_t i = 0; i < byteOffset && i < content.size(); ++i) {
-    if (content[i] == '\n') {
-      pos.line++;
-      pos.character = 1;
-    } else {
-      pos.character++;
+  kj::MutexGuarded<kj::Maybe<kj::Exception>> firstError;
+  workerPool().run(workerCount, [&](size_t w) {
+    for (size_t i = w; i < count; i += workerCount) {
+      KJ_IF_MAYBE (exception, kj::runCatchingExceptions([&]() { job(i); })) {
+        auto error = firstError.lockExclusive();
+        if (*error == nullptr) {
+          *error = kj::mv(*exception);
+        }
+        return;
+      }
     }
+  });
+  KJ_IF_MAYBE (exception, *firstError.lockExclusive()) {
+    kj::throwFatalException(kj::mv(*exception));
   }
+}
 
-  return pos;
+// The part of a display name naming its file.
+kj::String fileNameOf(kj::StringPtr displayName) {
+  KJ_IF_MAYBE (colonPos, displayName.findFirst(':')) {
+    return kj::heapString(displayName.slice(0, *colonPos));
+  }
+  return kj::heapString(displayName);
 }
 
+} // namespace
+
 kj::String extractFilePath(
     kj::StringPtr displayName,
     const kj::Vector<kj::String> &importPaths,
@@ -83,14 +177,16 @@ kj::String extractFilePath(
     relativeFilePathString = kj::heapString(relativeFilePathString.slice(1));
   }
   auto relativeFilePath = kj::Path::parse(relativeFilePathString);
-  // Try workspace path first
+  // Try workspace path first. Relative names are relative to the workspace,
+  // which is where the compiler ran.
   auto fs = kj::newDiskFilesystem();
-  const kj::Directory &currentDir = fs->getCurrent();
-  auto currentPath = fs->getCurrentPath();
-  if (currentDir.exists(relativeFilePath)) {
+  auto &root = fs->getRoot();
+  auto workspaceRoot = fs->getCurrentPath().evalNative(workspacePath);
+  auto inWorkspace = workspaceRoot.append(relativeFilePath.clone());
+  if (root.exists(inWorkspace)) {
     // exists in workspace
     KJ_LOG(INFO, "Found file in workspace", relativeFilePathString);
-    return currentPath.eval(relativeFilePathString).toNativeString(true);
+    return inWorkspace.toNativeString(true);
   } else {
     // Try import paths
     for (const auto &importPath : importPaths) {
@@ -98,23 +194,20 @@ kj::String extractFilePath(
         // absolute path
         auto parsed = kj::Path::parse(importPath.slice(1));
         auto eval = parsed.evalNative(relativeFilePathString);
-        if (fs->getRoot().exists(eval)) {
+        if (root.exists(eval)) {
           KJ_LOG(
               INFO, "Found file in absoluteimport path", eval.toNativeString());
           return eval.toNativeString(true);
         }
       } else {
         // relative path
-        auto parsed = kj::Path::parse(importPath);
-        auto eval = parsed.eval(relativeFilePathString);
-        if (currentDir.exists(eval)) {
+        auto eval = workspaceRoot.eval(importPath).eval(relativeFilePathString);
+        if (root.exists(eval)) {
           KJ_LOG(
               INFO,
               "Found file in relative import path",
               eval.toNativeString());
-          return currentPath.eval(importPath)
-              .eval(relativeFilePathString)
-              .toNativeString(true);
+          return eval.toNativeString(true);
         }
       }
     }
@@ -123,106 +216,281 @@ kj::String extractFilePath(
   KJ_FAIL_REQUIRE("File not found", relativeFilePath);
 }
 
+SymbolTable::Symbol makeSymbol(
+    capnp::schema::Node::Reader node,
+    kj::StringPtr filePath,
+    Range range) {
+  kj::StringPtr displayName = node.getDisplayName();
+  SymbolTable::Symbol symbol{
+      node.getId(),
+      node.getScopeId(),
+      SymbolKind::FILE,
+      false,
+      kj::heapString(displayName.slice(node.getDisplayNamePrefixLength())),
+      kj::heapString(displayName),
+      kj::heapString(filePath),
+      range,
+      {},
+      {}};
+  KJ_IF_MAYBE (colonPos, displayName.findFirst(':')) {
+    symbol.qualifiedName = kj::heapString(displayName.slice(*colonPos + 1));
+  }
+
+  switch (node.which()) {
+  case capnp::schema::Node::FILE:
+    symbol.scopeId = 0;
+    break;
+  case capnp::schema::Node::STRUCT:
+    symbol.kind = SymbolKind::STRUCT;
+    symbol.isGroup = node.getStruct().getIsGroup();
+    for (auto field : node.getStruct().getFields()) {
+      auto &member = symbol.members.add(SymbolTable::Member{
+          kj::heapString(field.getName()), SymbolKind::FIELD});
+      if (field.which() == capnp::schema::Field::GROUP) {
+        member.groupId = field.getGroup().getTypeId();
+      }
+    }
+    break;
+  case capnp::schema::Node::ENUM:
+    symbol.kind = SymbolKind::ENUM;
+    for (auto enumerant : node.getEnum().getEnumerants()) {
+      symbol.members.add(SymbolTable::Member{
+          kj::heapString(enumerant.getName()), SymbolKind::ENUMERANT});
+    }
+    break;
+  case capnp::schema::Node::INTERFACE:
+    symbol.kind = SymbolKind::INTERFACE;
+    for (auto method : node.getInterface().getMethods()) {
+      symbol.members.add(SymbolTable::Member{
+          kj::heapString(method.getName()), SymbolKind::METHOD});
+    }
+    break;
+  case capnp::schema::Node::CONST:
+    symbol.kind = SymbolKind::CONST;
+    break;
+  case capnp::schema::Node::ANNOTATION:
+    symbol.kind = SymbolKind::ANNOTATION;
+    break;
+  }
+
+  for (auto nested : node.getNestedNodes()) {
+    symbol.nestedIds.add(nested.getId());
+  }
+  return symbol;
+}
+
+namespace {
+
+using FileSourceInfo = capnp::schema::CodeGeneratorRequest::RequestedFile::
+    FileSourceInfo;
+
+// One file of the request, as resolved by the map phase.
+struct ResolvedFile {
+  kj::String path;
+  // Null for a file resolved without positions.
+  kj::Maybe<LineIndex> lines;
+  bool isRequested = false;
+};
+
+// What the merge phase applies for one node.
+struct ResolvedNode {
+  kj::Maybe<SymbolTable::Symbol> symbol;
+  kj::Maybe<Range> location;
+  kj::Maybe<ByteRange> span;
+  // Requested file nodes only.
+  kj::HashMap<Range, uint64_t> typeReferences;
+  kj::HashMap<Range, MemberKey> memberReferences;
+};
+
+} // namespace
+
+void SymbolResolver::setWorkerLimit(size_t limit) {
+  workerLimit.store(limit, std::memory_order_relaxed);
+}
+
 int SymbolResolver::resolve(
     kj::Own<capnp::MessageReader> reader,
-    kj::HashMap<kj::String, kj::HashMap<Range, uint64_t>> &positionToNodeIdMap,
-    kj::HashMap<uint64_t, kj::Own<Location>> &nodeLocationMap,
+    SymbolSnapshot::Builder &snapshot,
+    SymbolTable &symbolTable,
+    ReferenceIndex &referenceIndex,
+    SchemaStore &schemaStore,
     const kj::Vector<kj::String> &importPaths,
-    const kj::StringPtr &workspacePath) {
+    const kj::StringPtr &workspacePath,
+    kj::FunctionParam<bool(kj::StringPtr)> needsPositions,
+    kj::FunctionParam<kj::Maybe<kj::StringPtr>(kj::StringPtr)> unsavedText) {
   try {
-    kj::HashMap<uint64_t, capnp::schema::Node::SourceInfo::Reader>
-        sourceInfoMap;
-
     auto request = reader->getRoot<capnp::schema::CodeGeneratorRequest>();
+    auto nodes = request.getNodes();
 
-    kj::HashMap<
-        uint64_t,
-        capnp::schema::CodeGeneratorRequest::RequestedFile::FileSourceInfo::
-            Reader>
-        fileSourceInfoMap;
-
+    kj::HashMap<uint64_t, FileSourceInfo::Reader> fileSourceInfoMap;
+    kj::HashSet<kj::String> requestedFileNames;
     for (auto requestedFile : request.getRequestedFiles()) {
       fileSourceInfoMap.upsert(
           requestedFile.getId(), requestedFile.getFileSourceInfo());
+      kj::StringPtr fileName = requestedFile.getFilename();
+      if (!requestedFileNames.contains(fileName)) {
+        requestedFileNames.insert(kj::heapString(fileName));
+      }
     }
 
-    capnp::SchemaLoader schemaLoader;
-    for (auto node : request.getNodes()) {
-      schemaLoader.load(node);
-    }
-
+    kj::HashMap<uint64_t, capnp::schema::Node::SourceInfo::Reader>
+        sourceInfoMap;
     for (auto sourceInfo : request.getSourceInfo()) {
       sourceInfoMap.upsert(sourceInfo.getId(), sourceInfo);
     }
 
-    int depth = 1;
-    for (auto node : request.getNodes()) {
-      if (node.which() == capnp::schema::Node::Which::FILE) {
-        KJ_IF_MAYBE (sourceInfo, fileSourceInfoMap.find(node.getId())) {
-          kj::String filePath = extractFilePath(
-              node.getDisplayName(), importPaths, workspacePath);
-          // clear previous data for this file
-          positionToNodeIdMap.erase(filePath);
+    // Files are resolved once each rather than once per node.
+    kj::HashMap<kj::String, uint32_t> fileIndexes;
+    kj::Vector<kj::String> fileNames;
+    auto nodeFiles = kj::heapArray<uint32_t>(nodes.size());
+    for (uint32_t i = 0; i < nodes.size(); i++) {
+      auto fileName = fileNameOf(nodes[i].getDisplayName());
+      KJ_IF_MAYBE (index, fileIndexes.find(fileName)) {
+        nodeFiles[i] = *index;
+      } else {
+        nodeFiles[i] = fileNames.size();
+        fileIndexes.insert(kj::heapString(fileName), fileNames.size());
+        fileNames.add(kj::mv(fileName));
+      }
+    }
+
+    // Map phase. The message is only read, so files and then nodes are
+    // processed on as many threads as there are cores.
+    auto files = kj::heapArray<ResolvedFile>(fileNames.size());
+    runParallel(fileNames.size(), MIN_FILES_PER_WORKER, [&](size_t i) {
+      auto &file = files[i];
+      file.path = extractFilePath(fileNames[i], importPaths, workspacePath);
+      file.isRequested = requestedFileNames.contains(fileNames[i]);
+    });
+    // Only these files are read and indexed up front.
+    kj::Vector<size_t> positioned;
+    for (size_t i = 0; i < files.size(); i++) {
+      if (files[i].isRequested || needsPositions(files[i].path)) {
+        positioned.add(i);
+      }
+    }
+    auto buffers = kj::heapArray<kj::Maybe<kj::StringPtr>>(positioned.size());
+    for (size_t i = 0; i < positioned.size(); i++) {
+      buffers[i] = unsavedText(files[positioned[i]].path);
+    }
+    runParallel(positioned.size(), MIN_FILES_PER_WORKER, [&](size_t i) {
+      auto &file = files[positioned[i]];
+      KJ_IF_MAYBE (buffer, buffers[i]) {
+        file.lines = LineIndex(buffer->asArray());
+        return;
+      }
+      auto fs = kj::newDiskFilesystem();
+      auto content = fs->getRoot()
+                         .openFile(kj::Path::parse(file.path.slice(1)))
+                         ->readAllBytes();
+      file.lines = LineIndex(content.asChars());
+    });
 
-          nodeLocationMap.upsert(
-              node.getId(),
-              kj::heap<Location>(Location{
-                  kj::str(filePath), Range{Position{1, 1}, Position{1, 1}}}));
+    auto resolved = kj::heapArray<ResolvedNode>(nodes.size());
+    runParallel(nodes.size(), MIN_NODES_PER_WORKER, [&](size_t i) {
+      auto node = nodes[i];
+      auto &file = files[nodeFiles[i]];
+      auto rangeOf = [&](uint32_t startByte, uint32_t endByte) {
+        return KJ_ASSERT_NONNULL(file.lines).rangeOf({startByte, endByte});
+      };
+      auto &result = resolved[i];
 
+      if (node.which() == capnp::schema::Node::Which::FILE) {
+        result.symbol = makeSymbol(node, file.path, Range{{1, 1}, {1, 1}});
+        KJ_IF_MAYBE (sourceInfo, fileSourceInfoMap.find(node.getId())) {
+          result.location = Range{Position{1, 1}, Position{1, 1}};
           for (auto identifier : sourceInfo->getIdentifiers()) {
-            Range range{
-                getPositionInFile(filePath, identifier.getStartByte()),
-                getPositionInFile(filePath, identifier.getEndByte())};
-            Location location{kj::str(filePath), range};
-            auto &rangeMap = positionToNodeIdMap.findOrCreate(
-                location.uri,
-                [&]() -> kj::HashMap<kj::String, kj::HashMap<Range, uint64_t>>::
-                          Entry {
-                            return {
-                                kj::mv(location.uri),
-                                kj::HashMap<Range, uint64_t>()};
-                          });
-            rangeMap.upsert(range, identifier.getTypeId());
+            auto range =
+                rangeOf(identifier.getStartByte(), identifier.getEndByte());
+            if (identifier.which() ==
+                FileSourceInfo::Identifier::MEMBER) {
+              auto member = identifier.getMember();
+              result.memberReferences.upsert(
+                  range,
+                  MemberKey{member.getParentTypeId(), member.getOrdinal()});
+            } else {
+              result.typeReferences.upsert(range, identifier.getTypeId());
+            }
           }
         }
-        continue;
+        return;
       }
 
       kj::StringPtr displayName = node.getDisplayName();
       if (displayName.endsWith("$Params") || displayName.endsWith("$Results")) {
-        continue;
+        return;
       }
 
-      kj::String filePath =
-          extractFilePath(displayName, importPaths, workspacePath);
+      Range range{Position{1, 1}, Position{1, 1}};
+      auto sourceInfo = sourceInfoMap.find(node.getId());
+      KJ_IF_MAYBE (info, sourceInfo) {
+        if (file.lines == nullptr) {
+          result.span = ByteRange{info->getStartByte(), info->getEndByte()};
+        } else {
+          range = rangeOf(info->getStartByte(), info->getEndByte());
+          result.location = range;
+        }
+      }
+      auto symbol = makeSymbol(node, file.path, range);
+      symbol.span = result.span;
+      KJ_IF_MAYBE (info, sourceInfo) {
+        // Member positions only feed the outline of the files that have
+        // positions, so skip them for the rest of the import closure.
+        auto members = info->getMembers();
+        if (file.lines != nullptr && members.size() == symbol.members.size()) {
+          for (uint32_t m = 0; m < members.size(); m++) {
+            symbol.members[m].range =
+                rangeOf(members[m].getStartByte(), members[m].getEndByte());
+          }
+        }
+      }
+      result.symbol = kj::mv(symbol);
+    });
 
-      KJ_IF_MAYBE (sourceInfo, sourceInfoMap.find(node.getId())) {
-        Range range{
-            getPositionInFile(filePath, sourceInfo->getStartByte()),
-            getPositionInFile(filePath, sourceInfo->getEndByte())};
-        nodeLocationMap.upsert(
-            node.getId(),
-            kj::heap<Location>(Location{kj::str(filePath), range}));
+    // Merge phase, in node order.
+    kj::HashMap<kj::String, kj::Vector<SymbolTable::Symbol>> fileSymbols;
+    for (uint32_t i = 0; i < nodes.size(); i++) {
+      auto &result = resolved[i];
+      KJ_IF_MAYBE (symbol, result.symbol) {
+        auto &filePath = files[nodeFiles[i]].path;
+        if (nodes[i].which() == capnp::schema::Node::Which::FILE &&
+            result.location != nullptr) {
+          referenceIndex.replaceFile(
+              filePath, result.typeReferences, result.memberReferences);
+          snapshot.replaceReferences(filePath, kj::mv(result.typeReferences));
+        }
+        KJ_IF_MAYBE (location, result.location) {
+          snapshot.setLocation(nodes[i].getId(), filePath, *location);
+        }
+        KJ_IF_MAYBE (span, result.span) {
+          snapshot.setLocation(nodes[i].getId(), filePath, *span);
+        }
+        KJ_IF_MAYBE (symbols, fileSymbols.find(filePath)) {
+          symbols->add(kj::mv(*symbol));
+        } else {
+          fileSymbols.insert(kj::heapString(filePath), {})
+              .value.add(kj::mv(*symbol));
+        }
       }
     }
-    // KJ_LOG(INFO, "positionToNodeIdMap:");
-    // for (auto &[key, value] : positionToNodeIdMap) {
-    //   KJ_LOG(INFO, key.cStr());
-    //   for (auto &[range, nodeId] : value) {
-    //     KJ_LOG(INFO, nodeId, range.start.line, range.start.character,
-    //            range.end.character);
-    //   }
-    // }
-
-    // KJ_LOG(INFO, "nodeLocationMap:");
-    // for (auto &[key, value] : nodeLocationMap) {
-    //   KJ_LOG(INFO, key, value->uri, value->range.start.line,
-    //          value->range.end.line);
-    // }
+
+    for (auto &entry : fileSymbols) {
+      symbolTable.replaceFile(entry.key, kj::mv(entry.value));
+    }
+    // Hover materializes schemas from the retained request on demand.
+    schemaStore.addRequest(kj::mv(reader));
   } catch (kj::Exception &e) {
     KJ_LOG(ERROR, "Failed to resolve symbols", e.getDescription());
     return 1;
   }
   return 0;
 }
+
+kj::String SymbolResolver::resolveFilePath(
+    kj::StringPtr displayName,
+    const kj::Vector<kj::String> &importPaths,
+    kj::StringPtr workspacePath) {
+  return extractFilePath(displayName, importPaths, workspacePath);
+}
+
 } // namespace capnp_ls
\ No newline at end of file
@@ -6,17 +6,42 @@
 #pragma once
 
 #include "lsp_types.h"
+#include "reference_index.h"
+#include "schema_store.h"
+#include "symbol_snapshot.h"
+#include "symbol_table.h"
 #include <capnp/message.h>
+#include <kj/function.h>
 #include <kj/map.h>
 
 namespace capnp_ls {
 class SymbolResolver {
 public:
+  // Positions are computed for the requested files and for those
+  // `needsPositions` picks, e.g. open ones. Declarations in the rest of the
+  // import closure keep their byte ranges, so that their files are not even
+  // read until a result points into them. Positions in a file for which
+  // `unsavedText` returns a buffer are computed in that buffer, which the
+  // compiler read in place of the file.
   static int resolve(kj::Own<capnp::MessageReader> reader,
-                     kj::HashMap<kj::String, kj::HashMap<Range, uint64_t>>
-                         &positionToNodeIdMap,
-                     kj::HashMap<uint64_t, kj::Own<Location>> &nodeLocationMap,
+                     SymbolSnapshot::Builder &snapshot,
+                     SymbolTable &symbolTable,
+                     ReferenceIndex &referenceIndex,
+                     SchemaStore &schemaStore,
                      const kj::Vector<kj::String> &importPaths,
-                     const kj::StringPtr &workspacePath);
+                     const kj::StringPtr &workspacePath,
+                     kj::FunctionParam<bool(kj::StringPtr)> needsPositions,
+                     kj::FunctionParam<kj::Maybe<kj::StringPtr>(kj::StringPtr)>
+                         unsavedText);
+
+  // Caps the threads resolve() uses; 0, the default, means one per core.
+  static void setWorkerLimit(size_t limit);
+
+  // Absolute path of the file the compiler reported as `displayName`,
+  // searched in the workspace and then in the import paths.
+  static kj::String resolveFilePath(
+      kj::StringPtr displayName,
+      const kj::Vector<kj::String> &importPaths,
+      kj::StringPtr workspacePath);
 };
 } // namespace capnp_ls
\ No newline at end of file
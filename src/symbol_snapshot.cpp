@@ -0,0 +1,190 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#include "symbol_snapshot.h"
+#include <kj/debug.h>
+
+namespace capnp_ls {
+
+kj::Own<const SymbolSnapshot> SymbolSnapshot::empty() {
+  return kj::atomicRefcounted<SymbolSnapshot>();
+}
+
+kj::Maybe<const kj::HashMap<Range, uint64_t> &>
+SymbolSnapshot::findReferences(kj::StringPtr filePath) const {
+  KJ_IF_MAYBE (file, files.find(filePath)) {
+    KJ_IF_MAYBE (references, (*file)->references) {
+      return *references;
+    }
+  }
+  return nullptr;
+}
+
+kj::Maybe<Location> SymbolSnapshot::findLocation(uint64_t nodeId) const {
+  KJ_IF_MAYBE (file, nodeFiles.find(nodeId)) {
+    KJ_IF_MAYBE (range, (*file)->locations.find(nodeId)) {
+      return Location{kj::str((*file)->path), *range};
+    }
+    KJ_IF_MAYBE (span, (*file)->spans.find(nodeId)) {
+      auto lock = (*file)->lines.lockExclusive();
+      if (*lock == nullptr) {
+        *lock = LineIndex::forFile((*file)->path);
+      }
+      auto &lines = KJ_ASSERT_NONNULL(*lock);
+      return Location{kj::str((*file)->path), lines.rangeOf(*span)};
+    }
+  }
+  return nullptr;
+}
+
+kj::Maybe<const kj::Vector<Diagnostic> &>
+SymbolSnapshot::findDiagnostics(kj::StringPtr filePath) const {
+  return diagnostics.find(filePath);
+}
+
+size_t SymbolSnapshot::footprintOf(const FileSymbols &file) {
+  // Entries plus about two hash buckets each. A declaration also has its
+  // entry in `nodeFiles`.
+  constexpr size_t BUCKETS = 2 * sizeof(uint64_t);
+  constexpr size_t NODE_FILE =
+      sizeof(kj::HashMap<uint64_t, const FileSymbols *>::Entry) + BUCKETS;
+  size_t bytes = sizeof(FileSymbols) + file.path.size() +
+                 file.locations.size() *
+                     (sizeof(kj::HashMap<uint64_t, Range>::Entry) + BUCKETS +
+                      NODE_FILE) +
+                 file.spans.size() *
+                     (sizeof(kj::HashMap<uint64_t, ByteRange>::Entry) +
+                      BUCKETS + NODE_FILE);
+  KJ_IF_MAYBE (references, file.references) {
+    bytes += references->size() *
+             (sizeof(kj::HashMap<Range, uint64_t>::Entry) + BUCKETS);
+  }
+  return bytes;
+}
+
+SymbolSnapshot::Builder::Builder(const SymbolSnapshot &base)
+    : next(kj::atomicRefcounted<SymbolSnapshot>()) {
+  next->version = base.version + 1;
+  next->files.reserve(base.files.size());
+  for (auto &entry : base.files) {
+    next->files.insert(
+        kj::heapString(entry.key), kj::atomicAddRef(*entry.value));
+  }
+  next->nodeFiles.reserve(base.nodeFiles.size());
+  for (auto &entry : base.nodeFiles) {
+    next->nodeFiles.insert(entry.key, entry.value);
+  }
+}
+
+SymbolSnapshot::FileSymbols &
+SymbolSnapshot::Builder::edit(kj::StringPtr filePath) {
+  KJ_IF_MAYBE (file, edited.find(filePath)) {
+    return **file;
+  }
+  auto copy = kj::atomicRefcounted<FileSymbols>();
+  copy->path = kj::heapString(filePath);
+  KJ_IF_MAYBE (original, next->files.find(filePath)) {
+    KJ_IF_MAYBE (references, (*original)->references) {
+      kj::HashMap<Range, uint64_t> copied;
+      copied.reserve(references->size());
+      for (auto &entry : *references) {
+        copied.insert(entry.key, entry.value);
+      }
+      copy->references = kj::mv(copied);
+    }
+    copy->locations.reserve((*original)->locations.size());
+    for (auto &entry : (*original)->locations) {
+      copy->locations.insert(entry.key, entry.value);
+      next->nodeFiles.upsert(entry.key, copy.get());
+    }
+    copy->spans.reserve((*original)->spans.size());
+    for (auto &entry : (*original)->spans) {
+      copy->spans.insert(entry.key, entry.value);
+      next->nodeFiles.upsert(entry.key, copy.get());
+    }
+  }
+  return *edited.insert(kj::heapString(filePath), kj::mv(copy)).value;
+}
+
+void SymbolSnapshot::Builder::replaceReferences(
+    kj::StringPtr filePath,
+    kj::HashMap<Range, uint64_t> references) {
+  auto &file = edit(filePath);
+  if (references.size() == 0) {
+    file.references = nullptr;
+  } else {
+    file.references = kj::mv(references);
+  }
+}
+
+SymbolSnapshot::FileSymbols &
+SymbolSnapshot::Builder::moveNode(uint64_t nodeId, kj::StringPtr filePath) {
+  auto &file = edit(filePath);
+  KJ_IF_MAYBE (previous, next->nodeFiles.find(nodeId)) {
+    const FileSymbols *owner = *previous;
+    if (owner != &file) {
+      // The node moved to another file.
+      auto &moved = edit(owner->path);
+      moved.locations.erase(nodeId);
+      moved.spans.erase(nodeId);
+    }
+  }
+  next->nodeFiles.upsert(nodeId, &file);
+  return file;
+}
+
+void SymbolSnapshot::Builder::setLocation(
+    uint64_t nodeId,
+    kj::StringPtr filePath,
+    Range range) {
+  auto &file = moveNode(nodeId, filePath);
+  file.spans.erase(nodeId);
+  file.locations.upsert(nodeId, range);
+}
+
+void SymbolSnapshot::Builder::setLocation(
+    uint64_t nodeId,
+    kj::StringPtr filePath,
+    ByteRange span) {
+  auto &file = moveNode(nodeId, filePath);
+  file.locations.erase(nodeId);
+  file.spans.upsert(nodeId, span);
+}
+
+void SymbolSnapshot::Builder::removeFile(kj::StringPtr filePath) {
+  auto &file = edit(filePath);
+  for (auto &entry : file.locations) {
+    next->nodeFiles.erase(entry.key);
+  }
+  for (auto &entry : file.spans) {
+    next->nodeFiles.erase(entry.key);
+  }
+  edited.erase(filePath);
+  next->files.erase(filePath);
+}
+
+void SymbolSnapshot::Builder::keepDiagnostics(const SymbolSnapshot &base) {
+  for (auto &entry : base.diagnostics) {
+    kj::Vector<Diagnostic> copied(entry.value.size());
+    for (auto &diagnostic : entry.value) {
+      copied.add(Diagnostic{
+          diagnostic.range,
+          diagnostic.severity,
+          kj::str(diagnostic.message),
+          kj::str(diagnostic.source)});
+    }
+    next->diagnostics.upsert(kj::heapString(entry.key), kj::mv(copied));
+  }
+}
+
+kj::Own<const SymbolSnapshot> SymbolSnapshot::Builder::finish() {
+  for (auto &entry : edited) {
+    next->files.upsert(kj::mv(entry.key), kj::mv(entry.value));
+  }
+  edited.clear();
+  return kj::mv(next);
+}
+
+} // namespace capnp_ls
@@ -0,0 +1,109 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include "atomic_snapshot.h"
+#include "line_index.h"
+#include "lsp_types.h"
+#include <kj/map.h>
+#include <kj/mutex.h>
+#include <kj/refcount.h>
+#include <kj/string.h>
+#include <kj/vector.h>
+
+namespace capnp_ls {
+
+// One version of what compiles have found out about the workspace: the
+// node under each resolved identifier, where every node is declared, and
+// the diagnostics of the last compile. Never modified once published, so
+// any thread may query it. Per-file data is shared with the versions before
+// and after it, so a compile only copies the files it touched.
+class SymbolSnapshot : public kj::AtomicRefcounted {
+public:
+  class Builder;
+
+  static kj::Own<const SymbolSnapshot> empty();
+
+  uint64_t getVersion() const {
+    return version;
+  }
+  // Range of each identifier in `filePath` that resolved to a node, or
+  // null if the file was never compiled or has none.
+  kj::Maybe<const kj::HashMap<Range, uint64_t> &>
+  findReferences(kj::StringPtr filePath) const;
+  // Locations kept as byte ranges are converted here, against the file as
+  // it is on disk the first time one of them is asked for.
+  kj::Maybe<Location> findLocation(uint64_t nodeId) const;
+  const kj::HashMap<kj::String, kj::Vector<Diagnostic>> &
+  getDiagnostics() const {
+    return diagnostics;
+  }
+  kj::Maybe<const kj::Vector<Diagnostic> &>
+  findDiagnostics(kj::StringPtr filePath) const;
+  // Calls `callback(filePath, bytes)` with the approximate memory held by
+  // the references and declaration locations of each file.
+  template <typename Func> void forEachFootprint(Func &&callback) const {
+    for (auto &entry : files) {
+      callback(kj::StringPtr(entry.key), footprintOf(*entry.value));
+    }
+  }
+
+private:
+  struct FileSymbols : public kj::AtomicRefcounted {
+    kj::String path;
+    kj::Maybe<kj::HashMap<Range, uint64_t>> references;
+    // Nodes declared in this file, with positions or, for a file resolved
+    // without them, byte ranges.
+    kj::HashMap<uint64_t, Range> locations;
+    kj::HashMap<uint64_t, ByteRange> spans;
+    // Built on the first lookup of a span.
+    kj::MutexGuarded<kj::Maybe<LineIndex>> lines;
+  };
+
+  uint64_t version = 0;
+  kj::HashMap<kj::String, kj::Own<const FileSymbols>> files;
+  // File declaring each node; points into `files`.
+  kj::HashMap<uint64_t, const FileSymbols *> nodeFiles;
+  kj::HashMap<kj::String, kj::Vector<Diagnostic>> diagnostics;
+
+  static size_t footprintOf(const FileSymbols &file);
+};
+
+// The next version, built from the current one by a single compile.
+// Diagnostics start out empty: they always describe the latest compile.
+class SymbolSnapshot::Builder {
+public:
+  explicit Builder(const SymbolSnapshot &base);
+  KJ_DISALLOW_COPY(Builder);
+
+  // Empty `references` forget the file's references.
+  void replaceReferences(
+      kj::StringPtr filePath,
+      kj::HashMap<Range, uint64_t> references);
+  void setLocation(uint64_t nodeId, kj::StringPtr filePath, Range range);
+  void setLocation(uint64_t nodeId, kj::StringPtr filePath, ByteRange span);
+  // Forgets the references of `filePath` and the nodes it declares.
+  void removeFile(kj::StringPtr filePath);
+  kj::HashMap<kj::String, kj::Vector<Diagnostic>> &getDiagnostics() {
+    return next->diagnostics;
+  }
+  // For a version that is not the result of a compile.
+  void keepDiagnostics(const SymbolSnapshot &base);
+
+  kj::Own<const SymbolSnapshot> finish();
+
+private:
+  kj::Own<SymbolSnapshot> next;
+  // Files copied from `base` for this version, not yet in `next->files`.
+  kj::HashMap<kj::String, kj::Own<FileSymbols>> edited;
+
+  FileSymbols &edit(kj::StringPtr filePath);
+  FileSymbols &moveNode(uint64_t nodeId, kj::StringPtr filePath);
+};
+
+using SymbolSnapshots = AtomicSnapshot<SymbolSnapshot>;
+
+} // namespace capnp_ls
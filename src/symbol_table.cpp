@@ -0,0 +1,410 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#include "symbol_table.h"
+#include <algorithm>
+#include <kj/debug.h>
+
+namespace capnp_ls {
+
+kj::String toLowerAscii(kj::StringPtr text) {
+  auto result = kj::heapString(text);
+  for (char &c : result) {
+    if ('A' <= c && c <= 'Z') {
+      c = c - 'A' + 'a';
+    }
+  }
+  return result;
+}
+
+LspSymbolKind toLspSymbolKind(SymbolKind kind) {
+  switch (kind) {
+  case SymbolKind::FILE:
+    return LspSymbolKind::File;
+  case SymbolKind::STRUCT:
+    return LspSymbolKind::Struct;
+  case SymbolKind::ENUM:
+    return LspSymbolKind::Enum;
+  case SymbolKind::INTERFACE:
+    return LspSymbolKind::Interface;
+  case SymbolKind::CONST:
+    return LspSymbolKind::Constant;
+  case SymbolKind::ANNOTATION:
+    return LspSymbolKind::Property;
+  case SymbolKind::FIELD:
+    return LspSymbolKind::Field;
+  case SymbolKind::ENUMERANT:
+    return LspSymbolKind::EnumMember;
+  case SymbolKind::METHOD:
+    return LspSymbolKind::Method;
+  }
+  KJ_UNREACHABLE;
+}
+
+// Rewards an exact or prefix match of the short name, then an in-order
+// subsequence match over the qualified name with a bonus for runs.
+static uint32_t fuzzyScore(
+    const SymbolTable::Symbol &symbol,
+    kj::StringPtr query,
+    uint32_t sharedTrigrams) {
+  uint32_t score = sharedTrigrams * 10;
+  auto name = toLowerAscii(symbol.name);
+  if (name == query) {
+    score += 1000;
+  } else if (name.startsWith(query)) {
+    score += 500;
+  }
+
+  size_t matched = 0;
+  uint32_t run = 0;
+  for (char c : symbol.qualifiedName) {
+    if ('A' <= c && c <= 'Z') {
+      c = c - 'A' + 'a';
+    }
+    if (matched < query.size() && c == query[matched]) {
+      matched++;
+      run++;
+      score += run * 2;
+    } else {
+      run = 0;
+    }
+  }
+  if (matched == query.size()) {
+    score += 100;
+  }
+  return score;
+}
+
+static bool isBefore(const Position &a, const Position &b) {
+  return a.line < b.line || (a.line == b.line && a.character < b.character);
+}
+
+static bool rangeContains(const Range &range, const Position &pos) {
+  return !isBefore(pos, range.start) && !isBefore(range.end, pos);
+}
+
+void SymbolTable::replaceFile(
+    kj::StringPtr filePath,
+    kj::Vector<Symbol> newSymbols) {
+  removeFile(filePath);
+
+  kj::Vector<uint64_t> ids(newSymbols.size());
+  size_t bytes = 0;
+  for (auto &symbol : newSymbols) {
+    ids.add(symbol.id);
+    bytes += footprintOf(symbol);
+    if (symbol.kind == SymbolKind::FILE) {
+      fileIdByPath.upsert(kj::heapString(filePath), symbol.id);
+      fileIdByDisplayName.upsert(
+          kj::heapString(symbol.qualifiedName), symbol.id);
+    }
+    if (isSearchable(symbol)) {
+      trigramIndex.add(symbol.id, symbol.qualifiedName);
+      pendingNames.add(
+          NameIndexEntry{toLowerAscii(symbol.name), symbol.id, NO_MEMBER});
+      for (uint32_t i = 0; i < symbol.members.size(); i++) {
+        pendingNames.add(
+            NameIndexEntry{toLowerAscii(symbol.members[i].name), symbol.id, i});
+      }
+    }
+    symbols.upsert(symbol.id, kj::mv(symbol));
+  }
+  fileSymbolIds.insert(kj::heapString(filePath), kj::mv(ids));
+  fileRevisions.upsert(kj::heapString(filePath), nextRevision++);
+  fileFootprints.upsert(kj::heapString(filePath), bytes);
+}
+
+void SymbolTable::removeFile(kj::StringPtr filePath) {
+  KJ_IF_MAYBE (oldIds, fileSymbolIds.find(filePath)) {
+    for (auto id : *oldIds) {
+      KJ_IF_MAYBE (symbol, symbols.find(id)) {
+        if (symbol->kind == SymbolKind::FILE) {
+          fileIdByDisplayName.erase(symbol->qualifiedName);
+        }
+        if (isSearchable(*symbol)) {
+          trigramIndex.remove(id, symbol->qualifiedName);
+          if (!staleNameIds.contains(id)) {
+            staleNameIds.insert(id);
+          }
+        }
+      }
+      symbols.erase(id);
+    }
+    // Unmerged entries of the symbols just removed.
+    auto end = std::remove_if(
+        pendingNames.begin(),
+        pendingNames.end(),
+        [this](const NameIndexEntry &entry) {
+          return symbols.find(entry.id) == nullptr;
+        });
+    pendingNames.truncate(end - pendingNames.begin());
+  }
+  fileSymbolIds.erase(filePath);
+  fileIdByPath.erase(filePath);
+  lineIndexes.erase(filePath);
+  fileRevisions.erase(filePath);
+  fileFootprints.erase(filePath);
+}
+
+size_t SymbolTable::footprintOf(kj::StringPtr filePath) const {
+  KJ_IF_MAYBE (bytes, fileFootprints.find(filePath)) {
+    return *bytes;
+  }
+  return 0;
+}
+
+size_t SymbolTable::footprintOf(const Symbol &symbol) {
+  // The symbol, its name index entry and about one trigram posting per
+  // character of its qualified name.
+  size_t bytes = sizeof(Symbol) + sizeof(NameIndexEntry) +
+                 2 * symbol.name.size() + symbol.filePath.size() +
+                 symbol.qualifiedName.size() * (1 + 2 * sizeof(uint64_t)) +
+                 symbol.nestedIds.size() * sizeof(uint64_t);
+  for (auto &member : symbol.members) {
+    bytes += sizeof(Member) + sizeof(NameIndexEntry) + 2 * member.name.size();
+  }
+  return bytes;
+}
+
+uint64_t SymbolTable::getRevision(kj::StringPtr filePath) const {
+  KJ_IF_MAYBE (revision, fileRevisions.find(filePath)) {
+    return *revision;
+  }
+  return 0;
+}
+
+kj::ArrayPtr<const uint64_t>
+SymbolTable::getFileSymbolIds(kj::StringPtr filePath) const {
+  KJ_IF_MAYBE (ids, fileSymbolIds.find(filePath)) {
+    return ids->asPtr();
+  }
+  return nullptr;
+}
+
+kj::Maybe<const SymbolTable::Symbol &> SymbolTable::find(uint64_t id) const {
+  return symbols.find(id);
+}
+
+Range SymbolTable::rangeOf(const Symbol &symbol) const {
+  KJ_IF_MAYBE (span, symbol.span) {
+    auto &lines = lineIndexes.findOrCreate(
+        symbol.filePath, [&]() -> kj::HashMap<kj::String, LineIndex>::Entry {
+          return {
+              kj::heapString(symbol.filePath),
+              LineIndex::forFile(symbol.filePath)};
+        });
+    return lines.rangeOf(*span);
+  }
+  return symbol.range;
+}
+
+kj::Maybe<const SymbolTable::Symbol &>
+SymbolTable::findFile(kj::StringPtr filePath) const {
+  KJ_IF_MAYBE (id, fileIdByPath.find(filePath)) {
+    return symbols.find(*id);
+  }
+  return nullptr;
+}
+
+kj::Maybe<const SymbolTable::Symbol &> SymbolTable::findImport(
+    kj::StringPtr importPath,
+    kj::StringPtr fromFilePath) const {
+  kj::String displayName;
+  if (importPath.startsWith("/")) {
+    displayName = kj::heapString(importPath.slice(1));
+  } else {
+    // Relative imports are resolved against the importing file's directory,
+    // the same way the compiler builds display names.
+    KJ_IF_MAYBE (fromFile, findFile(fromFilePath)) {
+      KJ_IF_MAYBE (slash, fromFile->qualifiedName.findLast('/')) {
+        displayName = kj::str(
+            fromFile->qualifiedName.slice(0, *slash + 1), importPath);
+      } else {
+        displayName = kj::heapString(importPath);
+      }
+    } else {
+      return nullptr;
+    }
+  }
+  KJ_IF_MAYBE (id, fileIdByDisplayName.find(displayName)) {
+    return symbols.find(*id);
+  }
+  return nullptr;
+}
+
+kj::Maybe<const SymbolTable::Symbol &>
+SymbolTable::findChild(uint64_t scopeId, kj::StringPtr name) const {
+  KJ_IF_MAYBE (scope, symbols.find(scopeId)) {
+    for (auto id : scope->nestedIds) {
+      KJ_IF_MAYBE (child, symbols.find(id)) {
+        if (child->name == name) {
+          return *child;
+        }
+      }
+    }
+  }
+  return nullptr;
+}
+
+kj::Maybe<const SymbolTable::Symbol &>
+SymbolTable::findEnclosingScope(kj::StringPtr filePath, Position pos) const {
+  kj::Maybe<const Symbol &> best = findFile(filePath);
+  const Symbol *bestScope = nullptr;
+  KJ_IF_MAYBE (ids, fileSymbolIds.find(filePath)) {
+    for (auto id : *ids) {
+      KJ_IF_MAYBE (symbol, symbols.find(id)) {
+        if (symbol->kind == SymbolKind::FILE ||
+            !rangeContains(symbol->range, pos)) {
+          continue;
+        }
+        if (bestScope == nullptr ||
+            isBefore(bestScope->range.start, symbol->range.start) ||
+            isBefore(symbol->range.end, bestScope->range.end)) {
+          bestScope = symbol;
+        }
+      }
+    }
+  }
+  if (bestScope != nullptr) {
+    return *bestScope;
+  }
+  return best;
+}
+
+kj::Maybe<SymbolTable::Match>
+SymbolTable::findMemberAt(kj::StringPtr filePath, Position pos) const {
+  KJ_IF_MAYBE (scope, findEnclosingScope(filePath, pos)) {
+    for (auto &member : scope->members) {
+      if (rangeContains(member.range, pos)) {
+        return Match{scope, &member};
+      }
+    }
+  }
+  return nullptr;
+}
+
+kj::Vector<SymbolTable::Match>
+SymbolTable::findByPrefix(kj::StringPtr prefix, size_t limit) const {
+  if (pendingNames.size() > 0 || staleNameIds.size() > 0) {
+    mergeNameIndex();
+  }
+
+  kj::Vector<Match> matches;
+  auto key = toLowerAscii(prefix);
+  auto it = std::lower_bound(
+      nameIndex.begin(),
+      nameIndex.end(),
+      kj::StringPtr(key),
+      [](const NameIndexEntry &entry, kj::StringPtr value) {
+        return kj::StringPtr(entry.key) < value;
+      });
+  for (; it != nameIndex.end() && matches.size() < limit; ++it) {
+    if (!it->key.startsWith(key)) {
+      break;
+    }
+    KJ_IF_MAYBE (symbol, symbols.find(it->id)) {
+      const Member *member = nullptr;
+      if (it->memberIndex != NO_MEMBER) {
+        member = &symbol->members[it->memberIndex];
+      }
+      matches.add(Match{symbol, member});
+    }
+  }
+  return matches;
+}
+
+kj::Vector<SymbolTable::SearchResult>
+SymbolTable::search(kj::StringPtr query, size_t limit) const {
+  kj::Vector<char> chars;
+  for (char c : query) {
+    if (c != ' ' && c != '\t') {
+      chars.add(('A' <= c && c <= 'Z') ? c - 'A' + 'a' : c);
+    }
+  }
+  auto key = kj::heapString(chars.asPtr());
+
+  kj::Vector<SearchResult> results;
+  if (key.size() == 0) {
+    return results;
+  }
+
+  if (key.size() < 3) {
+    for (auto &match : findByPrefix(key, limit * 4)) {
+      if (match.member == nullptr && isSearchable(*match.symbol)) {
+        results.add(
+            SearchResult{match.symbol, fuzzyScore(*match.symbol, key, 0)});
+      }
+    }
+  } else {
+    // Allow roughly half of the query trigrams to miss so that typos and
+    // transpositions still match.
+    uint32_t queryTrigrams = TrigramIndex::trigramsOf(key).size();
+    uint32_t minShared = kj::max(1u, (queryTrigrams + 1) / 2);
+    for (auto &candidate : trigramIndex.match(key)) {
+      if (candidate.value < minShared) {
+        continue;
+      }
+      KJ_IF_MAYBE (symbol, symbols.find(candidate.key)) {
+        results.add(
+            SearchResult{symbol, fuzzyScore(*symbol, key, candidate.value)});
+      }
+    }
+  }
+
+  std::sort(
+      results.begin(),
+      results.end(),
+      [](const SearchResult &a, const SearchResult &b) {
+        if (a.score != b.score) {
+          return a.score > b.score;
+        }
+        return kj::StringPtr(a.symbol->qualifiedName) <
+               kj::StringPtr(b.symbol->qualifiedName);
+      });
+  if (results.size() > limit) {
+    results.resize(limit);
+  }
+  return results;
+}
+
+bool SymbolTable::isSearchable(const Symbol &symbol) {
+  return symbol.kind != SymbolKind::FILE && !symbol.isGroup;
+}
+
+void SymbolTable::mergeNameIndex() const {
+  auto byKey = [](const NameIndexEntry &a, const NameIndexEntry &b) {
+    if (kj::StringPtr(a.key) != kj::StringPtr(b.key)) {
+      return kj::StringPtr(a.key) < kj::StringPtr(b.key);
+    }
+    return a.id < b.id;
+  };
+  std::sort(pendingNames.begin(), pendingNames.end(), byKey);
+
+  kj::Vector<NameIndexEntry> merged(nameIndex.size() + pendingNames.size());
+  auto pending = pendingNames.begin();
+  for (auto &entry : nameIndex) {
+    if (staleNameIds.contains(entry.id)) {
+      continue;
+    }
+    while (pending != pendingNames.end() && byKey(*pending, entry)) {
+      merged.add(kj::mv(*pending++));
+    }
+    merged.add(kj::mv(entry));
+  }
+  for (; pending != pendingNames.end(); ++pending) {
+    merged.add(kj::mv(*pending));
+  }
+  KJ_LOG(
+      INFO,
+      "Merged symbol name index",
+      pendingNames.size(),
+      staleNameIds.size(),
+      merged.size());
+  nameIndex = kj::mv(merged);
+  pendingNames.clear();
+  staleNameIds.clear();
+}
+
+} // namespace capnp_ls
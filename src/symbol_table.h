@@ -0,0 +1,144 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include "line_index.h"
+#include "lsp_types.h"
+#include "trigram_index.h"
+#include <kj/map.h>
+#include <kj/string.h>
+#include <kj/vector.h>
+
+namespace capnp_ls {
+
+enum class SymbolKind {
+  FILE,
+  STRUCT,
+  ENUM,
+  INTERFACE,
+  CONST,
+  ANNOTATION,
+  FIELD,
+  ENUMERANT,
+  METHOD
+};
+
+// Declarations extracted from the compiled node tree, grouped per source file
+// so that a recompile can replace the symbols of exactly the files it
+// produced.
+class SymbolTable {
+public:
+  struct Member {
+    kj::String name;
+    SymbolKind kind;
+    Range range = {{1, 1}, {1, 1}};
+    uint64_t groupId = 0; // node id of the group/union a field declares
+  };
+
+  struct Symbol {
+    uint64_t id;
+    uint64_t scopeId; // 0 for files
+    SymbolKind kind;
+    bool isGroup;
+    kj::String name;          // e.g. "Employee"
+    kj::String qualifiedName; // e.g. "EmployeeManagement.Employee"
+    kj::String filePath;
+    Range range;
+    kj::Vector<uint64_t> nestedIds;
+    kj::Vector<Member> members;
+    // Set instead of `range` when the file was resolved without positions.
+    kj::Maybe<ByteRange> span = nullptr;
+  };
+
+  struct Match {
+    const Symbol *symbol;
+    const Member *member; // nullptr when the declaration itself matched
+  };
+
+  // Replaces every symbol previously recorded for `filePath`.
+  void replaceFile(kj::StringPtr filePath, kj::Vector<Symbol> symbols);
+  // Forgets `filePath` as if it had never been resolved.
+  void removeFile(kj::StringPtr filePath);
+  // Approximate bytes held for the symbols of `filePath`, indexes included.
+  size_t footprintOf(kj::StringPtr filePath) const;
+
+  kj::Maybe<const Symbol &> find(uint64_t id) const;
+  // `symbol.range`, converting its span first if it has one.
+  Range rangeOf(const Symbol &symbol) const;
+  kj::Maybe<const Symbol &> findFile(kj::StringPtr filePath) const;
+  // Resolves an import string as written in `fromFilePath`.
+  kj::Maybe<const Symbol &>
+  findImport(kj::StringPtr importPath, kj::StringPtr fromFilePath) const;
+  kj::Maybe<const Symbol &> findChild(uint64_t scopeId, kj::StringPtr name) const;
+  // Innermost non-file declaration of `filePath` whose range contains `pos`,
+  // or the file itself.
+  kj::Maybe<const Symbol &>
+  findEnclosingScope(kj::StringPtr filePath, Position pos) const;
+  // Field, enumerant or method of the innermost enclosing scope whose range
+  // contains `pos`.
+  kj::Maybe<Match> findMemberAt(kj::StringPtr filePath, Position pos) const;
+
+  // Symbols and members whose name starts with `prefix` (case-insensitive),
+  // in name order. Visits at most `limit` entries of the sorted name index.
+  kj::Vector<Match> findByPrefix(kj::StringPtr prefix, size_t limit) const;
+
+  struct SearchResult {
+    const Symbol *symbol;
+    uint32_t score;
+  };
+
+  // Fuzzy search over qualified names, best matches first. Candidates come
+  // from the trigram index (or the name index for queries shorter than a
+  // trigram), never from a scan of every symbol.
+  kj::Vector<SearchResult> search(kj::StringPtr query, size_t limit) const;
+
+  // Changes every time the symbols of `filePath` are replaced; 0 if the file
+  // has never been resolved.
+  uint64_t getRevision(kj::StringPtr filePath) const;
+  kj::ArrayPtr<const uint64_t> getFileSymbolIds(kj::StringPtr filePath) const;
+
+  size_t size() const {
+    return symbols.size();
+  }
+
+private:
+  struct NameIndexEntry {
+    kj::String key; // lower-cased name
+    uint64_t id;
+    uint32_t memberIndex; // NO_MEMBER for the declaration itself
+  };
+  static constexpr uint32_t NO_MEMBER = UINT32_MAX;
+
+  void mergeNameIndex() const;
+  static bool isSearchable(const Symbol &symbol);
+  static size_t footprintOf(const Symbol &symbol);
+
+  kj::HashMap<uint64_t, Symbol> symbols;
+  kj::HashMap<kj::String, kj::Vector<uint64_t>> fileSymbolIds;
+  kj::HashMap<kj::String, uint64_t> fileIdByPath;
+  kj::HashMap<kj::String, uint64_t> fileIdByDisplayName;
+  kj::HashMap<kj::String, uint64_t> fileRevisions;
+  kj::HashMap<kj::String, size_t> fileFootprints;
+  uint64_t nextRevision = 1;
+  TrigramIndex trigramIndex;
+
+  // Sorted by key. The entries of replaced files are dropped, and those of
+  // their replacements merged in, on the first query after an update: a
+  // burst of replaceFile() calls from one compile pays for one linear merge,
+  // and only the new names are lower-cased and sorted.
+  mutable kj::Vector<NameIndexEntry> nameIndex;
+  // Entries not merged into `nameIndex` yet, and ids whose entries there
+  // are stale.
+  mutable kj::Vector<NameIndexEntry> pendingNames;
+  mutable kj::HashSet<uint64_t> staleNameIds;
+  // Lines of the files whose spans were converted, until they are replaced.
+  mutable kj::HashMap<kj::String, LineIndex> lineIndexes;
+};
+
+kj::String toLowerAscii(kj::StringPtr text);
+LspSymbolKind toLspSymbolKind(SymbolKind kind);
+
+} // namespace capnp_ls
@@ -0,0 +1,417 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#include "syntax_tree.h"
+#include <kj/debug.h>
+
+namespace capnp_ls {
+namespace {
+
+constexpr int MAX_NESTING_DEPTH = 64;
+
+bool isTypeDeclaration(SyntaxKind kind) {
+  switch (kind) {
+  case SyntaxKind::USING:
+  case SyntaxKind::CONST:
+  case SyntaxKind::ANNOTATION:
+  case SyntaxKind::STRUCT:
+  case SyntaxKind::ENUM:
+  case SyntaxKind::INTERFACE:
+    return true;
+  case SyntaxKind::FIELD:
+  case SyntaxKind::GROUP:
+  case SyntaxKind::UNION:
+  case SyntaxKind::ENUMERANT:
+  case SyntaxKind::METHOD:
+    return false;
+  }
+  KJ_UNREACHABLE;
+}
+
+bool rangeContains(const Range &range, Position position) {
+  if (position.line < range.start.line || position.line > range.end.line) {
+    return false;
+  }
+  if (position.line == range.start.line &&
+      position.character < range.start.character) {
+    return false;
+  }
+  return position.line != range.end.line ||
+         position.character <= range.end.character;
+}
+
+// Whether only comments lie between `lastToken` and `changeStart`.
+bool reachesChange(
+    kj::ArrayPtr<const Token> tokens,
+    uint32_t lastToken,
+    uint32_t changeStart) {
+  for (uint32_t i = lastToken + 1; i < changeStart; i++) {
+    if (tokens[i].kind != TokenKind::COMMENT) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void shiftNode(SyntaxNode &node, int64_t delta) {
+  node.firstToken = static_cast<uint32_t>(node.firstToken + delta);
+  node.lastToken = static_cast<uint32_t>(node.lastToken + delta);
+  KJ_IF_MAYBE (name, node.nameToken) {
+    *name = static_cast<uint32_t>(*name + delta);
+  }
+  KJ_IF_MAYBE (ordinal, node.ordinalToken) {
+    *ordinal = static_cast<uint32_t>(*ordinal + delta);
+  }
+  for (auto &child : node.children) {
+    shiftNode(child, delta);
+  }
+}
+
+// Recursive descent over the token stream, skipping comments. Every call to
+// parseDeclaration() consumes at least one token, so parsing always
+// terminates however broken the input is.
+class Parser {
+public:
+  Parser(kj::StringPtr text, kj::ArrayPtr<const Token> tokens, uint32_t pos)
+      : text(text), tokens(tokens), pos(pos), lastConsumed(pos) {}
+
+  // Index of the next non-comment token, or tokens.size() at the end.
+  uint32_t position() {
+    skipComments();
+    return pos;
+  }
+
+  kj::Maybe<SyntaxNode> parseDeclaration(kj::Maybe<SyntaxKind> scope) {
+    return parseDeclaration(scope, 0);
+  }
+
+private:
+  kj::StringPtr text;
+  kj::ArrayPtr<const Token> tokens;
+  uint32_t pos;
+  uint32_t lastConsumed;
+
+  void skipComments() {
+    while (pos < tokens.size() && tokens[pos].kind == TokenKind::COMMENT) {
+      pos++;
+    }
+  }
+
+  void consume() {
+    lastConsumed = pos++;
+  }
+
+  bool is(uint32_t index, TokenKind kind, kj::StringPtr value) {
+    if (index >= tokens.size() || tokens[index].kind != kind) {
+      return false;
+    }
+    auto tokenText = Lexer::textOf(text, tokens[index]);
+    return kj::StringPtr(tokenText.begin(), tokenText.size()) == value;
+  }
+
+  bool isPunctuation(uint32_t index, kj::StringPtr value) {
+    return is(index, TokenKind::PUNCTUATION, value);
+  }
+
+  bool isKeyword(uint32_t index, kj::StringPtr value) {
+    return is(index, TokenKind::KEYWORD, value);
+  }
+
+  uint32_t nextCodeToken(uint32_t index) {
+    index++;
+    while (index < tokens.size() &&
+           tokens[index].kind == TokenKind::COMMENT) {
+      index++;
+    }
+    return index;
+  }
+
+  // A keyword in the first column that can only open a new declaration.
+  bool startsTopLevelDeclaration(uint32_t index) {
+    if (index >= tokens.size() || tokens[index].column != 0) {
+      return false;
+    }
+    for (auto keyword :
+         {"struct", "enum", "interface", "const", "annotation", "using"}) {
+      if (isKeyword(index, keyword)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // `name @N` at the start of a line, i.e. the next member after one whose
+  // `;` is still missing.
+  bool startsMemberLine(uint32_t index) {
+    return index < tokens.size() && index > 0 &&
+           tokens[index].kind == TokenKind::IDENTIFIER &&
+           tokens[lastConsumed].line != tokens[index].line &&
+           nextCodeToken(index) < tokens.size() &&
+           tokens[nextCodeToken(index)].kind == TokenKind::ORDINAL;
+  }
+
+  // Skips the rest of a declaration header (generic parameters, ids,
+  // annotations, types, default values). Returns true after consuming the
+  // `{` of a body; stops after `;` or, without consuming it, before a token
+  // that belongs to the enclosing scope or to the next declaration.
+  bool skipHeader() {
+    uint32_t depth = 0;
+    for (;;) {
+      skipComments();
+      if (pos >= tokens.size() || isPunctuation(pos, "}") ||
+          startsTopLevelDeclaration(pos) ||
+          (depth == 0 && startsMemberLine(pos))) {
+        return false;
+      }
+      if (depth == 0 && isPunctuation(pos, "{")) {
+        consume();
+        return true;
+      }
+      if (depth == 0 && isPunctuation(pos, ";")) {
+        consume();
+        return false;
+      }
+      if (isPunctuation(pos, "(") || isPunctuation(pos, "[")) {
+        depth++;
+      } else if (
+          depth > 0 && (isPunctuation(pos, ")") || isPunctuation(pos, "]"))) {
+        depth--;
+      }
+      consume();
+    }
+  }
+
+  void parseBody(SyntaxNode &node, SyntaxKind scope, int depth) {
+    for (;;) {
+      skipComments();
+      if (pos >= tokens.size() || startsTopLevelDeclaration(pos)) {
+        // Unterminated block.
+        return;
+      }
+      if (isPunctuation(pos, "}")) {
+        consume();
+        return;
+      }
+      KJ_IF_MAYBE (child, parseDeclaration(scope, depth + 1)) {
+        node.children.add(kj::mv(*child));
+      }
+    }
+  }
+
+  kj::Maybe<SyntaxNode>
+  parseDeclaration(kj::Maybe<SyntaxKind> scope, int depth) {
+    skipComments();
+    if (pos >= tokens.size()) {
+      return nullptr;
+    }
+    uint32_t first = pos;
+    SyntaxNode node{SyntaxKind::FIELD, first, first, nullptr, nullptr, {}};
+
+    if (isKeyword(pos, "struct") || isKeyword(pos, "enum") ||
+        isKeyword(pos, "interface")) {
+      node.kind = isKeyword(pos, "struct") ? SyntaxKind::STRUCT
+                  : isKeyword(pos, "enum") ? SyntaxKind::ENUM
+                                           : SyntaxKind::INTERFACE;
+      consume();
+      skipComments();
+      if (pos < tokens.size() && tokens[pos].kind == TokenKind::IDENTIFIER) {
+        node.nameToken = pos;
+        consume();
+      }
+    } else if (
+        isKeyword(pos, "const") || isKeyword(pos, "annotation") ||
+        isKeyword(pos, "using")) {
+      node.kind = isKeyword(pos, "const")        ? SyntaxKind::CONST
+                  : isKeyword(pos, "annotation") ? SyntaxKind::ANNOTATION
+                                                 : SyntaxKind::USING;
+      consume();
+      skipComments();
+      if (pos < tokens.size() && tokens[pos].kind == TokenKind::IDENTIFIER) {
+        node.nameToken = pos;
+        consume();
+      }
+    } else if (
+        scope != nullptr &&
+        (isKeyword(pos, "union") || isKeyword(pos, "group"))) {
+      // Unnamed union (or a stray group keyword).
+      node.kind =
+          isKeyword(pos, "union") ? SyntaxKind::UNION : SyntaxKind::GROUP;
+      consume();
+    } else if (
+        scope != nullptr && tokens[pos].kind == TokenKind::IDENTIFIER) {
+      node.nameToken = pos;
+      consume();
+      skipComments();
+      if (pos < tokens.size() && tokens[pos].kind == TokenKind::ORDINAL) {
+        node.ordinalToken = pos;
+        consume();
+      }
+      KJ_IF_MAYBE (scopeKind, scope) {
+        node.kind = *scopeKind == SyntaxKind::ENUM ? SyntaxKind::ENUMERANT
+                    : *scopeKind == SyntaxKind::INTERFACE
+                        ? SyntaxKind::METHOD
+                        : SyntaxKind::FIELD;
+      }
+      uint32_t next = position();
+      if (node.kind == SyntaxKind::FIELD && isPunctuation(next, ":")) {
+        uint32_t type = nextCodeToken(next);
+        if (isKeyword(type, "union")) {
+          node.kind = SyntaxKind::UNION;
+        } else if (isKeyword(type, "group")) {
+          node.kind = SyntaxKind::GROUP;
+        }
+      }
+    } else {
+      // Not a declaration: the file id, a stray token or a top-level member.
+      // Skip the statement and resynchronize at the next one.
+      consume();
+      if (!isPunctuation(first, ";") && !isPunctuation(first, "}") &&
+          skipHeader()) {
+        parseBody(node, SyntaxKind::STRUCT, depth);
+      }
+      return nullptr;
+    }
+
+    if (skipHeader() && depth < MAX_NESTING_DEPTH) {
+      SyntaxKind bodyScope =
+          node.kind == SyntaxKind::ENUM || node.kind == SyntaxKind::INTERFACE
+              ? node.kind
+              : SyntaxKind::STRUCT;
+      parseBody(node, bodyScope, depth);
+    }
+    node.lastToken = lastConsumed;
+    return kj::mv(node);
+  }
+};
+
+void findIn(
+    kj::StringPtr text,
+    kj::ArrayPtr<const Token> tokens,
+    kj::ArrayPtr<const SyntaxNode> nodes,
+    kj::ArrayPtr<const char> name,
+    Position position,
+    uint32_t score, // how closely the scope of `nodes` encloses `position`
+    const SyntaxNode *&best,
+    uint32_t &bestScore) {
+  for (auto &node : nodes) {
+    KJ_IF_MAYBE (nameToken, node.nameToken) {
+      if (isTypeDeclaration(node.kind) &&
+          Lexer::textOf(text, tokens[*nameToken]) == name &&
+          (best == nullptr || score > bestScore)) {
+        best = &node;
+        bestScore = score;
+      }
+    }
+    bool encloses = score > 0 &&
+                    rangeContains(
+                        SyntaxTree::rangeOf(
+                            tokens, node.firstToken, node.lastToken),
+                        position);
+    findIn(
+        text,
+        tokens,
+        node.children,
+        name,
+        position,
+        encloses ? score + 1 : 0,
+        best,
+        bestScore);
+  }
+}
+
+} // namespace
+
+void SyntaxTree::parse(kj::StringPtr text, kj::ArrayPtr<const Token> tokens) {
+  declarations.clear();
+  Parser parser(text, tokens, 0);
+  while (parser.position() < tokens.size()) {
+    KJ_IF_MAYBE (node, parser.parseDeclaration(nullptr)) {
+      declarations.add(kj::mv(*node));
+    }
+  }
+}
+
+SyntaxTreeChange SyntaxTree::reparse(
+    kj::StringPtr text,
+    kj::ArrayPtr<const Token> tokens,
+    uint32_t changeStart,
+    uint32_t oldCount,
+    uint32_t newCount) {
+  int64_t delta = static_cast<int64_t>(newCount) - oldCount;
+  uint32_t oldChangeEnd = changeStart + oldCount;
+
+  // Declarations ending before the change are untouched, except one
+  // followed by nothing but comments up to it: that one may have been cut
+  // short by a token the edit removed, or left open at the end of the file.
+  size_t first = 0;
+  while (first < declarations.size() &&
+         !reachesChange(tokens, declarations[first].lastToken, changeStart)) {
+    first++;
+  }
+  uint32_t start = first > 0 ? declarations[first - 1].lastToken + 1 : 0;
+
+  kj::Vector<SyntaxNode> updated(declarations.size());
+  for (size_t i = 0; i < first; i++) {
+    updated.add(kj::mv(declarations[i]));
+  }
+
+  Parser parser(text, tokens, start);
+  size_t old = first;
+  for (;;) {
+    uint32_t pos = parser.position();
+    if (pos >= tokens.size()) {
+      old = declarations.size();
+      break;
+    }
+    // Back in step once an old declaration past the change starts where the
+    // parser is: it and everything after it can be reused.
+    while (old < declarations.size() &&
+           (declarations[old].firstToken < oldChangeEnd ||
+            declarations[old].firstToken + delta < pos)) {
+      old++;
+    }
+    if (old < declarations.size() &&
+        declarations[old].firstToken + delta == pos) {
+      break;
+    }
+    KJ_IF_MAYBE (node, parser.parseDeclaration(nullptr)) {
+      updated.add(kj::mv(*node));
+    }
+  }
+  SyntaxTreeChange change{first, old - first, updated.size() - first};
+  for (; old < declarations.size(); old++) {
+    shiftNode(declarations[old], delta);
+    updated.add(kj::mv(declarations[old]));
+  }
+  declarations = kj::mv(updated);
+  return change;
+}
+
+kj::Maybe<const SyntaxNode &> SyntaxTree::findDeclaration(
+    kj::StringPtr text,
+    kj::ArrayPtr<const Token> tokens,
+    kj::ArrayPtr<const char> name,
+    Position position) const {
+  const SyntaxNode *best = nullptr;
+  uint32_t bestScore = 0;
+  findIn(text, tokens, declarations, name, position, 1, best, bestScore);
+  if (best == nullptr) {
+    return nullptr;
+  }
+  return *best;
+}
+
+Range SyntaxTree::rangeOf(
+    kj::ArrayPtr<const Token> tokens,
+    uint32_t first,
+    uint32_t last) {
+  auto &start = tokens[first];
+  auto &end = tokens[last];
+  return Range{
+      {start.line + 1, start.column + 1},
+      {end.line + 1, end.column + (end.endByte - end.startByte) + 1}};
+}
+
+} // namespace capnp_ls
@@ -0,0 +1,91 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include "lexer.h"
+#include "lsp_types.h"
+#include <kj/string.h>
+#include <kj/vector.h>
+
+namespace capnp_ls {
+
+enum class SyntaxKind {
+  USING,
+  CONST,
+  ANNOTATION,
+  STRUCT,
+  ENUM,
+  INTERFACE,
+  FIELD,
+  GROUP,
+  UNION,
+  ENUMERANT,
+  METHOD
+};
+
+// A declaration as written in the buffer. Positions are kept as indexes into
+// the token stream the node was parsed from, so that nodes after an edit
+// only need their indexes shifted.
+struct SyntaxNode {
+  SyntaxKind kind;
+  uint32_t firstToken;
+  uint32_t lastToken; // inclusive
+  kj::Maybe<uint32_t> nameToken;
+  kj::Maybe<uint32_t> ordinalToken; // "@N" of fields, enumerants and methods
+  kj::Vector<SyntaxNode> children;
+};
+
+// Top-level declarations [first, first + added) of the updated tree replace
+// [first, first + removed) of the previous one; the rest are unchanged apart
+// from their token indexes.
+struct SyntaxTreeChange {
+  size_t first;
+  size_t removed;
+  size_t added;
+};
+
+// Declaration tree of a schema, built without the compiler. The parser never
+// fails: a statement it cannot make sense of is skipped up to the next `;`
+// or `}`, and a block left open is closed again when a top-level keyword
+// starts a line, so that a half-typed declaration does not swallow the rest
+// of the file.
+class SyntaxTree {
+public:
+  void parse(kj::StringPtr text, kj::ArrayPtr<const Token> tokens);
+
+  // Updates the tree after tokens [changeStart, changeStart + oldCount) were
+  // replaced by the `newCount` tokens at the same index of `tokens`. Only the
+  // top-level declarations touching the change are parsed again; the ones
+  // after it are kept once the parser is back in step with them.
+  SyntaxTreeChange reparse(
+      kj::StringPtr text,
+      kj::ArrayPtr<const Token> tokens,
+      uint32_t changeStart,
+      uint32_t oldCount,
+      uint32_t newCount);
+
+  kj::ArrayPtr<const SyntaxNode> getDeclarations() const {
+    return declarations;
+  }
+
+  // The declaration named `name` closest to `position`: one nested in a
+  // scope enclosing the position wins over one further out. Only type,
+  // const and annotation declarations are considered.
+  kj::Maybe<const SyntaxNode &> findDeclaration(
+      kj::StringPtr text,
+      kj::ArrayPtr<const Token> tokens,
+      kj::ArrayPtr<const char> name,
+      Position position) const;
+
+  // 1-based range covering tokens [first, last].
+  static Range
+  rangeOf(kj::ArrayPtr<const Token> tokens, uint32_t first, uint32_t last);
+
+private:
+  kj::Vector<SyntaxNode> declarations;
+};
+
+} // namespace capnp_ls
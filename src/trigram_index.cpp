@@ -0,0 +1,74 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#include "trigram_index.h"
+#include <algorithm>
+
+namespace capnp_ls {
+
+static uint8_t lowerAscii(char c) {
+  if ('A' <= c && c <= 'Z') {
+    return c - 'A' + 'a';
+  }
+  return static_cast<uint8_t>(c);
+}
+
+kj::Vector<uint32_t> TrigramIndex::trigramsOf(kj::StringPtr text) {
+  kj::Vector<uint32_t> trigrams;
+  if (text.size() < 3) {
+    return trigrams;
+  }
+  trigrams.reserve(text.size() - 2);
+  for (size_t i = 0; i + 2 < text.size(); i++) {
+    trigrams.add(
+        (static_cast<uint32_t>(lowerAscii(text[i])) << 16) |
+        (static_cast<uint32_t>(lowerAscii(text[i + 1])) << 8) |
+        static_cast<uint32_t>(lowerAscii(text[i + 2])));
+  }
+  std::sort(trigrams.begin(), trigrams.end());
+  auto last = std::unique(trigrams.begin(), trigrams.end());
+  trigrams.resize(last - trigrams.begin());
+  return trigrams;
+}
+
+void TrigramIndex::add(uint64_t id, kj::StringPtr text) {
+  for (auto trigram : trigramsOf(text)) {
+    auto &ids = postings.findOrCreate(
+        trigram, [&]() -> kj::HashMap<uint32_t, kj::HashSet<uint64_t>>::Entry {
+          return {trigram, kj::HashSet<uint64_t>()};
+        });
+    if (!ids.contains(id)) {
+      ids.insert(id);
+    }
+  }
+}
+
+void TrigramIndex::remove(uint64_t id, kj::StringPtr text) {
+  for (auto trigram : trigramsOf(text)) {
+    KJ_IF_MAYBE (ids, postings.find(trigram)) {
+      ids->erase(id);
+      if (ids->size() == 0) {
+        postings.erase(trigram);
+      }
+    }
+  }
+}
+
+kj::HashMap<uint64_t, uint32_t>
+TrigramIndex::match(kj::StringPtr query) const {
+  kj::HashMap<uint64_t, uint32_t> counts;
+  for (auto trigram : trigramsOf(query)) {
+    KJ_IF_MAYBE (ids, postings.find(trigram)) {
+      for (auto id : *ids) {
+        counts.findOrCreate(id, [&]() -> kj::HashMap<uint64_t, uint32_t>::Entry {
+          return {id, 0};
+        })++;
+      }
+    }
+  }
+  return counts;
+}
+
+} // namespace capnp_ls
@@ -0,0 +1,32 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#pragma once
+
+#include <kj/map.h>
+#include <kj/string.h>
+#include <kj/vector.h>
+
+namespace capnp_ls {
+
+// Case-insensitive trigram postings for fuzzy name lookup. Each id maps to
+// the set of distinct trigrams of its text; callers must remove an id with
+// the same text it was added with.
+class TrigramIndex {
+public:
+  void add(uint64_t id, kj::StringPtr text);
+  void remove(uint64_t id, kj::StringPtr text);
+
+  // Number of distinct query trigrams each candidate shares with `query`.
+  // Only ids sharing at least one trigram are returned.
+  kj::HashMap<uint64_t, uint32_t> match(kj::StringPtr query) const;
+
+  static kj::Vector<uint32_t> trigramsOf(kj::StringPtr text);
+
+private:
+  kj::HashMap<uint32_t, kj::HashSet<uint64_t>> postings;
+};
+
+} // namespace capnp_ls
@@ -18,4 +18,11 @@ kj::String uriToPath(const kj::StringPtr uri) {
 
   return kj::heapString(path);
 }
+
+uint64_t hashBytes(kj::ArrayPtr<const kj::byte> bytes, uint64_t hash) {
+  for (auto byte : bytes) {
+    hash = (hash ^ byte) * 0x100000001b3ull;
+  }
+  return hash;
+}
 } // namespace capnp_ls
\ No newline at end of file
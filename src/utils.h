@@ -9,4 +9,10 @@
 
 namespace capnp_ls {
 kj::String uriToPath(const kj::StringPtr uri);
-}
\ No newline at end of file
+
+constexpr uint64_t HASH_SEED = 0xcbf29ce484222325ull;
+// 64-bit FNV-1a of `bytes`. Pass the result back as `hash` to cover several
+// pieces as one.
+uint64_t
+hashBytes(kj::ArrayPtr<const kj::byte> bytes, uint64_t hash = HASH_SEED);
+}
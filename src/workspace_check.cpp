@@ -0,0 +1,403 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#include "workspace_check.h"
+#include "compilation_manager.h"
+#include <algorithm>
+#include <capnp/compat/json.h>
+#include <capnp/message.h>
+#include <kj/async-io.h>
+#include <kj/debug.h>
+#include <kj/filesystem.h>
+#include <kj/io.h>
+#include <kj/main.h>
+#include <thread>
+#include <unistd.h>
+
+namespace capnp_ls {
+
+namespace {
+
+using DiagnosticMap = kj::HashMap<kj::String, kj::Vector<Diagnostic>>;
+
+// Files per compiler run. Files of a batch share the parse of their common
+// imports, so neighbours (by path) are batched together.
+constexpr size_t DEFAULT_BATCH_SIZE = 32;
+
+void findSchemas(
+    const kj::ReadableDirectory &dir,
+    kj::PathPtr prefix,
+    kj::Vector<kj::String> &fileNames) {
+  for (auto &entry : dir.listEntries()) {
+    if (entry.name.startsWith(".")) {
+      continue;
+    }
+    auto path = prefix.append(entry.name);
+    if (entry.type == kj::FsNode::Type::DIRECTORY) {
+      findSchemas(*dir.openSubdir(kj::Path(entry.name)), path, fileNames);
+    } else if (
+        entry.type == kj::FsNode::Type::FILE && entry.name.endsWith(".capnp")) {
+      fileNames.add(path.toString());
+    }
+  }
+}
+
+kj::StringPtr sarifLevelOf(DiagnosticSeverity severity) {
+  switch (severity) {
+  case DiagnosticSeverity::Error:
+    return "error";
+  case DiagnosticSeverity::Warning:
+    return "warning";
+  default:
+    return "note";
+  }
+}
+
+void setPosition(capnp::JsonValue::Builder value, const Position &position) {
+  auto positionObj = value.initObject(2);
+  positionObj[0].setName("line");
+  positionObj[0].getValue().setNumber(position.line);
+  positionObj[1].setName("character");
+  positionObj[1].getValue().setNumber(position.character);
+}
+
+class WorkspaceCheck {
+public:
+  explicit WorkspaceCheck(kj::ProcessContext &context) : context(context) {}
+
+  kj::MainFunc getMain() {
+    return kj::MainBuilder(
+               context,
+               "capnp-ls check",
+               "Compiles every .capnp file under <dir> and reports their "
+               "diagnostics. Exits with status 1 if any of them is an error.")
+        .addOptionWithArg(
+            {"compiler"},
+            KJ_BIND_METHOD(*this, setCompiler),
+            "<path>",
+            "Use the capnp compiler at <path>.")
+        .addOptionWithArg(
+            {'I', "import-path"},
+            KJ_BIND_METHOD(*this, addImportPath),
+            "<dir>",
+            "Search <dir> for absolute imports. May be repeated.")
+        .addOptionWithArg(
+            {"format"},
+            KJ_BIND_METHOD(*this, setFormat),
+            "<sarif|json>",
+            "Report format. Defaults to sarif.")
+        .addOptionWithArg(
+            {'o', "output"},
+            KJ_BIND_METHOD(*this, setOutput),
+            "<file>",
+            "Write the report to <file> instead of stdout.")
+        .addOptionWithArg(
+            {'j', "jobs"},
+            KJ_BIND_METHOD(*this, setJobs),
+            "<count>",
+            "Run up to <count> compilers at once. Defaults to one per core.")
+        .addOptionWithArg(
+            {"batch-size"},
+            KJ_BIND_METHOD(*this, setBatchSize),
+            "<count>",
+            "Compile up to <count> files per compiler run.")
+        .expectArg("<dir>", KJ_BIND_METHOD(*this, check))
+        .build();
+  }
+
+private:
+  kj::ProcessContext &context;
+  kj::String compilerPath =
+      kj::heapString(CompilationManager::defaultCompilerPath());
+  kj::Vector<kj::String> importPaths;
+  bool sarif = true;
+  kj::Maybe<kj::String> outputPath;
+  size_t jobs = kj::max(std::thread::hardware_concurrency(), 1u);
+  size_t batchSize = DEFAULT_BATCH_SIZE;
+
+  kj::String workingDir;
+  kj::Vector<kj::String> fileNames;
+  kj::Vector<kj::ArrayPtr<const kj::String>> batches;
+  size_t nextBatch = 0;
+  size_t failedBatches = 0;
+  DiagnosticMap diagnostics;
+
+  kj::MainBuilder::Validity setCompiler(kj::StringPtr path) {
+    compilerPath = kj::heapString(path);
+    return true;
+  }
+
+  kj::MainBuilder::Validity addImportPath(kj::StringPtr path) {
+    importPaths.add(kj::heapString(path));
+    return true;
+  }
+
+  kj::MainBuilder::Validity setFormat(kj::StringPtr format) {
+    if (format == "sarif") {
+      sarif = true;
+    } else if (format == "json") {
+      sarif = false;
+    } else {
+      return "must be sarif or json";
+    }
+    return true;
+  }
+
+  kj::MainBuilder::Validity setOutput(kj::StringPtr path) {
+    outputPath = kj::heapString(path);
+    return true;
+  }
+
+  kj::MainBuilder::Validity setJobs(kj::StringPtr count) {
+    KJ_IF_MAYBE (parsed, count.tryParseAs<uint>()) {
+      if (*parsed > 0) {
+        jobs = *parsed;
+        return true;
+      }
+    }
+    return "must be a positive number";
+  }
+
+  kj::MainBuilder::Validity setBatchSize(kj::StringPtr count) {
+    KJ_IF_MAYBE (parsed, count.tryParseAs<uint>()) {
+      if (*parsed > 0) {
+        batchSize = *parsed;
+        return true;
+      }
+    }
+    return "must be a positive number";
+  }
+
+  kj::MainBuilder::Validity check(kj::StringPtr dirName) {
+    auto fs = kj::newDiskFilesystem();
+    auto dirPath = fs->getCurrentPath().eval(dirName);
+    KJ_IF_MAYBE (dir, fs->getRoot().tryOpenSubdir(dirPath)) {
+      findSchemas(**dir, nullptr, fileNames);
+    } else {
+      return "not a directory";
+    }
+    workingDir = dirPath.toString(true);
+    std::sort(
+        fileNames.begin(),
+        fileNames.end(),
+        [](const kj::String &left, const kj::String &right) {
+          return left.asPtr() < right.asPtr();
+        });
+
+    // Small workspaces still spread over every job.
+    size_t perBatch = kj::max(
+        kj::min(batchSize, (fileNames.size() + jobs - 1) / jobs), size_t(1));
+    for (size_t i = 0; i < fileNames.size(); i += perBatch) {
+      batches.add(fileNames.asPtr().slice(
+          i, kj::min(i + perBatch, fileNames.size())));
+    }
+
+    auto ioContext = kj::setupAsyncIo();
+    CompilationManager compilationManager(ioContext);
+    if (!compilationManager.checkCapnpVersionCompatible(compilerPath).wait(
+            ioContext.waitScope)) {
+      context.exitError(
+          kj::str("Cannot use the capnp compiler at ", compilerPath));
+    }
+    auto workers = kj::heapArrayBuilder<kj::Promise<void>>(
+        kj::min(jobs, batches.size()));
+    while (!workers.isFull()) {
+      workers.add(checkNextBatch(compilationManager));
+    }
+    kj::joinPromises(workers.finish()).wait(ioContext.waitScope);
+
+    auto report = sarif ? buildSarif() : buildJson();
+    KJ_IF_MAYBE (path, outputPath) {
+      fs->getRoot()
+          .openFile(
+              fs->getCurrentPath().eval(*path),
+              kj::WriteMode::CREATE | kj::WriteMode::MODIFY |
+                  kj::WriteMode::CREATE_PARENT)
+          ->writeAll(report);
+    } else {
+      kj::FdOutputStream(STDOUT_FILENO).write(report.begin(), report.size());
+    }
+
+    size_t errors = 0;
+    for (auto &entry : diagnostics) {
+      for (auto &diagnostic : entry.value) {
+        if (diagnostic.severity == DiagnosticSeverity::Error) {
+          errors++;
+        }
+      }
+    }
+    if (errors > 0 || failedBatches > 0) {
+      context.error(kj::str(
+          errors,
+          " error(s) in ",
+          fileNames.size(),
+          " files checked",
+          failedBatches > 0 ? kj::str(", ", failedBatches, " runs failed")
+                            : kj::String()));
+    }
+    return true;
+  }
+
+  kj::Promise<void> checkNextBatch(CompilationManager &compilationManager) {
+    if (nextBatch == batches.size()) {
+      return kj::READY_NOW;
+    }
+    auto batch = batches[nextBatch++];
+    return compilationManager
+        .check(CompilationManager::CheckParams{
+            .compilerPath = compilerPath,
+            .importPaths = importPaths,
+            .workingDir = workingDir,
+            .fileNames = batch})
+        .then(
+            [this](DiagnosticMap found) {
+              for (auto &entry : found) {
+                diagnostics.upsert(kj::mv(entry.key), kj::mv(entry.value));
+              }
+            },
+            [this, batch](kj::Exception &&e) {
+              context.warning(kj::str(
+                  "Failed to check ", batch[0], ": ", e.getDescription()));
+              failedBatches++;
+            })
+        .then([this, &compilationManager]() {
+          return checkNextBatch(compilationManager);
+        });
+  }
+
+  // Files with diagnostics, in path order.
+  kj::Vector<kj::StringPtr> reportedFiles() {
+    kj::Vector<kj::StringPtr> reported;
+    for (auto &fileName : fileNames) {
+      if (diagnostics.find(fileName) != nullptr) {
+        reported.add(fileName);
+      }
+    }
+    return reported;
+  }
+
+  kj::String buildJson() {
+    capnp::MallocMessageBuilder builder;
+    auto root = builder.initRoot<capnp::JsonValue>().initObject(2);
+    root[0].setName("checkedFiles");
+    root[0].getValue().setNumber(fileNames.size());
+    root[1].setName("files");
+    auto reported = reportedFiles();
+    auto files = root[1].getValue().initArray(reported.size());
+    for (size_t i = 0; i < reported.size(); i++) {
+      auto &found = KJ_ASSERT_NONNULL(diagnostics.find(reported[i]));
+      auto fileObj = files[i].initObject(2);
+      fileObj[0].setName("path");
+      fileObj[0].getValue().setString(reported[i]);
+      fileObj[1].setName("diagnostics");
+      auto list = fileObj[1].getValue().initArray(found.size());
+      for (size_t j = 0; j < found.size(); j++) {
+        auto &diagnostic = found[j];
+        // Same shape as the diagnostics the editor receives.
+        auto diagnosticObj = list[j].initObject(4);
+        diagnosticObj[0].setName("range");
+        auto rangeObj = diagnosticObj[0].getValue().initObject(2);
+        rangeObj[0].setName("start");
+        setPosition(rangeObj[0].getValue(), diagnostic.range.start);
+        rangeObj[1].setName("end");
+        setPosition(rangeObj[1].getValue(), diagnostic.range.end);
+        diagnosticObj[1].setName("severity");
+        diagnosticObj[1].getValue().setNumber(
+            static_cast<int>(diagnostic.severity));
+        diagnosticObj[2].setName("message");
+        diagnosticObj[2].getValue().setString(diagnostic.message);
+        diagnosticObj[3].setName("source");
+        diagnosticObj[3].getValue().setString(diagnostic.source);
+      }
+    }
+    capnp::JsonCodec codec;
+    codec.setPrettyPrint(true);
+    return codec.encodeRaw(builder.getRoot<capnp::JsonValue>());
+  }
+
+  // SARIF 2.1.0, with one result per diagnostic and file URIs relative to
+  // the checked directory.
+  kj::String buildSarif() {
+    size_t resultCount = 0;
+    for (auto &entry : diagnostics) {
+      resultCount += entry.value.size();
+    }
+
+    capnp::MallocMessageBuilder builder;
+    auto root = builder.initRoot<capnp::JsonValue>().initObject(3);
+    root[0].setName("$schema");
+    root[0].getValue().setString(
+        "https://json.schemastore.org/sarif-2.1.0.json");
+    root[1].setName("version");
+    root[1].getValue().setString("2.1.0");
+    root[2].setName("runs");
+    auto run = root[2].getValue().initArray(1)[0].initObject(3);
+
+    run[0].setName("tool");
+    auto driver = run[0].getValue().initObject(1);
+    driver[0].setName("driver");
+    auto driverObj = driver[0].getValue().initObject(1);
+    driverObj[0].setName("name");
+    driverObj[0].getValue().setString("capnp-ls");
+
+    run[1].setName("originalUriBaseIds");
+    auto baseIds = run[1].getValue().initObject(1);
+    baseIds[0].setName("SRCROOT");
+    auto srcRoot = baseIds[0].getValue().initObject(1);
+    srcRoot[0].setName("uri");
+    srcRoot[0].getValue().setString(kj::str("file://", workingDir, "/"));
+
+    run[2].setName("results");
+    auto results = run[2].getValue().initArray(resultCount);
+    size_t index = 0;
+    for (auto fileName : reportedFiles()) {
+      for (auto &diagnostic : KJ_ASSERT_NONNULL(diagnostics.find(fileName))) {
+        auto result = results[index++].initObject(3);
+        result[0].setName("level");
+        result[0].getValue().setString(sarifLevelOf(diagnostic.severity));
+        result[1].setName("message");
+        auto message = result[1].getValue().initObject(1);
+        message[0].setName("text");
+        message[0].getValue().setString(diagnostic.message);
+
+        result[2].setName("locations");
+        auto location = result[2].getValue().initArray(1)[0].initObject(1);
+        location[0].setName("physicalLocation");
+        auto physical = location[0].getValue().initObject(2);
+        physical[0].setName("artifactLocation");
+        auto artifact = physical[0].getValue().initObject(2);
+        artifact[0].setName("uri");
+        artifact[0].getValue().setString(fileName);
+        artifact[1].setName("uriBaseId");
+        artifact[1].getValue().setString("SRCROOT");
+        // SARIF lines and columns are 1-based.
+        physical[1].setName("region");
+        auto region = physical[1].getValue().initObject(4);
+        region[0].setName("startLine");
+        region[0].getValue().setNumber(diagnostic.range.start.line + 1);
+        region[1].setName("startColumn");
+        region[1].getValue().setNumber(diagnostic.range.start.character + 1);
+        region[2].setName("endLine");
+        region[2].getValue().setNumber(diagnostic.range.end.line + 1);
+        region[3].setName("endColumn");
+        region[3].getValue().setNumber(diagnostic.range.end.character + 1);
+      }
+    }
+    capnp::JsonCodec codec;
+    codec.setPrettyPrint(true);
+    return codec.encodeRaw(builder.getRoot<capnp::JsonValue>());
+  }
+};
+
+} // namespace
+
+int runWorkspaceCheck(int argc, char *argv[]) {
+  kj::_::Debug::setLogLevel(kj::LogSeverity::WARNING);
+  kj::TopLevelProcessContext context(argv[0]);
+  WorkspaceCheck check(context);
+  return kj::runMainAndExit(context, check.getMain(), argc, argv);
+}
+
+} // namespace capnp_ls
@@ -0,0 +1,15 @@
+// Copyright (c) 2024 Atsushi Tomida
+//
+// Licensed under the MIT License.
+// See LICENSE file in the project root for full license information.
+
+#pragma once
+
+namespace capnp_ls {
+
+// `capnp-ls check <dir>`: compiles every schema under a directory, without
+// an editor, and reports the diagnostics the editor would show as SARIF or
+// JSON. Exits with a nonzero status if any of them is an error.
+int runWorkspaceCheck(int argc, char *argv[]);
+
+} // namespace capnp_ls